@@ -0,0 +1,421 @@
+#include <libbladeRF.h>
+#include "bench.h"
+#include "options.h"
+#include "util.h"
+#include "conversions.h"
+#include "fftplan.h"
+#include "sc16.h"
+#include "codes.h"
+#include "compress.h"
+#include "window.h"
+#include <algorithm>
+#include <vector>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Times every registered case at every size, and prints one row per case,
+ * size and sample rate.  Timing doesn't depend on the sample rate; it's there
+ * so each row can say how much faster than real time the case ran.
+ */
+
+// We want each timed sample to be long enough that the clock isn't the story
+#define MIN_SAMPLE_NS 20000.0
+#define MIN_SAMPLES 10
+#define MAX_SAMPLES 100000
+
+static std::vector<struct bench_case> * cases;
+
+bool bench_register(const struct bench_case * bc)
+{
+    if( !cases )
+        cases = new std::vector<struct bench_case>();
+    cases->push_back(*bc);
+    return true;
+}
+
+static struct {
+    std::vector<unsigned int> sizes;
+    std::vector<unsigned int> rates;
+    const char * filter;
+    double min_time_ms;
+    bool json;
+    bool list;
+    bool check;
+} bench_opts;
+
+struct result {
+    const char * name;
+    unsigned int size;
+    unsigned long long iterations;
+    // All per item
+    double min_ns, mean_ns, p50_ns, p90_ns, p99_ns;
+    double gbps;
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static double percentile(const std::vector<double> & sorted, double p)
+{
+    size_t idx = (size_t)(p*(sorted.size() - 1) + 0.5);
+    return sorted[MIN(idx, sorted.size() - 1)];
+}
+
+static bool run_case(const struct bench_case * bc, unsigned int size, struct result * res)
+{
+    void * state = bc->setup(size, bc->arg);
+    if( !state )
+        return false;
+
+    // Warm up, and find out how many calls make a decent sized sample
+    bc->run(state, size);
+    double start = now_ns();
+    bc->run(state, size);
+    double once = MAX(now_ns() - start, 1.0);
+    unsigned int reps = (unsigned int)MAX(1.0, MIN_SAMPLE_NS/once);
+
+    std::vector<double> samples;
+    double begin = now_ns();
+    while( samples.size() < MIN_SAMPLES ||
+           (now_ns() - begin < bench_opts.min_time_ms*1e6 && samples.size() < MAX_SAMPLES) ) {
+        start = now_ns();
+        for( unsigned int idx=0; idx<reps; ++idx )
+            bc->run(state, size);
+        samples.push_back((now_ns() - start)/((double)reps*size));
+    }
+    bc->teardown(state);
+
+    double sum = 0;
+    for( size_t idx=0; idx<samples.size(); ++idx )
+        sum += samples[idx];
+    std::sort(samples.begin(), samples.end());
+
+    res->name = bc->name;
+    res->size = size;
+    res->iterations = (unsigned long long)samples.size()*reps;
+    res->min_ns = samples[0];
+    res->mean_ns = sum/samples.size();
+    res->p50_ns = percentile(samples, 0.50);
+    res->p90_ns = percentile(samples, 0.90);
+    res->p99_ns = percentile(samples, 0.99);
+    res->gbps = bc->bytes_per_item/res->p50_ns;
+    return true;
+}
+
+static void print_header(void)
+{
+    if( bench_opts.json )
+        printf("[\n");
+    else
+        printf("case,size,samplerate,iterations,ns_per_item_min,ns_per_item_mean,"
+               "ns_per_item_p50,ns_per_item_p90,ns_per_item_p99,gb_per_s,realtime_x\n");
+}
+
+static void print_result(const struct result * res, unsigned int rate, bool first)
+{
+    // How many times faster than samples show up at this rate, going by the median
+    double realtime = 1e9/(res->p50_ns*rate);
+    if( bench_opts.json ) {
+        printf("%s  {\"case\": \"%s\", \"size\": %u, \"samplerate\": %u, \"iterations\": %llu, "
+               "\"ns_per_item\": {\"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f}, "
+               "\"gb_per_s\": %.4f, \"realtime_x\": %.3f}",
+               first ? "" : ",\n", res->name, res->size, rate, res->iterations, res->min_ns,
+               res->mean_ns, res->p50_ns, res->p90_ns, res->p99_ns, res->gbps, realtime);
+    } else {
+        printf("%s,%u,%u,%llu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.3f\n",
+               res->name, res->size, rate, res->iterations, res->min_ns, res->mean_ns,
+               res->p50_ns, res->p90_ns, res->p99_ns, res->gbps, realtime);
+    }
+    fflush(stdout);
+}
+
+static void print_footer(void)
+{
+    if( bench_opts.json )
+        printf("\n]\n");
+}
+
+static void usage(void)
+{
+    printf("Usage:\n");
+    printf("  radar_bench [options]\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  -h --help                  Show this screen.\n");
+    printf("  -l --list                  List the cases and exit.\n");
+    printf("  -c --check                 Check every SC16 conversion this CPU runs bit for bit\n");
+    printf("                             against the scalar reference, and the time domain\n");
+    printf("                             pulse compressor against the FFT one, and exit.\n");
+    printf("  -f --filter=<s>            Only run cases (or checks) with <s> in their name [default: ]\n");
+    printf("  -s --sizes=<n,...>         Sizes to run each case at [default: 256,4096,65536,1048576]\n");
+    printf("  -r --rates=<sr,...>        Sample rates to report real time factors at\n");
+    printf("                             [default: 2M,10M,28M]\n");
+    printf("  -t --min-time=<t>          How long to keep timing each case and size for [default: 200ms]\n");
+    printf("  -o --format=<fmt>          Output format, one of (csv, json) [default: csv]\n");
+}
+
+static bool parse_list(const char * str, std::vector<unsigned int> * out, bool with_suffix)
+{
+    char * copy = strdup(str);
+    char * save = NULL;
+    bool ok = true;
+    out->clear();
+    for( char * tok = strtok_r(copy, ",", &save); tok && ok; tok = strtok_r(NULL, ",", &save) ) {
+        unsigned int val;
+        if( with_suffix )
+            val = str2uint_suffix(tok, 1, UINT_MAX, freq_suffixes, NUM_FREQ_SUFFIXES, &ok);
+        else
+            val = str2uint(tok, 1, 1 << 28, &ok);
+        out->push_back(val);
+    }
+    free(copy);
+    return ok && !out->empty();
+}
+
+static const struct option longopts[] = {
+    { "help",       no_argument,        0, 'h' },
+    { "list",       no_argument,        0, 'l' },
+    { "check",      no_argument,        0, 'c' },
+    { "filter",     required_argument,  0, 'f' },
+    { "sizes",      required_argument,  0, 's' },
+    { "rates",      required_argument,  0, 'r' },
+    { "min-time",   required_argument,  0, 't' },
+    { "format",     required_argument,  0, 'o' },
+    { 0,            0,                  0,  0  },
+};
+
+static void parse_bench_options(int argc, char ** argv)
+{
+    bool ok;
+    int c;
+
+    parse_list("256,4096,65536,1048576", &bench_opts.sizes, false);
+    parse_list("2M,10M,28M", &bench_opts.rates, true);
+    bench_opts.filter = "";
+    bench_opts.min_time_ms = 200;
+
+    while( (c = getopt_long(argc, argv, "hlcf:s:r:t:o:", longopts, NULL)) != -1 ) {
+        switch( c ) {
+            case 'h':
+                usage();
+                exit(0);
+            case 'l':
+                bench_opts.list = true;
+                break;
+            case 'c':
+                bench_opts.check = true;
+                break;
+            case 'f':
+                bench_opts.filter = optarg;
+                break;
+            case 's':
+                if( !parse_list(optarg, &bench_opts.sizes, false) ) {
+                    ERROR("Invalid sizes \"%s\"\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'r':
+                if( !parse_list(optarg, &bench_opts.rates, true) ) {
+                    ERROR("Invalid sample rates \"%s\"\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 't':
+                bench_opts.min_time_ms = str2dbl_suffix(optarg, 0, 600000, time_suffixes,
+                                                        NUM_TIME_SUFFIXES, &ok);
+                if( !ok ) {
+                    ERROR("Invalid time \"%s\"\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'o':
+                if( strcmp(optarg, "json") == 0 ) {
+                    bench_opts.json = true;
+                } else if( strcmp(optarg, "csv") == 0 ) {
+                    bench_opts.json = false;
+                } else {
+                    ERROR("Invalid format \"%s\"\n", optarg);
+                    exit(1);
+                }
+                break;
+            default:
+                usage();
+                exit(1);
+        }
+    }
+}
+
+// Every implementation, not just the one sc16_init() would pick, so a broken
+// one doesn't hide behind a better one
+static bool check_sc16(void)
+{
+    bool ok = true;
+    for( unsigned int idx=0; idx<num_sc16_impls; ++idx ) {
+        const struct sc16_impl * impl = &sc16_impls[idx];
+        char name[32];
+        snprintf(name, sizeof(name), "sc16/%s", impl->name);
+        if( !strstr(name, bench_opts.filter) )
+            continue;
+        if( !impl->supported() ) {
+            printf("%s: not supported here, skipped\n", name);
+        } else if( sc16_check(impl) ) {
+            printf("%s: ok\n", name);
+        } else {
+            printf("%s: FAILED\n", name);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Where each output of a pulse compressor landed, by timestamp
+static void check_pc_cb(struct pulse_compressor * pc, const fftwf_complex * out,
+                        unsigned int count, uint64_t ts, void * user_data)
+{
+    std::vector<float> * got = (std::vector<float> *)user_data;
+    for( unsigned int idx=0; idx<count && ts + idx < got->size()/2; ++idx ) {
+        (*got)[2*(ts + idx) + 0] = out[idx][0];
+        (*got)[2*(ts + idx) + 1] = out[idx][1];
+    }
+}
+
+static bool check_pc_run(const fftwf_complex * code, unsigned int code_len, enum pc_method method,
+                         const int16_t * iq, unsigned int count, unsigned int block,
+                         std::vector<float> * got)
+{
+    struct pulse_compressor pc;
+    got->assign(2*count, NAN);
+    if( !pc_init(&pc, code, code_len, 0, method, check_pc_cb, got) )
+        return false;
+    for( unsigned int idx=0; idx<count; idx += block )
+        pc_push_sc16(&pc, iq + 2*idx, MIN(block, count - idx), idx);
+    pc_flush(&pc);
+    pc_free(&pc);
+    return true;
+}
+
+// The time domain correlators (unrolled for every Barker length, and the
+// loop over the chips for anything else) have to give what the FFTs do, fed
+// in blocks of every size from one sample to more than an FFT's worth
+static bool check_bpsk(void)
+{
+    static const unsigned int lens[] = { 2, 3, 4, 5, 7, 11, 13, 17, BPSK_MAX_LEN };
+    static const unsigned int blocks[] = { 1, 5, 64, 1000, 4096 };
+    const unsigned int count = 4096;
+    bool ok = true;
+
+    std::vector<int16_t> iq(2*count);
+    uint32_t rng = 12345;
+    for( unsigned int idx=0; idx<2*count; ++idx ) {
+        rng = rng*1664525 + 1013904223;
+        iq[idx] = (int16_t)((int32_t)rng >> 21);
+    }
+
+    for( unsigned int l=0; l<sizeof(lens)/sizeof(lens[0]); ++l ) {
+        const unsigned int len = lens[l];
+        char name[32];
+        int row = barker_row(len);
+        snprintf(name, sizeof(name), row >= 0 ? "bpsk/barker%u" : "bpsk/generic%u", len);
+        if( !strstr(name, bench_opts.filter) )
+            continue;
+
+        // Chips of something other than 1, so the direct path has to scale
+        fftwf_complex * code = fftwf_alloc_complex(len);
+        for( unsigned int chip=0; chip<len; ++chip ) {
+            rng = rng*1664525 + 1013904223;
+            int sign = row >= 0 ? barker_chips[row][chip] : (rng >> 31 ? -1 : 1);
+            code[chip][0] = 0.75f*sign;
+            code[chip][1] = 0;
+        }
+
+        bool passed = true;
+        std::vector<float> fft, direct;
+        for( unsigned int b=0; b<sizeof(blocks)/sizeof(blocks[0]) && passed; ++b ) {
+            if( !check_pc_run(code, len, PC_FFT, iq.data(), count, blocks[b], &fft) ||
+                !check_pc_run(code, len, PC_DIRECT, iq.data(), count, blocks[b], &direct) ) {
+                printf("%s: couldn't set up the pulse compressor\n", name);
+                passed = false;
+                break;
+            }
+            // Both add up len products of a chip and a sample of at most 1
+            const float tolerance = 1e-5f*len;
+            for( unsigned int idx=0; idx<2*count; ++idx ) {
+                bool same = isnan(fft[idx]) ? isnan(direct[idx]) : fabsf(fft[idx] - direct[idx]) <= tolerance;
+                if( !same ) {
+                    printf("%s: FAILED in blocks of %u, output %u is %g, not %g\n", name, blocks[b],
+                           idx/2, direct[idx], fft[idx]);
+                    passed = false;
+                    break;
+                }
+            }
+        }
+        if( passed )
+            printf("%s: ok\n", name);
+        ok = ok && passed;
+        fftwf_free(code);
+    }
+    return ok;
+}
+
+int main(int argc, char ** argv)
+{
+    parse_bench_options(argc, argv);
+    if( !cases ) {
+        ERROR("No benchmark cases registered\n");
+        return 1;
+    }
+
+    // Same setup the radar does, so the library code behaves like it does there
+    opts.verbosity = 0;
+    opts.range_bins = 1024;
+    if( !sc16_init() )
+        return 1;
+    fft_plans_init("", FFTW_ESTIMATE);
+
+    if( bench_opts.check ) {
+        bool ok = check_sc16();
+        ok = check_bpsk() && ok;
+        fft_plans_cleanup();
+        window_cache_cleanup();
+        return ok ? 0 : 1;
+    }
+
+    if( bench_opts.list ) {
+        for( size_t idx=0; idx<cases->size(); ++idx )
+            printf("%s\n", (*cases)[idx].name);
+        fft_plans_cleanup();
+        window_cache_cleanup();
+        return 0;
+    }
+
+    bool first = true;
+    print_header();
+    for( size_t idx=0; idx<cases->size(); ++idx ) {
+        const struct bench_case * bc = &(*cases)[idx];
+        if( !strstr(bc->name, bench_opts.filter) )
+            continue;
+        for( size_t s=0; s<bench_opts.sizes.size(); ++s ) {
+            struct result res;
+            if( !run_case(bc, bench_opts.sizes[s], &res) )
+                continue;
+            for( size_t r=0; r<bench_opts.rates.size(); ++r ) {
+                print_result(&res, bench_opts.rates[r], first);
+                first = false;
+            }
+        }
+    }
+    print_footer();
+
+    fft_plans_cleanup();
+    window_cache_cleanup();
+    return 0;
+}
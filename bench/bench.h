@@ -0,0 +1,38 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include <stdbool.h>
+#include <stddef.h>
+
+// One thing to time.  Every case gets swept over a list of sizes; `size` is
+// however many items (usually complex samples) one call to run() handles.
+struct bench_case {
+    // Name it shows up as in the results, "group/variant" by convention
+    const char * name;
+
+    // Bytes read plus bytes written per item, for GB/s (0 if it doesn't mean
+    // anything for this case)
+    double bytes_per_item;
+
+    // Build whatever run() needs for `size` items, or return NULL if this
+    // case doesn't make sense at that size.  `arg` is passed through from
+    // the registration so one set of functions can back several cases.
+    void * (*setup)(unsigned int size, const void * arg);
+    void (*run)(void * state, unsigned int size);
+    void (*teardown)(void * state);
+    const void * arg;
+};
+
+// Add a case to the harness.  Returns true so it can initialize a static,
+// which is how BENCH_CASE() registers cases before main() runs.
+bool bench_register(const struct bench_case * bc);
+
+#define BENCH_CASE(ident, ...) \
+    static const struct bench_case ident = { __VA_ARGS__ }; \
+    static bool ident##_registered __attribute__((unused)) = bench_register(&ident)
+
+// Keep the compiler from throwing away results nobody reads
+static inline void bench_keep(const void * p)
+{
+    __asm__ __volatile__("" : : "g"(p) : "memory");
+}
+#endif
@@ -0,0 +1,548 @@
+#include <libbladeRF.h>
+#include "bench.h"
+#include "options.h"
+#include "util.h"
+#include "conversions.h"
+#include "fftplan.h"
+#include "sc16.h"
+#include "waveform.h"
+#include "compress.h"
+#include "doppler.h"
+#include "cfar.h"
+#include "window.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int8_t barker11[11] = { 1, 1, 1, -1, -1, -1, 1, -1, -1, 1, -1 };
+
+// Complex noise plus a few strong returns, in whatever format a case wants
+static void fill_sc16(int16_t * iq, unsigned int count)
+{
+    uint32_t rng = 12345;
+    for( unsigned int idx=0; idx<2*count; ++idx ) {
+        rng = rng*1664525 + 1013904223;
+        iq[idx] = (int16_t)((int32_t)rng >> 21);
+    }
+    for( unsigned int idx=0; idx<count; idx += 997 )
+        iq[2*idx] = 2047;
+}
+
+static void fill_cf32(float * x, unsigned int count)
+{
+    int16_t * iq = (int16_t *)malloc(sizeof(int16_t)*2*count);
+    fill_sc16(iq, count);
+    for( unsigned int idx=0; idx<2*count; ++idx )
+        x[idx] = iq[idx]*(1.0f/2048.0f);
+    free(iq);
+}
+
+static void free_state(void * state)
+{
+    free(state);
+}
+
+/*
+ * Burst fill: what transmit_barker11() used to do for every burst (allocate,
+ * write every chip one sample at a time, free) against tiling the code out
+ * once the way the waveform bank does it
+ */
+static void * burst_setup(unsigned int size, const void * arg)
+{
+    if( size < 11 )
+        return NULL;
+    int16_t * buf = (int16_t *)malloc(sizeof(int16_t)*2*size);
+    memset(buf, 0, sizeof(int16_t)*2*size);
+    return buf;
+}
+
+static void burst_legacy_run(void * state, unsigned int size)
+{
+    unsigned int N = size/11;
+    int16_t * buff = (int16_t *)malloc(sizeof(int16_t)*2*N*11);
+    memset(buff, 0, sizeof(int16_t)*2*N*11);
+    for( unsigned int i=0; i<N; ++i ) {
+        for( unsigned int chip=0; chip<11; ++chip )
+            buff[22*i + 2*chip] = 2047*barker11[chip];
+    }
+    bench_keep(buff);
+    free(buff);
+}
+
+static void burst_tile_run(void * state, unsigned int size)
+{
+    static int16_t code[22];
+    for( unsigned int chip=0; chip<11; ++chip )
+        code[2*chip] = 2047*barker11[chip];
+    waveform_tile(code, 11, (int16_t *)state, size);
+    bench_keep(state);
+}
+
+BENCH_CASE(burst_legacy, "burst_fill/legacy", 4, burst_setup, burst_legacy_run, free_state, NULL);
+BENCH_CASE(burst_tile, "burst_fill/tile", 4, burst_setup, burst_tile_run, free_state, NULL);
+
+/*
+ * Windows: what rd_init() used to do on every call (cos() per point in double,
+ * then a float copy) against a lookup in the window cache, plus the kernels
+ * that apply them
+ */
+static void * window_setup(unsigned int size, const void * arg)
+{
+    if( size < 2 )
+        return NULL;
+    return malloc((sizeof(double) + sizeof(float))*size);
+}
+
+static void window_compute_run(void * state, unsigned int size)
+{
+    double * window = (double *)state;
+    float * out = (float *)(window + size);
+    for( unsigned int idx=0; idx<size; ++idx )
+        window[idx] = 0.5*(1 - cos(2*M_PI*idx/(size - 1)));
+    for( unsigned int idx=0; idx<size; ++idx )
+        out[idx] = (float)window[idx];
+    bench_keep(out);
+}
+
+// Per run(), so this is per item of one lookup's worth of window
+static void window_cached_run(void * state, unsigned int size)
+{
+    bench_keep(window_get_f32((const char *)state, size));
+}
+
+static void * window_cached_setup(unsigned int size, const void * arg)
+{
+    if( size < 2 || !window_get_f32((const char *)arg, size) )
+        return NULL;
+    return (void *)arg;
+}
+
+static void window_cached_teardown(void * state)
+{
+}
+
+BENCH_CASE(window_compute, "window/compute_hann", 12, window_setup, window_compute_run, free_state, NULL);
+BENCH_CASE(window_cached_hann, "window/cached_hann", 0, window_cached_setup, window_cached_run,
+           window_cached_teardown, "hann");
+BENCH_CASE(window_cached_taylor, "window/cached_taylor", 0, window_cached_setup, window_cached_run,
+           window_cached_teardown, "taylor");
+
+struct window_apply_state {
+    fftwf_complex * in;
+    fftwf_complex * out;
+    const float * window;
+};
+
+static void * window_apply_setup(unsigned int size, const void * arg)
+{
+    if( size < 2 )
+        return NULL;
+    struct window_apply_state * ws = (struct window_apply_state *)malloc(sizeof(struct window_apply_state));
+    ws->in = fftwf_alloc_complex(size);
+    ws->out = fftwf_alloc_complex(size);
+    ws->window = window_get_f32("blackman-harris", size);
+    fill_cf32((float *)ws->in, size);
+    return ws;
+}
+
+static void window_apply_teardown(void * state)
+{
+    struct window_apply_state * ws = (struct window_apply_state *)state;
+    fftwf_free(ws->in);
+    fftwf_free(ws->out);
+    free(ws);
+}
+
+static void window_apply_reference_run(void * state, unsigned int size)
+{
+    struct window_apply_state * ws = (struct window_apply_state *)state;
+    for( unsigned int idx=0; idx<size; ++idx ) {
+        ws->out[idx][0] = ws->in[idx][0]*ws->window[idx];
+        ws->out[idx][1] = ws->in[idx][1]*ws->window[idx];
+    }
+    bench_keep(ws->out);
+}
+
+static void window_apply_run(void * state, unsigned int size)
+{
+    struct window_apply_state * ws = (struct window_apply_state *)state;
+    window_apply(ws->in, ws->out, ws->window, size);
+    bench_keep(ws->out);
+}
+
+static void window_scale_run(void * state, unsigned int size)
+{
+    struct window_apply_state * ws = (struct window_apply_state *)state;
+    window_scale(ws->in, ws->out, 0.5f, size);
+    bench_keep(ws->out);
+}
+
+BENCH_CASE(window_apply_ref, "window/apply_reference", 20, window_apply_setup, window_apply_reference_run,
+           window_apply_teardown, NULL);
+BENCH_CASE(window_apply_simd, "window/apply", 20, window_apply_setup, window_apply_run,
+           window_apply_teardown, NULL);
+BENCH_CASE(window_scale_simd, "window/scale", 16, window_apply_setup, window_scale_run,
+           window_apply_teardown, NULL);
+
+/*
+ * Numeric suffix helpers, `size` strings per run.  They only run while
+ * parsing options, but they're cheap to keep an eye on.
+ */
+static const char * suffix_strs[] = { "2.4G", "915M", "40MHz", "500k", "1.5GHz", "433.92M", "28M", "100" };
+#define NUM_SUFFIX_STRS (sizeof(suffix_strs)/sizeof(suffix_strs[0]))
+
+static void * suffix_setup(unsigned int size, const void * arg)
+{
+    // Only makes sense for small counts, this isn't a bulk operation
+    if( size > 65536 )
+        return NULL;
+    return malloc(64);
+}
+
+static void str2dbl_run(void * state, unsigned int size)
+{
+    bool ok;
+    double sum = 0;
+    for( unsigned int idx=0; idx<size; ++idx )
+        sum += str2dbl_suffix(suffix_strs[idx % NUM_SUFFIX_STRS], 0, 1e10, freq_suffixes,
+                              NUM_FREQ_SUFFIXES, &ok);
+    *(double *)state = sum;
+    bench_keep(state);
+}
+
+static void dbl2str_run(void * state, unsigned int size)
+{
+    for( unsigned int idx=0; idx<size; ++idx )
+        double2str_suffix((char *)state, 1e3*(idx + 1), freq_suffixes, NUM_FREQ_SUFFIXES);
+    bench_keep(state);
+}
+
+BENCH_CASE(str2dbl, "suffix/str2dbl_suffix", 0, suffix_setup, str2dbl_run, free_state, NULL);
+BENCH_CASE(dbl2str, "suffix/double2str_suffix", 0, suffix_setup, dbl2str_run, free_state, NULL);
+
+/*
+ * SC16 <-> float conversion: a plain loop written here as the reference,
+ * then every implementation in sc16.cpp that this CPU runs
+ */
+struct convert_state {
+    int16_t * iq;
+    float * cf;
+    float * window;
+};
+
+static void * convert_setup(unsigned int size, const void * arg)
+{
+    const struct sc16_impl * impl = (const struct sc16_impl *)arg;
+    if( impl && !impl->supported() )
+        return NULL;
+
+    struct convert_state * cs = (struct convert_state *)malloc(sizeof(struct convert_state));
+    cs->iq = (int16_t *)fftwf_malloc(sizeof(int16_t)*2*size);
+    cs->cf = (float *)fftwf_malloc(sizeof(float)*2*size);
+    cs->window = (float *)fftwf_malloc(sizeof(float)*size);
+    fill_sc16(cs->iq, size);
+    fill_cf32(cs->cf, size);
+    for( unsigned int idx=0; idx<size; ++idx )
+        cs->window[idx] = 0.5f;
+    return cs;
+}
+
+static void convert_teardown(void * state)
+{
+    struct convert_state * cs = (struct convert_state *)state;
+    fftwf_free(cs->iq);
+    fftwf_free(cs->cf);
+    fftwf_free(cs->window);
+    free(cs);
+}
+
+static void to_cf32_reference_run(void * state, unsigned int size)
+{
+    struct convert_state * cs = (struct convert_state *)state;
+    for( unsigned int idx=0; idx<2*size; ++idx )
+        cs->cf[idx] = cs->iq[idx]*(1.0f/2048.0f);
+    bench_keep(cs->cf);
+}
+
+// Which implementation a case runs is in the registration's arg, but run()
+// only gets the state, so keep it in there next to the buffers
+struct impl_state {
+    struct convert_state cs;
+    const struct sc16_impl * impl;
+};
+
+static void * impl_setup(unsigned int size, const void * arg)
+{
+    struct convert_state * cs = (struct convert_state *)convert_setup(size, arg);
+    if( !cs )
+        return NULL;
+    struct impl_state * is = (struct impl_state *)realloc(cs, sizeof(struct impl_state));
+    is->impl = (const struct sc16_impl *)arg;
+    return is;
+}
+
+static void to_cf32_impl_run(void * state, unsigned int size)
+{
+    struct impl_state * is = (struct impl_state *)state;
+    is->impl->to_cf32(is->cs.iq, is->cs.cf, size, 1.0f/2048.0f, NULL);
+    bench_keep(is->cs.cf);
+}
+
+static void to_cf32_window_impl_run(void * state, unsigned int size)
+{
+    struct impl_state * is = (struct impl_state *)state;
+    is->impl->to_cf32(is->cs.iq, is->cs.cf, size, 1.0f/2048.0f, is->cs.window);
+    bench_keep(is->cs.cf);
+}
+
+static void to_sc16_impl_run(void * state, unsigned int size)
+{
+    struct impl_state * is = (struct impl_state *)state;
+    is->impl->to_sc16(is->cs.cf, is->cs.iq, size, 2048.0f);
+    bench_keep(is->cs.iq);
+}
+
+BENCH_CASE(to_cf32_reference, "sc16_to_cf32/reference", 12, convert_setup, to_cf32_reference_run,
+           convert_teardown, NULL);
+
+// One case per implementation, made up at startup since we don't know the
+// list (or the names) until sc16.cpp tells us
+static bool register_sc16_impls(void)
+{
+    static char names[3][16][48];
+    for( unsigned int idx=0; idx<num_sc16_impls && idx<16; ++idx ) {
+        const struct sc16_impl * impl = &sc16_impls[idx];
+        snprintf(names[0][idx], sizeof(names[0][idx]), "sc16_to_cf32/%s", impl->name);
+        snprintf(names[1][idx], sizeof(names[1][idx]), "sc16_to_cf32_window/%s", impl->name);
+        snprintf(names[2][idx], sizeof(names[2][idx]), "cf32_to_sc16/%s", impl->name);
+        struct bench_case to_cf32 = { names[0][idx], 12, impl_setup, to_cf32_impl_run,
+                                      convert_teardown, impl };
+        struct bench_case to_cf32_window = { names[1][idx], 16, impl_setup, to_cf32_window_impl_run,
+                                             convert_teardown, impl };
+        struct bench_case to_sc16 = { names[2][idx], 12, impl_setup, to_sc16_impl_run,
+                                      convert_teardown, impl };
+        bench_register(&to_cf32);
+        bench_register(&to_cf32_window);
+        bench_register(&to_sc16);
+    }
+    return true;
+}
+static bool sc16_impls_registered __attribute__((unused)) = register_sc16_impls();
+
+/*
+ * Correlation against barker11: the reference is one big FFTW transform of
+ * the whole input written just for the harness, the others are the pulse
+ * compressor the radar runs, left to choose for itself and forced to
+ * overlap-save FFTs or the time domain
+ */
+struct correlate_state {
+    int16_t * iq;
+    fftwf_complex * buf;
+    fftwf_complex * code_fft;
+    fftwf_plan fwd, inv;
+    struct pulse_compressor pc;
+};
+
+static void correlate_cb(struct pulse_compressor * pc, const fftwf_complex * out,
+                         unsigned int count, uint64_t ts, void * user_data)
+{
+    bench_keep(out);
+}
+
+static void * correlate_setup(unsigned int size, const void * arg)
+{
+    if( size < 64 )
+        return NULL;
+    struct correlate_state * cs = (struct correlate_state *)calloc(1, sizeof(struct correlate_state));
+    cs->iq = (int16_t *)malloc(sizeof(int16_t)*2*size);
+    fill_sc16(cs->iq, size);
+
+    fftwf_complex * code = fftwf_alloc_complex(11);
+    for( unsigned int chip=0; chip<11; ++chip ) {
+        code[chip][0] = barker11[chip];
+        code[chip][1] = 0;
+    }
+
+    if( arg ) {
+        pc_init(&cs->pc, code, 11, 0, *(const enum pc_method *)arg, correlate_cb, NULL);
+    } else {
+        // Linear correlation of all of it at once, zero padded so nothing wraps
+        unsigned int n = 1;
+        while( n < size + 11 )
+            n <<= 1;
+        cs->buf = fftwf_alloc_complex(n);
+        cs->code_fft = fftwf_alloc_complex(n);
+        cs->fwd = fft_plan_1d(n, FFTW_FORWARD, true, true);
+        cs->inv = fft_plan_1d(n, FFTW_BACKWARD, true, true);
+        memset(cs->code_fft, 0, sizeof(fftwf_complex)*n);
+        memcpy(cs->code_fft, code, sizeof(fftwf_complex)*11);
+        fftwf_execute_dft(cs->fwd, cs->code_fft, cs->code_fft);
+        for( unsigned int idx=0; idx<n; ++idx )
+            cs->code_fft[idx][1] = -cs->code_fft[idx][1];
+    }
+    fftwf_free(code);
+    return cs;
+}
+
+static void correlate_reference_run(void * state, unsigned int size)
+{
+    struct correlate_state * cs = (struct correlate_state *)state;
+    unsigned int n = 1;
+    while( n < size + 11 )
+        n <<= 1;
+
+    memset(cs->buf, 0, sizeof(fftwf_complex)*n);
+    for( unsigned int idx=0; idx<size; ++idx ) {
+        cs->buf[idx][0] = cs->iq[2*idx + 0]*(1.0f/2048.0f);
+        cs->buf[idx][1] = cs->iq[2*idx + 1]*(1.0f/2048.0f);
+    }
+    fftwf_execute_dft(cs->fwd, cs->buf, cs->buf);
+    for( unsigned int idx=0; idx<n; ++idx ) {
+        float re = cs->buf[idx][0]*cs->code_fft[idx][0] - cs->buf[idx][1]*cs->code_fft[idx][1];
+        float im = cs->buf[idx][0]*cs->code_fft[idx][1] + cs->buf[idx][1]*cs->code_fft[idx][0];
+        cs->buf[idx][0] = re;
+        cs->buf[idx][1] = im;
+    }
+    fftwf_execute_dft(cs->inv, cs->buf, cs->buf);
+    bench_keep(cs->buf);
+}
+
+static void correlate_pc_run(void * state, unsigned int size)
+{
+    struct correlate_state * cs = (struct correlate_state *)state;
+
+    // Every run is a fresh stretch, same as after a gap in the timestamps
+    pc_push_sc16(&cs->pc, cs->iq, size, 0);
+}
+
+static void correlate_teardown(void * state)
+{
+    struct correlate_state * cs = (struct correlate_state *)state;
+    if( cs->buf ) {
+        fftwf_free(cs->buf);
+        fftwf_free(cs->code_fft);
+    } else {
+        pc_free(&cs->pc);
+    }
+    free(cs->iq);
+    free(cs);
+}
+
+static const enum pc_method pc_auto = PC_AUTO, pc_fft = PC_FFT, pc_direct = PC_DIRECT;
+
+BENCH_CASE(correlate_reference, "correlate/reference_fft", 12, correlate_setup, correlate_reference_run,
+           correlate_teardown, NULL);
+BENCH_CASE(correlate_pc, "correlate/pulse_compressor", 12, correlate_setup, correlate_pc_run,
+           correlate_teardown, &pc_auto);
+BENCH_CASE(correlate_pc_fft, "correlate/pulse_compressor_fft", 12, correlate_setup, correlate_pc_run,
+           correlate_teardown, &pc_fft);
+BENCH_CASE(correlate_pc_direct, "correlate/pulse_compressor_direct", 12, correlate_setup,
+           correlate_pc_run, correlate_teardown, &pc_direct);
+
+/*
+ * Range-Doppler over a 64 pulse CPI, `size` being the number of cells in the
+ * map (64 x size/64 range bins)
+ */
+#define BENCH_CPI_PULSES 64
+
+struct rd_state {
+    struct range_doppler rd;
+    fftwf_complex * profile;
+};
+
+static void * rd_setup(unsigned int size, const void * arg)
+{
+    if( size < BENCH_CPI_PULSES*16 )
+        return NULL;
+    unsigned int range_bins = size/BENCH_CPI_PULSES;
+    struct rd_state * rs = (struct rd_state *)calloc(1, sizeof(struct rd_state));
+    rs->profile = fftwf_alloc_complex(range_bins);
+    fill_cf32((float *)rs->profile, range_bins);
+    if( !rd_init(&rs->rd, BENCH_CPI_PULSES, range_bins, "hann", NULL, NULL) ) {
+        fftwf_free(rs->profile);
+        free(rs);
+        return NULL;
+    }
+    return rs;
+}
+
+static void rd_run(void * state, unsigned int size)
+{
+    struct rd_state * rs = (struct rd_state *)state;
+    for( unsigned int pulse=0; pulse<BENCH_CPI_PULSES; ++pulse )
+        rd_push_profile(&rs->rd, rs->profile, pulse, pulse);
+    bench_keep(rs->rd.map);
+}
+
+static void rd_teardown(void * state)
+{
+    struct rd_state * rs = (struct rd_state *)state;
+    rd_free(&rs->rd);
+    fftwf_free(rs->profile);
+    free(rs);
+}
+
+// A profile in and the windowed copy, then the transform out of place
+BENCH_CASE(range_doppler, "range_doppler/cpi64", 32, rd_setup, rd_run, rd_teardown, NULL);
+
+/*
+ * CFAR, `size` cells: a single range profile for 1-D, a 64 pulse map for 2-D
+ */
+struct cfar_state {
+    struct cfar c;
+    fftwf_complex * data;
+};
+
+static const enum cfar_method cfar_ca = CFAR_CA, cfar_os = CFAR_OS;
+
+static void * cfar_setup(unsigned int size, const void * arg, bool map)
+{
+    if( map && size < BENCH_CPI_PULSES*16 )
+        return NULL;
+    unsigned int range_bins = map ? size/BENCH_CPI_PULSES : size;
+    struct cfar_state * cs = (struct cfar_state *)calloc(1, sizeof(struct cfar_state));
+    cs->data = fftwf_alloc_complex(size);
+    fill_cf32((float *)cs->data, size);
+    if( !cfar_init(&cs->c, *(const enum cfar_method *)arg, range_bins,
+                   map ? BENCH_CPI_PULSES : 1, 2, 8, 1e-6f, 4096) ) {
+        fftwf_free(cs->data);
+        free(cs);
+        return NULL;
+    }
+    return cs;
+}
+
+static void * cfar_1d_setup(unsigned int size, const void * arg)
+{
+    return cfar_setup(size, arg, false);
+}
+
+static void * cfar_2d_setup(unsigned int size, const void * arg)
+{
+    return cfar_setup(size, arg, true);
+}
+
+static void cfar_1d_run(void * state, unsigned int size)
+{
+    struct cfar_state * cs = (struct cfar_state *)state;
+    cfar_profile(&cs->c, cs->data, 0);
+}
+
+static void cfar_2d_run(void * state, unsigned int size)
+{
+    struct cfar_state * cs = (struct cfar_state *)state;
+    cfar_map(&cs->c, cs->data, 0);
+}
+
+static void cfar_teardown(void * state)
+{
+    struct cfar_state * cs = (struct cfar_state *)state;
+    cfar_free(&cs->c);
+    fftwf_free(cs->data);
+    free(cs);
+}
+
+BENCH_CASE(cfar_ca_1d, "cfar/ca_1d", 8, cfar_1d_setup, cfar_1d_run, cfar_teardown, &cfar_ca);
+BENCH_CASE(cfar_os_1d, "cfar/os_1d", 8, cfar_1d_setup, cfar_1d_run, cfar_teardown, &cfar_os);
+BENCH_CASE(cfar_ca_2d, "cfar/ca_2d", 8, cfar_2d_setup, cfar_2d_run, cfar_teardown, &cfar_ca);
+BENCH_CASE(cfar_os_2d, "cfar/os_2d", 8, cfar_2d_setup, cfar_2d_run, cfar_teardown, &cfar_os);
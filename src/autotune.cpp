@@ -0,0 +1,290 @@
+#include <libbladeRF.h>
+#include "autotune.h"
+#include "options.h"
+#include "util.h"
+#include "radio.h"
+#include "metrics.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+// What we try, every combination that leaves num_transfers at most half of
+// num_buffers (libbladeRF wants some buffers free to work on).  The async
+// engine sizes its own buffer pools, so there num_buffers only has to be valid.
+static const unsigned int buffer_sizes[] = { 1024, 2048, 4096, 8192, 16384, 32768 };
+static const unsigned int buffer_counts[] = { 16, 32, 64, 128 };
+static const unsigned int transfer_counts[] = { 4, 8, 16, 32 };
+
+// A trial has to keep up with the sample rate to within this much to pass.
+// Samples come in a whole buffer at a time, so a short trial can't be held
+// to much better; really falling behind shows up as overruns anyway.
+#define AUTOTUNE_MIN_THROUGHPUT 0.95
+
+struct trial {
+    unsigned int num_buffers;
+    unsigned int buffer_size;
+    unsigned int num_transfers;
+    bool started;
+
+    // Over the measured part of the trial
+    uint64_t overruns;
+    uint64_t dropped;
+    uint64_t late;
+    uint64_t errors;
+    double throughput;
+    double tx_queue_us;
+
+    // How much can be queued up in each direction: every buffer with sync
+    // calls, every transfer in flight with the async engine
+    double buffered_ms;
+};
+
+// Everything a trial is judged on, at one point in time
+struct snapshot {
+    uint64_t ns;
+    uint64_t overruns;
+    uint64_t dropped;
+    uint64_t late;
+    uint64_t errors;
+    uint64_t samples;
+    uint64_t tx_queue_count;
+    uint64_t tx_queue_ns;
+};
+
+static void take_snapshot(struct snapshot * s)
+{
+    s->ns = metrics_now_ns();
+    s->overruns = metric_total(M_RX_DEVICE_OVERRUNS) + metric_total(M_RX_DISCONTINUITIES);
+    s->dropped = metric_total(M_RX_RING_OVERRUNS);
+    s->late = metric_total(M_TX_LATE_BURSTS);
+    s->errors = metric_total(M_RX_ERRORS) + metric_total(M_TX_ERRORS);
+    s->samples = metric_total(M_RX_SAMPLES);
+    metric_histogram_totals(M_TX_QUEUE_NS, &s->tx_queue_count, &s->tx_queue_ns);
+}
+
+char * tuning_default_path(void)
+{
+    const char * home = getenv("HOME");
+    if( !home || home[0] == '\0' )
+        return strdup("");
+    char * path = (char *)malloc(strlen(home) + 16);
+    sprintf(path, "%s/.radar_tuning", home);
+    return path;
+}
+
+// Profiles are keyed on the device string as given, so "" (whatever bladeRF
+// is plugged in) is its own entry
+static std::string tuning_key(void)
+{
+    char rate[16];
+    snprintf(rate, sizeof(rate), "%u", opts.samplerate);
+    return std::string(opts.devstrs[0][0] == '\0' ? "-" : opts.devstrs[0]) + " " +
+           (opts.async_stream ? "async" : "sync") + " " + rate;
+}
+
+/*
+ * The tuning file is one profile per line:
+ *
+ *   <device or -> <sync|async> <samplerate> <num_buffers> <buffer_size> <num_transfers>
+ *
+ * with # comments.
+ */
+bool tuning_load(const char * path)
+{
+    if( path[0] == '\0' )
+        return false;
+    FILE * f = fopen(path, "r");
+    if( !f )
+        return false;
+
+    std::string key = tuning_key();
+    char line[1024];
+    bool found = false;
+    while( fgets(line, sizeof(line), f) ) {
+        char dev[512], mode[8];
+        unsigned int rate, num_buffers, buffer_size, num_transfers;
+        if( line[0] == '#' )
+            continue;
+        if( sscanf(line, "%511s %7s %u %u %u %u", dev, mode, &rate, &num_buffers, &buffer_size,
+                   &num_transfers) != 6 )
+            continue;
+        if( std::string(dev) + " " + mode + " " + std::to_string(rate) != key )
+            continue;
+        if( buffer_size == 0 || buffer_size % 1024 != 0 || num_transfers == 0 ||
+            num_transfers >= num_buffers ) {
+            ERROR("Ignoring bad tuning profile in %s: %s", path, line);
+            continue;
+        }
+        opts.num_buffers = num_buffers;
+        opts.buffer_size = buffer_size;
+        opts.num_transfers = num_transfers;
+        found = true;
+    }
+    fclose(f);
+
+    if( found ) {
+        INFO("  Tuned buffers: %u x %u samples, %u transfers (from %s)\n", opts.num_buffers,
+             opts.buffer_size, opts.num_transfers, path);
+    }
+    return found;
+}
+
+// Replace our line in the tuning file, leaving every other profile be
+static bool tuning_save(const char * path, const struct trial * t)
+{
+    std::string key = tuning_key();
+    std::vector<std::string> lines;
+    FILE * f = fopen(path, "r");
+    if( f ) {
+        char line[1024], dev[512], mode[8];
+        unsigned int rate;
+        while( fgets(line, sizeof(line), f) ) {
+            if( line[0] != '#' && sscanf(line, "%511s %7s %u", dev, mode, &rate) == 3 &&
+                std::string(dev) + " " + mode + " " + std::to_string(rate) == key )
+                continue;
+            lines.push_back(line);
+        }
+        fclose(f);
+    }
+    if( lines.empty() )
+        lines.push_back("# radar --autotune: device stream samplerate num_buffers buffer_size num_transfers\n");
+
+    std::string tmp = std::string(path) + ".tmp";
+    f = fopen(tmp.c_str(), "w");
+    if( !f ) {
+        ERROR("Couldn't write tuning profile to %s: %s\n", tmp.c_str(), strerror(errno));
+        return false;
+    }
+    for( const std::string & line : lines )
+        fputs(line.c_str(), f);
+    fprintf(f, "%s %u %u %u\n", key.c_str(), t->num_buffers, t->buffer_size, t->num_transfers);
+    if( fclose(f) != 0 || rename(tmp.c_str(), path) != 0 ) {
+        ERROR("Couldn't write tuning profile to %s: %s\n", path, strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Run the radio and processing just like a normal run would, with t's buffer
+// settings.  The first quarter of the trial is left out of the measurements,
+// since startup is always a little rough.
+static void run_trial(const struct waveform * wf, struct trial * t)
+{
+    struct snapshot before, after;
+    bool measuring = false;
+
+    opts.num_buffers = t->num_buffers;
+    opts.buffer_size = t->buffer_size;
+    opts.num_transfers = t->num_transfers;
+    t->buffered_ms = 1000.0*(opts.async_stream ? t->num_transfers : t->num_buffers)*t->buffer_size/
+                     opts.samplerate;
+
+    if( !start_radios(wf) )
+        return;
+    t->started = true;
+
+    uint64_t start = metrics_now_ns();
+    uint64_t trial_ns = (uint64_t)(opts.autotune_ms*1e6);
+    while( true ) {
+        uint64_t now = metrics_now_ns();
+        if( now - start >= trial_ns )
+            break;
+        if( !measuring && now - start >= trial_ns/4 ) {
+            take_snapshot(&before);
+            measuring = true;
+        }
+        usleep(1000);
+    }
+    take_snapshot(&after);
+    stop_radios();
+
+    if( !measuring )
+        before = after;
+    double secs = (after.ns - before.ns)*1e-9;
+    t->overruns = after.overruns - before.overruns;
+    t->dropped = after.dropped - before.dropped;
+    t->late = after.late - before.late;
+    t->errors = after.errors - before.errors;
+    t->throughput = secs > 0 ? (after.samples - before.samples)/secs : 0;
+    t->tx_queue_us = after.tx_queue_count > before.tx_queue_count ?
+        (after.tx_queue_ns - before.tx_queue_ns)*1e-3/(after.tx_queue_count - before.tx_queue_count) : 0;
+}
+
+static bool trial_passed(const struct trial * t)
+{
+    return t->started && t->overruns == 0 && t->dropped == 0 && t->late == 0 && t->errors == 0 &&
+           t->throughput >= AUTOTUNE_MIN_THROUGHPUT*opts.samplerate;
+}
+
+// Of two trials that passed, the one with less latency wins
+static bool trial_better(const struct trial * a, const struct trial * b)
+{
+    if( a->buffered_ms != b->buffered_ms )
+        return a->buffered_ms < b->buffered_ms;
+    return a->tx_queue_us < b->tx_queue_us;
+}
+
+bool run_autotune(const struct waveform * wf)
+{
+    std::vector<struct trial> trials;
+    for( unsigned int buffer_size : buffer_sizes ) {
+        for( unsigned int num_buffers : buffer_counts ) {
+            for( unsigned int num_transfers : transfer_counts ) {
+                if( 2*num_transfers > num_buffers )
+                    continue;
+                if( opts.async_stream && num_buffers != MAX(buffer_counts[0], 2*num_transfers) )
+                    continue;
+                struct trial t;
+                memset(&t, 0, sizeof(t));
+                t.num_buffers = num_buffers;
+                t.buffer_size = buffer_size;
+                t.num_transfers = num_transfers;
+                trials.push_back(t);
+            }
+        }
+    }
+
+    char rate[9];
+    double2str_suffix(rate, opts.samplerate, freq_suffixes, NUM_FREQ_SUFFIXES);
+    printf("Autotuning %s streaming at %ssps: %zu trials of %gms\n",
+           opts.async_stream ? "async" : "sync", rate, trials.size(), opts.autotune_ms);
+
+    const struct trial * best = NULL;
+    for( struct trial & t : trials ) {
+        run_trial(wf, &t);
+        if( !t.started ) {
+            printf("  %3u x %5u samples, %2u transfers: failed to start\n",
+                   t.num_buffers, t.buffer_size, t.num_transfers);
+            continue;
+        }
+        printf("  %3u x %5u samples, %2u transfers: %6.2f MS/s, %llu overruns, %llu dropped, "
+               "%llu late, %llu errors, %.2fms buffered",
+               t.num_buffers, t.buffer_size, t.num_transfers, t.throughput/1e6,
+               (unsigned long long)t.overruns, (unsigned long long)t.dropped, (unsigned long long)t.late,
+               (unsigned long long)t.errors, t.buffered_ms);
+        // The async engine doesn't hand bursts over one at a time
+        if( !opts.async_stream )
+            printf(", %.0fus per burst", t.tx_queue_us);
+        printf("%s\n", trial_passed(&t) ? "" : " (failed)");
+        if( trial_passed(&t) && (!best || trial_better(&t, best)) )
+            best = &t;
+    }
+
+    if( !best ) {
+        ERROR("No buffer settings kept up at %ssps, nothing saved\n", rate);
+        return false;
+    }
+    printf("Best: --num-buffers=%u --buffer-size=%u --num-transfers=%u (%.2fms buffered)\n",
+           best->num_buffers, best->buffer_size, best->num_transfers, best->buffered_ms);
+    if( opts.tuning[0] == '\0' )
+        return true;
+    if( !tuning_save(opts.tuning, best) )
+        return false;
+    printf("Saved to %s\n", opts.tuning);
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+#include <stdbool.h>
+
+struct waveform;
+
+// Where tuned buffer settings are kept unless --tuning says otherwise
+char * tuning_default_path(void);
+
+// Fill in opts.num_buffers, opts.buffer_size and opts.num_transfers from the
+// profile saved in path for the (only) device, the stream mode and opts.samplerate,
+// if there is one
+bool tuning_load(const char * path);
+
+// Run the radio (transmitting wf) and processing for opts.autotune_ms with
+// each combination of buffer settings we know to try, and save whichever kept
+// up with the least buffering to opts.tuning for later runs to pick up
+bool run_autotune(const struct waveform * wf);
+#endif
@@ -0,0 +1,130 @@
+#include "bpsk.h"
+#include "util.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BPSK_X86
+#endif
+
+// Outputs worked on at once: 64 floats of accumulator stay in registers
+// (8 AVX or 16 SSE), and every chip is one pass of adds over them
+#define BPSK_BLOCK 32
+
+bool bpsk_detect(const fftwf_complex * code, unsigned int code_len, uint64_t * signs,
+                 float * amplitude)
+{
+    if( code_len == 0 || code_len > BPSK_MAX_LEN )
+        return false;
+
+    // A little slack, so codes that went through a sin() or two still count
+    float a = fabsf(code[0][0]);
+    if( a == 0 )
+        return false;
+    *signs = 0;
+    for( unsigned int idx=0; idx<code_len; ++idx ) {
+        if( fabsf(fabsf(code[idx][0]) - a) > 1e-6f*a || fabsf(code[idx][1]) > 1e-6f*a )
+            return false;
+        if( code[idx][0] < 0 )
+            *signs |= 1ull << idx;
+    }
+    *amplitude = a;
+    return true;
+}
+
+// w outputs starting at x.  N is the code length, or 0 to take it from len;
+// when w is BPSK_BLOCK every loop has a fixed count and vectorizes cleanly.
+template<unsigned int N>
+static inline __attribute__((always_inline))
+void bpsk_block(const float * __restrict x, float * __restrict out, unsigned int w,
+                uint64_t signs, unsigned int len)
+{
+    const unsigned int taps = N ? N : len;
+    float acc[2*BPSK_BLOCK];
+
+    if( signs & 1 ) {
+        for( unsigned int idx=0; idx<2*w; ++idx )
+            acc[idx] = -x[idx];
+    } else {
+        for( unsigned int idx=0; idx<2*w; ++idx )
+            acc[idx] = x[idx];
+    }
+    for( unsigned int k=1; k<taps; ++k ) {
+        const float * __restrict xk = x + 2*k;
+        if( (signs >> k) & 1 ) {
+            for( unsigned int idx=0; idx<2*w; ++idx )
+                acc[idx] -= xk[idx];
+        } else {
+            for( unsigned int idx=0; idx<2*w; ++idx )
+                acc[idx] += xk[idx];
+        }
+    }
+    memcpy(out, acc, sizeof(float)*2*w);
+}
+
+template<unsigned int N>
+static inline __attribute__((always_inline))
+void bpsk_correlate_body(const float * in, float * out, unsigned int count, uint64_t signs,
+                         unsigned int len)
+{
+    unsigned int idx = 0;
+    for( ; idx + BPSK_BLOCK <= count; idx += BPSK_BLOCK )
+        bpsk_block<N>(in + 2*idx, out + 2*idx, BPSK_BLOCK, signs, len);
+    if( idx < count )
+        bpsk_block<N>(in + 2*idx, out + 2*idx, count - idx, signs, len);
+}
+
+// Whatever the compiler vectorizes to for the baseline ISA (SSE2 on x86-64)
+template<unsigned int N>
+static void bpsk_correlate_base(const float * in, float * out, unsigned int count, uint64_t signs,
+                                unsigned int len)
+{
+    bpsk_correlate_body<N>(in, out, count, signs, len);
+}
+
+#ifdef BPSK_X86
+// The same thing 8 floats at a time.  Adds in the same order, so it comes out
+// the same bit for bit.
+template<unsigned int N>
+__attribute__((target("avx2")))
+static void bpsk_correlate_avx2(const float * in, float * out, unsigned int count, uint64_t signs,
+                                unsigned int len)
+{
+    bpsk_correlate_body<N>(in, out, count, signs, len);
+}
+#define BPSK_KERNEL(n) { n, bpsk_correlate_base<n>, bpsk_correlate_avx2<n> }
+#else
+#define BPSK_KERNEL(n) { n, bpsk_correlate_base<n>, NULL }
+#endif
+
+static const struct {
+    unsigned int len;
+    bpsk_correlate_fn base;
+    bpsk_correlate_fn avx2;
+} kernels[] = {
+    BPSK_KERNEL(2),
+    BPSK_KERNEL(3),
+    BPSK_KERNEL(4),
+    BPSK_KERNEL(5),
+    BPSK_KERNEL(7),
+    BPSK_KERNEL(11),
+    BPSK_KERNEL(13),
+
+    // Anything else
+    BPSK_KERNEL(0),
+};
+
+bpsk_correlate_fn bpsk_get(unsigned int code_len)
+{
+    if( code_len == 0 || code_len > BPSK_MAX_LEN )
+        return NULL;
+
+    unsigned int idx = 0;
+    while( kernels[idx].len != 0 && kernels[idx].len != code_len )
+        idx++;
+#ifdef BPSK_X86
+    if( __builtin_cpu_supports("avx2") )
+        return kernels[idx].avx2;
+#endif
+    return kernels[idx].base;
+}
@@ -0,0 +1,27 @@
+#ifndef BPSK_H
+#define BPSK_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <fftw3.h>
+
+// Longest code the time domain correlator takes, one sign bit per chip
+#define BPSK_MAX_LEN 64
+
+// out[n] = sum over k of s_k*in[n + k] for count outputs, where s_k is -1 if
+// bit k of signs is set and +1 otherwise.  in and out are interleaved complex
+// float; in needs count + code_len - 1 samples.  Nothing but adds and
+// subtracts, a block of outputs at a time.
+typedef void (*bpsk_correlate_fn)(const float * in, float * out, unsigned int count,
+                                  uint64_t signs, unsigned int code_len);
+
+// Whether code (as handed to pc_init()) is binary phase: every sample real
+// and the same size up to sign.  If it is, the chips go in *signs as above and
+// that size in *amplitude.
+bool bpsk_detect(const fftwf_complex * code, unsigned int code_len, uint64_t * signs,
+                 float * amplitude);
+
+// The best correlator for code_len chips this CPU runs: unrolled at compile
+// time for each Barker length, a loop over the chips otherwise.  NULL if
+// code_len is more than BPSK_MAX_LEN.
+bpsk_correlate_fn bpsk_get(unsigned int code_len);
+#endif
@@ -0,0 +1,242 @@
+#include <libbladeRF.h>
+#include "calibrate.h"
+#include "options.h"
+#include "util.h"
+#include "radio.h"
+#include "metrics.h"
+#include "waveform.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// How long the radios run for while we measure
+#define CAL_MS 1000
+
+// Range bins we look for the loopback in, from right at the TX timestamp
+#define CAL_RANGE_BINS 1024
+
+// The loopback has to stand at least this far (20dB) above the median range
+// bin, or whatever we found isn't it
+#define CAL_MIN_PEAK 100.0
+
+// Every radio's range profile power, summed over the run
+static struct {
+    std::vector<double> power;
+    uint64_t profiles;
+} accum[MAX_RADIOS];
+
+// On each radio's processing thread, which is stopped before anyone reads this
+static void cal_tap(void * user_data, const fftwf_complex * profile, unsigned int range_bins, uint64_t ts)
+{
+    const struct radio * r = (const struct radio *)user_data;
+    std::vector<double> & power = accum[r->idx].power;
+    for( unsigned int idx=0; idx<range_bins && idx<power.size(); ++idx )
+        power[idx] += (double)profile[idx][0]*profile[idx][0] + (double)profile[idx][1]*profile[idx][1];
+    accum[r->idx].profiles++;
+}
+
+char * calibration_default_path(void)
+{
+    const char * home = getenv("HOME");
+    if( !home || home[0] == '\0' )
+        return strdup("");
+    char * path = (char *)malloc(strlen(home) + 24);
+    sprintf(path, "%s/.radar_calibration", home);
+    return path;
+}
+
+// The delay depends on the board and on the sample rate (the filters in the
+// FPGA and the LMS are clocked off of it), and a little on the frequency
+static std::string cal_key(const char * serial)
+{
+    char rest[32];
+    snprintf(rest, sizeof(rest), " %u %u", opts.samplerate, opts.freq);
+    return std::string(serial) + rest;
+}
+
+/*
+ * The calibration file is one delay per line:
+ *
+ *   <serial> <samplerate> <frequency> <delay in samples>
+ *
+ * with # comments.
+ */
+bool calibration_load(struct radio * r)
+{
+    if( opts.calibration[0] == '\0' )
+        return false;
+    FILE * f = fopen(opts.calibration, "r");
+    if( !f )
+        return false;
+
+    std::string key = cal_key(r->device.serial);
+    char line[1024];
+    bool found = false;
+    while( fgets(line, sizeof(line), f) ) {
+        char serial[BLADERF_SERIAL_LENGTH];
+        unsigned int rate, freq;
+        double delay;
+        if( line[0] == '#' )
+            continue;
+        if( sscanf(line, "%32s %u %u %lf", serial, &rate, &freq, &delay) != 4 )
+            continue;
+        if( std::string(serial) + " " + std::to_string(rate) + " " + std::to_string(freq) != key )
+            continue;
+        if( !isfinite(delay) || delay < 0 ) {
+            ERROR("Ignoring bad calibration in %s: %s", opts.calibration, line);
+            continue;
+        }
+        r->rx_delay = delay;
+        found = true;
+    }
+    fclose(f);
+
+    if( found ) {
+        INFO("  %sTX to RX delay: %.2f samples (from %s)\n", r->label, r->rx_delay,
+             opts.calibration);
+    }
+    return found;
+}
+
+// Replace r's line in the calibration file, leaving every other one be
+static bool calibration_save(const char * path, const struct radio * r)
+{
+    std::string key = cal_key(r->device.serial);
+    std::vector<std::string> lines;
+    FILE * f = fopen(path, "r");
+    if( f ) {
+        char line[1024], serial[BLADERF_SERIAL_LENGTH];
+        unsigned int rate, freq;
+        while( fgets(line, sizeof(line), f) ) {
+            if( line[0] != '#' && sscanf(line, "%32s %u %u", serial, &rate, &freq) == 3 &&
+                std::string(serial) + " " + std::to_string(rate) + " " + std::to_string(freq) == key )
+                continue;
+            lines.push_back(line);
+        }
+        fclose(f);
+    }
+    if( lines.empty() )
+        lines.push_back("# radar --calibrate: serial samplerate frequency delay\n");
+
+    std::string tmp = std::string(path) + ".tmp";
+    f = fopen(tmp.c_str(), "w");
+    if( !f ) {
+        ERROR("Couldn't write calibration to %s: %s\n", tmp.c_str(), strerror(errno));
+        return false;
+    }
+    for( const std::string & line : lines )
+        fputs(line.c_str(), f);
+    fprintf(f, "%s %.3f\n", key.c_str(), r->rx_delay);
+    if( fclose(f) != 0 || rename(tmp.c_str(), path) != 0 ) {
+        ERROR("Couldn't write calibration to %s: %s\n", path, strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Where the loopback peaks, to a fraction of a bin, and how far above the
+// median bin that peak is.  A burst of the code over and over again matches
+// once per repeat, and the first of those is the one we want.  Around the
+// peak the mainlobe's close enough to a Gaussian that the vertex of a
+// parabola through the log power of the peak bin and its neighbours is good
+// to a tenth of a bin or so.
+static void find_peak(const std::vector<double> & power, double * bin, double * over_median)
+{
+    size_t k = std::max_element(power.begin(), power.end()) - power.begin();
+    std::vector<double> sorted(power);
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size()/2, sorted.end());
+    double median = sorted[sorted.size()/2];
+    *over_median = median > 0 ? power[k]/median : INFINITY;
+
+    for( size_t idx=1; idx<k; ++idx ) {
+        if( power[idx] >= power[k]/2 && power[idx] >= power[idx - 1] && power[idx] >= power[idx + 1] ) {
+            k = idx;
+            break;
+        }
+    }
+
+    double frac = 0;
+    if( k > 0 && k + 1 < power.size() && power[k - 1] > 0 && power[k + 1] > 0 ) {
+        double a = log(power[k - 1]), b = log(power[k]), c = log(power[k + 1]);
+        double curve = a - 2*b + c;
+        if( curve < 0 )
+            frac = 0.5*(a - c)/curve;
+    }
+    *bin = k + frac;
+}
+
+bool run_calibration(const struct waveform * wf)
+{
+    // The loopback has to die away before the next burst, or there's no
+    // telling which burst it came from
+    uint64_t pri = (uint64_t)(opts.pri_ms*opts.samplerate/1000);
+    uint64_t quiet = (uint64_t)CAL_RANGE_BINS*opts.decimate;
+    if( wf->burst_len + quiet > pri ) {
+        ERROR("Calibration needs at least %llu samples between bursts, use a shorter --burst\n",
+              (unsigned long long)quiet);
+        return false;
+    }
+
+    // A normal run, only as quiet as we can make it and with range profiles
+    // starting right at each burst's timestamp
+    opts.txvga1 = BLADERF_TXVGA1_GAIN_MIN;
+    opts.txvga2 = BLADERF_TXVGA2_GAIN_MIN;
+    opts.rf_loopback = opts.calibrate == CAL_RF;
+    opts.workers = 1;
+    opts.range_offset = 0;
+    opts.range_bins = CAL_RANGE_BINS;
+    for( unsigned int idx=0; idx<opts.num_devices; ++idx ) {
+        accum[idx].power.assign(CAL_RANGE_BINS, 0.0);
+        accum[idx].profiles = 0;
+    }
+
+    printf("Calibrating over %s loopback for %dms\n", opts.calibrate == CAL_RF ? "RF" : "cable", CAL_MS);
+    process_set_profile_tap(cal_tap);
+    if( !start_radios(wf) ) {
+        process_set_profile_tap(NULL);
+        return false;
+    }
+    uint64_t start = metrics_now_ns();
+    while( metrics_now_ns() - start < (uint64_t)CAL_MS*1000000 )
+        usleep(1000);
+    stop_radios();
+    process_set_profile_tap(NULL);
+
+    bool ok = true;
+    for( unsigned int idx=0; idx<num_radios; ++idx ) {
+        struct radio * r = &radios[idx];
+        if( accum[idx].profiles == 0 ) {
+            ERROR("%sNo range profiles to calibrate from\n", r->label);
+            ok = false;
+            continue;
+        }
+
+        double bin, over_median;
+        find_peak(accum[idx].power, &bin, &over_median);
+        if( over_median < CAL_MIN_PEAK ) {
+            ERROR("%sNo loopback found: the strongest range bin is only %.1fdB over the median\n",
+                  r->label, 10*log10(over_median));
+            ok = false;
+            continue;
+        }
+        r->rx_delay = process_bin_delay(r, bin);
+        printf("%s%s: %.2f samples (%.1fns) from TX to RX, %.1fdB over the median over %llu range profiles\n",
+               r->label, r->device.serial, r->rx_delay, r->rx_delay*1e9/opts.samplerate,
+               10*log10(over_median), (unsigned long long)accum[idx].profiles);
+        if( opts.calibration[0] == '\0' )
+            continue;
+        if( !calibration_save(opts.calibration, r) ) {
+            ok = false;
+            continue;
+        }
+        printf("%sSaved to %s\n", r->label, opts.calibration);
+    }
+    return ok;
+}
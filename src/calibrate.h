@@ -0,0 +1,33 @@
+#ifndef CALIBRATE_H
+#define CALIBRATE_H
+#include <stdbool.h>
+
+struct waveform;
+struct radio;
+
+// How --calibrate gets TX back into RX
+enum cal_loopback {
+    CAL_RF = 1,
+    CAL_CABLE,
+};
+
+// Where calibrated delays are kept unless --calibration says otherwise
+char * calibration_default_path(void);
+
+// Fill in r->rx_delay from whatever --calibrate saved to opts.calibration for
+// r's board, opts.samplerate and opts.freq, if it's been run.  r's device has
+// to be open.
+bool calibration_load(struct radio * r);
+
+/*
+ * Measure every radio's delay from a TX timestamp to the RX timestamp its
+ * samples come back at, and save it to opts.calibration for later runs.
+ *
+ * The radios run just like a normal run (transmitting wf at the lowest TX
+ * gain, looped back inside the board or through a cable) for a second,
+ * while every range profile's power is added up.  The loopback is the
+ * strongest thing in them by far, and where it peaks, interpolated between
+ * range bins, is the delay to a fraction of a sample.
+ */
+bool run_calibration(const struct waveform * wf);
+#endif
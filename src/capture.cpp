@@ -0,0 +1,260 @@
+#include <libbladeRF.h>
+#include "options.h"
+#include "util.h"
+#include "rx.h"
+#include "tx.h"
+#include "capture.h"
+#include "metrics.h"
+#include "radio.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// <opts.capture>, and which radio this is if there's more than one
+static void capture_prefix(struct radio * r, char * prefix, size_t len)
+{
+    if( num_radios > 1 )
+        snprintf(prefix, len, "%s.r%u", opts.capture, r->idx);
+    else
+        snprintf(prefix, len, "%s", opts.capture);
+}
+
+static bool open_capture_file(struct radio * r)
+{
+    struct capture_data_struct * cd = &r->capture;
+    const size_t block_bytes = (size_t)r->rx.ring.block_size*2*sizeof(int16_t);
+    char prefix[PATH_MAX - 16], path[PATH_MAX];
+
+    // O_DIRECT wants every write aligned on both ends, which we get as long as
+    // blocks come in whole pages (ring memory itself is page aligned)
+    capture_prefix(r, prefix, sizeof(prefix));
+    snprintf(path, sizeof(path), "%s.%04u.sc16", prefix, cd->file_idx);
+    cd->direct = block_bytes % RING_ARENA_ALIGN == 0;
+    cd->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | (cd->direct ? O_DIRECT : 0), 0644);
+    if( cd->fd < 0 && cd->direct && errno == EINVAL ) {
+        // Not every filesystem does O_DIRECT (tmpfs, for one)
+        cd->direct = false;
+        cd->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if( cd->fd < 0 ) {
+        ERROR("Couldn't open capture file %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    // Get all the space we're going to need up front, so we're not waiting on
+    // the filesystem to find more of it mid-capture
+    int status = posix_fallocate(cd->fd, 0, cd->rotate_bytes);
+    if( status != 0 && status != EOPNOTSUPP && status != EINVAL ) {
+        ERROR("Couldn't preallocate %llu bytes for %s: %s\n",
+              (unsigned long long)cd->rotate_bytes, path, strerror(status));
+        close(cd->fd);
+        cd->fd = -1;
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "%s.%04u.meta", prefix, cd->file_idx);
+    cd->meta = fopen(path, "w");
+    if( !cd->meta ) {
+        ERROR("Couldn't open capture metadata file %s: %s\n", path, strerror(errno));
+        close(cd->fd);
+        cd->fd = -1;
+        return false;
+    }
+
+    bool ok;
+    fprintf(cd->meta, "format sc16q11\n");
+    fprintf(cd->meta, "device %s\n", r->device.devstr[0] != '\0' ? r->device.devstr : "-");
+    fprintf(cd->meta, "samplerate %u\n", opts.samplerate);
+    fprintf(cd->meta, "frequency %u\n", opts.freq);
+    fprintf(cd->meta, "lna_gain %d\n", bladerf_lna_gain_to_db(opts.lna, &ok));
+    fprintf(cd->meta, "rxvga1 %d\n", opts.rxvga1);
+    fprintf(cd->meta, "rxvga2 %d\n", opts.rxvga2);
+    fprintf(cd->meta, "txvga1 %d\n", opts.txvga1);
+    fprintf(cd->meta, "txvga2 %d\n", opts.txvga2);
+    fprintf(cd->meta, "rx_lpf %s\n", opts.rx_lpf_enabled ? "enabled" : "bypassed");
+    fprintf(cd->meta, "tx_lpf %s\n", opts.tx_lpf_enabled ? "enabled" : "bypassed");
+    fprintf(cd->meta, "buffer_size %u\n", r->rx.ring.block_size);
+    fprintf(cd->meta, "waveform %s\n", opts.waveform);
+    fprintf(cd->meta, "tx_epoch %llu\n", (unsigned long long)r->tx.epoch);
+    fprintf(cd->meta, "pri %llu\n", (unsigned long long)r->tx.pri);
+    if( opts.align_timestamps )
+        fprintf(cd->meta, "clock_offset %lld\n", (long long)r->clock_offset);
+    if( r->rx_delay != 0 )
+        fprintf(cd->meta, "rx_delay %.3f\n", r->rx_delay);
+    fprintf(cd->meta, "# block <sample offset> <timestamp> <samples> <status>\n");
+
+    cd->file_bytes = 0;
+    cd->files.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+static void close_capture_file(struct capture_data_struct * cd)
+{
+    if( cd->fd >= 0 ) {
+        // Give back whatever we preallocated and didn't use
+        if( ftruncate(cd->fd, cd->file_bytes) != 0 )
+            ERROR("Couldn't trim capture file: %s\n", strerror(errno));
+        close(cd->fd);
+        cd->fd = -1;
+    }
+    if( cd->meta ) {
+        fclose(cd->meta);
+        cd->meta = NULL;
+    }
+}
+
+// Write all of buf at offset, returns false if the disk won't have it
+static bool write_all(int fd, const void * buf, size_t len, uint64_t offset)
+{
+    const char * p = (const char *)buf;
+    while( len > 0 ) {
+        ssize_t written = pwrite(fd, p, len, offset);
+        if( written < 0 ) {
+            if( errno == EINTR )
+                continue;
+            ERROR("Capture write failed: %s\n", strerror(errno));
+            return false;
+        }
+        p += written;
+        len -= written;
+        offset += written;
+    }
+    return true;
+}
+
+// How many of the `count` blocks starting at `first` still belong in the
+// current file
+static unsigned int blocks_for_file(struct capture_data_struct * cd, const struct rx_block * first,
+                                    unsigned int count, size_t block_bytes)
+{
+    unsigned int n = 0;
+
+    if( cd->file_bytes == 0 )
+        cd->file_ts = first->timestamp;
+    while( n < count ) {
+        if( cd->file_bytes + (n + 1)*block_bytes > cd->rotate_bytes )
+            break;
+        if( cd->rotate_samples != 0 && first[n].timestamp - cd->file_ts >= cd->rotate_samples )
+            break;
+        n++;
+    }
+    return n;
+}
+
+static void * capture_thread(void * arg)
+{
+    struct radio * r = (struct radio *)arg;
+    struct capture_data_struct * cd = &r->capture;
+    struct sample_ring * ring = &r->rx.ring;
+    const size_t block_bytes = (size_t)ring->block_size*2*sizeof(int16_t);
+    const unsigned int max_run = MAX(1, (unsigned int)(CAPTURE_MAX_WRITE/block_bytes));
+
+    while( true ) {
+        unsigned int count;
+        struct rx_block * first = ring_tap_peek(ring, &count);
+        if( !first ) {
+            // Write out everything that's left before we quit
+            if( !cd->running.load(std::memory_order_relaxed) )
+                break;
+            usleep(500);
+            continue;
+        }
+        count = MIN(count, max_run);
+
+        if( cd->failed ) {
+            ring_tap_release(ring, count);
+            continue;
+        }
+
+        unsigned int n = blocks_for_file(cd, first, count, block_bytes);
+        if( n == 0 ) {
+            close_capture_file(cd);
+            cd->file_idx++;
+            if( !open_capture_file(r) ) {
+                cd->failed = true;
+                cd->errors.fetch_add(1, std::memory_order_relaxed);
+                metric_inc(M_CAPTURE_ERRORS);
+                continue;
+            }
+            n = MAX(1u, blocks_for_file(cd, first, count, block_bytes));
+        }
+
+        // Blocks are back to back in ring memory, so the whole run is one
+        // write.  Not so for the async engine's, which sit between message
+        // headers in its stream buffers.
+        for( unsigned int idx=1; idx<n; ++idx ) {
+            if( first[idx].samples != first[0].samples + 2*(size_t)idx*ring->block_size ) {
+                n = idx;
+                break;
+            }
+        }
+        uint64_t start = metrics_now_ns();
+        bool ok = write_all(cd->fd, first->samples, n*block_bytes, cd->file_bytes);
+        metric_observe(M_CAPTURE_WRITE_NS, metrics_now_ns() - start);
+        if( !ok ) {
+            cd->failed = true;
+            cd->errors.fetch_add(1, std::memory_order_relaxed);
+            metric_inc(M_CAPTURE_ERRORS);
+            ring_tap_release(ring, n);
+            continue;
+        }
+        for( unsigned int idx=0; idx<n; ++idx ) {
+            fprintf(cd->meta, "block %llu %llu %u 0x%x\n",
+                    (unsigned long long)(cd->file_bytes/(2*sizeof(int16_t)) + (uint64_t)idx*ring->block_size),
+                    (unsigned long long)first[idx].timestamp, first[idx].count, first[idx].status);
+        }
+        cd->file_bytes += n*block_bytes;
+        cd->bytes.fetch_add(n*block_bytes, std::memory_order_relaxed);
+        metric_add(M_CAPTURE_BYTES, n*block_bytes);
+        cd->blocks.fetch_add(n, std::memory_order_relaxed);
+        ring_tap_release(ring, n);
+    }
+    return NULL;
+}
+
+bool start_capture(struct radio * r)
+{
+    struct capture_data_struct * cd = &r->capture;
+    const uint64_t block_bytes = (uint64_t)r->rx.ring.block_size*2*sizeof(int16_t);
+    char prefix[PATH_MAX];
+
+    cd->fd = -1;
+    cd->meta = NULL;
+    cd->file_idx = 0;
+    cd->failed = false;
+    cd->rotate_bytes = MAX(block_bytes, opts.capture_size/block_bytes*block_bytes);
+    cd->rotate_samples = (uint64_t)(opts.capture_time_ms*opts.samplerate/1000);
+    cd->bytes = 0;
+    cd->blocks = 0;
+    cd->files = 0;
+    cd->errors = 0;
+    if( !open_capture_file(r) )
+        return false;
+
+    cd->running = true;
+    if( pthread_create(&cd->thread, NULL, capture_thread, r) != 0 ) {
+        ERROR("%sFailed to start capture thread\n", r->label);
+        cd->running = false;
+        close_capture_file(cd);
+        return false;
+    }
+    capture_prefix(r, prefix, sizeof(prefix));
+    LOG("%sCapturing to %s.*.sc16 (%s I/O)\n", r->label, prefix, cd->direct ? "direct" : "buffered");
+    return true;
+}
+
+void stop_capture(struct radio * r)
+{
+    struct capture_data_struct * cd = &r->capture;
+
+    cd->running = false;
+    pthread_join(cd->thread, NULL);
+    close_capture_file(cd);
+
+    LOG("\n%sCapture: %llu blocks, %llu bytes in %llu files, %llu errors",
+        r->label, (unsigned long long)cd->blocks.load(), (unsigned long long)cd->bytes.load(),
+        (unsigned long long)cd->files.load(), (unsigned long long)cd->errors.load());
+}
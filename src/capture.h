@@ -0,0 +1,56 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <atomic>
+
+// Biggest single write we'll issue, in bytes
+#define CAPTURE_MAX_WRITE (4 << 20)
+
+// Records everything RX receives to <opts.capture>.NNNN.sc16 files, raw SC16
+// Q11 in the same format as signal/*.sc16, with a .NNNN.meta text file next
+// to each one describing the radio settings and every block (sample offset,
+// hardware timestamp, sample count and RX status flags).  With more than one
+// radio each gets its own, <opts.capture>.rN.NNNN.sc16 for radio N.  The writer is a tap
+// on the RX ring so samples go to disk straight out of ring memory, and if
+// it can't keep up the RX ring overruns rather than RX stalling.
+struct capture_data_struct {
+    pthread_t thread;
+    std::atomic<bool> running;
+
+    // Current data and metadata files
+    int fd;
+    FILE * meta;
+    unsigned int file_idx;
+    bool direct;
+
+    // Where we are in the current file, and the timestamp it starts at
+    uint64_t file_bytes;
+    uint64_t file_ts;
+
+    // Start a new file once this one reaches rotate_bytes, or spans
+    // rotate_samples of signal (0 for never)
+    uint64_t rotate_bytes;
+    uint64_t rotate_samples;
+
+    // Once writes start failing we stop trying, but keep draining the ring
+    bool failed;
+
+    // Statistics, updated by the capture thread only
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> blocks;
+    std::atomic<uint64_t> files;
+    std::atomic<uint64_t> errors;
+};
+
+struct radio;
+
+// Open r's first capture file and start writing out what its RX receives.
+// RX has to be started first, with the tap on its ring.
+bool start_capture(struct radio * r);
+
+// Write out anything still in the ring and close up the last file
+void stop_capture(struct radio * r);
+#endif
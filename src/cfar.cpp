@@ -0,0 +1,363 @@
+#include "cfar.h"
+#include "util.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+
+/*
+ * The inner loops are written so the compiler can vectorize them, and on x86
+ * we have it build AVX-512 and AVX2 versions alongside the baseline one and
+ * pick between them at load time.
+ */
+#if defined(__x86_64__) && defined(__linux__)
+#define CFAR_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define CFAR_CLONES
+#endif
+
+static unsigned int os_rank(unsigned int n)
+{
+    return MIN(n, MAX(1u, (3*n + 3)/4));
+}
+
+static double os_log_pfa(unsigned int n, unsigned int k, double alpha)
+{
+    double log_pfa = 0;
+    for( unsigned int idx=0; idx<k; ++idx )
+        log_pfa += log((double)(n - idx)/(n - idx + alpha));
+    return log_pfa;
+}
+
+// Threshold multiplier for n training cells.  For CA it multiplies their sum,
+// for OS the k-th smallest of them.
+static float cfar_alpha(struct cfar * c, unsigned int n)
+{
+    if( c->alpha[n] != 0 )
+        return c->alpha[n];
+
+    if( n == 0 ) {
+        // No idea what the noise is, so never say anything
+        c->alpha[n] = INFINITY;
+    } else if( c->method == CFAR_CA ) {
+        c->alpha[n] = (float)(pow(c->pfa, -1.0/n) - 1.0);
+    } else {
+        // Pfa = prod_{i<k} (n - i)/(n - i + alpha), which only goes down as
+        // alpha goes up, so find an upper bound and bisect for it
+        unsigned int k = os_rank(n);
+        double target = log(c->pfa);
+        double lo = 0, hi = 1;
+        while( os_log_pfa(n, k, hi) > target && hi < 1e12 ) {
+            lo = hi;
+            hi *= 2;
+        }
+        for( int iter=0; iter<64; ++iter ) {
+            double mid = (lo + hi)/2;
+            if( os_log_pfa(n, k, mid) > target )
+                lo = mid;
+            else
+                hi = mid;
+        }
+        c->alpha[n] = (float)hi;
+    }
+    return c->alpha[n];
+}
+
+bool str2cfar(const char * str, enum cfar_method * method)
+{
+    if( strcasecmp(str, "ca") == 0 ) {
+        *method = CFAR_CA;
+        return true;
+    }
+    if( strcasecmp(str, "os") == 0 ) {
+        *method = CFAR_OS;
+        return true;
+    }
+    return false;
+}
+
+bool cfar_init(struct cfar * c, enum cfar_method method, unsigned int range_bins,
+               unsigned int doppler_bins, unsigned int guard, unsigned int train,
+               float pfa, unsigned int max_dets)
+{
+    memset(c, 0, sizeof(struct cfar));
+    c->method = method;
+    c->guard = guard;
+    c->train = train;
+    c->pfa = pfa;
+    c->range_bins = range_bins;
+    c->doppler_bins = MAX(doppler_bins, 1u);
+    c->max_dets = max_dets;
+
+    // Keep the Doppler window from wrapping onto itself
+    unsigned int half = (c->doppler_bins - 1)/2;
+    c->guard_doppler = MIN(guard, half);
+    c->train_doppler = MIN(train, half - c->guard_doppler);
+
+    unsigned int wr = guard + train, wd = c->guard_doppler + c->train_doppler;
+    unsigned int cells_1d = 2*train;
+    unsigned int cells_2d = (2*wd + 1)*(2*wr + 1) - (2*c->guard_doppler + 1)*(2*guard + 1);
+    c->max_cells = MAX(cells_1d, cells_2d);
+
+    size_t map_len = (size_t)c->doppler_bins*range_bins;
+    size_t sums_len = (size_t)(c->doppler_bins + 2*wd + 1)*(range_bins + 1);
+    c->alpha = (float *)calloc(c->max_cells + 1, sizeof(float));
+    c->power = (float *)malloc(sizeof(float)*map_len);
+    c->thresh = (float *)malloc(sizeof(float)*range_bins);
+    c->noise = (float *)malloc(sizeof(float)*range_bins);
+    c->sums = (double *)malloc(sizeof(double)*sums_len);
+    c->cells = (float *)malloc(sizeof(float)*MAX(c->max_cells, 1u));
+    c->dets = (struct detection *)malloc(sizeof(struct detection)*max_dets);
+    if( !c->alpha || !c->power || !c->thresh || !c->noise || !c->sums || !c->cells || !c->dets ) {
+        cfar_free(c);
+        return false;
+    }
+    return true;
+}
+
+void cfar_free(struct cfar * c)
+{
+    free(c->alpha);
+    free(c->power);
+    free(c->thresh);
+    free(c->noise);
+    free(c->sums);
+    free(c->cells);
+    free(c->dets);
+    memset(c, 0, sizeof(struct cfar));
+}
+
+CFAR_CLONES
+static void cfar_power(const fftwf_complex * in, float * out, size_t count)
+{
+    const float * x = (const float *)in;
+    for( size_t idx=0; idx<count; ++idx )
+        out[idx] = x[2*idx + 0]*x[2*idx + 0] + x[2*idx + 1]*x[2*idx + 1];
+}
+
+// Compare every cell against its threshold and write out the ones that beat it
+static void cfar_emit(struct cfar * c, const float * power, uint64_t ts, unsigned int doppler_bin)
+{
+    for( unsigned int idx=0; idx<c->range_bins; ++idx ) {
+        if( !(power[idx] > c->thresh[idx]) )
+            continue;
+        if( c->num_dets == c->max_dets ) {
+            c->dropped++;
+            continue;
+        }
+        struct detection * det = &c->dets[c->num_dets++];
+        det->timestamp = ts;
+        det->range_bin = idx;
+        det->doppler_bin = doppler_bin;
+        det->power = power[idx];
+        det->noise = c->noise[idx];
+    }
+}
+
+/*
+ * 1-D: the sums over both training windows come from a prefix sum, so each
+ * cell is four lookups no matter how wide the windows are.
+ */
+CFAR_CLONES
+static void ca_1d_interior(const double * prefix, float * thresh, float * noise,
+                           unsigned int begin, unsigned int end, unsigned int guard,
+                           unsigned int train, float alpha, float inv_n)
+{
+    for( unsigned int idx=begin; idx<end; ++idx ) {
+        float sum = (float)((prefix[idx - guard] - prefix[idx - guard - train]) +
+                            (prefix[idx + guard + train + 1] - prefix[idx + guard + 1]));
+        thresh[idx] = alpha*sum;
+        noise[idx] = inv_n*sum;
+    }
+}
+
+static void ca_1d(struct cfar * c, const float * power)
+{
+    const unsigned int n = c->range_bins, g = c->guard, t = c->train;
+    double * prefix = c->sums;
+
+    prefix[0] = 0;
+    for( unsigned int idx=0; idx<n; ++idx )
+        prefix[idx + 1] = prefix[idx] + power[idx];
+
+    // Cells whose windows both fit get the fast path, the rest lose part of
+    // a window off the end
+    unsigned int begin = MIN(g + t, n);
+    unsigned int end = n > g + t ? MAX(begin, n - g - t) : begin;
+    if( t > 0 )
+        ca_1d_interior(prefix, c->thresh, c->noise, begin, end, g, t, cfar_alpha(c, 2*t), 1.0f/(2*t));
+
+    for( unsigned int idx=0; idx<n; ++idx ) {
+        if( idx == begin && t > 0 )
+            idx = end;
+        if( idx >= n )
+            break;
+        unsigned int l0 = idx > g + t ? idx - g - t : 0;
+        unsigned int l1 = idx > g ? idx - g : 0;
+        unsigned int r0 = MIN(idx + g + 1, n);
+        unsigned int r1 = MIN(idx + g + t + 1, n);
+        unsigned int cells = (l1 - l0) + (r1 - r0);
+        float sum = (float)((prefix[l1] - prefix[l0]) + (prefix[r1] - prefix[r0]));
+        c->thresh[idx] = cfar_alpha(c, cells)*sum;
+        c->noise[idx] = cells ? sum/cells : 0;
+    }
+}
+
+static void os_1d(struct cfar * c, const float * power)
+{
+    const unsigned int n = c->range_bins, g = c->guard, t = c->train;
+
+    for( unsigned int idx=0; idx<n; ++idx ) {
+        unsigned int cells = 0;
+        for( unsigned int j = idx > g + t ? idx - g - t : 0; j + g < idx; ++j )
+            c->cells[cells++] = power[j];
+        for( unsigned int j = idx + g + 1; j < n && j <= idx + g + t; ++j )
+            c->cells[cells++] = power[j];
+
+        if( cells == 0 ) {
+            c->thresh[idx] = INFINITY;
+            c->noise[idx] = 0;
+            continue;
+        }
+        unsigned int k = os_rank(cells) - 1;
+        std::nth_element(c->cells, c->cells + k, c->cells + cells);
+        c->thresh[idx] = cfar_alpha(c, cells)*c->cells[k];
+        c->noise[idx] = c->cells[k];
+    }
+}
+
+unsigned int cfar_profile(struct cfar * c, const fftwf_complex * profile, uint64_t ts)
+{
+    c->num_dets = 0;
+    cfar_power(profile, c->power, c->range_bins);
+    if( c->method == CFAR_CA )
+        ca_1d(c, c->power);
+    else
+        os_1d(c, c->power);
+    cfar_emit(c, c->power, ts, 0);
+    return c->num_dets;
+}
+
+/*
+ * 2-D: a summed area table over the map, with the rows wrapped around top and
+ * bottom so the Doppler window can run off either end.  Each training region
+ * is the outer rectangle minus the guard rectangle, eight lookups per cell.
+ */
+CFAR_CLONES
+static void ca_2d_interior(const double * outer0, const double * outer1,
+                           const double * guard0, const double * guard1,
+                           float * thresh, float * noise, unsigned int begin, unsigned int end,
+                           unsigned int wr, unsigned int gr, float alpha, float inv_n)
+{
+    for( unsigned int idx=begin; idx<end; ++idx ) {
+        double outer = outer1[idx + wr + 1] - outer0[idx + wr + 1] - outer1[idx - wr] + outer0[idx - wr];
+        double inner = guard1[idx + gr + 1] - guard0[idx + gr + 1] - guard1[idx - gr] + guard0[idx - gr];
+        float sum = (float)(outer - inner);
+        thresh[idx] = alpha*sum;
+        noise[idx] = inv_n*sum;
+    }
+}
+
+static void ca_2d(struct cfar * c, unsigned int d)
+{
+    const unsigned int n = c->range_bins, stride = n + 1;
+    const unsigned int gr = c->guard, wr = c->guard + c->train;
+    const unsigned int gd = c->guard_doppler, wd = c->guard_doppler + c->train_doppler;
+
+    // Row e of the table sums rows up to (not including) extended row e,
+    // and the cell under test sits at extended row d + wd
+    const double * outer0 = c->sums + (size_t)d*stride;
+    const double * outer1 = c->sums + (size_t)(d + 2*wd + 1)*stride;
+    const double * guard0 = c->sums + (size_t)(d + wd - gd)*stride;
+    const double * guard1 = c->sums + (size_t)(d + wd + gd + 1)*stride;
+    const unsigned int rows_outer = 2*wd + 1, rows_guard = 2*gd + 1;
+
+    unsigned int begin = MIN(wr, n);
+    unsigned int end = n > wr ? MAX(begin, n - wr) : begin;
+    unsigned int full = rows_outer*(2*wr + 1) - rows_guard*(2*gr + 1);
+    if( full > 0 ) {
+        ca_2d_interior(outer0, outer1, guard0, guard1, c->thresh, c->noise, begin, end, wr, gr,
+                       cfar_alpha(c, full), 1.0f/full);
+    }
+
+    for( unsigned int idx=0; idx<n; ++idx ) {
+        if( idx == begin && full > 0 )
+            idx = end;
+        if( idx >= n )
+            break;
+        unsigned int o0 = idx > wr ? idx - wr : 0, o1 = MIN(idx + wr + 1, n);
+        unsigned int i0 = idx > gr ? idx - gr : 0, i1 = MIN(idx + gr + 1, n);
+        double outer = outer1[o1] - outer0[o1] - outer1[o0] + outer0[o0];
+        double inner = guard1[i1] - guard0[i1] - guard1[i0] + guard0[i0];
+        unsigned int cells = rows_outer*(o1 - o0) - rows_guard*(i1 - i0);
+        float sum = (float)(outer - inner);
+        c->thresh[idx] = cfar_alpha(c, cells)*sum;
+        c->noise[idx] = cells ? sum/cells : 0;
+    }
+}
+
+static void os_2d(struct cfar * c, unsigned int d)
+{
+    const unsigned int n = c->range_bins, rows = c->doppler_bins;
+    const unsigned int gr = c->guard, wr = c->guard + c->train;
+    const int gd = c->guard_doppler, wd = c->guard_doppler + c->train_doppler;
+
+    for( unsigned int idx=0; idx<n; ++idx ) {
+        unsigned int o0 = idx > wr ? idx - wr : 0, o1 = MIN(idx + wr + 1, n);
+        unsigned int cells = 0;
+        for( int dd=-wd; dd<=wd; ++dd ) {
+            const float * row = c->power + (size_t)((d + rows + dd) % rows)*n;
+            bool guard_row = dd >= -gd && dd <= gd;
+            for( unsigned int r=o0; r<o1; ++r ) {
+                if( guard_row && r + gr >= idx && r <= idx + gr )
+                    continue;
+                c->cells[cells++] = row[r];
+            }
+        }
+
+        if( cells == 0 ) {
+            c->thresh[idx] = INFINITY;
+            c->noise[idx] = 0;
+            continue;
+        }
+        unsigned int k = os_rank(cells) - 1;
+        std::nth_element(c->cells, c->cells + k, c->cells + cells);
+        c->thresh[idx] = cfar_alpha(c, cells)*c->cells[k];
+        c->noise[idx] = c->cells[k];
+    }
+}
+
+unsigned int cfar_map(struct cfar * c, const fftwf_complex * map, uint64_t ts)
+{
+    const unsigned int n = c->range_bins, rows = c->doppler_bins, stride = n + 1;
+    const unsigned int wd = c->guard_doppler + c->train_doppler;
+
+    c->num_dets = 0;
+    cfar_power(map, c->power, (size_t)rows*n);
+
+    if( c->method == CFAR_CA ) {
+        double * sums = c->sums;
+        memset(sums, 0, sizeof(double)*stride);
+        for( unsigned int e=0; e<rows + 2*wd; ++e ) {
+            const float * row = c->power + (size_t)((e + rows - wd) % rows)*n;
+            const double * above = sums + (size_t)e*stride;
+            double * here = sums + (size_t)(e + 1)*stride;
+            double run = 0;
+            here[0] = 0;
+            for( unsigned int r=0; r<n; ++r ) {
+                run += row[r];
+                here[r + 1] = above[r + 1] + run;
+            }
+        }
+    }
+
+    for( unsigned int d=0; d<rows; ++d ) {
+        if( c->method == CFAR_CA )
+            ca_2d(c, d);
+        else
+            os_2d(c, d);
+        cfar_emit(c, c->power + (size_t)d*n, ts, d);
+    }
+    return c->num_dets;
+}
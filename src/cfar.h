@@ -0,0 +1,81 @@
+#ifndef CFAR_H
+#define CFAR_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <fftw3.h>
+
+// What a detection looks like once it leaves the detector
+struct detection {
+    // Timestamp the pulse went out at (the first pulse of the CPI for
+    // range-Doppler maps), so the echo arrived at timestamp + range_bin
+    uint64_t timestamp;
+    uint32_t range_bin;
+    uint32_t doppler_bin;
+
+    // Power in the cell, and the noise estimate it beat
+    float power;
+    float noise;
+};
+
+enum cfar_method {
+    // Cell averaging: noise is the mean of the training cells
+    CFAR_CA,
+    // Ordered statistic: noise is the k-th smallest training cell, with k at
+    // 3/4 of the way up.  Holds up better next to other targets, but costs
+    // a selection per cell instead of a couple of lookups.
+    CFAR_OS,
+};
+
+struct cfar {
+    enum cfar_method method;
+
+    // Cells on each side of the cell under test that are skipped, and the
+    // ones past those that the noise is estimated from, in range and Doppler
+    unsigned int guard, train;
+    unsigned int guard_doppler, train_doppler;
+
+    // Probability of false alarm we set thresholds for
+    float pfa;
+
+    // Threshold multipliers by number of training cells; the count only
+    // changes near the edges, so these get filled in the first time we see
+    // each one (0 means not yet)
+    float * alpha;
+    unsigned int max_cells;
+
+    // Biggest input we were set up for
+    unsigned int range_bins;
+    unsigned int doppler_bins;
+
+    // Scratch
+    float * power;
+    float * thresh;
+    float * noise;
+    double * sums;
+    float * cells;
+
+    // Detections from the last call, and how many didn't fit over all calls
+    struct detection * dets;
+    unsigned int num_dets;
+    unsigned int max_dets;
+    uint64_t dropped;
+};
+
+// Set up for range profiles of range_bins cells and range-Doppler maps of
+// doppler_bins x range_bins.  Doppler training is cut back if it doesn't fit
+// in doppler_bins; the Doppler axis wraps around, range doesn't.
+bool cfar_init(struct cfar * c, enum cfar_method method, unsigned int range_bins,
+               unsigned int doppler_bins, unsigned int guard, unsigned int train,
+               float pfa, unsigned int max_dets);
+void cfar_free(struct cfar * c);
+
+// Run over a range profile of pulse sent at ts, returns the number of
+// detections now in c->dets
+unsigned int cfar_profile(struct cfar * c, const fftwf_complex * profile, uint64_t ts);
+
+// Run over a range-Doppler map laid out like range_doppler_cb's
+unsigned int cfar_map(struct cfar * c, const fftwf_complex * map, uint64_t ts);
+
+// Parse "ca" or "os"
+bool str2cfar(const char * str, enum cfar_method * method);
+#endif
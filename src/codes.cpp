@@ -0,0 +1,22 @@
+#include "codes.h"
+
+bool code_generate(enum code_type type, unsigned int len, double bt, unsigned int spc,
+                   int16_t * iq, float * taps)
+{
+    if( !code_valid(type, len) || spc == 0 )
+        return false;
+
+    // Same arithmetic as code_make(), so a code comes out exactly the same
+    // whichever way it was made
+    const unsigned int total = len*spc;
+    for( unsigned int n=0; n<total; ++n ) {
+        // Phase codes hold each chip for spc samples, a chirp just gets
+        // sampled that much finer
+        double phase = type == CODE_LFM ? code_phase(type, total, n, bt) : code_phase(type, len, n/spc, bt);
+        iq[2*n + 0] = code_round(CODE_AMPLITUDE*code_cos(phase));
+        iq[2*n + 1] = code_round(CODE_AMPLITUDE*code_sin(phase));
+        taps[2*(total - 1 - n) + 0] = (float)code_cos(phase);
+        taps[2*(total - 1 - n) + 1] = (float)-code_sin(phase);
+    }
+    return true;
+}
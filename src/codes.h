@@ -0,0 +1,167 @@
+#ifndef CODES_H
+#define CODES_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Pulse compression codes: what we transmit, one sample per chip, and the
+ * matched filter for it.
+ *
+ *  - Barker codes of length 2, 3, 4, 5, 7, 11 and 13 (binary phase)
+ *  - Frank codes of length m^2, the phases of an m-point DFT matrix read out
+ *    row by row
+ *  - P3 and P4 codes of any length, sampled chirps that are more Doppler
+ *    tolerant than Frank's and (P4) have lower sidelobes
+ *  - LFM chirps of any length sweeping a band of bt/len of the sample rate,
+ *    centered on DC, for a time-bandwidth product of bt
+ *
+ * Everything is defined by the phase of each sample (in cycles), which works
+ * in constant expressions, so code_table<type, len> is built entirely at
+ * compile time.  code_generate() does the same at run time for lengths,
+ * time-bandwidth products and samples per chip that aren't known until then.
+ */
+
+enum code_type {
+    CODE_BARKER,
+    CODE_FRANK,
+    CODE_P3,
+    CODE_P4,
+    CODE_LFM,
+};
+
+// Amplitude of every sample in SC16 Q11, just under full scale
+#define CODE_AMPLITUDE 2047
+
+// Default time-bandwidth product of an LFM chirp of len samples: half the
+// band, leaving the rest for the filters either side of the converters
+#define CODE_LFM_DEFAULT_BT(len) ((len)/2)
+
+static constexpr int8_t barker_chips[][13] = {
+    { 1, -1 },
+    { 1, 1, -1 },
+    { 1, 1, -1, 1 },
+    { 1, 1, 1, -1, 1 },
+    { 1, 1, 1, -1, -1, 1, -1 },
+    { 1, 1, 1, -1, -1, -1, 1, -1, -1, 1, -1 },
+    { 1, 1, 1, 1, 1, -1, -1, 1, 1, -1, 1, -1, 1 },
+};
+
+// Row of barker_chips for a code of len chips, -1 if there's no such Barker code
+constexpr int barker_row(unsigned int len)
+{
+    return len == 2 ? 0 : len == 3 ? 1 : len == 4 ? 2 : len == 5 ? 3 :
+           len == 7 ? 4 : len == 11 ? 5 : len == 13 ? 6 : -1;
+}
+
+// Side of the Frank matrix for a code of len chips, 0 if len isn't a square
+constexpr unsigned int frank_side(unsigned int len)
+{
+    unsigned int m = 1;
+    while( (m + 1)*(m + 1) <= len )
+        m++;
+    return len > 1 && m*m == len ? m : 0;
+}
+
+constexpr bool code_valid(enum code_type type, unsigned int len)
+{
+    return type == CODE_BARKER ? barker_row(len) >= 0 :
+           type == CODE_FRANK ? frank_side(len) != 0 : len > 1;
+}
+
+// cycles wrapped into [-0.5, 0.5)
+constexpr double code_wrap(double cycles)
+{
+    long long whole = (long long)cycles;
+    cycles -= (double)whole;
+    if( cycles >= 0.5 )
+        cycles -= 1;
+    if( cycles < -0.5 )
+        cycles += 1;
+    return cycles;
+}
+
+// sin(2*pi*cycles), good to double precision and usable in constant expressions
+constexpr double code_sin(double cycles)
+{
+    double x = 2*3.14159265358979323846*code_wrap(cycles);
+    double term = x, sum = x;
+    for( int k=1; k<14; ++k ) {
+        term *= -x*x/((2*k)*(2*k + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double code_cos(double cycles)
+{
+    return code_sin(cycles + 0.25);
+}
+
+// Phase in cycles of sample n of a len-chip code.  Anything with a whole
+// number of cycles in it is taken out with integer arithmetic first, so long
+// codes don't lose precision.  bt is only used for CODE_LFM.
+constexpr double code_phase(enum code_type type, unsigned int len, unsigned int n, double bt)
+{
+    switch( type ) {
+        case CODE_BARKER:
+            return barker_chips[barker_row(len)][n] < 0 ? 0.5 : 0.0;
+        case CODE_FRANK: {
+            unsigned int m = frank_side(len);
+            return (double)((n/m)*(n%m) % m)/m;
+        }
+        case CODE_P3:
+            return (double)((uint64_t)n*n % (2ull*len))/(2.0*len);
+        case CODE_P4:
+            return (double)(((uint64_t)n*n + 2ull*len*len - (uint64_t)n*len) % (2ull*len))/(2.0*len);
+        case CODE_LFM: {
+            // Sweeping -bt/(2*len) to bt/(2*len) cycles per sample, centered
+            // on the middle of the pulse
+            double u = (double)n/len - 0.5;
+            return code_wrap(bt/2*u*u);
+        }
+    }
+    return 0;
+}
+
+// One period of a code: SC16 Q11 samples to transmit, and the matched filter
+// taps for them (conjugated and time reversed, unit amplitude, interleaved
+// complex floats)
+template<unsigned int N>
+struct code_samples {
+    int16_t iq[2*N];
+    float taps[2*N];
+};
+
+constexpr int16_t code_round(double x)
+{
+    return (int16_t)(x < 0 ? x - 0.5 : x + 0.5);
+}
+
+template<enum code_type T, unsigned int N, unsigned int BT>
+constexpr struct code_samples<N> code_make(void)
+{
+    struct code_samples<N> c = {};
+    for( unsigned int n=0; n<N; ++n ) {
+        double phase = code_phase(T, N, n, BT);
+        c.iq[2*n + 0] = code_round(CODE_AMPLITUDE*code_cos(phase));
+        c.iq[2*n + 1] = code_round(CODE_AMPLITUDE*code_sin(phase));
+        c.taps[2*(N - 1 - n) + 0] = (float)code_cos(phase);
+        c.taps[2*(N - 1 - n) + 1] = (float)-code_sin(phase);
+    }
+    return c;
+}
+
+// code_samples for a code known at compile time, e.g.
+// code_table<CODE_FRANK, 64>::value.iq
+template<enum code_type T, unsigned int N, unsigned int BT = CODE_LFM_DEFAULT_BT(N)>
+struct code_table {
+    static_assert(code_valid(T, N), "No code of that type and length");
+    static constexpr struct code_samples<N> value = code_make<T, N, BT>();
+};
+
+// The same thing at run time, with each chip held for spc samples (so iq and
+// taps need room for len*spc samples).  False if there's no code of that type
+// and length.
+bool code_generate(enum code_type type, unsigned int len, double bt, unsigned int spc,
+                   int16_t * iq, float * taps);
+#endif
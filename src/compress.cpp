@@ -0,0 +1,166 @@
+#include "compress.h"
+#include "fftplan.h"
+#include "sc16.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Per output, the time domain takes code_len complex adds, and overlap-save
+// takes two FFTs plus a multiply over fft_len points for every step outputs.
+// Counting a point of an FFT pass (fft_len*log2(fft_len) of them per
+// transform) as PC_FFT_COST complex adds: FFTW manages about twice that on
+// AVX2, so this leans towards the FFTs.  See correlate/* in radar_bench.
+#define PC_FFT_COST 1.0
+
+static bool direct_cheaper(unsigned int code_len, unsigned int fft_len)
+{
+    double direct = code_len;
+    double fft = PC_FFT_COST*(2*fft_len*log2((double)fft_len) + fft_len)/(fft_len - code_len + 1);
+    return direct < fft;
+}
+
+bool pc_init(struct pulse_compressor * pc, const fftwf_complex * code, unsigned int code_len,
+             unsigned int fft_len, enum pc_method method, compress_cb callback, void * user_data)
+{
+    memset(pc, 0, sizeof(struct pulse_compressor));
+
+    // Overlap-save throws away code_len - 1 outputs per FFT, so we want the
+    // FFT to be comfortably longer than the code.  Powers of two are fastest.
+    if( fft_len == 0 ) {
+        fft_len = 4096;
+        while( fft_len < 8*code_len )
+            fft_len *= 2;
+    }
+    if( code_len == 0 || fft_len < code_len )
+        return false;
+
+    pc->fft_len = fft_len;
+    pc->code_len = code_len;
+    pc->step = fft_len - code_len + 1;
+    pc->callback = callback;
+    pc->user_data = user_data;
+
+    float amplitude;
+    if( method != PC_FFT && bpsk_detect(code, code_len, &pc->signs, &amplitude) &&
+        (method == PC_DIRECT || direct_cheaper(code_len, fft_len)) )
+        pc->direct = bpsk_get(code_len);
+    if( method == PC_DIRECT && !pc->direct )
+        return false;
+
+    pc->in = fftwf_alloc_complex(fft_len);
+    pc->out = fftwf_alloc_complex(fft_len);
+    if( !pc->in || !pc->out ) {
+        pc_free(pc);
+        return false;
+    }
+    if( pc->direct ) {
+        pc->scale = amplitude;
+        return true;
+    }
+
+    pc->code_fft = fftwf_alloc_complex(fft_len);
+    pc->freq = fftwf_alloc_complex(fft_len);
+    if( !pc->code_fft || !pc->freq ) {
+        pc_free(pc);
+        return false;
+    }
+
+    // Plans are shared, and live as long as the plan cache does
+    pc->fwd = fft_plan_1d(fft_len, FFTW_FORWARD, false, true);
+    pc->inv = fft_plan_1d(fft_len, FFTW_BACKWARD, false, true);
+    if( !pc->fwd || !pc->inv ) {
+        pc_free(pc);
+        return false;
+    }
+
+    // Correlating against the code is multiplying by its conjugate spectrum
+    memset(pc->in, 0, sizeof(fftwf_complex)*fft_len);
+    memcpy(pc->in, code, sizeof(fftwf_complex)*code_len);
+    fftwf_execute_dft(pc->fwd, pc->in, pc->code_fft);
+    for( unsigned int idx=0; idx<fft_len; ++idx ) {
+        pc->code_fft[idx][0] =  pc->code_fft[idx][0]/fft_len;
+        pc->code_fft[idx][1] = -pc->code_fft[idx][1]/fft_len;
+    }
+    return true;
+}
+
+void pc_free(struct pulse_compressor * pc)
+{
+    fftwf_free(pc->code_fft);
+    fftwf_free(pc->in);
+    fftwf_free(pc->freq);
+    fftwf_free(pc->out);
+    memset(pc, 0, sizeof(struct pulse_compressor));
+}
+
+// Correlate whatever is in `in` into `out`, at least the first count outputs
+static void pc_correlate(struct pulse_compressor * pc, unsigned int count)
+{
+    if( pc->direct ) {
+        pc->direct((const float *)pc->in, (float *)pc->out, count, pc->signs, pc->code_len);
+        if( pc->scale != 1.0f ) {
+            float * o = (float *)pc->out;
+            for( unsigned int idx=0; idx<2*count; ++idx )
+                o[idx] *= pc->scale;
+        }
+        return;
+    }
+
+    fftwf_execute_dft(pc->fwd, pc->in, pc->freq);
+
+    float * __restrict f = (float *)pc->freq;
+    const float * __restrict h = (const float *)pc->code_fft;
+    for( unsigned int idx=0; idx<pc->fft_len; ++idx ) {
+        float re = f[2*idx]*h[2*idx] - f[2*idx + 1]*h[2*idx + 1];
+        float im = f[2*idx]*h[2*idx + 1] + f[2*idx + 1]*h[2*idx];
+        f[2*idx] = re;
+        f[2*idx + 1] = im;
+    }
+
+    fftwf_execute_dft(pc->inv, pc->freq, pc->out);
+}
+
+static void pc_run(struct pulse_compressor * pc)
+{
+    pc_correlate(pc, pc->step);
+    pc->callback(pc, pc->out, pc->step, pc->in_ts, pc->user_data);
+
+    // The tail of this block is the history for the next one
+    memmove(pc->in, pc->in + pc->step, sizeof(fftwf_complex)*(pc->code_len - 1));
+    pc->fill = pc->code_len - 1;
+    pc->in_ts += pc->step;
+}
+
+void pc_push_sc16(struct pulse_compressor * pc, const int16_t * iq, unsigned int count, uint64_t ts)
+{
+    // Start over if there's a gap, correlating across it would be nonsense
+    if( pc->fill == 0 || ts != pc->in_ts + pc->fill ) {
+        pc->fill = 0;
+        pc->in_ts = ts;
+    }
+
+    while( count > 0 ) {
+        unsigned int n = pc->fft_len - pc->fill;
+        if( n > count )
+            n = count;
+
+        sc16_to_cf32(iq, (float *)(pc->in + pc->fill), n, 1.0f/2048.0f, NULL);
+
+        pc->fill += n;
+        iq += 2*n;
+        count -= n;
+        if( pc->fill == pc->fft_len )
+            pc_run(pc);
+    }
+}
+
+void pc_flush(struct pulse_compressor * pc)
+{
+    // Only outputs with the whole code over real input are worth anything
+    if( pc->fill >= pc->code_len ) {
+        memset(pc->in + pc->fill, 0, sizeof(fftwf_complex)*(pc->fft_len - pc->fill));
+        pc_correlate(pc, pc->fill - pc->code_len + 1);
+        pc->callback(pc, pc->out, pc->fill - pc->code_len + 1, pc->in_ts, pc->user_data);
+    }
+    pc->fill = 0;
+}
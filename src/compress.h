@@ -0,0 +1,73 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <fftw3.h>
+#include "bpsk.h"
+
+struct pulse_compressor;
+
+// Called with every run of compressed output.  out[n] is the correlation of
+// the reference code against the input starting at timestamp ts + n, so a
+// peak at n means an echo of a pulse that started arriving at ts + n.
+typedef void (*compress_cb)(struct pulse_compressor * pc, const fftwf_complex * out,
+                            unsigned int count, uint64_t ts, void * user_data);
+
+// How to correlate: PC_AUTO uses the time domain when the code is binary
+// phase and that's cheaper than the FFTs, PC_DIRECT insists on it
+enum pc_method {
+    PC_AUTO,
+    PC_FFT,
+    PC_DIRECT,
+};
+
+// Overlap-save matched filter.  Each FFT takes the last code_len - 1 samples
+// of the previous block plus `step` new ones, and yields `step` valid outputs.
+// Short binary phase codes are correlated directly in the time domain
+// instead (see bpsk.h), over the same blocks.
+struct pulse_compressor {
+    unsigned int fft_len;
+    unsigned int code_len;
+    unsigned int step;
+
+    // conj(FFT(code)), prescaled by 1/fft_len so the inverse comes out right
+    fftwf_complex * code_fft;
+
+    // Set when correlating in the time domain, in which case there's no
+    // code_fft, freq or plans.  Outputs get multiplied by scale, the size of
+    // the code's chips, unless that's 1.
+    bpsk_correlate_fn direct;
+    uint64_t signs;
+    float scale;
+
+    // Time domain input (history + new samples), spectrum and output
+    fftwf_complex * in;
+    fftwf_complex * freq;
+    fftwf_complex * out;
+
+    // Borrowed from the plan cache, see fftplan.h
+    fftwf_plan fwd, inv;
+
+    // How many samples are sitting in `in`, and the timestamp of in[0]
+    unsigned int fill;
+    uint64_t in_ts;
+
+    compress_cb callback;
+    void * user_data;
+};
+
+// Picks an FFT length suitable for a code of code_len samples when fft_len is
+// 0.  Fails if method is PC_DIRECT and the code isn't binary phase.
+bool pc_init(struct pulse_compressor * pc, const fftwf_complex * code, unsigned int code_len,
+             unsigned int fft_len, enum pc_method method, compress_cb callback, void * user_data);
+void pc_free(struct pulse_compressor * pc);
+
+// Feed it a block of SC16 Q11 samples starting at timestamp ts.  A gap in
+// timestamps restarts the filter, so outputs are only produced for stretches
+// of continuous input.
+void pc_push_sc16(struct pulse_compressor * pc, const int16_t * iq, unsigned int count, uint64_t ts);
+
+// Produce every output the input so far covers, as if it stopped here.  The
+// next push starts the filter over.
+void pc_flush(struct pulse_compressor * pc);
+#endif
@@ -0,0 +1,251 @@
+#include "decimate.h"
+#include "util.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Same deal as the CFAR kernels: the FIR's inner loop is plain code the
+ * compiler vectorizes, built for AVX-512 and AVX2 as well as the baseline.
+ */
+#if defined(__x86_64__) && defined(__linux__)
+#define DECIM_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define DECIM_CLONES
+#endif
+
+#define FIR_PHASE_TAPS (DECIM_FIR_TAPS/2)
+#define FIR_HISTORY (FIR_PHASE_TAPS - 1)
+
+// FIR outputs worked on at once, 32 floats of accumulator
+#define FIR_BLOCK 16
+
+// The FIR's passband and stopband edges, in cycles per CIC output sample.
+// The decimated band ends at 0.25; what lands between 0.25 and 0.3 aliases
+// back down above 0.2, outside the band we keep flat.
+#define FIR_PASS 0.2
+#define FIR_STOP 0.3
+
+// The CIC's magnitude response at f cycles per CIC output sample
+static double cic_response(unsigned int ratio, double f)
+{
+    if( ratio == 1 || f == 0 )
+        return 1;
+    return pow(fabs(sin(M_PI*f)/(ratio*sin(M_PI*f/ratio))), DECIM_CIC_STAGES);
+}
+
+// Frequency sampling: the inverse of the CIC's droop across the passband,
+// rolled off with a raised cosine to nothing at the stopband, then
+// Blackman windowed and scaled for unity gain at DC
+static void design_fir(struct decimator * d)
+{
+    const unsigned int grid = 4096;
+    const double center = (DECIM_FIR_TAPS - 1)/2.0;
+    double h[DECIM_FIR_TAPS], sum = 0;
+
+    for( unsigned int k=0; k<DECIM_FIR_TAPS; ++k )
+        h[k] = 0;
+    for( unsigned int g=0; g<grid; ++g ) {
+        double f = (g + 0.5)/grid*0.5;
+        double gain = 0;
+        if( f <= FIR_PASS )
+            gain = 1/cic_response(d->cic_ratio, f);
+        else if( f < FIR_STOP )
+            gain = 0.5*(1 + cos(M_PI*(f - FIR_PASS)/(FIR_STOP - FIR_PASS)))/cic_response(d->cic_ratio, FIR_PASS);
+        for( unsigned int k=0; k<DECIM_FIR_TAPS; ++k )
+            h[k] += gain*cos(2*M_PI*f*(k - center));
+    }
+    for( unsigned int k=0; k<DECIM_FIR_TAPS; ++k ) {
+        double x = 2*M_PI*k/(DECIM_FIR_TAPS - 1);
+        h[k] *= 0.42 - 0.5*cos(x) + 0.08*cos(2*x);
+        sum += h[k];
+    }
+
+    // Tap 2i applies to the even CIC output i samples on, 2i + 1 to the odd one
+    for( unsigned int i=0; i<FIR_PHASE_TAPS; ++i ) {
+        d->taps[0][i] = (float)(h[2*i + 0]/sum);
+        d->taps[1][i] = (float)(h[2*i + 1]/sum);
+    }
+}
+
+bool decim_init(struct decimator * d, unsigned int factor)
+{
+    memset(d, 0, sizeof(struct decimator));
+    if( factor < 2 || factor % 2 != 0 || factor > DECIM_MAX )
+        return false;
+
+    d->factor = factor;
+    d->cic_ratio = factor/2;
+    d->cic_scale = (float)(1/pow((double)d->cic_ratio, DECIM_CIC_STAGES));
+    design_fir(d);
+    decim_reset(d);
+    return true;
+}
+
+void decim_free(struct decimator * d)
+{
+    free(d->phase[0]);
+    free(d->phase[1]);
+    free(d->out);
+    free(d->out_sc16);
+    memset(d, 0, sizeof(struct decimator));
+}
+
+void decim_reset(struct decimator * d)
+{
+    memset(d->integ, 0, sizeof(d->integ));
+    memset(d->comb, 0, sizeof(d->comb));
+    for( unsigned int p=0; p<2; ++p ) {
+        if( d->phase[p] )
+            memset(d->phase[p], 0, sizeof(float)*2*FIR_HISTORY);
+    }
+    d->fill = 0;
+    d->have_pending = false;
+    d->next_ts = UINT64_MAX;
+}
+
+// Make sure there's room for count more inputs' worth of everything
+static bool reserve(struct decimator * d, unsigned int count)
+{
+    unsigned int need = count/d->factor + 2;
+    if( need <= d->cap && need <= d->out_cap )
+        return true;
+
+    need = MAX(need, 2*d->cap);
+    for( unsigned int p=0; p<2; ++p ) {
+        float * phase = (float *)realloc(d->phase[p], sizeof(float)*2*(FIR_HISTORY + need));
+        if( !phase )
+            return false;
+        if( !d->phase[p] )
+            memset(phase, 0, sizeof(float)*2*FIR_HISTORY);
+        d->phase[p] = phase;
+    }
+    d->cap = need;
+
+    float * out = (float *)realloc(d->out, sizeof(float)*2*need);
+    if( out )
+        d->out = out;
+    int16_t * out_sc16 = (int16_t *)realloc(d->out_sc16, sizeof(int16_t)*2*need);
+    if( out_sc16 )
+        d->out_sc16 = out_sc16;
+    if( !out || !out_sc16 )
+        return false;
+    d->out_cap = need;
+    return true;
+}
+
+// out[j] = sum over i of he[i]*e[j + i] + ho[i]*o[j + i], for count outputs
+DECIM_CLONES
+static void fir_phases(const float * e, const float * o, const float * he, const float * ho,
+                       float * out, unsigned int count)
+{
+    for( unsigned int base=0; base<count; base += FIR_BLOCK ) {
+        unsigned int n = MIN(FIR_BLOCK, count - base);
+        float acc[2*FIR_BLOCK];
+        for( unsigned int idx=0; idx<2*n; ++idx )
+            acc[idx] = 0;
+        for( unsigned int i=0; i<FIR_PHASE_TAPS; ++i ) {
+            const float * x = e + 2*(base + i);
+            const float h = he[i];
+            for( unsigned int idx=0; idx<2*n; ++idx )
+                acc[idx] += h*x[idx];
+            x = o + 2*(base + i);
+            const float g = ho[i];
+            for( unsigned int idx=0; idx<2*n; ++idx )
+                acc[idx] += g*x[idx];
+        }
+        memcpy(out + 2*base, acc, sizeof(float)*2*n);
+    }
+}
+
+// One CIC output, with CIC timestamp c, into whichever phase it belongs to
+static inline void to_fir(struct decimator * d, float i, float q, uint64_t c, uint64_t * first_ts)
+{
+    if( c % 2 == 0 ) {
+        d->pending[0] = i;
+        d->pending[1] = q;
+        d->have_pending = true;
+        return;
+    }
+    // Right after a restart there's no even half for this one
+    if( !d->have_pending )
+        return;
+
+    if( d->fill == 0 )
+        *first_ts = c/2;
+    float * e = d->phase[0] + 2*(FIR_HISTORY + d->fill);
+    float * o = d->phase[1] + 2*(FIR_HISTORY + d->fill);
+    e[0] = d->pending[0];
+    e[1] = d->pending[1];
+    o[0] = i;
+    o[1] = q;
+    d->fill++;
+    d->have_pending = false;
+}
+
+unsigned int decim_push(struct decimator * d, const int16_t * iq, unsigned int count, uint64_t ts)
+{
+    if( !reserve(d, count) )
+        return 0;
+    if( ts != d->next_ts )
+        decim_reset(d);
+    d->next_ts = ts + count;
+
+    uint64_t first_ts = 0;
+    if( d->cic_ratio == 1 ) {
+        for( unsigned int idx=0; idx<count; ++idx )
+            to_fir(d, iq[2*idx + 0], iq[2*idx + 1], ts + idx, &first_ts);
+    } else {
+        const unsigned int r = d->cic_ratio;
+        unsigned int in_cycle = (unsigned int)(ts % r);
+        for( unsigned int idx=0; idx<count; ++idx ) {
+            for( unsigned int ch=0; ch<2; ++ch ) {
+                uint64_t x = (uint64_t)(int64_t)iq[2*idx + ch];
+                for( unsigned int s=0; s<DECIM_CIC_STAGES; ++s ) {
+                    d->integ[s][ch] += x;
+                    x = d->integ[s][ch];
+                }
+            }
+            if( ++in_cycle < r )
+                continue;
+            in_cycle = 0;
+
+            float v[2];
+            for( unsigned int ch=0; ch<2; ++ch ) {
+                uint64_t y = d->integ[DECIM_CIC_STAGES - 1][ch];
+                for( unsigned int s=0; s<DECIM_CIC_STAGES; ++s ) {
+                    uint64_t prev = d->comb[s][ch];
+                    d->comb[s][ch] = y;
+                    y -= prev;
+                }
+                v[ch] = (float)(int64_t)y*d->cic_scale;
+            }
+            to_fir(d, v[0], v[1], (ts + idx)/r, &first_ts);
+        }
+    }
+
+    unsigned int n = d->fill;
+    if( n == 0 )
+        return 0;
+    fir_phases(d->phase[0], d->phase[1], d->taps[0], d->taps[1], d->out, n);
+    d->out_ts = first_ts;
+
+    // The newest samples are the history for next time
+    for( unsigned int p=0; p<2; ++p )
+        memmove(d->phase[p], d->phase[p] + 2*n, sizeof(float)*2*FIR_HISTORY);
+    d->fill = 0;
+    return n;
+}
+
+unsigned int decim_push_sc16(struct decimator * d, const int16_t * iq, unsigned int count, uint64_t ts)
+{
+    // Not cf32_to_sc16(), that saturates to what the DAC takes
+    unsigned int n = decim_push(d, iq, count, ts);
+    for( unsigned int idx=0; idx<2*n; ++idx ) {
+        float v = d->out[idx]*DECIM_GAIN;
+        v = v > -32768.0f ? v : -32768.0f;
+        v = v < 32767.0f ? v : 32767.0f;
+        d->out_sc16[idx] = (int16_t)lrintf(v);
+    }
+    return n;
+}
@@ -0,0 +1,79 @@
+#ifndef DECIMATE_H
+#define DECIMATE_H
+#include <stdbool.h>
+#include <stdint.h>
+
+// Most we'll decimate by, which keeps the CIC's bit growth well inside 64 bits
+#define DECIM_MAX 256
+
+#define DECIM_CIC_STAGES 4
+
+// Length of the compensating FIR; half of them apply to each of its two phases
+#define DECIM_FIR_TAPS 64
+
+// decim_push_sc16() scales its output up by this before rounding it back to
+// SC16, so the precision decimating gains isn't rounded straight back off: 3
+// more bits, with room for a full scale input to overshoot by 2x
+#define DECIM_GAIN 8
+
+/*
+ * Decimation of RX samples by an even factor, ahead of any processing: a
+ * DECIM_CIC_STAGES stage CIC decimating by factor/2 (skipped when that's 1),
+ * then a polyphase FIR decimating by 2 that flattens the CIC's droop across
+ * the band we keep and cuts off what would alias.  The CIC is integer math,
+ * the FIR works on float a block of outputs at a time, one phase of the
+ * input after the other.
+ *
+ * Output m comes out once input timestamp m*factor + factor - 1 has gone in,
+ * and carries timestamp m, so decimated timestamps are just the input ones
+ * divided by factor.  About 80% of the decimated band is flat; the filters
+ * delay everything by the same amount, which matching against a reference
+ * code that went through a decimator of its own takes back out.
+ */
+struct decimator {
+    unsigned int factor;
+    unsigned int cic_ratio;
+
+    // CIC integrators and comb delays for I and Q.  They wrap freely; only
+    // differences make it out of the combs, and those always fit.
+    uint64_t integ[DECIM_CIC_STAGES][2];
+    uint64_t comb[DECIM_CIC_STAGES][2];
+    float cic_scale;
+
+    // FIR taps for CIC outputs with even and odd timestamps
+    float taps[2][DECIM_FIR_TAPS/2];
+
+    // CIC output waiting on the FIR, split the same way: DECIM_FIR_TAPS/2 - 1
+    // samples of history and then `fill` new ones each (interleaved complex).
+    // An even sample sits in `pending` until its odd partner shows up.
+    float * phase[2];
+    unsigned int fill;
+    unsigned int cap;
+    float pending[2];
+    bool have_pending;
+
+    // The last decim_push()'s output, as float (Q11 scale) and SC16 (Q11
+    // times DECIM_GAIN), and the decimated timestamp of its first sample
+    float * out;
+    int16_t * out_sc16;
+    unsigned int out_cap;
+    uint64_t out_ts;
+
+    // The input timestamp we expect next; anything else starts over
+    uint64_t next_ts;
+};
+
+// factor has to be even and at most DECIM_MAX
+bool decim_init(struct decimator * d, unsigned int factor);
+void decim_free(struct decimator * d);
+
+// Forget all the history, as if nothing had gone in yet
+void decim_reset(struct decimator * d);
+
+// Run count SC16 Q11 samples starting at timestamp ts through, leaving
+// whatever came out in d->out starting at d->out_ts, and return how many that
+// was.  decim_push_sc16() does the same and converts it to d->out_sc16 too,
+// DECIM_GAIN times bigger than Q11 and saturated to the int16 range.
+unsigned int decim_push(struct decimator * d, const int16_t * iq, unsigned int count, uint64_t ts);
+unsigned int decim_push_sc16(struct decimator * d, const int16_t * iq, unsigned int count, uint64_t ts);
+#endif
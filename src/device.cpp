@@ -2,25 +2,27 @@
 #include "device.h"
 #include "options.h"
 #include "util.h"
+#include "sim.h"
 #include <stdlib.h>
+#include <string.h>
 
-struct device_data_struct device_data;
-
-bool open_device(void)
+static int bladerf_backend_open(struct device_data_struct * dd)
 {
     int status;
 
-    // Initialize everything in device_data to zero
-    memset(&device_data, 0, sizeof(struct device_data_struct));
-
-    LOG("Opening and initializing device...\n");
-    status = bladerf_open(&device_data.dev, opts.devstr);
+    status = bladerf_open(&dd->dev, dd->devstr);
     if( status != 0 ) {
         ERROR("Failed to open device: %s\n", bladerf_strerror(status));
         goto out;
     }
 
-    status = bladerf_set_frequency(device_data.dev, BLADERF_MODULE_RX, opts.freq);
+    status = bladerf_get_serial(dd->dev, dd->serial);
+    if( status != 0 ) {
+        ERROR("Failed to get serial number: %s\n", bladerf_strerror(status));
+        goto out;
+    }
+
+    status = bladerf_set_frequency(dd->dev, BLADERF_MODULE_RX, opts.freq);
     if( status != 0 ) {
         ERROR("Failed to set RX frequency %u: %s\n", opts.freq, bladerf_strerror(status));
         goto out;
@@ -30,7 +32,7 @@ bool open_device(void)
         INFO("  RX frequency: %sHz\n", str);
     }
 
-    status = bladerf_set_frequency(device_data.dev, BLADERF_MODULE_TX, opts.freq);
+    status = bladerf_set_frequency(dd->dev, BLADERF_MODULE_TX, opts.freq);
     if( status != 0 ) {
         ERROR("Failed to set TX frequency %u: %s\n", opts.freq, bladerf_strerror(status));
         goto out;
@@ -40,7 +42,7 @@ bool open_device(void)
         INFO("  TX frequency: %sHz\n", str);
     }
 
-    status = bladerf_set_sample_rate(device_data.dev, BLADERF_MODULE_RX, opts.samplerate, NULL);
+    status = bladerf_set_sample_rate(dd->dev, BLADERF_MODULE_RX, opts.samplerate, NULL);
     if( status != 0 ) {
         ERROR("Failed to set RX sample rate: %s\n", bladerf_strerror(status));
         goto out;
@@ -50,7 +52,7 @@ bool open_device(void)
         INFO("  RX samplerate: %ssps\n", str);
     }
 
-    status = bladerf_set_sample_rate(device_data.dev, BLADERF_MODULE_TX, opts.samplerate, NULL);
+    status = bladerf_set_sample_rate(dd->dev, BLADERF_MODULE_TX, opts.samplerate, NULL);
     if( status != 0 ) {
         ERROR("Failed to set TX sample rate: %s\n", bladerf_strerror(status));
         goto out;
@@ -61,7 +63,7 @@ bool open_device(void)
     }
 
     if( !opts.rx_lpf_enabled ) {
-        status = bladerf_set_lpf_mode(device_data.dev, BLADERF_MODULE_RX, BLADERF_LPF_BYPASSED);
+        status = bladerf_set_lpf_mode(dd->dev, BLADERF_MODULE_RX, BLADERF_LPF_BYPASSED);
         if( status != 0 ) {
             ERROR("Failed to bypass RX low pass filter: %s\n", bladerf_strerror(status));
             goto out;
@@ -71,7 +73,7 @@ bool open_device(void)
     }
 
     if( !opts.tx_lpf_enabled ) {
-        status = bladerf_set_lpf_mode(device_data.dev, BLADERF_MODULE_TX, BLADERF_LPF_BYPASSED);
+        status = bladerf_set_lpf_mode(dd->dev, BLADERF_MODULE_TX, BLADERF_LPF_BYPASSED);
         if( status != 0 ) {
             ERROR("Failed to bypass TX low pass filter: %s\n", bladerf_strerror(status));
             goto out;
@@ -80,7 +82,7 @@ bool open_device(void)
         }
     }
 
-    status = bladerf_set_lna_gain(device_data.dev, opts.lna);
+    status = bladerf_set_lna_gain(dd->dev, opts.lna);
     if( status != 0 ) {
         bool ok;
         ERROR("Failed to set LNA gain to %ddB: %s\n", bladerf_lna_gain_to_db(opts.lna, &ok), bladerf_strerror(status));
@@ -90,7 +92,7 @@ bool open_device(void)
         INFO("  LNA Gain: %ddB\n", bladerf_lna_gain_to_db(opts.lna, &ok));
     }
 
-    status = bladerf_set_rxvga1(device_data.dev, opts.rxvga1);
+    status = bladerf_set_rxvga1(dd->dev, opts.rxvga1);
     if( status != 0 ) {
         ERROR("Failed to set RX VGA1 gain: %s\n", bladerf_strerror(status));
         goto out;
@@ -98,7 +100,7 @@ bool open_device(void)
         INFO("  RX VGA1 gain: %ddB\n", opts.rxvga1);
     }
 
-    status = bladerf_set_rxvga2(device_data.dev, opts.rxvga2);
+    status = bladerf_set_rxvga2(dd->dev, opts.rxvga2);
     if( status != 0 ) {
         ERROR("Failed to set RX VGA2 gain: %s\n", bladerf_strerror(status));
         goto out;
@@ -106,7 +108,7 @@ bool open_device(void)
         INFO("  RX VGA2 gain: %ddB\n", opts.rxvga2);
     }
 
-    status = bladerf_set_txvga1(device_data.dev, opts.txvga1);
+    status = bladerf_set_txvga1(dd->dev, opts.txvga1);
     if( status != 0 ) {
         ERROR("Failed to set TX VGA1 gain: %s\n", bladerf_strerror(status));
         goto out;
@@ -114,7 +116,7 @@ bool open_device(void)
         INFO("  TX VGA1 gain: %ddB\n", opts.txvga1);
     }
 
-    status = bladerf_set_txvga2(device_data.dev, opts.txvga2);
+    status = bladerf_set_txvga2(dd->dev, opts.txvga2);
     if( status != 0 ) {
         ERROR("Failed to set TX VGA2 gain: %s\n", bladerf_strerror(status));
         goto out;
@@ -122,66 +124,205 @@ bool open_device(void)
         INFO("  TX VGA2 gain: %ddB\n", opts.txvga2);
     }
 
-    status = bladerf_sync_config(device_data.dev, BLADERF_MODULE_RX,
-                                 BLADERF_FORMAT_SC16_Q11_META, opts.num_buffers,
-                                 opts.buffer_size, opts.num_transfers, opts.timeout_ms);
-    if( status != 0 ) {
-        ERROR("Failed to sync RX config: %s\n", bladerf_strerror(status));
-        goto out;
+    // For --calibrate, TX straight back into RX through the LNA for the band
+    // we're on, the way the RF front end would see an echo.  Otherwise make
+    // sure there's no loopback, in case whoever had the board last left one.
+    {
+        bladerf_loopback lb = BLADERF_LB_NONE;
+        if( opts.rf_loopback )
+            lb = opts.freq >= 1500000000u ? BLADERF_LB_RF_LNA2 : BLADERF_LB_RF_LNA1;
+        status = bladerf_set_loopback(dd->dev, lb);
+        if( status != 0 ) {
+            ERROR("Failed to set loopback: %s\n", bladerf_strerror(status));
+            goto out;
+        } else if( opts.rf_loopback ) {
+            INFO("  Loopback: RF, through LNA%d\n", lb == BLADERF_LB_RF_LNA2 ? 2 : 1);
+        }
     }
 
-    status = bladerf_sync_config(device_data.dev, BLADERF_MODULE_TX,
-                                 BLADERF_FORMAT_SC16_Q11_META, opts.num_buffers,
-                                 opts.buffer_size, opts.num_transfers, opts.timeout_ms);
-    if( status != 0 ) {
-        ERROR("Failed to sync TX config: %s\n", bladerf_strerror(status));
-        goto out;
+    // The async engine sets up its own streams once it knows what it's sending
+    if( !opts.async_stream ) {
+        status = bladerf_sync_config(dd->dev, BLADERF_MODULE_RX,
+                                     BLADERF_FORMAT_SC16_Q11_META, opts.num_buffers,
+                                     opts.buffer_size, opts.num_transfers, opts.timeout_ms);
+        if( status != 0 ) {
+            ERROR("Failed to sync RX config: %s\n", bladerf_strerror(status));
+            goto out;
+        }
+
+        status = bladerf_sync_config(dd->dev, BLADERF_MODULE_TX,
+                                     BLADERF_FORMAT_SC16_Q11_META, opts.num_buffers,
+                                     opts.buffer_size, opts.num_transfers, opts.timeout_ms);
+        if( status != 0 ) {
+            ERROR("Failed to sync TX config: %s\n", bladerf_strerror(status));
+            goto out;
+        }
     }
 
-    status = bladerf_enable_module(device_data.dev, BLADERF_MODULE_RX, true);
+    // Messages are 2KiB over USB 3, 1KiB over USB 2
+    dd->msg_size = bladerf_device_speed(dd->dev) == BLADERF_DEVICE_SPEED_SUPER ? 2048 : 1024;
+
+    status = bladerf_enable_module(dd->dev, BLADERF_MODULE_RX, true);
     if( status != 0 ) {
         ERROR("Failed to enable RX module: %s\n", bladerf_strerror(status));
         goto out;
     }
 
-    status = bladerf_enable_module(device_data.dev, BLADERF_MODULE_TX, true);
+    status = bladerf_enable_module(dd->dev, BLADERF_MODULE_TX, true);
     if( status != 0 ) {
         ERROR("Failed to enable TX module: %s\n", bladerf_strerror(status));
         goto out;
     }
 
-    // Get our next transmission time
-    status = bladerf_get_timestamp(device_data.dev, BLADERF_MODULE_TX, &device_data.next_tx_time);
-    if (status != 0) {
-        ERROR("Failed to get TX timestamp: %s\n", bladerf_strerror(status));
-        goto out;
-    }
-
 out:
     if (status != 0) {
-        bladerf_close(device_data.dev);
-        return false;
+        if( opts.rf_loopback && dd->dev )
+            bladerf_set_loopback(dd->dev, BLADERF_LB_NONE);
+        bladerf_close(dd->dev);
+        dd->dev = NULL;
     }
-    return true;
+    return status;
 }
 
-void close_device(void)
+static void bladerf_backend_close(struct device_data_struct * dd)
 {
     int status = 0;
-    LOG("\nClosing device...");
 
     /* Disable RX module, shutting down our underlying RX stream */
-    status = bladerf_enable_module(device_data.dev, BLADERF_MODULE_RX, false);
+    status = bladerf_enable_module(dd->dev, BLADERF_MODULE_RX, false);
     if (status != 0) {
         ERROR("Failed to disable RX module: %s\n", bladerf_strerror(status));
     }
 
-    status = bladerf_enable_module(device_data.dev, BLADERF_MODULE_TX, false);
+    status = bladerf_enable_module(dd->dev, BLADERF_MODULE_TX, false);
     if (status != 0) {
         ERROR("Failed to disable TX module: %s\n", bladerf_strerror(status));
     }
 
+    // Don't leave the board looping TX into RX for the next one to use it
+    if( opts.rf_loopback ) {
+        status = bladerf_set_loopback(dd->dev, BLADERF_LB_NONE);
+        if( status != 0 ) {
+            ERROR("Failed to turn off loopback: %s\n", bladerf_strerror(status));
+        }
+    }
+
     // Deinitialize and free resources
-    bladerf_close(device_data.dev);
+    bladerf_close(dd->dev);
+    dd->dev = NULL;
+}
+
+static int bladerf_backend_sync_tx(struct device_data_struct * dd, void * samples,
+                                   unsigned int num_samples, struct bladerf_metadata * meta,
+                                   unsigned int timeout_ms)
+{
+    return bladerf_sync_tx(dd->dev, samples, num_samples, meta, timeout_ms);
+}
+
+static int bladerf_backend_sync_rx(struct device_data_struct * dd, void * samples,
+                                   unsigned int num_samples, struct bladerf_metadata * meta,
+                                   unsigned int timeout_ms)
+{
+    return bladerf_sync_rx(dd->dev, samples, num_samples, meta, timeout_ms);
+}
+
+static int bladerf_backend_get_timestamp(struct device_data_struct * dd, bladerf_module module,
+                                         uint64_t * value)
+{
+    return bladerf_get_timestamp(dd->dev, module, value);
+}
+
+static int bladerf_backend_wait_timestamp(struct device_data_struct * dd, bladerf_module module,
+                                          uint64_t ts, unsigned int timeout_ms)
+{
+    uint64_t now;
+    struct timespec start, t;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Sleep for as long as the clock says we have to go, then check again in
+    // case our idea of the sample rate and the board's don't quite agree
+    while( true ) {
+        int status = bladerf_get_timestamp(dd->dev, module, &now);
+        if( status != 0 || now >= ts )
+            return status;
+
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        if( (t.tv_sec - start.tv_sec)*1000 + (t.tv_nsec - start.tv_nsec)/1000000 > timeout_ms )
+            return BLADERF_ERR_TIMEOUT;
+
+        uint64_t ns = (ts - now)*1000000000ULL/opts.samplerate;
+        struct timespec delay = { (time_t)(ns/1000000000ULL), (long)(ns%1000000000ULL) };
+        nanosleep(&delay, NULL);
+    }
+}
+
+static int bladerf_backend_init_stream(struct device_data_struct * dd, struct bladerf_stream ** stream,
+                                       bladerf_stream_cb callback, void *** buffers, size_t num_buffers,
+                                       size_t samples_per_buffer, size_t num_transfers, void * user_data)
+{
+    return bladerf_init_stream(stream, dd->dev, callback, buffers, num_buffers,
+                               BLADERF_FORMAT_SC16_Q11_META, samples_per_buffer, num_transfers,
+                               user_data);
+}
+
+static int bladerf_backend_stream(struct device_data_struct * dd, struct bladerf_stream * stream,
+                                  bladerf_module module)
+{
+    return bladerf_stream(stream, module);
+}
+
+static void bladerf_backend_deinit_stream(struct device_data_struct * dd, struct bladerf_stream * stream)
+{
+    bladerf_deinit_stream(stream);
+}
+
+static const struct device_ops bladerf_ops = {
+    "bladerf",
+    bladerf_backend_open,
+    bladerf_backend_close,
+    bladerf_backend_sync_tx,
+    bladerf_backend_sync_rx,
+    bladerf_backend_get_timestamp,
+    bladerf_backend_wait_timestamp,
+    bladerf_backend_init_stream,
+    bladerf_backend_stream,
+    bladerf_backend_deinit_stream,
+};
+
+bool open_device(struct device_data_struct * dd, const char * devstr)
+{
+    int status;
+
+    // Initialize everything in dd to zero
+    memset(dd, 0, sizeof(struct device_data_struct));
+    dd->devstr = devstr;
+
+    // "sim" or "sim:<params>" selects the simulated radio, anything else is
+    // handed to bladerf_open() as a device identifier
+    if( is_sim_devstr(devstr) )
+        dd->ops = &sim_ops;
+    else
+        dd->ops = &bladerf_ops;
+
+    LOG("Opening and initializing %s device%s%s...\n", dd->ops->name, devstr[0] != '\0' ? " " : "",
+        devstr);
+    status = dd->ops->open(dd);
+    if( status != 0 )
+        return false;
+
+    // Get our next transmission time
+    status = device_get_timestamp(dd, BLADERF_MODULE_TX, &dd->next_tx_time);
+    if (status != 0) {
+        ERROR("Failed to get TX timestamp: %s\n", bladerf_strerror(status));
+        dd->ops->close(dd);
+        return false;
+    }
+    return true;
+}
+
+void close_device(struct device_data_struct * dd)
+{
+    LOG("\nClosing %s device%s%s...", dd->ops->name, dd->devstr[0] != '\0' ? " " : "", dd->devstr);
+    dd->ops->close(dd);
     LOG(".Done!\n");
 }
@@ -1,17 +1,110 @@
+#ifndef DEVICE_H
+#define DEVICE_H
 #include <stdbool.h>
 #include <stdint.h>
 #include <queue>
 #include <time.h>
 #include <pthread.h>
+#include <libbladeRF.h>
+
+struct device_data_struct;
+
+// Everything we ask of a radio goes through one of these, so that we can swap
+// real hardware out for a simulated radio (see sim.cpp).  Return values are
+// libbladeRF status codes in all cases.
+struct device_ops {
+    const char * name;
+    int (*open)(struct device_data_struct * dd);
+    void (*close)(struct device_data_struct * dd);
+    int (*sync_tx)(struct device_data_struct * dd, void * samples, unsigned int num_samples,
+                   struct bladerf_metadata * meta, unsigned int timeout_ms);
+    int (*sync_rx)(struct device_data_struct * dd, void * samples, unsigned int num_samples,
+                   struct bladerf_metadata * meta, unsigned int timeout_ms);
+    int (*get_timestamp)(struct device_data_struct * dd, bladerf_module module, uint64_t * value);
+
+    // Sleep until the device's clock reaches ts
+    int (*wait_timestamp)(struct device_data_struct * dd, bladerf_module module, uint64_t ts,
+                          unsigned int timeout_ms);
+
+    // Asynchronous streaming for the zero-copy engine (see stream.h), with
+    // the same contract as bladerf_init_stream()/bladerf_stream()/
+    // bladerf_deinit_stream(), always in SC16_Q11_META format
+    int (*init_stream)(struct device_data_struct * dd, struct bladerf_stream ** stream,
+                       bladerf_stream_cb callback, void *** buffers, size_t num_buffers,
+                       size_t samples_per_buffer, size_t num_transfers, void * user_data);
+    int (*stream)(struct device_data_struct * dd, struct bladerf_stream * stream, bladerf_module module);
+    void (*deinit_stream)(struct device_data_struct * dd, struct bladerf_stream * stream);
+};
 
 struct device_data_struct {
-    // Our bladeRF context object
+    // Which backend is driving this device, and what it was opened as
+    const struct device_ops * ops;
+    const char * devstr;
+
+    // Our bladeRF context object (NULL for simulated devices)
     struct bladerf *dev;
 
+    // Backend-private state (e.g. the simulated echo channel)
+    void * backend_data;
+
     // The timestamp at which we should try to transmit our next buffer
     uint64_t next_tx_time;
+
+    // Bytes in each message of a metadata stream, header included; depends
+    // on how fast the USB link is
+    unsigned int msg_size;
+
+    // The board's serial number ("sim" for simulated devices)
+    char serial[BLADERF_SERIAL_LENGTH];
 };
-extern struct device_data_struct device_data;
+// Open the device named by devstr (see --device) into dd, which should
+// outlive it being open
+bool open_device(struct device_data_struct * dd, const char * devstr);
+void close_device(struct device_data_struct * dd);
+
+// Thin wrappers so callers don't have to care which backend they're talking to
+static inline int device_sync_tx(struct device_data_struct * dd, void * samples,
+                                 unsigned int num_samples, struct bladerf_metadata * meta,
+                                 unsigned int timeout_ms)
+{
+    return dd->ops->sync_tx(dd, samples, num_samples, meta, timeout_ms);
+}
+
+static inline int device_sync_rx(struct device_data_struct * dd, void * samples,
+                                 unsigned int num_samples, struct bladerf_metadata * meta,
+                                 unsigned int timeout_ms)
+{
+    return dd->ops->sync_rx(dd, samples, num_samples, meta, timeout_ms);
+}
+
+static inline int device_get_timestamp(struct device_data_struct * dd, bladerf_module module,
+                                       uint64_t * value)
+{
+    return dd->ops->get_timestamp(dd, module, value);
+}
+
+static inline int device_wait_timestamp(struct device_data_struct * dd, bladerf_module module,
+                                        uint64_t ts, unsigned int timeout_ms)
+{
+    return dd->ops->wait_timestamp(dd, module, ts, timeout_ms);
+}
+
+static inline int device_init_stream(struct device_data_struct * dd, struct bladerf_stream ** stream,
+                                     bladerf_stream_cb callback, void *** buffers, size_t num_buffers,
+                                     size_t samples_per_buffer, size_t num_transfers, void * user_data)
+{
+    return dd->ops->init_stream(dd, stream, callback, buffers, num_buffers, samples_per_buffer,
+                                num_transfers, user_data);
+}
+
+static inline int device_stream(struct device_data_struct * dd, struct bladerf_stream * stream,
+                                bladerf_module module)
+{
+    return dd->ops->stream(dd, stream, module);
+}
 
-bool open_device(void);
-void close_device(void);
+static inline void device_deinit_stream(struct device_data_struct * dd, struct bladerf_stream * stream)
+{
+    dd->ops->deinit_stream(dd, stream);
+}
+#endif
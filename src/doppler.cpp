@@ -0,0 +1,72 @@
+#include "doppler.h"
+#include "fftplan.h"
+#include "util.h"
+#include "window.h"
+#include <stdlib.h>
+#include <string.h>
+
+bool rd_init(struct range_doppler * rd, unsigned int num_pulses, unsigned int range_bins,
+             const char * window_name, range_doppler_cb callback, void * user_data)
+{
+    memset(rd, 0, sizeof(struct range_doppler));
+    rd->num_pulses = num_pulses;
+    rd->range_bins = range_bins;
+    rd->callback = callback;
+    rd->user_data = user_data;
+
+    rd->cpi = fftwf_alloc_complex((size_t)num_pulses*range_bins);
+    rd->map = fftwf_alloc_complex((size_t)num_pulses*range_bins);
+    if( !rd->cpi || !rd->map )
+        goto fail;
+
+    // Shared out of the window cache, so nothing to free
+    if( window_name ) {
+        rd->window = window_get_f32(window_name, num_pulses);
+        if( !rd->window )
+            goto fail;
+    }
+
+    // Range bin r of pulse p lives at p*range_bins + r, so each slow time
+    // transform strides by a whole row and neighbouring transforms are one
+    // element apart
+    rd->plan = fft_plan_get(num_pulses, FFTW_FORWARD, range_bins, range_bins, 1, false, true);
+    if( !rd->plan )
+        goto fail;
+    return true;
+
+fail:
+    rd_free(rd);
+    return false;
+}
+
+void rd_free(struct range_doppler * rd)
+{
+    fftwf_free(rd->cpi);
+    fftwf_free(rd->map);
+    rd->cpi = NULL;
+    rd->map = NULL;
+    rd->window = NULL;
+}
+
+void rd_push_profile(struct range_doppler * rd, const fftwf_complex * profile,
+                     uint64_t seq, uint64_t ts)
+{
+    if( rd->fill > 0 && seq != rd->next_seq )
+        rd->fill = 0;
+    if( rd->fill == 0 )
+        rd->cpi_ts = ts;
+    rd->next_seq = seq + 1;
+
+    fftwf_complex * row = rd->cpi + (size_t)rd->fill*rd->range_bins;
+    if( rd->window )
+        window_scale(profile, row, rd->window[rd->fill], rd->range_bins);
+    else
+        memcpy(row, profile, sizeof(fftwf_complex)*rd->range_bins);
+
+    if( ++rd->fill == rd->num_pulses ) {
+        fftwf_execute_dft(rd->plan, rd->cpi, rd->map);
+        if( rd->callback )
+            rd->callback(rd, rd->map, rd->cpi_ts, rd->user_data);
+        rd->fill = 0;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef DOPPLER_H
+#define DOPPLER_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <fftw3.h>
+
+struct range_doppler;
+
+// Called with every finished range-Doppler map.  map[d*range_bins + r] is
+// Doppler bin d of range bin r, with d in FFT order: bin 0 is zero velocity
+// and bins num_pulses/2 and up are the negative velocities.  ts is the
+// timestamp of the first pulse in the CPI.
+typedef void (*range_doppler_cb)(struct range_doppler * rd, const fftwf_complex * map,
+                                 uint64_t ts, void * user_data);
+
+// Coherent processing interval: collects num_pulses consecutive range
+// profiles into a matrix with one row per pulse, then transforms every range
+// bin across slow time with one batched FFT.
+struct range_doppler {
+    unsigned int num_pulses;
+    unsigned int range_bins;
+
+    // Slow time window, applied as profiles come in (NULL for none).
+    // Borrowed from the window cache, see window.h
+    const float * window;
+
+    // The CPI we're filling in, and the map it turns into
+    fftwf_complex * cpi;
+    fftwf_complex * map;
+
+    // Borrowed from the plan cache, see fftplan.h
+    fftwf_plan plan;
+
+    // How many pulses are in `cpi`, which pulse we expect next, and the
+    // timestamp of the first one
+    unsigned int fill;
+    uint64_t next_seq;
+    uint64_t cpi_ts;
+
+    range_doppler_cb callback;
+    void * user_data;
+};
+
+// window_name is anything window_valid() accepts, or NULL for no window
+bool rd_init(struct range_doppler * rd, unsigned int num_pulses, unsigned int range_bins,
+             const char * window_name, range_doppler_cb callback, void * user_data);
+void rd_free(struct range_doppler * rd);
+
+// Add the range profile for pulse number seq, which went out at timestamp ts.
+// Pulses have to come in back to back, a missing one starts a new CPI.
+void rd_push_profile(struct range_doppler * rd, const fftwf_complex * profile,
+                     uint64_t seq, uint64_t ts);
+#endif
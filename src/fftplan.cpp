@@ -0,0 +1,137 @@
+#include <libbladeRF.h>
+#include "options.h"
+#include "util.h"
+#include "fftplan.h"
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <map>
+#include <string>
+
+struct plan_key {
+    int n, sign, howmany, stride, dist;
+    bool in_place, aligned;
+
+    bool operator<(const plan_key &o) const {
+        if( n != o.n ) return n < o.n;
+        if( sign != o.sign ) return sign < o.sign;
+        if( howmany != o.howmany ) return howmany < o.howmany;
+        if( stride != o.stride ) return stride < o.stride;
+        if( dist != o.dist ) return dist < o.dist;
+        if( in_place != o.in_place ) return in_place < o.in_place;
+        return aligned < o.aligned;
+    }
+};
+
+// FFTW's planner isn't thread safe, so everything that plans goes through here
+static pthread_mutex_t plan_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<plan_key, fftwf_plan> plans;
+static std::string wisdom_path;
+static unsigned int plan_flags = FFTW_MEASURE;
+static bool new_wisdom = false;
+
+bool str2fftflags(const char * str, unsigned int * flags)
+{
+    if( strcasecmp(str, "estimate") == 0 ) {
+        *flags = FFTW_ESTIMATE;
+    } else if( strcasecmp(str, "measure") == 0 ) {
+        *flags = FFTW_MEASURE;
+    } else if( strcasecmp(str, "patient") == 0 ) {
+        *flags = FFTW_PATIENT;
+    } else if( strcasecmp(str, "exhaustive") == 0 ) {
+        *flags = FFTW_EXHAUSTIVE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+void fft_plans_init(const char * wisdom_file, unsigned int flags)
+{
+    pthread_mutex_lock(&plan_lock);
+    plan_flags = flags;
+    wisdom_path = wisdom_file ? wisdom_file : "";
+    if( !wisdom_path.empty() ) {
+        if( fftwf_import_wisdom_from_filename(wisdom_path.c_str()) ) {
+            INFO("  Loaded FFTW wisdom from %s\n", wisdom_path.c_str());
+        } else {
+            INFO("  No usable FFTW wisdom in %s, planning from scratch\n", wisdom_path.c_str());
+        }
+    }
+    pthread_mutex_unlock(&plan_lock);
+}
+
+void fft_plans_cleanup(void)
+{
+    pthread_mutex_lock(&plan_lock);
+    if( new_wisdom && !wisdom_path.empty() ) {
+        if( fftwf_export_wisdom_to_filename(wisdom_path.c_str()) ) {
+            INFO("Saved FFTW wisdom to %s\n", wisdom_path.c_str());
+        } else {
+            ERROR("Failed to save FFTW wisdom to %s\n", wisdom_path.c_str());
+        }
+    }
+    for( std::map<plan_key, fftwf_plan>::iterator it = plans.begin(); it != plans.end(); ++it )
+        fftwf_destroy_plan(it->second);
+    plans.clear();
+    new_wisdom = false;
+    pthread_mutex_unlock(&plan_lock);
+}
+
+fftwf_plan fft_plan_get(int n, int sign, int howmany, int stride, int dist,
+                        bool in_place, bool aligned)
+{
+    plan_key key = { n, sign, howmany, stride, dist, in_place, aligned };
+
+    pthread_mutex_lock(&plan_lock);
+    std::map<plan_key, fftwf_plan>::iterator it = plans.find(key);
+    if( it != plans.end() ) {
+        fftwf_plan plan = it->second;
+        pthread_mutex_unlock(&plan_lock);
+        return plan;
+    }
+
+    // Plan on scratch buffers so we never trample the caller's data.  If the
+    // wisdom already knows this size, FFTW_WISDOM_ONLY gets it for free.
+    size_t len = (size_t)(howmany - 1)*dist + (size_t)(n - 1)*stride + 1;
+    fftwf_complex * in = fftwf_alloc_complex(len + 1);
+    fftwf_complex * out = in_place ? in : fftwf_alloc_complex(len + 1);
+    fftwf_complex * pin = aligned ? in : in + 1;
+    fftwf_complex * pout = aligned ? out : out + 1;
+    unsigned int flags = aligned ? 0 : FFTW_UNALIGNED;
+
+    double start = now_secs();
+    fftwf_plan plan = fftwf_plan_many_dft(1, &n, howmany, pin, NULL, stride, dist,
+                                          pout, NULL, stride, dist, sign,
+                                          flags | plan_flags | FFTW_WISDOM_ONLY);
+    bool from_wisdom = plan != NULL;
+    if( !plan ) {
+        plan = fftwf_plan_many_dft(1, &n, howmany, pin, NULL, stride, dist,
+                                   pout, NULL, stride, dist, sign, flags | plan_flags);
+        new_wisdom = new_wisdom || plan != NULL;
+    }
+    double elapsed = now_secs() - start;
+
+    if( !in_place )
+        fftwf_free(out);
+    fftwf_free(in);
+
+    if( plan ) {
+        plans[key] = plan;
+        INFO("  Planned %d x %d-point %s FFT in %.3fs%s\n", howmany, n,
+             sign == FFTW_FORWARD ? "forward" : "inverse", elapsed,
+             from_wisdom ? " (from wisdom)" : "");
+    } else {
+        ERROR("Failed to plan %d x %d-point FFT\n", howmany, n);
+    }
+    pthread_mutex_unlock(&plan_lock);
+    return plan;
+}
@@ -0,0 +1,35 @@
+#ifndef FFTPLAN_H
+#define FFTPLAN_H
+#include <stdbool.h>
+#include <fftw3.h>
+
+// Load wisdom from wisdom_file (if non-empty and it exists) and remember the
+// planner flags to make new plans with.  Call before asking for any plans.
+void fft_plans_init(const char * wisdom_file, unsigned int flags);
+
+// Destroy all plans, and save wisdom back out if we learned anything new
+void fft_plans_cleanup(void);
+
+// Get a plan for `howmany` complex transforms of length n, element i of
+// transform j living at i*stride + j*dist (the same on input and output).
+// Plans are made once per distinct layout and shared from then on; run them
+// with fftwf_execute_dft() on your own buffers, which must match the
+// in_place/aligned-ness the plan was asked for.  Safe to call from any thread.
+fftwf_plan fft_plan_get(int n, int sign, int howmany, int stride, int dist,
+                        bool in_place, bool aligned);
+
+// Shorthand for a single contiguous transform
+static inline fftwf_plan fft_plan_1d(int n, int sign, bool in_place, bool aligned)
+{
+    return fft_plan_get(n, sign, 1, 1, n, in_place, aligned);
+}
+
+// Whether a buffer is aligned the way FFTW's SIMD codelets want it
+static inline bool fft_is_aligned(const void * p)
+{
+    return fftwf_alignment_of((float *)p) == 0;
+}
+
+// Parse "estimate", "measure", "patient" or "exhaustive" into FFTW flags
+bool str2fftflags(const char * str, unsigned int * flags);
+#endif
@@ -0,0 +1,74 @@
+#include "gate.h"
+#include "tx.h"
+#include "util.h"
+#include <string.h>
+
+void gate_init(struct range_gate * g, const struct tx_data_struct * tx, unsigned int decimate,
+               uint64_t epoch, uint64_t pri, uint64_t offset, unsigned int len)
+{
+    memset(g, 0, sizeof(struct range_gate));
+    g->tx = tx;
+    g->decimate = decimate;
+    g->epoch = epoch;
+    g->pri = tx ? tx->pri/decimate : pri;
+    g->offset = offset;
+    g->len = len;
+    g->enabled = len <= g->pri;
+}
+
+// When g->burst goes out, false if it hasn't been scheduled yet
+static bool burst_time(struct range_gate * g, uint64_t * b)
+{
+    if( !g->tx ) {
+        *b = g->epoch + g->burst*g->pri;
+        return true;
+    }
+    while( !tx_burst_time(g->tx, g->burst, b) ) {
+        uint64_t have = g->tx->history_count.load(std::memory_order_acquire);
+        if( g->burst >= have )
+            return false;
+
+        // So far behind it's been forgotten; carry on from one that hasn't
+        g->burst = have - TX_HISTORY/2;
+    }
+    *b /= g->decimate;
+    return true;
+}
+
+bool gate_next(struct range_gate * g, uint64_t ts, unsigned int count,
+               unsigned int * skip, unsigned int * n, bool * done)
+{
+    if( count == 0 )
+        return false;
+    if( !g->enabled ) {
+        *skip = 0;
+        *n = count;
+        *done = false;
+        return true;
+    }
+
+    // On a fixed grid we can go straight to the first window not behind us
+    uint64_t reach = g->epoch + g->offset + g->len;
+    if( !g->tx && ts >= reach )
+        g->burst = MAX(g->burst, (ts - reach)/g->pri + 1);
+
+    uint64_t b;
+    while( true ) {
+        if( !burst_time(g, &b) )
+            return false;
+        if( b + g->offset + g->len > ts )
+            break;
+        g->burst++;
+    }
+
+    uint64_t start = b + g->offset;
+    uint64_t end = start + g->len;
+    if( start >= ts + count )
+        return false;
+    uint64_t from = MAX(start, ts);
+    uint64_t to = MIN(end, ts + count);
+    *skip = (unsigned int)(from - ts);
+    *n = (unsigned int)(to - from);
+    *done = to == end;
+    return true;
+}
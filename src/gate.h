@@ -0,0 +1,57 @@
+#ifndef GATE_H
+#define GATE_H
+#include <stdbool.h>
+#include <stdint.h>
+
+struct tx_data_struct;
+
+/*
+ * Range gating: of everything we receive, only what can hold an echo from
+ * between the minimum and maximum range of a burst we actually sent is worth
+ * processing.  For a burst that went out at b, that's the window
+ * [b + offset, b + offset + len), where offset is the minimum range's delay
+ * and len is enough samples to compress a range profile's worth of bins.
+ *
+ * Burst times come from the TX schedule's history (see tx.h), so PRIs that
+ * got skipped don't get processed at all, or without a TX schedule (replay)
+ * from a burst every pri samples starting at epoch.  Everything is in
+ * processing samples, after any decimation.
+ *
+ * The gate only says where windows fall in a block; the samples themselves
+ * are never copied, callers just process that part of the block in place.
+ */
+struct range_gate {
+    // Where bursts come from: tx's history, divided down by decimate, or if
+    // tx is NULL every pri samples starting at epoch
+    const struct tx_data_struct * tx;
+    unsigned int decimate;
+    uint64_t epoch;
+    uint64_t pri;
+
+    uint64_t offset;
+    unsigned int len;
+
+    // Off when windows would run into each other; then everything is in one
+    bool enabled;
+
+    // The earliest burst whose window might not be behind us yet
+    uint64_t burst;
+
+    // Statistics, kept by whoever's feeding samples through
+    uint64_t kept;
+    uint64_t dropped;
+};
+
+void gate_init(struct range_gate * g, const struct tx_data_struct * tx, unsigned int decimate,
+               uint64_t epoch, uint64_t pri, uint64_t offset, unsigned int len);
+
+// Find the first run of the count samples starting at ts that's inside a
+// window: the first *skip of them come before it, and the *n after that are
+// in it.  *done is set when the run goes all the way to the end of its
+// window.  False if none of the samples are in any window we know of.
+//
+// Nothing changes but which bursts are known to be behind ts, so whatever's
+// left of a run can be asked about again later.
+bool gate_next(struct range_gate * g, uint64_t ts, unsigned int count,
+               unsigned int * skip, unsigned int * n, bool * done);
+#endif
@@ -0,0 +1,266 @@
+#include <libbladeRF.h>
+#include "options.h"
+#include "util.h"
+#include "logger.h"
+#include "ring.h"
+#include "metrics.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Must be a power of two
+#define LOG_RING_RECORDS 1024
+
+// How much formatted text we save up before writing it out
+#define LOG_OUT_LEN 8192
+
+/*
+ * A bounded multi-producer queue: slot k is free for the producer that
+ * claims position pos (k = pos % size) once its seq is pos, and ready for
+ * the writer thread once its seq is pos + 1.  The writer hands it back for
+ * the next lap by setting seq to pos + size.
+ */
+static struct log_record log_ring[LOG_RING_RECORDS] __attribute__((aligned(CACHE_LINE_SIZE)));
+static std::atomic<uint64_t> log_head __attribute__((aligned(CACHE_LINE_SIZE)));
+static std::atomic<uint64_t> log_dropped __attribute__((aligned(CACHE_LINE_SIZE)));
+std::atomic<bool> log_running;
+
+static struct {
+    pthread_t thread;
+    std::atomic<bool> stop;
+    bool started;
+
+    // Writer thread only
+    uint64_t tail;
+    uint64_t reported_dropped;
+    char out[LOG_OUT_LEN];
+    size_t out_len;
+
+    // Lines start with when they were logged, relative to this, and how
+    // loudly; messages are free to start or end lines part way through
+    uint64_t start_ns;
+    bool line_start;
+} log_data;
+
+static const char * level_names[] = { "ERROR", "LOG", "INFO" };
+
+struct log_record * log_claim(void)
+{
+    uint64_t pos = log_head.load(std::memory_order_relaxed);
+    while( true ) {
+        struct log_record * rec = &log_ring[pos & (LOG_RING_RECORDS - 1)];
+        int64_t diff = (int64_t)(rec->seq.load(std::memory_order_acquire) - pos);
+        if( diff == 0 ) {
+            if( log_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+                return rec;
+        } else if( diff < 0 ) {
+            // The writer hasn't gotten to this one since last lap
+            log_dropped.fetch_add(1, std::memory_order_relaxed);
+            return NULL;
+        } else {
+            pos = log_head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void log_publish(struct log_record * rec)
+{
+    uint64_t pos = rec->seq.load(std::memory_order_relaxed);
+    rec->seq.store(pos + 1, std::memory_order_release);
+}
+
+static void flush_out(void)
+{
+    if( log_data.out_len > 0 ) {
+        fwrite(log_data.out, 1, log_data.out_len, stderr);
+        log_data.out_len = 0;
+    }
+}
+
+// Any numeric argument, as whatever the format wants it as
+static int64_t arg_int(const struct log_record * rec, unsigned int idx)
+{
+    return rec->types[idx] == LOG_ARG_DOUBLE ? (int64_t)rec->args[idx].d : rec->args[idx].i;
+}
+
+static double arg_double(const struct log_record * rec, unsigned int idx)
+{
+    if( rec->types[idx] == LOG_ARG_DOUBLE )
+        return rec->args[idx].d;
+    return rec->types[idx] == LOG_ARG_UINT ? (double)rec->args[idx].u : (double)rec->args[idx].i;
+}
+
+static void append(const char * spec, bool wide, const struct log_record * rec, unsigned int idx, char conv)
+{
+    char * out = log_data.out + log_data.out_len;
+    size_t room = LOG_OUT_LEN - log_data.out_len;
+    char f[40];
+    int n;
+
+    if( idx >= rec->nargs ) {
+        n = snprintf(out, room, "%s%c", spec, conv);
+    } else {
+        switch( conv ) {
+            // We kept all 64 bits, but without a length modifier the caller
+            // meant an int, which matters for negative numbers and %x
+            case 'd':
+            case 'i':
+                snprintf(f, sizeof(f), "%slld", spec);
+                n = snprintf(out, room, f, wide ? (long long)arg_int(rec, idx) : (int)arg_int(rec, idx));
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                snprintf(f, sizeof(f), "%sll%c", spec, conv);
+                n = snprintf(out, room, f, wide ? (unsigned long long)arg_int(rec, idx)
+                                                : (unsigned int)arg_int(rec, idx));
+                break;
+            case 'c':
+                snprintf(f, sizeof(f), "%sc", spec);
+                n = snprintf(out, room, f, (int)arg_int(rec, idx));
+                break;
+            case 's':
+                snprintf(f, sizeof(f), "%ss", spec);
+                n = snprintf(out, room, f, rec->types[idx] == LOG_ARG_STRING ? rec->text + rec->args[idx].u
+                                                                             : "(?)");
+                break;
+            case 'p':
+                snprintf(f, sizeof(f), "%sp", spec);
+                n = snprintf(out, room, f, rec->args[idx].p);
+                break;
+            default:
+                snprintf(f, sizeof(f), "%s%c", spec, conv);
+                n = snprintf(out, room, f, arg_double(rec, idx));
+                break;
+        }
+    }
+    if( n > 0 )
+        log_data.out_len += MIN((size_t)n, room - 1);
+}
+
+// "[seconds since start] LEVEL: " if we're at the start of a line
+static void prefix(const struct log_record * rec)
+{
+    if( !log_data.line_start )
+        return;
+    uint64_t ns = rec->ns > log_data.start_ns ? rec->ns - log_data.start_ns : 0;
+    int n = snprintf(log_data.out + log_data.out_len, LOG_OUT_LEN - log_data.out_len,
+                     "[%llu.%06llu] %s: ", (unsigned long long)(ns/1000000000ull),
+                     (unsigned long long)(ns/1000%1000000), level_names[rec->level]);
+    if( n > 0 )
+        log_data.out_len += MIN((size_t)n, LOG_OUT_LEN - log_data.out_len - 1);
+    log_data.line_start = false;
+}
+
+// Does the formatting the caller would have done, one conversion at a time
+static void format_record(const struct log_record * rec)
+{
+    // Room for the longest message we'll write without cutting it off
+    if( LOG_OUT_LEN - log_data.out_len < 1024 )
+        flush_out();
+
+    unsigned int idx = 0;
+    for( const char * p = rec->fmt; *p != '\0'; ) {
+        if( *p != '%' || p[1] == '%' ) {
+            if( *p != '\n' )
+                prefix(rec);
+            if( log_data.out_len < LOG_OUT_LEN - 1 )
+                log_data.out[log_data.out_len++] = *p;
+            log_data.line_start = *p == '\n';
+            p += *p == '%' ? 2 : 1;
+            continue;
+        }
+
+        // Flags, width and precision are passed along; length modifiers are
+        // ours to decide
+        char spec[32];
+        size_t len = 0;
+        bool wide = false;
+        spec[len++] = *p++;
+        while( *p != '\0' && strchr("-+ #0123456789.", *p) && len < sizeof(spec) - 1 )
+            spec[len++] = *p++;
+        while( *p != '\0' && strchr("hlLqjzt", *p) )
+            wide |= *p++ != 'h';
+        spec[len] = '\0';
+        if( *p == '\0' )
+            break;
+        prefix(rec);
+        size_t before = log_data.out_len;
+        append(spec, wide, rec, idx++, *p++);
+        if( log_data.out_len > before )
+            log_data.line_start = log_data.out[log_data.out_len - 1] == '\n';
+    }
+}
+
+static void * logger_thread(void * arg)
+{
+    while( true ) {
+        bool stopping = log_data.stop.load(std::memory_order_acquire);
+        unsigned int count = 0;
+        while( true ) {
+            struct log_record * rec = &log_ring[log_data.tail & (LOG_RING_RECORDS - 1)];
+            if( rec->seq.load(std::memory_order_acquire) != log_data.tail + 1 )
+                break;
+            format_record(rec);
+            rec->seq.store(log_data.tail + LOG_RING_RECORDS, std::memory_order_release);
+            log_data.tail++;
+            count++;
+        }
+
+        uint64_t dropped = log_dropped.load(std::memory_order_relaxed);
+        if( dropped != log_data.reported_dropped ) {
+            metric_add(M_LOG_DROPPED, dropped - log_data.reported_dropped);
+            int n = snprintf(log_data.out + log_data.out_len, LOG_OUT_LEN - log_data.out_len,
+                             "\n[%llu log messages dropped]\n",
+                             (unsigned long long)(dropped - log_data.reported_dropped));
+            log_data.out_len += MIN((size_t)n, LOG_OUT_LEN - log_data.out_len - 1);
+            log_data.reported_dropped = dropped;
+            log_data.line_start = true;
+        }
+        flush_out();
+
+        // Checked before draining, so nothing published before stop_logger()
+        // gets left behind
+        if( stopping )
+            break;
+        if( count == 0 )
+            usleep(1000);
+    }
+    return NULL;
+}
+
+bool start_logger(void)
+{
+    for( unsigned int idx=0; idx<LOG_RING_RECORDS; ++idx )
+        log_ring[idx].seq.store(idx, std::memory_order_relaxed);
+    log_head.store(0);
+    log_dropped.store(0);
+    log_data.tail = 0;
+    log_data.reported_dropped = 0;
+    log_data.out_len = 0;
+    log_data.stop = false;
+    log_data.line_start = true;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    log_data.start_ns = (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+
+    if( pthread_create(&log_data.thread, NULL, logger_thread, NULL) != 0 ) {
+        ERROR("Failed to start logging thread, logging straight to stderr\n");
+        return false;
+    }
+    log_data.started = true;
+    log_running.store(true, std::memory_order_release);
+    atexit(stop_logger);
+    return true;
+}
+
+void stop_logger(void)
+{
+    if( !log_data.started )
+        return;
+    log_running.store(false, std::memory_order_release);
+    log_data.stop.store(true, std::memory_order_release);
+    pthread_join(log_data.thread, NULL);
+    log_data.started = false;
+}
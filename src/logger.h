@@ -0,0 +1,139 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <type_traits>
+
+/*
+ * Logging that never makes the caller wait on stderr.
+ *
+ * ERROR()/LOG()/INFO() don't format anything: they copy the format pointer,
+ * a timestamp and the raw arguments into a fixed-size record in a lock-free
+ * ring, and a background thread formats and writes them out.  Each line
+ * starts with when it was logged (seconds since start_logger()) and at what
+ * level, so however long it sat in the ring doesn't blur the timing.  If the
+ * ring is full the message is dropped and counted, never waited for.  Before
+ * start_logger() (and after stop_logger()) messages go straight to stderr.
+ *
+ * Format strings have to outlive the program, which string literals do.
+ * Strings passed as %s arguments are copied, up to what fits in a record.
+ */
+
+enum log_level {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_LOG,
+    LOG_LEVEL_INFO,
+};
+
+enum log_arg_type {
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER,
+};
+
+#define LOG_RECORD_SIZE 256
+#define LOG_MAX_ARGS 12
+#define LOG_TEXT_LEN (LOG_RECORD_SIZE - 40 - 8*LOG_MAX_ARGS)
+
+struct log_record {
+    // Which lap around the ring this slot is on, see logger.cpp
+    std::atomic<uint64_t> seq;
+    uint64_t ns;
+    const char * fmt;
+    uint8_t level;
+    uint8_t nargs;
+    uint8_t types[LOG_MAX_ARGS];
+    uint16_t text_len;
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        const void * p;
+    } args[LOG_MAX_ARGS];
+
+    // Copies of string arguments; their args[] hold offsets into this
+    char text[LOG_TEXT_LEN];
+};
+static_assert(sizeof(struct log_record) == LOG_RECORD_SIZE, "log records should be a fixed size");
+
+extern std::atomic<bool> log_running;
+
+// A free record, or NULL (and one more dropped message) if the ring is full
+struct log_record * log_claim(void);
+void log_publish(struct log_record * rec);
+
+template<typename T>
+static inline void log_pack_arg(struct log_record * rec, unsigned int idx, T v)
+{
+    if constexpr( std::is_floating_point<T>::value ) {
+        rec->types[idx] = LOG_ARG_DOUBLE;
+        rec->args[idx].d = v;
+    } else if constexpr( std::is_same<T, char *>::value || std::is_same<T, const char *>::value ) {
+        // Truncated to fit; once text is full, everything else gets the
+        // empty string at the very end of it
+        const char * s = v ? v : "(null)";
+        size_t room = LOG_TEXT_LEN - rec->text_len;
+        rec->types[idx] = LOG_ARG_STRING;
+        if( room == 0 ) {
+            rec->args[idx].u = LOG_TEXT_LEN - 1;
+            return;
+        }
+        size_t len = strlen(s);
+        if( len > room - 1 )
+            len = room - 1;
+        memcpy(rec->text + rec->text_len, s, len);
+        rec->text[rec->text_len + len] = '\0';
+        rec->args[idx].u = rec->text_len;
+        rec->text_len += len + 1;
+    } else if constexpr( std::is_pointer<T>::value ) {
+        rec->types[idx] = LOG_ARG_POINTER;
+        rec->args[idx].p = (const void *)v;
+    } else if constexpr( std::is_enum<T>::value || std::is_signed<T>::value ) {
+        rec->types[idx] = LOG_ARG_INT;
+        rec->args[idx].i = (int64_t)v;
+    } else {
+        rec->types[idx] = LOG_ARG_UINT;
+        rec->args[idx].u = (uint64_t)v;
+    }
+}
+
+template<typename... Args>
+static inline void log_write(enum log_level level, const char * fmt, Args... args)
+{
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many arguments for one log record");
+    if( !log_running.load(std::memory_order_acquire) ) {
+        fprintf(stderr, fmt, args...);
+        return;
+    }
+    struct log_record * rec = log_claim();
+    if( !rec )
+        return;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    rec->ns = (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+    rec->fmt = fmt;
+    rec->level = level;
+    rec->nargs = sizeof...(Args);
+    rec->text_len = 0;
+    rec->text[LOG_TEXT_LEN - 1] = '\0';
+    unsigned int idx = 0;
+    (log_pack_arg(rec, idx++, args), ...);
+    (void)idx;
+    log_publish(rec);
+}
+
+// Never called, only there so the compiler checks log formats like printf's
+int log_check_format(const char * fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// Start the thread that writes everything out; it's stopped (and whatever's
+// left is flushed) at exit
+bool start_logger(void);
+void stop_logger(void);
+#endif
@@ -3,7 +3,24 @@
 #include "util.h"
 #include "device.h"
 #include "options.h"
+#include "rx.h"
+#include "process.h"
+#include "fftplan.h"
+#include "waveform.h"
+#include "tx.h"
+#include "capture.h"
+#include "replay.h"
+#include "autotune.h"
+#include "calibrate.h"
+#include "sc16.h"
+#include "window.h"
+#include "stream.h"
+#include "metrics.h"
+#include "realtime.h"
+#include "radio.h"
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <time.h>
 #include <unistd.h>
@@ -20,92 +37,81 @@ void sigint_handler(int dummy)
     sigaction(SIGINT, &old_sigint_action, NULL);
 }
 
-void wait_preciousssss() {
-    int status = 0;
+int main(int argc, char ** argv)
+{
+    parse_options(argc, argv);
 
-    // Give ourselves 5ms time to setup the next transmission
-    uint64_t wait_ts = device_data.next_tx_time - 5*opts.samplerate/1000;
-    uint64_t curr_ts = 0;
+    // Get stderr off of everyone else's critical path before anything starts
+    start_logger();
 
-    status = bladerf_get_timestamp(device_data.dev, BLADERF_MODULE_TX, &curr_ts);
-    if( status != 0 ) {
-        ERROR("Failed to get timestamp: %s\n", bladerf_strerror(status));
-        return;
-    }
+    // Before anything big gets allocated, so it all gets locked in
+    rt_init();
 
-    while( curr_ts < wait_ts ) {
-        usleep(1000);
+    if( opts.verbosity > 2 )
+        bladerf_log_set_verbosity(BLADERF_LOG_LEVEL_DEBUG);
 
-        status = bladerf_get_timestamp(device_data.dev, BLADERF_MODULE_TX, &curr_ts);
-        if( status != 0 ) {
-            ERROR("Failed to get timestamp: %s\n", bladerf_strerror(status));
-            return;
-        }
-    }
-}
+    const char * sc16 = sc16_init();
+    if( !sc16 )
+        return 1;
+    INFO("  SC16 conversions: %s\n", sc16);
 
-// We will transmit barker 11 codes lasting time_ms in one burst here
-void transmit_barker11(unsigned int time_ms) {
-    int status = 0;
-    struct bladerf_metadata meta;
-
-    memset(&meta, 0, sizeof(meta));
-
-    /* Send entire burst worth of samples in one function call */
-    meta.flags = BLADERF_META_FLAG_TX_BURST_START |
-                 BLADERF_META_FLAG_TX_NOW |
-                 BLADERF_META_FLAG_TX_BURST_END;
-
-    // Try to schedule this transmission for the next transmission time
-    //meta.timestamp = device_data.next_tx_time;
-
-    unsigned int N = (time_ms*opts.samplerate)/(1000*11);
-    int16_t * buff = (int16_t *)malloc(sizeof(int16_t)*2*N*11);
-
-    // Slam out barker11 datapoints with some gain into the real part of buff
-    for( unsigned int i=0; i<N; ++i ) {
-        buff[22*i +  0] = 2047;
-        buff[22*i +  2] = 2047;
-        buff[22*i +  4] = 2047;
-        buff[22*i +  6] = -2047;
-        buff[22*i +  8] = -2047;
-        buff[22*i + 10] = -2047;
-        buff[22*i + 12] = 2047;
-        buff[22*i + 14] = -2047;
-        buff[22*i + 16] = -2047;
-        buff[22*i + 18] = 2047;
-        buff[22*i + 20] = -2047;
+    // Load up everything we know how to transmit, and tile the one we will
+    // out to a burst
+    if( !waveform_bank_init(opts.signal_dir, opts.waveform, (unsigned int)(opts.burst_ms*opts.samplerate/1000)) )
+        return 1;
+    const struct waveform * wf = waveform_get(opts.waveform);
+    if( !wf ) {
+        ERROR("Unknown waveform \"%s\"\n", opts.waveform);
+        waveform_bank_free();
+        return 1;
     }
 
-    // Hand these samples off to libbladeRF
-    status = bladerf_sync_tx(device_data.dev, buff, N*11, &meta, opts.timeout_ms);
-    if( status != 0 ) {
-        ERROR("TX failed for %d samples: %s\n", N*11, bladerf_strerror(status));
+    // Get all of our FFT planning out of the way before the radio is running,
+    // the processing thread sits idle until RX starts filling its ring
+    fft_plans_init(opts.fft_wisdom, opts.fft_flags);
+
+    // Recordings don't need a radio, or any of the threads that feed off of one
+    if( opts.num_replay > 0 ) {
+        bool ok = run_replay(wf);
+        fft_plans_cleanup();
+        window_cache_cleanup();
+        waveform_bank_free();
+        cleanup_options();
+        return ok ? 0 : 1;
     }
 
-    // Update next_transmission_time, bumping next_tx_time forward if we have
-    // fallen behind somehow
-    uint64_t curr_ts = 0;
-    status = bladerf_get_timestamp(device_data.dev, BLADERF_MODULE_TX, &curr_ts);
-    if( status != 0 ) {
-        ERROR("Could not get timestamp: %s\n", bladerf_strerror(status));
-    } else {
-        if( device_data.next_tx_time < curr_ts )
-            device_data.next_tx_time = curr_ts;
+    // Tuning starts and stops the radio and processing once per trial itself
+    if( opts.autotune_ms > 0 ) {
+        bool ok = run_autotune(wf);
+        fft_plans_cleanup();
+        window_cache_cleanup();
+        waveform_bank_free();
+        cleanup_options();
+        return ok ? 0 : 1;
     }
-    device_data.next_tx_time += N*11;
-}
 
-int main(int argc, char ** argv)
-{
-    parse_options(argc, argv);
-
-    if( opts.verbosity > 2 )
-        bladerf_log_set_verbosity(BLADERF_LOG_LEVEL_DEBUG);
+    // So does calibration, just the once
+    if( opts.calibrate ) {
+        bool ok = run_calibration(wf);
+        fft_plans_cleanup();
+        window_cache_cleanup();
+        waveform_bank_free();
+        cleanup_options();
+        return ok ? 0 : 1;
+    }
 
-    // Open our bladeRF
-    if( !open_device() )
+    // Processing, every radio, and their RX and TX threads
+    if( !start_radios(wf) ) {
+        fft_plans_cleanup();
+        window_cache_cleanup();
+        waveform_bank_free();
+        cleanup_options();
         return 1;
+    }
+
+    // Not being able to watch the radar is no reason not to run it, so this
+    // only complains if it can't start
+    start_metrics();
 
     // Setup SIGINT handler so we can gracefully quit
     struct sigaction act;
@@ -113,11 +119,11 @@ int main(int argc, char ** argv)
     sigaction(SIGINT, &act, &old_sigint_action);
 
     // Keep track of the time
-    timeval tv_start, tv_status, tv;
+    timeval tv_start, tv;
     gettimeofday(&tv_start, NULL);
-    tv_status = tv_start;
 
-    // Begin transmission loop
+    // Every radio transmits and receives on threads of its own, all we have
+    // to do is wait
     while( keep_running ) {
         // Always get current time
         gettimeofday(&tv, NULL);
@@ -128,16 +134,22 @@ int main(int argc, char ** argv)
             break;
         }
 
-        // Otherwise, transmit!
-        printf(".");
-        fflush(stdout);
-        transmit_barker11(10);
-        wait_preciousssss();
+        // A radio we can't receive from or transmit on is no use to anyone
+        if( radios_failed() ) {
+            ERROR("Stopping, a radio has stopped receiving or transmitting\n");
+            break;
+        }
+
+        usleep(10000);
     }
 
     // Stop worker threads
-    close_device();
+    stop_radios();
+    stop_metrics();
+    fft_plans_cleanup();
+    window_cache_cleanup();
+    waveform_bank_free();
     cleanup_options();
-    LOG("Shutdown complete!\n")
+    LOG("\nShutdown complete!\n")
     return 0;
 }
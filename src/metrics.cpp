@@ -0,0 +1,261 @@
+#include <libbladeRF.h>
+#include "options.h"
+#include "util.h"
+#include "metrics.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Threads past this many share one shard
+#define METRICS_MAX_THREADS 64
+
+struct metric_desc {
+    const char * name;
+    const char * help;
+};
+
+static const struct metric_desc counter_descs[] = {
+    { "radar_tx_bursts_total",              "Bursts handed to the radio" },
+    { "radar_tx_late_bursts_total",         "Bursts that missed their slot" },
+    { "radar_tx_skipped_pris_total",        "PRIs skipped to get back on schedule" },
+    { "radar_tx_errors_total",              "TX calls that failed" },
+    { "radar_rx_blocks_total",              "Blocks read from the radio" },
+    { "radar_rx_samples_total",             "Samples read from the radio" },
+    { "radar_rx_ring_overruns_total",       "Blocks dropped because the RX ring was full" },
+    { "radar_rx_device_overruns_total",     "Overruns reported by the radio" },
+    { "radar_rx_discontinuities_total",     "Gaps in RX timestamps" },
+    { "radar_rx_errors_total",              "RX calls that failed" },
+    { "radar_processed_samples_total",      "Samples run through processing" },
+    { "radar_gated_samples_total",          "Samples outside every range gate, never processed" },
+    { "radar_range_profiles_total",         "Range profiles formed" },
+    { "radar_cpis_total",                   "Range-Doppler maps formed" },
+    { "radar_detections_total",             "CFAR detections in range-Doppler maps" },
+    { "radar_processing_stalls_total",      "Times processing held up the RX ring waiting on workers" },
+    { "radar_capture_bytes_total",          "Bytes of IQ written to capture files" },
+    { "radar_capture_errors_total",         "Capture files we had to give up on" },
+    { "radar_log_dropped_total",            "Log messages dropped because the log ring was full" },
+};
+
+static const struct metric_desc gauge_descs[] = {
+    { "radar_rx_ring_fill_blocks",          "Blocks waiting in the RX ring" },
+    { "radar_tx_epoch_samples",             "Device timestamp of the first burst" },
+};
+
+static const struct metric_desc histogram_descs[] = {
+    { "radar_tx_slip_samples",              "How far past its slot a late burst was, in samples" },
+    { "radar_tx_lead_samples",              "How far ahead of the device clock bursts were queued, in samples" },
+    { "radar_tx_queue_ns",                  "Time spent handing each burst to the radio" },
+    { "radar_processing_block_ns",          "CPU time spent processing each RX block" },
+    { "radar_capture_write_ns",             "Time spent on each capture write" },
+};
+
+static_assert(sizeof(counter_descs)/sizeof(counter_descs[0]) == NUM_METRIC_COUNTERS,
+              "every counter needs a name");
+static_assert(sizeof(gauge_descs)/sizeof(gauge_descs[0]) == NUM_METRIC_GAUGES,
+              "every gauge needs a name");
+static_assert(sizeof(histogram_descs)/sizeof(histogram_descs[0]) == NUM_METRIC_HISTOGRAMS,
+              "every histogram needs a name");
+
+std::atomic<int64_t> metric_gauges[NUM_METRIC_GAUGES];
+__thread struct metrics_shard * metrics_local;
+
+// Handed out once each and never taken back, so the publisher can read any
+// shard below num_shards at any time
+static struct metrics_shard shards[METRICS_MAX_THREADS + 1];
+static std::atomic<unsigned int> num_shards;
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool running;
+
+    // What we last told stderr about, to turn totals into rates, and where
+    // we started from for the rate over the whole run
+    uint64_t last_samples;
+    uint64_t last_ns;
+    uint64_t start_samples;
+    uint64_t start_ns;
+} metrics_data = { 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, 0, 0, 0, 0 };
+
+struct metrics_shard * metrics_attach(void)
+{
+    unsigned int idx = num_shards.fetch_add(1);
+    if( idx < METRICS_MAX_THREADS ) {
+        metrics_local = &shards[idx];
+    } else {
+        num_shards.store(METRICS_MAX_THREADS);
+        metrics_local = &shards[METRICS_MAX_THREADS];
+        metrics_local->shared = true;
+    }
+    return metrics_local;
+}
+
+uint64_t metrics_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+uint64_t metric_total(enum metric_counter c)
+{
+    uint64_t total = 0;
+    unsigned int n = MIN(num_shards.load(), (unsigned int)METRICS_MAX_THREADS);
+    for( unsigned int idx=0; idx<n; ++idx )
+        total += shards[idx].counters[c].load(std::memory_order_relaxed);
+    return total + shards[METRICS_MAX_THREADS].counters[c].load(std::memory_order_relaxed);
+}
+
+// Every shard that's been handed out, plus the overflow one
+static void histogram_total(enum metric_histogram h, uint64_t * buckets, uint64_t * count, uint64_t * sum)
+{
+    unsigned int n = MIN(num_shards.load(), (unsigned int)METRICS_MAX_THREADS);
+    memset(buckets, 0, sizeof(uint64_t)*METRIC_BUCKETS);
+    *count = 0;
+    *sum = 0;
+    for( unsigned int idx=0; idx<=n; ++idx ) {
+        const struct metric_histogram_shard * hs =
+            &shards[idx == n ? METRICS_MAX_THREADS : idx].histograms[h];
+        for( unsigned int b=0; b<METRIC_BUCKETS; ++b )
+            buckets[b] += hs->buckets[b].load(std::memory_order_relaxed);
+        *count += hs->count.load(std::memory_order_relaxed);
+        *sum += hs->sum.load(std::memory_order_relaxed);
+    }
+}
+
+void metric_histogram_totals(enum metric_histogram h, uint64_t * count, uint64_t * sum)
+{
+    uint64_t buckets[METRIC_BUCKETS];
+    histogram_total(h, buckets, count, sum);
+}
+
+static bool publish_file(const char * path)
+{
+    size_t len = strlen(path);
+    char * tmp = (char *)malloc(len + 5);
+    sprintf(tmp, "%s.tmp", path);
+    FILE * f = fopen(tmp, "w");
+    if( !f ) {
+        free(tmp);
+        return false;
+    }
+
+    for( unsigned int c=0; c<NUM_METRIC_COUNTERS; ++c ) {
+        fprintf(f, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_descs[c].name,
+                counter_descs[c].help, counter_descs[c].name, counter_descs[c].name,
+                (unsigned long long)metric_total((enum metric_counter)c));
+    }
+    for( unsigned int g=0; g<NUM_METRIC_GAUGES; ++g ) {
+        fprintf(f, "# HELP %s %s\n# TYPE %s gauge\n%s %lld\n", gauge_descs[g].name,
+                gauge_descs[g].help, gauge_descs[g].name, gauge_descs[g].name,
+                (long long)metric_gauges[g].load(std::memory_order_relaxed));
+    }
+    for( unsigned int h=0; h<NUM_METRIC_HISTOGRAMS; ++h ) {
+        const char * name = histogram_descs[h].name;
+        uint64_t buckets[METRIC_BUCKETS], count, sum, cumulative = 0;
+        histogram_total((enum metric_histogram)h, buckets, &count, &sum);
+        fprintf(f, "# HELP %s %s\n# TYPE %s histogram\n", name, histogram_descs[h].help, name);
+        // Bucket b tops out at 2^b - 1, which is what le has to say, since
+        // 2^b itself is in the next one up.  The last bucket also has
+        // everything too big for it, so it's +Inf.
+        for( unsigned int b=0; b<METRIC_BUCKETS - 1; ++b ) {
+            cumulative += buckets[b];
+            fprintf(f, "%s_bucket{le=\"%llu\"} %llu\n", name, (1ull << b) - 1,
+                    (unsigned long long)cumulative);
+        }
+        fprintf(f, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %llu\n%s_count %llu\n", name,
+                (unsigned long long)count, name, (unsigned long long)sum, name,
+                (unsigned long long)count);
+    }
+
+    bool ok = fclose(f) == 0 && rename(tmp, path) == 0;
+    free(tmp);
+    return ok;
+}
+
+// The last one, once the radios have stopped, gives the rate over the whole
+// run instead of since the one before (which would be cut short)
+static void publish_status(bool last)
+{
+    uint64_t now = metrics_now_ns();
+    uint64_t samples = metric_total(M_RX_SAMPLES);
+    uint64_t since_ns = last ? metrics_data.start_ns : metrics_data.last_ns;
+    uint64_t since_samples = last ? metrics_data.start_samples : metrics_data.last_samples;
+    double secs = (now - since_ns)*1e-9;
+    double rate = secs > 0 ? (samples - since_samples)/secs : 0;
+    metrics_data.last_ns = now;
+    metrics_data.last_samples = samples;
+
+    LOG("\nTX %llu bursts, %llu late, %llu PRIs skipped | RX %.2f MS/s%s, ring %lld, "
+        "%llu ring + %llu device overruns | %llu CPIs, %llu detections",
+        (unsigned long long)metric_total(M_TX_BURSTS), (unsigned long long)metric_total(M_TX_LATE_BURSTS),
+        (unsigned long long)metric_total(M_TX_SKIPPED_PRIS), rate/1e6, last ? " overall" : "",
+        (long long)metric_gauges[M_RX_RING_FILL].load(std::memory_order_relaxed),
+        (unsigned long long)metric_total(M_RX_RING_OVERRUNS),
+        (unsigned long long)metric_total(M_RX_DEVICE_OVERRUNS),
+        (unsigned long long)metric_total(M_PROC_CPIS), (unsigned long long)metric_total(M_PROC_DETECTIONS));
+}
+
+static void * metrics_thread(void * arg)
+{
+    bool warned = false;
+    pthread_mutex_lock(&metrics_data.lock);
+    while( metrics_data.running ) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t ns = deadline.tv_nsec + (uint64_t)(opts.metrics_interval_ms*1e6);
+        deadline.tv_sec += ns/1000000000ull;
+        deadline.tv_nsec = ns%1000000000ull;
+        while( metrics_data.running &&
+               pthread_cond_timedwait(&metrics_data.wake, &metrics_data.lock, &deadline) != ETIMEDOUT )
+            ;
+        bool last = !metrics_data.running;
+        pthread_mutex_unlock(&metrics_data.lock);
+
+        if( opts.metrics[0] != '\0' && !publish_file(opts.metrics) && !warned ) {
+            ERROR("Couldn't write metrics to %s: %s\n", opts.metrics, strerror(errno));
+            warned = true;
+        }
+        publish_status(last);
+        pthread_mutex_lock(&metrics_data.lock);
+    }
+    pthread_mutex_unlock(&metrics_data.lock);
+    return NULL;
+}
+
+void start_metrics(void)
+{
+    if( opts.metrics[0] == '\0' && opts.verbosity == 0 )
+        return;
+
+    metrics_data.running = true;
+    metrics_data.start_ns = metrics_data.last_ns = metrics_now_ns();
+    metrics_data.start_samples = metrics_data.last_samples = metric_total(M_RX_SAMPLES);
+    if( pthread_create(&metrics_data.thread, NULL, metrics_thread, NULL) != 0 ) {
+        ERROR("Failed to start metrics thread\n");
+        metrics_data.running = false;
+        return;
+    }
+    if( opts.metrics[0] != '\0' ) {
+        LOG("Publishing metrics to %s every %gms\n", opts.metrics, opts.metrics_interval_ms);
+    }
+}
+
+void stop_metrics(void)
+{
+    pthread_mutex_lock(&metrics_data.lock);
+    bool running = metrics_data.running;
+    metrics_data.running = false;
+    pthread_cond_signal(&metrics_data.wake);
+    pthread_mutex_unlock(&metrics_data.lock);
+    if( !running )
+        return;
+    pthread_join(metrics_data.thread, NULL);
+
+    // One last time, so whatever scrapes us sees how the run ended
+    if( opts.metrics[0] != '\0' )
+        publish_file(opts.metrics);
+}
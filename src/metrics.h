@@ -0,0 +1,141 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <atomic>
+
+/*
+ * Runtime metrics, for watching a running radar from the outside.
+ *
+ * Every thread that touches a counter or histogram gets its own shard of
+ * them, so updating one is a plain load and store to memory nobody else
+ * writes: no locks, no locked instructions and no syscalls.  A background
+ * thread adds the shards up every so often and writes them out in the
+ * Prometheus text format (to <file>.tmp, then renamed over <file>, so
+ * node_exporter's textfile collector never sees half a file).
+ */
+
+enum metric_counter {
+    M_TX_BURSTS,
+    M_TX_LATE_BURSTS,
+    M_TX_SKIPPED_PRIS,
+    M_TX_ERRORS,
+    M_RX_BLOCKS,
+    M_RX_SAMPLES,
+    M_RX_RING_OVERRUNS,
+    M_RX_DEVICE_OVERRUNS,
+    M_RX_DISCONTINUITIES,
+    M_RX_ERRORS,
+    M_PROC_SAMPLES,
+    M_PROC_GATED,
+    M_PROC_PROFILES,
+    M_PROC_CPIS,
+    M_PROC_DETECTIONS,
+    M_PROC_STALLS,
+    M_CAPTURE_BYTES,
+    M_CAPTURE_ERRORS,
+    M_LOG_DROPPED,
+    NUM_METRIC_COUNTERS
+};
+
+// Last value wins; these are set from one place each
+enum metric_gauge {
+    M_RX_RING_FILL,
+    M_TX_EPOCH,
+    NUM_METRIC_GAUGES
+};
+
+// Power of two buckets: bucket k counts values below 2^k
+enum metric_histogram {
+    // How far past its slot (in samples) a late burst was when we noticed
+    M_TX_SLIP_SAMPLES,
+    // How far ahead of the device clock (in samples) each burst got queued
+    M_TX_LEAD_SAMPLES,
+    // Wall clock time spent in sync_tx per burst
+    M_TX_QUEUE_NS,
+    // CPU time spent processing each RX block
+    M_PROC_BLOCK_NS,
+    // Wall clock time spent writing each run of captured blocks
+    M_CAPTURE_WRITE_NS,
+    NUM_METRIC_HISTOGRAMS
+};
+
+#define METRIC_BUCKETS 48
+
+struct metric_histogram_shard {
+    std::atomic<uint64_t> buckets[METRIC_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+};
+
+struct metrics_shard {
+    std::atomic<uint64_t> counters[NUM_METRIC_COUNTERS];
+    struct metric_histogram_shard histograms[NUM_METRIC_HISTOGRAMS];
+
+    // The overflow shard, for threads past METRICS_MAX_THREADS, is shared
+    // and has to use atomic read-modify-writes instead
+    bool shared;
+};
+
+extern std::atomic<int64_t> metric_gauges[NUM_METRIC_GAUGES];
+extern __thread struct metrics_shard * metrics_local;
+
+// Find (or make) this thread's shard; only ever slow the first time
+struct metrics_shard * metrics_attach(void);
+
+static inline struct metrics_shard * metrics_shard(void)
+{
+    struct metrics_shard * shard = metrics_local;
+    return shard ? shard : metrics_attach();
+}
+
+static inline void metrics_bump(std::atomic<uint64_t> * v, uint64_t n, bool shared)
+{
+    if( shared )
+        v->fetch_add(n, std::memory_order_relaxed);
+    else
+        v->store(v->load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static inline void metric_add(enum metric_counter c, uint64_t n)
+{
+    struct metrics_shard * shard = metrics_shard();
+    metrics_bump(&shard->counters[c], n, shard->shared);
+}
+
+static inline void metric_inc(enum metric_counter c)
+{
+    metric_add(c, 1);
+}
+
+static inline void metric_set(enum metric_gauge g, int64_t v)
+{
+    metric_gauges[g].store(v, std::memory_order_relaxed);
+}
+
+static inline void metric_observe(enum metric_histogram h, uint64_t v)
+{
+    struct metrics_shard * shard = metrics_shard();
+    struct metric_histogram_shard * hs = &shard->histograms[h];
+    unsigned int bucket = v == 0 ? 0 : 64 - __builtin_clzll(v);
+    if( bucket >= METRIC_BUCKETS )
+        bucket = METRIC_BUCKETS - 1;
+    metrics_bump(&hs->buckets[bucket], 1, shard->shared);
+    metrics_bump(&hs->count, 1, shard->shared);
+    metrics_bump(&hs->sum, v, shard->shared);
+}
+
+// Monotonic wall clock in nanoseconds, for timing things (vDSO, no syscall)
+uint64_t metrics_now_ns(void);
+
+// Start publishing to opts.metrics every opts.metrics_interval_ms, and/or a
+// one line summary to stderr at that rate if we're being verbose
+void start_metrics(void);
+void stop_metrics(void);
+
+// Total of a counter over every thread, for anyone who wants it in-process
+uint64_t metric_total(enum metric_counter c);
+
+// Same for how many values a histogram has seen, and what they added up to
+void metric_histogram_totals(enum metric_histogram h, uint64_t * count, uint64_t * sum);
+#endif
@@ -2,12 +2,22 @@
 #include "options.h"
 #include "util.h"
 #include "conversions.h"
+#include "fftplan.h"
+#include "cfar.h"
+#include "window.h"
+#include "autotune.h"
+#include "realtime.h"
+#include "radio.h"
+#include "decimate.h"
+#include "calibrate.h"
 #include <libbladeRF.h>
 #include <getopt.h>
 #include <fcntl.h>
 #include <string.h>
+#include <strings.h>
 #include <math.h>
 #include <limits.h>
+#include <unistd.h>
 
 // Instantiate our options struct
 struct opts_struct opts;
@@ -44,9 +54,122 @@ void usage()
     printf("                             as symbolic (min, max).  [default: min]\n");
     printf("  -R --rx-lpf                Enable RX LPF [default: disabled]\n");
     printf("  -T --tx-lpf                Enable TX LPF [default: disabled]\n");
-    printf("  -d --device=<d>            Device identifier [default: ]\n");
+    printf("  -d --device=<d>            Device identifier, repeat to run up to %d radios at once\n", MAX_RADIOS);
+    printf("                             [default: ]\n");
+    printf("                             \"sim[:<params>]\" selects a simulated radio with params\n");
+    printf("                             delay=<samples>, atten=<dB>, noise=<dBFS>, freerun\n");
+    printf("  --align-timestamps         Measure how far apart each device's clock is and transmit\n");
+    printf("                             on every one at once; for devices sharing a reference\n");
+    printf("                             clock and trigger [default: disabled]\n");
+    printf("  -s --signal-dir=<dir>      Directory to load .sc16 waveforms from [default: signal]\n");
+    printf("  -W --waveform=<name>       Waveform to transmit, a file from the signal directory or\n");
+    printf("                             barker<n> (n = 2, 3, 4, 5, 7, 11, 13), frank<n> (n square),\n");
+    printf("                             p3_<n>, p4_<n> or lfm<n>[_bt<bt>] (bt defaults to n/2),\n");
+    printf("                             optionally followed by x<spc> for spc samples per chip\n");
+    printf("                             [default: barker11]\n");
+    printf("  --burst=<t>                Length of each transmitted burst [default: 10ms]\n");
+    printf("  --pri=<t>                  Pulse repetition interval, from the start of one burst\n");
+    printf("                             to the start of the next [default: 10ms]\n");
+    printf("  --tx-lead=<t>              How far ahead of the radio to queue bursts [default: 5ms]\n");
+    printf("  --decimate=<n>             Decimate RX samples by n (1, or even up to %d) with a CIC\n", DECIM_MAX);
+    printf("                             and compensating FIR before processing them; range bins\n");
+    printf("                             are n samples apart then [default: 1]\n");
+    printf("  --range-bins=<n>           Number of range bins per range profile [default: 1024]\n");
+    printf("  --range=<min>:<max>        Only process echoes from between min and max (in m or km)\n");
+    printf("                             after each burst, which sets the number of range bins\n");
+    printf("                             [default: from 0 out to --range-bins]\n");
+    printf("  --range-window=<w>         Window to taper the reference code with, see below [default: rect]\n");
+    printf("  --cpi=<n>                  Number of pulses per range-Doppler map [default: 64]\n");
+    printf("  --doppler-window=<w>       Slow time window, see below [default: hann]\n");
+    printf("  --cfar=<m>                 CFAR detector, one of (ca, os) [default: ca]\n");
+    printf("  --cfar-guard=<n>           Guard cells on each side of the cell under test [default: 2]\n");
+    printf("  --cfar-train=<n>           Training cells on each side past the guard cells [default: 8]\n");
+    printf("  --cfar-pfa=<p>             Probability of false alarm per cell [default: 1e-6]\n");
+    printf("  --stream=<mode>            How to move samples to and from the radio, one of (sync,\n");
+    printf("                             async); async is zero-copy [default: sync]\n");
+    printf("  --num-buffers=<n>          Sample buffers queued up in each direction (sync only)\n");
+    printf("                             [default: tuned, or 32]\n");
+    printf("  --buffer-size=<n>          Samples in each buffer, a multiple of 1024 [default: tuned,\n");
+    printf("                             or 8192]\n");
+    printf("  --num-transfers=<n>        USB transfers in flight, fewer than --num-buffers\n");
+    printf("                             [default: tuned, or 8]\n");
+    printf("  --timeout=<t>              How long to wait on any one transfer [default: 1s]\n");
+    printf("  --autotune[=<t>]           Try buffer settings for this device and sample rate for <t>\n");
+    printf("                             each, and save the best to the --tuning file [default: 500ms]\n");
+    printf("  --tuning=<file>            Where --autotune results are kept [default: ~/.radar_tuning]\n");
+    printf("  --calibrate[=<lb>]         Measure the delay from TX to RX timestamps at the lowest\n");
+    printf("                             TX gain, looped back inside the device (rf) or through an\n");
+    printf("                             attenuated cable (cable), and save it to the --calibration\n");
+    printf("                             file for later runs to measure range from [default: rf]\n");
+    printf("  --calibration=<file>       Where --calibrate results are kept\n");
+    printf("                             [default: ~/.radar_calibration]\n");
+    printf("  --workers=<n>              Threads to process pulses and CPIs on [default: one per core]\n");
+    printf("  --realtime                 Lock memory, use hugepages for sample buffers, and run TX,\n");
+    printf("                             RX and processing threads SCHED_FIFO [default: disabled]\n");
+    printf("  --tx-cpus=<cpus>           With --realtime, CPUs to run TX on (ex: \"2\" or \"2,3\")\n");
+    printf("                             [default: ]\n");
+    printf("  --rx-cpus=<cpus>           With --realtime, CPUs to run RX on [default: ]\n");
+    printf("  --worker-cpus=<cpus>       With --realtime, CPUs to process on, one per worker\n");
+    printf("                             (ex: \"4-7\") [default: ]\n");
+    printf("  --capture=<path>           Record received samples to <path>.NNNN.sc16, with metadata\n");
+    printf("                             in <path>.NNNN.meta [default: ]\n");
+    printf("  --capture-size=<bytes>     Start a new capture file after this many bytes [default: 1G]\n");
+    printf("  --capture-time=<t>         Start a new capture file after this long [default: 0]\n");
+    printf("  --metrics=<file>           Publish runtime metrics to <file> in Prometheus text format,\n");
+    printf("                             for node_exporter's textfile collector [default: ]\n");
+    printf("  --metrics-interval=<t>     How often to publish metrics (and, with -v, print a status\n");
+    printf("                             line) [default: 1s]\n");
+    printf("  --replay=<file>            Process a recorded .sc16 file as fast as possible instead of\n");
+    printf("                             running the radio (can be repeated)\n");
+    printf("  --fft-wisdom=<file>        Load FFTW wisdom from and save it to <file> [default: ]\n");
+    printf("  --fft-planner=<p>          FFTW planner effort, one of (estimate, measure, patient,\n");
+    printf("                             exhaustive) [default: measure]\n");
+    printf("\n");
+    printf("Windows:\n");
+    printf("  rect, hann, hamming, blackman-harris, kaiser[:beta] (beta defaults to 8.6),\n");
+    printf("  taylor[:sll[:nbar]] (sidelobes sll dB down, nbar - 1 terms, defaults to 30:4)\n");
 }
 
+// Values for options that only have a long form
+enum {
+    OPT_RANGE_BINS = 0x100,
+    OPT_BURST,
+    OPT_PRI,
+    OPT_TX_LEAD,
+    OPT_FFT_WISDOM,
+    OPT_FFT_PLANNER,
+    OPT_CPI,
+    OPT_DOPPLER_WINDOW,
+    OPT_RANGE_WINDOW,
+    OPT_CFAR,
+    OPT_CFAR_GUARD,
+    OPT_CFAR_TRAIN,
+    OPT_CFAR_PFA,
+    OPT_WORKERS,
+    OPT_CAPTURE,
+    OPT_CAPTURE_SIZE,
+    OPT_CAPTURE_TIME,
+    OPT_REPLAY,
+    OPT_METRICS,
+    OPT_METRICS_INTERVAL,
+    OPT_STREAM,
+    OPT_NUM_BUFFERS,
+    OPT_BUFFER_SIZE,
+    OPT_NUM_TRANSFERS,
+    OPT_TIMEOUT,
+    OPT_AUTOTUNE,
+    OPT_TUNING,
+    OPT_REALTIME,
+    OPT_TX_CPUS,
+    OPT_RX_CPUS,
+    OPT_WORKER_CPUS,
+    OPT_ALIGN_TIMESTAMPS,
+    OPT_DECIMATE,
+    OPT_RANGE,
+    OPT_CALIBRATE,
+    OPT_CALIBRATION,
+};
+
 static const struct option longopts[] = {
     { "help",               no_argument,        0, 'h' },
     { "version",            no_argument,        0, 'V' },
@@ -62,19 +185,60 @@ static const struct option longopts[] = {
     { "rx-lpf",             no_argument,        0, 'R' },
     { "tx-lpf",             no_argument,        0, 'T' },
     { "device",             required_argument,  0, 'd' },
+    { "signal-dir",         required_argument,  0, 's' },
+    { "waveform",           required_argument,  0, 'W' },
+    { "burst",              required_argument,  0, OPT_BURST },
+    { "pri",                required_argument,  0, OPT_PRI },
+    { "tx-lead",            required_argument,  0, OPT_TX_LEAD },
+    { "decimate",           required_argument,  0, OPT_DECIMATE },
+    { "range-bins",         required_argument,  0, OPT_RANGE_BINS },
+    { "range",              required_argument,  0, OPT_RANGE },
+    { "fft-wisdom",         required_argument,  0, OPT_FFT_WISDOM },
+    { "fft-planner",        required_argument,  0, OPT_FFT_PLANNER },
+    { "cpi",                required_argument,  0, OPT_CPI },
+    { "doppler-window",     required_argument,  0, OPT_DOPPLER_WINDOW },
+    { "range-window",       required_argument,  0, OPT_RANGE_WINDOW },
+    { "cfar",               required_argument,  0, OPT_CFAR },
+    { "cfar-guard",         required_argument,  0, OPT_CFAR_GUARD },
+    { "cfar-train",         required_argument,  0, OPT_CFAR_TRAIN },
+    { "cfar-pfa",           required_argument,  0, OPT_CFAR_PFA },
+    { "stream",             required_argument,  0, OPT_STREAM },
+    { "num-buffers",        required_argument,  0, OPT_NUM_BUFFERS },
+    { "buffer-size",        required_argument,  0, OPT_BUFFER_SIZE },
+    { "num-transfers",      required_argument,  0, OPT_NUM_TRANSFERS },
+    { "timeout",            required_argument,  0, OPT_TIMEOUT },
+    { "autotune",           optional_argument,  0, OPT_AUTOTUNE },
+    { "tuning",             required_argument,  0, OPT_TUNING },
+    { "calibrate",          optional_argument,  0, OPT_CALIBRATE },
+    { "calibration",        required_argument,  0, OPT_CALIBRATION },
+    { "workers",            required_argument,  0, OPT_WORKERS },
+    { "realtime",           no_argument,        0, OPT_REALTIME },
+    { "tx-cpus",            required_argument,  0, OPT_TX_CPUS },
+    { "rx-cpus",            required_argument,  0, OPT_RX_CPUS },
+    { "worker-cpus",        required_argument,  0, OPT_WORKER_CPUS },
+    { "align-timestamps",   no_argument,        0, OPT_ALIGN_TIMESTAMPS },
+    { "capture",            required_argument,  0, OPT_CAPTURE },
+    { "capture-size",       required_argument,  0, OPT_CAPTURE_SIZE },
+    { "capture-time",       required_argument,  0, OPT_CAPTURE_TIME },
+    { "replay",             required_argument,  0, OPT_REPLAY },
+    { "metrics",            required_argument,  0, OPT_METRICS },
+    { "metrics-interval",   required_argument,  0, OPT_METRICS_INTERVAL },
     { 0,                    0,                  0,  0  },
 };
 
 
 // Macro to set default values that are initialized to zero
 #define DEFAULT(field, val) if( field == 0 ) { field = val; }
-#define OPTSTR "hvVRTe:f:b:g:o:w:q:r:d:"
+#define OPTSTR "hvVRTe:f:b:g:o:w:q:r:d:s:W:"
 
 void parse_options(int argc, char ** argv)
 {
     // First thing we do is initialize the entire opts struct to zero
     memset(&opts, sizeof(opts), 0);
 
+    // Zero is a perfectly good value for these, so they can't use DEFAULT()
+    opts.cfar_guard = 2;
+
     // Declare some temporary variables
     bool ok;
 
@@ -187,7 +351,265 @@ void parse_options(int argc, char ** argv)
                 opts.tx_lpf_enabled = true;
                 break;
             case 'd':
-                opts.devstr = strdup(optarg);
+                if( opts.num_devices == MAX_RADIOS ) {
+                    ERROR("Too many devices, at most %d can be used at once\n", MAX_RADIOS);
+                    exit(1);
+                }
+                opts.devstrs = (char **)realloc(opts.devstrs, sizeof(char *)*(opts.num_devices + 1));
+                opts.devstrs[opts.num_devices++] = strdup(optarg);
+                break;
+            case 's':
+                free(opts.signal_dir);
+                opts.signal_dir = strdup(optarg);
+                break;
+            case 'W':
+                free(opts.waveform);
+                opts.waveform = strdup(optarg);
+                break;
+            case OPT_BURST:
+            case OPT_PRI:
+            case OPT_TX_LEAD:
+            case OPT_CAPTURE_TIME:
+            case OPT_METRICS_INTERVAL: {
+                double ms = str2dbl_suffix(optarg, 0.001, 60000, time_suffixes,
+                                           NUM_TIME_SUFFIXES, &ok);
+                if( !ok ) {
+                    ERROR("Invalid time \"%s\"\n", optarg);
+                    ERROR("Valid values given in milliseconds (ex: \"0.5\")\n");
+                    ERROR("or, equivalently, with units: (ex: \"500ms\" or \"0.5s\")\n");
+                    exit(1);
+                }
+                if( c == OPT_BURST )
+                    opts.burst_ms = ms;
+                else if( c == OPT_PRI )
+                    opts.pri_ms = ms;
+                else if( c == OPT_TX_LEAD )
+                    opts.tx_lead_ms = ms;
+                else if( c == OPT_CAPTURE_TIME )
+                    opts.capture_time_ms = ms;
+                else
+                    opts.metrics_interval_ms = ms;
+            }   break;
+            case OPT_RANGE_BINS:
+                opts.range_bins = str2uint(optarg, 1, 1 << 20, &ok);
+                if( !ok ) {
+                    ERROR("Invalid number of range bins \"%s\"\n", optarg);
+                    ERROR("Valid range: [1, %u]\n", 1 << 20);
+                    exit(1);
+                }
+                break;
+            case OPT_RANGE: {
+                char * min = strdup(optarg);
+                char * max = strchr(min, ':');
+                if( max ) {
+                    *max++ = '\0';
+                    opts.min_range = str2dbl_suffix(min, 0, 1e9, distance_suffixes, NUM_DISTANCE_SUFFIXES, &ok);
+                    if( ok )
+                        opts.max_range = str2dbl_suffix(max, 0, 1e9, distance_suffixes, NUM_DISTANCE_SUFFIXES, &ok);
+                }
+                free(min);
+                if( !max || !ok || opts.max_range <= opts.min_range ) {
+                    ERROR("Invalid range \"%s\"\n", optarg);
+                    ERROR("Give it as <min>:<max>, e.g. 500:3km\n");
+                    exit(1);
+                }
+            }   break;
+            case OPT_DECIMATE:
+                opts.decimate = str2uint(optarg, 1, DECIM_MAX, &ok);
+                if( !ok || (opts.decimate > 1 && opts.decimate % 2 != 0) ) {
+                    ERROR("Invalid decimation \"%s\"\n", optarg);
+                    ERROR("Valid values: 1, or even numbers up to %u\n", DECIM_MAX);
+                    exit(1);
+                }
+                break;
+            case OPT_FFT_WISDOM:
+                free(opts.fft_wisdom);
+                opts.fft_wisdom = strdup(optarg);
+                break;
+            case OPT_FFT_PLANNER:
+                if( !str2fftflags(optarg, &opts.fft_flags) ) {
+                    ERROR("Invalid FFT planner \"%s\"\n", optarg);
+                    ERROR("Valid values: [\"estimate\", \"measure\", \"patient\", \"exhaustive\"]\n");
+                    exit(1);
+                }
+                break;
+            case OPT_CPI:
+                opts.cpi_pulses = str2uint(optarg, 1, 1 << 16, &ok);
+                if( !ok ) {
+                    ERROR("Invalid number of pulses per CPI \"%s\"\n", optarg);
+                    ERROR("Valid range: [1, %u]\n", 1 << 16);
+                    exit(1);
+                }
+                break;
+            case OPT_DOPPLER_WINDOW:
+            case OPT_RANGE_WINDOW:
+                if( !window_valid(optarg) ) {
+                    ERROR("Invalid window \"%s\"\n", optarg);
+                    ERROR("Valid values: [\"rect\", \"hann\", \"hamming\", \"blackman-harris\", "
+                          "\"kaiser[:beta]\", \"taylor[:sll[:nbar]]\"]\n");
+                    exit(1);
+                }
+                if( c == OPT_DOPPLER_WINDOW ) {
+                    free(opts.doppler_window);
+                    opts.doppler_window = strdup(optarg);
+                } else {
+                    free(opts.range_window);
+                    opts.range_window = strdup(optarg);
+                }
+                break;
+            case OPT_WORKERS:
+                opts.workers = str2uint(optarg, 1, 1024, &ok);
+                if( !ok ) {
+                    ERROR("Invalid number of workers \"%s\"\n", optarg);
+                    ERROR("Valid range: [1, 1024]\n");
+                    exit(1);
+                }
+                break;
+            case OPT_REALTIME:
+                opts.realtime = true;
+                break;
+            case OPT_ALIGN_TIMESTAMPS:
+                opts.align_timestamps = true;
+                break;
+            case OPT_TX_CPUS:
+            case OPT_RX_CPUS:
+            case OPT_WORKER_CPUS: {
+                cpu_set_t set;
+                if( !rt_parse_cpus(optarg, &set) ) {
+                    ERROR("Invalid CPU list \"%s\"\n", optarg);
+                    ERROR("Valid values are CPU numbers and ranges (ex: \"3\" or \"0,4-7\")\n");
+                    exit(1);
+                }
+                char ** cpus = c == OPT_TX_CPUS ? &opts.tx_cpus : c == OPT_RX_CPUS ? &opts.rx_cpus
+                                                                                 : &opts.worker_cpus;
+                free(*cpus);
+                *cpus = strdup(optarg);
+            }   break;
+            case OPT_CFAR: {
+                enum cfar_method method;
+                if( !str2cfar(optarg, &method) ) {
+                    ERROR("Invalid CFAR method \"%s\"\n", optarg);
+                    ERROR("Valid values: [\"ca\", \"os\"]\n");
+                    exit(1);
+                }
+                opts.cfar_method = method;
+            }   break;
+            case OPT_CFAR_GUARD:
+            case OPT_CFAR_TRAIN: {
+                unsigned int cells = str2uint(optarg, c == OPT_CFAR_TRAIN ? 1 : 0, 1024, &ok);
+                if( !ok ) {
+                    ERROR("Invalid number of CFAR cells \"%s\"\n", optarg);
+                    ERROR("Valid range: [%d, 1024]\n", c == OPT_CFAR_TRAIN ? 1 : 0);
+                    exit(1);
+                }
+                if( c == OPT_CFAR_GUARD )
+                    opts.cfar_guard = cells;
+                else
+                    opts.cfar_train = cells;
+            }   break;
+            case OPT_STREAM:
+                if( strcasecmp(optarg, "async") == 0 ) {
+                    opts.async_stream = true;
+                } else if( strcasecmp(optarg, "sync") == 0 ) {
+                    opts.async_stream = false;
+                } else {
+                    ERROR("Invalid stream mode \"%s\"\n", optarg);
+                    ERROR("Valid values: [\"sync\", \"async\"]\n");
+                    exit(1);
+                }
+                break;
+            case OPT_NUM_BUFFERS:
+                opts.num_buffers = str2uint(optarg, 2, 4096, &ok);
+                if( !ok ) {
+                    ERROR("Invalid number of buffers \"%s\"\n", optarg);
+                    ERROR("Valid range: [2, 4096]\n");
+                    exit(1);
+                }
+                break;
+            case OPT_BUFFER_SIZE:
+                opts.buffer_size = str2uint(optarg, 1024, 1 << 20, &ok);
+                if( !ok || opts.buffer_size % 1024 != 0 ) {
+                    ERROR("Invalid buffer size \"%s\"\n", optarg);
+                    ERROR("Valid values are multiples of 1024 samples in [1024, %u]\n", 1 << 20);
+                    exit(1);
+                }
+                break;
+            case OPT_NUM_TRANSFERS:
+                opts.num_transfers = str2uint(optarg, 1, 4095, &ok);
+                if( !ok ) {
+                    ERROR("Invalid number of transfers \"%s\"\n", optarg);
+                    ERROR("Valid range: [1, 4095]\n");
+                    exit(1);
+                }
+                break;
+            case OPT_TIMEOUT:
+                opts.timeout_ms = str2uint_suffix(optarg, 1, 60000, time_suffixes,
+                                                  NUM_TIME_SUFFIXES, &ok);
+                if( !ok ) {
+                    ERROR("Invalid timeout \"%s\"\n", optarg);
+                    ERROR("Valid values given in milliseconds (ex: \"250\")\n");
+                    ERROR("or, equivalently, with units: (ex: \"250ms\" or \"2s\")\n");
+                    exit(1);
+                }
+                break;
+            case OPT_AUTOTUNE:
+                opts.autotune_ms = 500;
+                if( optarg ) {
+                    opts.autotune_ms = str2dbl_suffix(optarg, 10, 60000, time_suffixes,
+                                                      NUM_TIME_SUFFIXES, &ok);
+                    if( !ok ) {
+                        ERROR("Invalid autotune trial length \"%s\"\n", optarg);
+                        ERROR("Valid values are between 10ms and 60s (ex: \"500ms\" or \"2s\")\n");
+                        exit(1);
+                    }
+                }
+                break;
+            case OPT_TUNING:
+                free(opts.tuning);
+                opts.tuning = strdup(optarg);
+                break;
+            case OPT_CALIBRATE:
+                opts.calibrate = CAL_RF;
+                if( optarg && strcasecmp(optarg, "cable") == 0 ) {
+                    opts.calibrate = CAL_CABLE;
+                } else if( optarg && strcasecmp(optarg, "rf") != 0 ) {
+                    ERROR("Invalid loopback \"%s\"\n", optarg);
+                    ERROR("Valid values: rf, cable\n");
+                    exit(1);
+                }
+                break;
+            case OPT_CALIBRATION:
+                free(opts.calibration);
+                opts.calibration = strdup(optarg);
+                break;
+            case OPT_CAPTURE:
+                free(opts.capture);
+                opts.capture = strdup(optarg);
+                break;
+            case OPT_METRICS:
+                free(opts.metrics);
+                opts.metrics = strdup(optarg);
+                break;
+            case OPT_REPLAY:
+                opts.replay = (char **)realloc(opts.replay, sizeof(char *)*(opts.num_replay + 1));
+                opts.replay[opts.num_replay++] = strdup(optarg);
+                break;
+            case OPT_CAPTURE_SIZE:
+                opts.capture_size = str2uint64_suffix(optarg, 1 << 20, UINT64_MAX, freq_suffixes,
+                                                      NUM_FREQ_SUFFIXES, &ok);
+                if( !ok ) {
+                    ERROR("Invalid capture file size \"%s\"\n", optarg);
+                    ERROR("Valid values are at least 1M bytes (ex: \"500M\" or \"2G\")\n");
+                    exit(1);
+                }
+                break;
+            case OPT_CFAR_PFA:
+                opts.cfar_pfa = str2double(optarg, 1e-20, 0.5, &ok);
+                if( !ok ) {
+                    ERROR("Invalid probability of false alarm \"%s\"\n", optarg);
+                    ERROR("Valid range: [1e-20, 0.5]\n");
+                    exit(1);
+                }
                 break;
         }
 
@@ -203,11 +625,82 @@ void parse_options(int argc, char ** argv)
     DEFAULT(opts.rxvga2, BLADERF_RXVGA2_GAIN_MIN);
     DEFAULT(opts.txvga1, BLADERF_TXVGA1_GAIN_MIN);
     DEFAULT(opts.txvga2, BLADERF_TXVGA2_GAIN_MIN);
-    DEFAULT(opts.devstr, strdup(""));
+    if( opts.num_devices == 0 ) {
+        opts.devstrs = (char **)malloc(sizeof(char *));
+        opts.devstrs[opts.num_devices++] = strdup("");
+    }
+    DEFAULT(opts.tuning, tuning_default_path());
+    DEFAULT(opts.calibration, calibration_default_path());
+    if( opts.calibrate && opts.autotune_ms > 0 ) {
+        ERROR("Can't --calibrate and --autotune at once\n");
+        exit(1);
+    }
+    // Buffer settings are all or nothing: if none were given, use whatever
+    // --autotune found worked best here, if it's been run.  Profiles are per
+    // device, so they're no help with several.
+    if( opts.autotune_ms > 0 && opts.num_devices > 1 ) {
+        ERROR("Can only --autotune one device at a time\n");
+        exit(1);
+    }
+    if( opts.autotune_ms == 0 && opts.num_devices == 1 && opts.num_buffers == 0 &&
+        opts.buffer_size == 0 && opts.num_transfers == 0 )
+        tuning_load(opts.tuning);
     DEFAULT(opts.num_buffers, 32);
     DEFAULT(opts.buffer_size, 8192);
     DEFAULT(opts.num_transfers, 8);
     DEFAULT(opts.timeout_ms, 1000);
+    if( opts.num_transfers >= opts.num_buffers ) {
+        ERROR("Need fewer transfers (%u) than buffers (%u)\n", opts.num_transfers, opts.num_buffers);
+        exit(1);
+    }
+    DEFAULT(opts.burst_ms, 10);
+    DEFAULT(opts.pri_ms, opts.burst_ms);
+    DEFAULT(opts.tx_lead_ms, 5);
+    DEFAULT(opts.decimate, 1);
+    {
+        // Range profiles have to start on a decimated sample every time
+        uint64_t pri = (uint64_t)(opts.pri_ms*opts.samplerate/1000);
+        if( pri % opts.decimate != 0 ) {
+            ERROR("The PRI (%llu samples) has to be a whole number of decimated samples (%u)\n",
+                  (unsigned long long)pri, opts.decimate);
+            exit(1);
+        }
+    }
+    if( opts.max_range > 0 ) {
+        if( opts.range_bins != 0 ) {
+            ERROR("Give either --range or --range-bins, not both\n");
+            exit(1);
+        }
+        // Out and back, in processing samples
+        double per_metre = 2*(double)opts.samplerate/opts.decimate/SPEED_OF_LIGHT;
+        opts.range_offset = (unsigned int)floor(opts.min_range*per_metre);
+        double bins = ceil(opts.max_range*per_metre) - opts.range_offset;
+        if( bins > (1 << 20) ) {
+            ERROR("%gm to %gm works out to %.0f range bins, more than %u\n",
+                  opts.min_range, opts.max_range, bins, 1 << 20);
+            exit(1);
+        }
+        opts.range_bins = MAX((unsigned int)bins, 1u);
+    }
+    DEFAULT(opts.range_bins, 1024);
+    DEFAULT(opts.cpi_pulses, 64);
+    DEFAULT(opts.range_window, strdup("rect"));
+    DEFAULT(opts.doppler_window, strdup("hann"));
+    DEFAULT(opts.capture, strdup(""));
+    DEFAULT(opts.capture_size, 1000000000ull);
+    DEFAULT(opts.metrics, strdup(""));
+    DEFAULT(opts.metrics_interval_ms, 1000);
+    DEFAULT(opts.cfar_train, 8);
+    DEFAULT(opts.cfar_pfa, 1e-6);
+    // opts.cfar_method needs no default, CFAR_CA is zero
+    DEFAULT(opts.workers, (unsigned int)MAX(sysconf(_SC_NPROCESSORS_ONLN), 1L));
+    DEFAULT(opts.tx_cpus, strdup(""));
+    DEFAULT(opts.rx_cpus, strdup(""));
+    DEFAULT(opts.worker_cpus, strdup(""));
+    DEFAULT(opts.fft_wisdom, strdup(""));
+    DEFAULT(opts.signal_dir, strdup("signal"));
+    DEFAULT(opts.waveform, strdup("barker11"));
+    // opts.fft_flags needs no default, FFTW_MEASURE is zero
 
     // Do we have excess arguments?
     if( argc - optind > 0 ) {
@@ -219,5 +712,22 @@ void parse_options(int argc, char ** argv)
 
 void cleanup_options(void)
 {
-    free(opts.devstr);
+    for( unsigned int idx=0; idx<opts.num_devices; ++idx )
+        free(opts.devstrs[idx]);
+    free(opts.devstrs);
+    free(opts.fft_wisdom);
+    free(opts.signal_dir);
+    free(opts.waveform);
+    free(opts.range_window);
+    free(opts.doppler_window);
+    free(opts.capture);
+    free(opts.metrics);
+    free(opts.tuning);
+    free(opts.calibration);
+    free(opts.tx_cpus);
+    free(opts.rx_cpus);
+    free(opts.worker_cpus);
+    for( unsigned int idx=0; idx<opts.num_replay; ++idx )
+        free(opts.replay[idx]);
+    free(opts.replay);
 }
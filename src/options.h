@@ -21,14 +21,106 @@ struct opts_struct {
     char rxvga1, rxvga2;
     char txvga1, txvga2;
 
-    // Internal buffer settings (we don't have a way to set these right now)
+    // Whether to stream with the zero-copy async engine (see stream.h)
+    // rather than sync calls
+    bool async_stream;
+
+    // Internal buffer settings, as passed to bladerf_sync_config().  Unless
+    // they're given, they come from whatever --autotune last saved to
+    // opts.tuning for this device and sample rate.
     unsigned int num_buffers;
     unsigned int buffer_size;
     unsigned int num_transfers;
     unsigned int timeout_ms;
 
-    // bladeRF device name
-    char * devstr;
+    // How long each --autotune trial runs in milliseconds (0 when we aren't
+    // tuning), and where tuned buffer settings are kept (empty for nowhere)
+    double autotune_ms;
+    char * tuning;
+
+    // With --calibrate, how TX gets back to RX (a cal_loopback, see
+    // calibrate.h; 0 for a normal run), whether the device should loop it
+    // back internally, and where calibrated delays are kept (empty for nowhere)
+    int calibrate;
+    bool rf_loopback;
+    char * calibration;
+
+    // Burst length, time between the starts of bursts, and how far ahead of
+    // the radio we keep bursts queued up, all in milliseconds
+    double burst_ms;
+    double pri_ms;
+    double tx_lead_ms;
+
+    // What to decimate RX samples by before processing them (1 for not at
+    // all, otherwise even, see decimate.h)
+    unsigned int decimate;
+
+    // Number of range bins in each range profile, and the window the
+    // reference code is tapered with to keep range sidelobes down
+    unsigned int range_bins;
+    char * range_window;
+
+    // The ranges in metres echoes are processed between (max_range is 0 when
+    // it's up to --range-bins), and how many processing samples after each
+    // burst min_range works out to, where range bin 0 starts
+    double min_range;
+    double max_range;
+    unsigned int range_offset;
+
+    // Pulses per coherent processing interval, and the slow time window
+    // applied across them before the Doppler FFT
+    unsigned int cpi_pulses;
+    char * doppler_window;
+
+    // CFAR detector: method (a cfar_method), guard and training cells on each
+    // side of the cell under test, and the false alarm rate to aim for
+    int cfar_method;
+    unsigned int cfar_guard;
+    unsigned int cfar_train;
+    double cfar_pfa;
+
+    // Threads to process on; with just one, everything happens on the
+    // processing thread
+    unsigned int workers;
+
+    // The real-time host profile (see realtime.h), and the cores to pin TX,
+    // RX and processing threads to (empty for wherever)
+    bool realtime;
+    char * tx_cpus;
+    char * rx_cpus;
+    char * worker_cpus;
+
+    // Where to keep FFTW wisdom between runs (empty for nowhere), and how
+    // hard the FFTW planner should try
+    char * fft_wisdom;
+    unsigned int fft_flags;
+
+    // Prefix of files to capture RX samples to (empty for no capture), and when
+    // to move on to the next file, in bytes and milliseconds (0 for never)
+    char * capture;
+    uint64_t capture_size;
+    double capture_time_ms;
+
+    // Where to publish runtime metrics (empty for nowhere), and how often
+    char * metrics;
+    double metrics_interval_ms;
+
+    // Recorded .sc16 files to run through processing instead of using a radio
+    char ** replay;
+    unsigned int num_replay;
+
+    // Where to find .sc16 waveforms, and which one to transmit
+    char * signal_dir;
+    char * waveform;
+
+    // bladeRF device names, one radio each (just "" for whichever one is
+    // plugged in if none were given)
+    char ** devstrs;
+    unsigned int num_devices;
+
+    // Whether to line every radio's bursts and range profiles up in time,
+    // for boards that share a reference clock and trigger (see radio.h)
+    bool align_timestamps;
 };
 extern struct opts_struct opts;
 
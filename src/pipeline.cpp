@@ -0,0 +1,355 @@
+#include <libbladeRF.h>
+#include "options.h"
+#include "util.h"
+#include "fftplan.h"
+#include "process.h"
+#include "window.h"
+#include "pipeline.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static void pulse_compressed(struct pulse_compressor * pc, const fftwf_complex * out,
+                             unsigned int count, uint64_t ts, void * user_data)
+{
+    struct pipeline_worker * w = (struct pipeline_worker *)user_data;
+    memcpy(w->row, out, sizeof(fftwf_complex)*MIN(count, w->range_bins));
+}
+
+static void cpi_run(struct cpi_slot * slot, unsigned int worker)
+{
+    struct pipeline * pl = slot->pl;
+    struct cfar * cfar = &pl->workers[worker].cfar;
+    uint64_t start = thread_cpu_ns();
+
+    fftwf_execute_dft(pl->plan, slot->cpi, slot->map);
+    slot->detections = cfar_map(cfar, slot->map, slot->ts);
+    for( unsigned int idx=0; idx<slot->detections; ++idx ) {
+        if( idx == 0 || cfar->dets[idx].power > slot->strongest.power )
+            slot->strongest = cfar->dets[idx];
+    }
+    pl->busy_ns.fetch_add(thread_cpu_ns() - start, std::memory_order_relaxed);
+    slot->done.store(true, std::memory_order_release);
+}
+
+static void cpi_task(void * arg, unsigned int worker)
+{
+    cpi_run((struct cpi_slot *)arg, worker);
+}
+
+// Drop a reference to slot; the last one out finishes it.  worker is -1 off
+// of the pool, where we'd rather hand the Doppler work to it than do it here.
+static void slot_put(struct cpi_slot * slot, int worker)
+{
+    if( slot->refs.fetch_sub(1, std::memory_order_acq_rel) != 1 )
+        return;
+    if( !slot->complete )
+        slot->done.store(true, std::memory_order_release);
+    else if( worker < 0 )
+        pool_submit(slot->pl->pool, cpi_task, slot);
+    else
+        cpi_run(slot, (unsigned int)worker);
+}
+
+static void pulse_task_run(void * arg, unsigned int worker)
+{
+    struct pulse_task * task = (struct pulse_task *)arg;
+    struct cpi_slot * slot = task->slot;
+    struct pipeline * pl = slot->pl;
+    struct pipeline_worker * w = &pl->workers[worker];
+    uint64_t ts = slot->ts + (uint64_t)task->pulse*pl->pri;
+    uint64_t start = thread_cpu_ns();
+
+    w->row = slot->cpi + (size_t)task->pulse*pl->range_bins;
+    pc_push_sc16(&w->pc, slot->raw + 2*(size_t)task->pulse*pl->seg_len, pl->seg_len, ts);
+    pc_flush(&w->pc);
+
+    slot->profile_detections.fetch_add(cfar_profile(&w->cfar, w->row, ts),
+                                       std::memory_order_relaxed);
+    if( pl->window )
+        window_scale(w->row, w->row, pl->window[task->pulse], pl->range_bins);
+
+    // Once we let go of the slot its CPI can finish, and the pipeline with it
+    pl->busy_ns.fetch_add(thread_cpu_ns() - start, std::memory_order_relaxed);
+    slot_put(slot, (int)worker);
+}
+
+/*
+ * Feeding thread side
+ */
+static struct cpi_slot * slot_open(struct pipeline * pl, uint64_t ts)
+{
+    struct cpi_slot * slot = &pl->slots[pl->next_cpi % pl->num_slots];
+    if( slot->in_use )
+        return NULL;
+
+    slot->seq = pl->next_cpi++;
+    slot->ts = ts;
+    slot->started = 0;
+    slot->dispatched = 0;
+    slot->in_use = true;
+    slot->closed = false;
+    slot->complete = false;
+    slot->refs.store(1, std::memory_order_relaxed);
+    slot->done.store(false, std::memory_order_relaxed);
+    slot->profile_detections.store(0, std::memory_order_relaxed);
+    slot->detections = 0;
+    return slot;
+}
+
+// We won't be adding any more pulses to slot
+static void slot_close(struct pipeline * pl, struct cpi_slot * slot)
+{
+    if( slot->closed )
+        return;
+    slot->closed = true;
+    slot->complete = slot->dispatched == pl->num_pulses;
+    if( pl->current == slot )
+        pl->current = NULL;
+    slot_put(slot, -1);
+}
+
+static void dispatch(struct pipeline * pl, const struct pulse_gather * g)
+{
+    struct cpi_slot * slot = g->slot;
+    struct pulse_task * task = &slot->tasks[g->pulse];
+    task->slot = slot;
+    task->pulse = g->pulse;
+    slot->refs.fetch_add(1, std::memory_order_relaxed);
+    slot->dispatched++;
+    pool_submit(pl->pool, pulse_task_run, task);
+
+    if( slot->dispatched == pl->num_pulses )
+        slot_close(pl, slot);
+}
+
+// Throw away every pulse we haven't finished gathering, along with the CPIs
+// they were part of
+static void abandon(struct pipeline * pl)
+{
+    for( size_t idx=0; idx<pl->gathering.size(); ++idx )
+        slot_close(pl, pl->gathering[idx].slot);
+    pl->gathering.clear();
+    if( pl->current )
+        slot_close(pl, pl->current);
+}
+
+void pipeline_retire(struct pipeline * pl)
+{
+    while( pl->retire_cpi < pl->next_cpi ) {
+        struct cpi_slot * slot = &pl->slots[pl->retire_cpi % pl->num_slots];
+        if( !slot->done.load(std::memory_order_acquire) )
+            break;
+
+        pl->profiles += slot->dispatched;
+        pl->profile_detections += slot->profile_detections.load(std::memory_order_relaxed);
+        if( slot->complete ) {
+            pl->cpis++;
+            pl->map_detections += slot->detections;
+            pl->last_cpi_detections = slot->detections;
+            if( slot->detections > 0 )
+                pl->last_cpi_strongest = slot->strongest;
+        }
+        slot->in_use = false;
+        pl->retire_cpi++;
+    }
+}
+
+unsigned int pipeline_push_sc16(struct pipeline * pl, const int16_t * iq, unsigned int count,
+                                uint64_t ts)
+{
+    pipeline_retire(pl);
+
+    // Nothing we're partway through gathering can be finished across a gap.
+    // Gaps between pulses are fine, range gating leaves nothing but; if any
+    // pulses went missing in one the next pulse won't follow on.
+    if( ts != pl->next_ts && !pl->gathering.empty() )
+        abandon(pl);
+
+    uint64_t pos = ts;
+    uint64_t end = ts + count;
+    while( pos < end ) {
+        uint64_t start = pl->epoch;
+        if( pos > pl->epoch )
+            start += (pos - pl->epoch + pl->pri - 1)/pl->pri*pl->pri;
+
+        if( start == pos ) {
+            // A pulse starts here.  It goes in the current CPI if there's room
+            // and it follows on from the last one, otherwise in a new one.
+            uint64_t pulse = (pos - pl->epoch)/pl->pri;
+            if( pulse != pl->last_pulse + 1 )
+                abandon(pl);
+            if( pl->current && pl->current->started == pl->num_pulses )
+                pl->current = NULL;
+            if( !pl->current ) {
+                pl->current = slot_open(pl, pos);
+                if( !pl->current ) {
+                    // Out of slots; leave the rest for when the workers catch up
+                    pl->stalls++;
+                    break;
+                }
+            }
+            struct pulse_gather g = { pl->current, pl->current->started++, pos };
+            pl->gathering.push_back(g);
+            pl->last_pulse = pulse;
+            start += pl->pri;
+        }
+
+        // Copy out as far as the next pulse start, into everything that wants it
+        unsigned int n = (unsigned int)(MIN(end, start) - pos);
+        for( size_t idx=0; idx<pl->gathering.size(); ) {
+            struct pulse_gather * g = &pl->gathering[idx];
+            unsigned int have = (unsigned int)(pos - g->start);
+            unsigned int m = MIN(n, pl->seg_len - have);
+            memcpy(g->slot->raw + 2*((size_t)g->pulse*pl->seg_len + have), iq + 2*(pos - ts),
+                   2*sizeof(int16_t)*m);
+            if( have + m == pl->seg_len ) {
+                dispatch(pl, g);
+                pl->gathering.erase(pl->gathering.begin() + idx);
+            } else {
+                ++idx;
+            }
+        }
+        pos += n;
+    }
+
+    pl->samples += pos - ts;
+    pl->next_ts = pos;
+    return (unsigned int)(pos - ts);
+}
+
+/*
+ * Setup and teardown
+ */
+static void free_buffers(struct pipeline * pl)
+{
+    if( pl->slots ) {
+        for( unsigned int idx=0; idx<pl->num_slots; ++idx ) {
+            fftwf_free(pl->slots[idx].raw);
+            fftwf_free(pl->slots[idx].cpi);
+            fftwf_free(pl->slots[idx].map);
+            delete[] pl->slots[idx].tasks;
+        }
+        delete[] pl->slots;
+        pl->slots = NULL;
+    }
+    if( pl->workers ) {
+        for( unsigned int idx=0; idx<pl->num_workers; ++idx ) {
+            pc_free(&pl->workers[idx].pc);
+            cfar_free(&pl->workers[idx].cfar);
+        }
+        delete[] pl->workers;
+        pl->workers = NULL;
+    }
+}
+
+// Enough CPIs in flight to keep every worker busy while the oldest one
+// finishes up, and a couple more to absorb bumps
+static unsigned int pipeline_slots(unsigned int num_workers, unsigned int cpi_pulses)
+{
+    return MAX(4u, (2*num_workers + cpi_pulses - 1)/cpi_pulses + 2);
+}
+
+unsigned int pipeline_max_tasks(unsigned int num_workers, unsigned int cpi_pulses)
+{
+    // A task per pulse, then one for the Doppler work
+    return pipeline_slots(num_workers, cpi_pulses)*(cpi_pulses + 1);
+}
+
+bool pipeline_init(struct pipeline * pl, struct task_pool * pool, const fftwf_complex * code,
+                   unsigned int code_len, unsigned int range_bins, uint64_t pri, uint64_t epoch,
+                   unsigned int cpi_pulses, const char * doppler_window,
+                   enum cfar_method cfar_method, unsigned int cfar_guard, unsigned int cfar_train,
+                   float cfar_pfa)
+{
+    const unsigned int num_workers = pool->num_workers;
+    pl->pool = pool;
+    pl->num_workers = num_workers;
+    pl->range_bins = range_bins;
+    pl->code_len = code_len;
+    pl->seg_len = range_bins + code_len - 1;
+    pl->num_pulses = cpi_pulses;
+    pl->pri = MAX(pri, (uint64_t)range_bins);
+    pl->epoch = epoch;
+    pl->next_ts = UINT64_MAX;
+    pl->current = NULL;
+    pl->next_cpi = pl->retire_cpi = 0;
+    pl->samples = pl->profiles = pl->cpis = 0;
+    pl->profile_detections = pl->map_detections = 0;
+    pl->last_cpi_detections = 0;
+    pl->stalls = pl->dropped = 0;
+    pl->busy_ns = 0;
+    pl->busy_secs = 0;
+
+    pl->num_slots = pipeline_slots(num_workers, cpi_pulses);
+    pl->slots = new struct cpi_slot[pl->num_slots]();
+    pl->workers = new struct pipeline_worker[num_workers];
+    memset(pl->workers, 0, sizeof(struct pipeline_worker)*num_workers);
+
+    pl->window = NULL;
+    if( doppler_window ) {
+        pl->window = window_get_f32(doppler_window, cpi_pulses);
+        if( !pl->window )
+            goto fail;
+    }
+    pl->plan = fft_plan_get(cpi_pulses, FFTW_FORWARD, range_bins, range_bins, 1, false, true);
+    if( !pl->plan )
+        goto fail;
+
+    for( unsigned int idx=0; idx<pl->num_slots; ++idx ) {
+        struct cpi_slot * slot = &pl->slots[idx];
+        slot->pl = pl;
+        slot->in_use = false;
+        slot->raw = (int16_t *)fftwf_malloc(2*sizeof(int16_t)*cpi_pulses*pl->seg_len);
+        slot->cpi = fftwf_alloc_complex((size_t)cpi_pulses*range_bins);
+        slot->map = fftwf_alloc_complex((size_t)cpi_pulses*range_bins);
+        slot->tasks = new struct pulse_task[cpi_pulses];
+        if( !slot->raw || !slot->cpi || !slot->map )
+            goto fail;
+    }
+
+    {
+        // One FFT per pulse, so the smallest power of two that fits it all
+        unsigned int fft_len = 1;
+        while( fft_len < pl->seg_len )
+            fft_len *= 2;
+        for( unsigned int idx=0; idx<num_workers; ++idx ) {
+            struct pipeline_worker * w = &pl->workers[idx];
+            w->range_bins = range_bins;
+            if( !pc_init(&w->pc, code, code_len, fft_len, PC_AUTO, pulse_compressed, w) ||
+                !cfar_init(&w->cfar, cfar_method, range_bins, cpi_pulses, cfar_guard, cfar_train,
+                           cfar_pfa, CHAIN_MAX_DETECTIONS) )
+                goto fail;
+        }
+    }
+
+    return true;
+
+fail:
+    free_buffers(pl);
+    return false;
+}
+
+void pipeline_free(struct pipeline * pl)
+{
+    // Wait for everything in flight to come back through the reorder stage
+    abandon(pl);
+    while( pl->retire_cpi < pl->next_cpi ) {
+        pipeline_retire(pl);
+        if( pl->retire_cpi < pl->next_cpi )
+            usleep(100);
+    }
+    pl->busy_secs = pl->busy_ns.load()*1e-9;
+
+    for( unsigned int idx=0; idx<pl->num_workers; ++idx )
+        pl->dropped += pl->workers[idx].cfar.dropped;
+    free_buffers(pl);
+}
@@ -0,0 +1,158 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include <fftw3.h>
+#include "compress.h"
+#include "cfar.h"
+#include "pool.h"
+
+/*
+ * The processing chain from process.h, spread over a pool of workers.
+ *
+ * Every pulse is compressed on its own: the thread feeding us copies the
+ * samples each range profile needs (range_bins + code_len - 1 of them, from
+ * the start of each PRI) into a slot for the CPI the pulse belongs to, and
+ * hands the pulse to the pool.  Workers compress it, run CFAR over the range
+ * profile, and window it into its row of the CPI.  Whoever finishes the last
+ * pulse of a CPI goes on to the Doppler FFT and CFAR over the map.
+ *
+ * CPIs can finish in any order, so each one gets a sequence number and the
+ * feeding thread retires them strictly in that order.  There are only so
+ * many slots; when they're all in flight we stop taking samples, which backs
+ * up into the RX ring.
+ *
+ * The pool isn't ours: every radio's pipeline hands its pulses to the same
+ * one, and workers keep a set of scratch space per pipeline.
+ */
+
+struct pipeline;
+
+struct cpi_slot {
+    struct pipeline * pl;
+
+    // Which CPI this is, and the timestamp of its first pulse
+    uint64_t seq;
+    uint64_t ts;
+
+    // Input for each pulse, seg_len samples apiece, then the CPI and map
+    int16_t * raw;
+    fftwf_complex * cpi;
+    fftwf_complex * map;
+
+    // Feeding thread only: pulses we've started gathering, and handed out
+    unsigned int started;
+    unsigned int dispatched;
+    bool in_use;
+    bool closed;
+
+    // Pulses still being worked on, plus one for the feeding thread until
+    // it's done with the slot.  Whoever drops it to zero finishes the CPI.
+    std::atomic<unsigned int> refs;
+    bool complete;
+    std::atomic<bool> done;
+
+    // Results
+    std::atomic<uint64_t> profile_detections;
+    unsigned int detections;
+    struct detection strongest;
+
+    // Task arguments for each pulse, so dispatching never allocates
+    struct pulse_task * tasks;
+};
+
+struct pulse_task {
+    struct cpi_slot * slot;
+    unsigned int pulse;
+};
+
+// Per-worker scratch; a worker only ever runs one task at a time
+struct pipeline_worker {
+    struct pulse_compressor pc;
+    struct cfar cfar;
+
+    // Where the pulse being compressed goes
+    fftwf_complex * row;
+    unsigned int range_bins;
+};
+
+// A pulse we're still copying input for
+struct pulse_gather {
+    struct cpi_slot * slot;
+    unsigned int pulse;
+    uint64_t start;
+};
+
+struct pipeline {
+    struct task_pool * pool;
+    struct pipeline_worker * workers;
+    unsigned int num_workers;
+
+    // Same framing as process_chain
+    uint64_t epoch;
+    uint64_t pri;
+    unsigned int range_bins;
+    unsigned int code_len;
+    unsigned int seg_len;
+    unsigned int num_pulses;
+
+    // Slow time window and Doppler plan, both shared
+    const float * window;
+    fftwf_plan plan;
+
+    // CPI seq lives in slots[seq % num_slots]
+    struct cpi_slot * slots;
+    unsigned int num_slots;
+
+    // Feeding thread only
+    std::vector<struct pulse_gather> gathering;
+    struct cpi_slot * current;
+    uint64_t next_cpi;
+    uint64_t retire_cpi;
+    uint64_t last_pulse;
+    uint64_t next_ts;
+
+    // Statistics, kept up to date by the reorder stage
+    uint64_t samples;
+    uint64_t profiles;
+    uint64_t cpis;
+    uint64_t profile_detections;
+    uint64_t map_detections;
+    unsigned int last_cpi_detections;
+    struct detection last_cpi_strongest;
+    uint64_t stalls;
+
+    // CPU time workers spent on our tasks, as it adds up
+    std::atomic<uint64_t> busy_ns;
+
+    // Filled in by pipeline_free()
+    uint64_t dropped;
+    double busy_secs;
+};
+
+// pool has to outlive the pipeline
+bool pipeline_init(struct pipeline * pl, struct task_pool * pool, const fftwf_complex * code,
+                   unsigned int code_len, unsigned int range_bins, uint64_t pri, uint64_t epoch,
+                   unsigned int cpi_pulses, const char * doppler_window,
+                   enum cfar_method cfar_method, unsigned int cfar_guard, unsigned int cfar_train,
+                   float cfar_pfa);
+
+// The most tasks one pipeline will ever have on a pool of num_workers at once
+unsigned int pipeline_max_tasks(unsigned int num_workers, unsigned int cpi_pulses);
+
+// Finishes everything already handed out, leaving the pool to whoever else
+// is using it.  The statistics are final once this returns.
+void pipeline_free(struct pipeline * pl);
+
+// Take as much of a block of samples starting at timestamp ts as we have room
+// for, and return how many samples that was.  Anything short of count means
+// the workers are behind; call again with the rest once they've caught up.
+unsigned int pipeline_push_sc16(struct pipeline * pl, const int16_t * iq, unsigned int count,
+                                uint64_t ts);
+
+// Retire finished CPIs, in order.  pipeline_push_sc16() does this too; call
+// it when there's nothing to push so results don't sit around.
+void pipeline_retire(struct pipeline * pl);
+#endif
@@ -0,0 +1,210 @@
+#include <libbladeRF.h>
+#include "options.h"
+#include "util.h"
+#include "ring.h"
+#include "pool.h"
+#include "realtime.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct pool_task {
+    pool_task_fn fn;
+    void * arg;
+};
+
+// Each queue gets its own cache line so workers only fight over a lock when
+// one of them is actually stealing
+struct pool_queue {
+    alignas(CACHE_LINE_SIZE) pthread_mutex_t lock;
+
+    // Ring of pool->capacity tasks, oldest at head
+    struct pool_task * tasks;
+    uint64_t head;
+    uint64_t tail;
+
+    // Only touched by the worker that owns this queue until it's stopped
+    double busy_secs;
+};
+
+struct pool_worker_arg {
+    struct task_pool * pool;
+    unsigned int idx;
+};
+
+// Which pool (if any) and worker the current thread is
+static __thread struct task_pool * current_pool;
+static __thread unsigned int current_worker;
+
+static double thread_cpu_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Our own queue newest first, then everyone else's oldest first
+static bool pool_take(struct task_pool * pool, unsigned int idx, struct pool_task * task)
+{
+    struct pool_queue * q = &pool->queues[idx];
+    const uint64_t mask = pool->capacity - 1;
+    pthread_mutex_lock(&q->lock);
+    if( q->tail != q->head ) {
+        *task = q->tasks[--q->tail & mask];
+        pthread_mutex_unlock(&q->lock);
+        return true;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    for( unsigned int off=1; off<pool->num_workers; ++off ) {
+        q = &pool->queues[(idx + off) % pool->num_workers];
+        pthread_mutex_lock(&q->lock);
+        if( q->tail != q->head ) {
+            *task = q->tasks[q->head++ & mask];
+            pthread_mutex_unlock(&q->lock);
+            pool->stolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+    return false;
+}
+
+static void * pool_worker(void * arg)
+{
+    struct task_pool * pool = ((struct pool_worker_arg *)arg)->pool;
+    unsigned int idx = ((struct pool_worker_arg *)arg)->idx;
+    free(arg);
+    current_pool = pool;
+    current_worker = idx;
+    rt_thread_setup(RT_WORKER, idx);
+
+    while( true ) {
+        struct pool_task task;
+        if( pool_take(pool, idx, &task) ) {
+            pool->queued.fetch_sub(1, std::memory_order_relaxed);
+            double start = thread_cpu_secs();
+            task.fn(task.arg, idx);
+            pool->queues[idx].busy_secs += thread_cpu_secs() - start;
+            pool->executed.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Nothing anywhere; sleep until somebody submits something
+        pthread_mutex_lock(&pool->sleep_lock);
+        while( pool->queued.load() == 0 && pool->running.load() )
+            pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+        bool done = pool->queued.load() == 0 && !pool->running.load();
+        pthread_mutex_unlock(&pool->sleep_lock);
+        if( done )
+            break;
+    }
+    return NULL;
+}
+
+// The RX and processing threads submit at a higher priority than the workers
+// run at, so a worker mustn't be able to sit on a lock one of them wants
+static void pool_mutex_init(pthread_mutex_t * lock)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+bool pool_init(struct task_pool * pool, unsigned int num_workers, unsigned int capacity)
+{
+    pool->num_workers = num_workers;
+    // Round robin doesn't promise an even spread once workers steal, so any
+    // one queue may end up holding everything
+    pool->capacity = 1;
+    while( pool->capacity < capacity )
+        pool->capacity *= 2;
+    pool->queued = 0;
+    pool->next_queue = 0;
+    pool->running = true;
+    pool->executed = 0;
+    pool->stolen = 0;
+    pool_mutex_init(&pool->sleep_lock);
+    pthread_cond_init(&pool->wake, NULL);
+
+    pool->queues = new struct pool_queue[num_workers];
+    pool->threads = (pthread_t *)calloc(num_workers, sizeof(pthread_t));
+    for( unsigned int idx=0; idx<num_workers; ++idx ) {
+        pool_mutex_init(&pool->queues[idx].lock);
+        pool->queues[idx].tasks = (struct pool_task *)malloc(sizeof(struct pool_task)*pool->capacity);
+        pool->queues[idx].head = pool->queues[idx].tail = 0;
+        pool->queues[idx].busy_secs = 0;
+    }
+
+    for( unsigned int idx=0; idx<num_workers; ++idx ) {
+        struct pool_worker_arg * arg = (struct pool_worker_arg *)malloc(sizeof(struct pool_worker_arg));
+        arg->pool = pool;
+        arg->idx = idx;
+        if( pthread_create(&pool->threads[idx], NULL, pool_worker, arg) != 0 ) {
+            ERROR("Failed to start worker thread %u\n", idx);
+            free(arg);
+            pool->num_workers = idx;
+            pool_free(pool);
+            return false;
+        }
+    }
+    return true;
+}
+
+void pool_free(struct task_pool * pool)
+{
+    pthread_mutex_lock(&pool->sleep_lock);
+    pool->running = false;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->sleep_lock);
+
+    pool->busy_secs = 0;
+    for( unsigned int idx=0; idx<pool->num_workers; ++idx )
+        pthread_join(pool->threads[idx], NULL);
+    for( unsigned int idx=0; idx<pool->num_workers; ++idx ) {
+        pool->busy_secs += pool->queues[idx].busy_secs;
+        pthread_mutex_destroy(&pool->queues[idx].lock);
+        free(pool->queues[idx].tasks);
+    }
+    delete[] pool->queues;
+    free(pool->threads);
+    pool->queues = NULL;
+    pool->threads = NULL;
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->sleep_lock);
+}
+
+void pool_submit(struct task_pool * pool, pool_task_fn fn, void * arg)
+{
+    unsigned int idx;
+    if( current_pool == pool )
+        idx = current_worker;
+    else
+        idx = pool->next_queue.fetch_add(1, std::memory_order_relaxed) % pool->num_workers;
+
+    struct pool_task task = { fn, arg };
+    for( unsigned int tries=0; ; ++tries ) {
+        struct pool_queue * q = &pool->queues[(idx + tries) % pool->num_workers];
+        // Count it while it's still locked in the queue, so whoever takes it
+        // can't count it back out first
+        pthread_mutex_lock(&q->lock);
+        if( q->tail - q->head < pool->capacity ) {
+            q->tasks[q->tail++ & (pool->capacity - 1)] = task;
+            pool->queued.fetch_add(1);
+            pthread_mutex_unlock(&q->lock);
+            break;
+        }
+        pthread_mutex_unlock(&q->lock);
+        // Only when more is outstanding than pool_init() was told to expect
+        if( tries % pool->num_workers == pool->num_workers - 1 )
+            sched_yield();
+    }
+
+    // Sleepers check queued under this lock, so they either see it or get this
+    pthread_mutex_lock(&pool->sleep_lock);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->sleep_lock);
+}
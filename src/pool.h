@@ -0,0 +1,56 @@
+#ifndef POOL_H
+#define POOL_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+
+// `worker` is the index of the worker running the task, for tasks that keep
+// per-worker scratch space
+typedef void (*pool_task_fn)(void * arg, unsigned int worker);
+
+struct pool_queue;
+
+// Work-stealing thread pool.  Every worker has its own queue: tasks submitted
+// from a worker go on the back of that worker's queue and it takes them back
+// off of the back (so whatever it just made is still in cache), while idle
+// workers steal from the front of everyone else's.  Tasks submitted from
+// outside the pool are dealt out to the queues round robin.
+struct task_pool {
+    unsigned int num_workers;
+    pthread_t * threads;
+    struct pool_queue * queues;
+
+    // Tasks sitting in a queue, not counting any that are running
+    std::atomic<uint64_t> queued;
+    std::atomic<unsigned int> next_queue;
+    std::atomic<bool> running;
+
+    // Every queue can hold this many tasks (a power of two)
+    unsigned int capacity;
+
+    // Where workers with nothing to do wait
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake;
+
+    // Statistics
+    std::atomic<uint64_t> executed;
+    std::atomic<uint64_t> stolen;
+
+    // CPU time every worker spent running tasks, filled in by pool_free()
+    double busy_secs;
+};
+
+// capacity is the most tasks that will ever be queued or running at once;
+// the queues are sized up front so submitting never allocates
+bool pool_init(struct task_pool * pool, unsigned int num_workers, unsigned int capacity);
+
+// Runs every task that has been (or gets) submitted, then stops the workers
+void pool_free(struct task_pool * pool);
+
+// Safe from any thread including the pool's own.  It takes two locks that
+// workers only ever hold for a few instructions, both priority inheriting,
+// so a worker holding one runs at the submitter's priority until it lets go.
+// Past capacity it waits for a worker to make room.
+void pool_submit(struct task_pool * pool, pool_task_fn fn, void * arg);
+#endif
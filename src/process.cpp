@@ -0,0 +1,652 @@
+#include <libbladeRF.h>
+#include "options.h"
+#include "util.h"
+#include "rx.h"
+#include "process.h"
+#include "sc16.h"
+#include "waveform.h"
+#include "window.h"
+#include "pipeline.h"
+#include "metrics.h"
+#include "realtime.h"
+#include "radio.h"
+#include "pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+static void profile_done(struct process_chain * chain)
+{
+    chain->profiles++;
+    if( chain->tap )
+        chain->tap(chain->tap_data, chain->profile, chain->range_bins, chain->profile_ts);
+    chain->profile_detections += cfar_profile(&chain->cfar, chain->profile, chain->profile_ts);
+
+    rd_push_profile(&chain->rd, chain->profile, (chain->profile_ts - chain->epoch)/chain->pri,
+                    chain->profile_ts);
+}
+
+static void cpi_done(struct range_doppler * rd, const fftwf_complex * map,
+                     uint64_t ts, void * user_data)
+{
+    struct process_chain * chain = (struct process_chain *)user_data;
+    unsigned int count = cfar_map(&chain->cfar, map, ts);
+
+    // Nobody downstream of us yet, so just hang on to the strongest one
+    chain->last_cpi_detections = count;
+    for( unsigned int idx=0; idx<count; ++idx ) {
+        if( idx == 0 || chain->cfar.dets[idx].power > chain->last_cpi_strongest.power )
+            chain->last_cpi_strongest = chain->cfar.dets[idx];
+    }
+    chain->map_detections += count;
+    chain->cpis++;
+}
+
+// Slice the compressed stream up into range profiles
+static void compressed_cb(struct pulse_compressor * pc, const fftwf_complex * out,
+                          unsigned int count, uint64_t ts, void * user_data)
+{
+    struct process_chain * chain = (struct process_chain *)user_data;
+
+    while( count > 0 ) {
+        unsigned int n;
+        if( ts < chain->epoch ) {
+            n = (unsigned int)MIN((uint64_t)count, chain->epoch - ts);
+        } else {
+            uint64_t rel = ts - chain->epoch;
+            uint64_t offset = rel % chain->pri;
+            uint64_t start = ts - offset;
+
+            if( offset >= chain->range_bins ) {
+                // Between profiles
+                n = (unsigned int)MIN((uint64_t)count, chain->pri - offset);
+            } else {
+                n = (unsigned int)MIN((uint64_t)count, chain->range_bins - offset);
+
+                // Only start filling at the beginning of a profile; if we
+                // joined partway through (or there was a gap) wait for the next
+                if( offset == 0 ) {
+                    chain->profile_ts = start;
+                    chain->profile_fill = 0;
+                }
+                if( chain->profile_ts == start && chain->profile_fill == offset ) {
+                    memcpy(chain->profile + offset, out, sizeof(fftwf_complex)*n);
+                    chain->profile_fill += n;
+                    if( chain->profile_fill == chain->range_bins )
+                        profile_done(chain);
+                }
+            }
+        }
+
+        out += n;
+        ts += n;
+        count -= n;
+    }
+}
+
+bool chain_init(struct process_chain * chain, const fftwf_complex * code, unsigned int code_len,
+                unsigned int fft_len, unsigned int range_bins, uint64_t pri, uint64_t epoch,
+                unsigned int cpi_pulses, const char * doppler_window,
+                enum cfar_method cfar_method, unsigned int cfar_guard, unsigned int cfar_train,
+                float cfar_pfa)
+{
+    memset(chain, 0, sizeof(struct process_chain));
+    chain->range_bins = range_bins;
+    chain->pri = MAX(pri, (uint64_t)range_bins);
+    chain->epoch = epoch;
+    chain->profile_ts = UINT64_MAX;
+
+    chain->profile = fftwf_alloc_complex(range_bins);
+    if( !chain->profile )
+        return false;
+    if( !pc_init(&chain->pc, code, code_len, fft_len, PC_AUTO, compressed_cb, chain) ) {
+        fftwf_free(chain->profile);
+        return false;
+    }
+    if( !rd_init(&chain->rd, cpi_pulses, range_bins, doppler_window, cpi_done, chain) ) {
+        pc_free(&chain->pc);
+        fftwf_free(chain->profile);
+        return false;
+    }
+    if( !cfar_init(&chain->cfar, cfar_method, range_bins, cpi_pulses, cfar_guard, cfar_train,
+                   cfar_pfa, CHAIN_MAX_DETECTIONS) ) {
+        rd_free(&chain->rd);
+        pc_free(&chain->pc);
+        fftwf_free(chain->profile);
+        return false;
+    }
+    return true;
+}
+
+void chain_free(struct process_chain * chain)
+{
+    cfar_free(&chain->cfar);
+    rd_free(&chain->rd);
+    pc_free(&chain->pc);
+    fftwf_free(chain->profile);
+    chain->profile = NULL;
+}
+
+void chain_push_sc16(struct process_chain * chain, const int16_t * iq, unsigned int count, uint64_t ts)
+{
+    pc_push_sc16(&chain->pc, iq, count, ts);
+    chain->samples += count;
+}
+
+// Feed the parts of a block inside gate's windows to the pipeline, or the
+// chain if there's no pipeline, starting offset samples in.  Returns how far
+// into the block that got, which is short of count only when the pipeline's
+// workers are behind.
+static unsigned int push_gated(struct range_gate * gate, struct process_chain * chain,
+                               struct pipeline * pl, const int16_t * iq, unsigned int count,
+                               uint64_t ts, unsigned int offset)
+{
+    while( offset < count ) {
+        unsigned int skip, n;
+        bool done;
+        if( !gate_next(gate, ts + offset, count - offset, &skip, &n, &done) ) {
+            gate->dropped += count - offset;
+            return count;
+        }
+        gate->dropped += skip;
+        offset += skip;
+
+        if( pl ) {
+            unsigned int pushed = pipeline_push_sc16(pl, iq + 2*offset, n, ts + offset);
+            gate->kept += pushed;
+            offset += pushed;
+            if( pushed < n )
+                break;
+        } else {
+            chain_push_sc16(chain, iq + 2*offset, n, ts + offset);
+            if( done )
+                pc_flush(&chain->pc);
+            gate->kept += n;
+            offset += n;
+        }
+    }
+    return offset;
+}
+
+void chain_push_gated(struct process_chain * chain, struct range_gate * gate, const int16_t * iq,
+                      unsigned int count, uint64_t ts)
+{
+    push_gated(gate, chain, NULL, iq, count, ts, 0);
+}
+
+static double thread_cpu_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+enum {
+    PROGRESS_SAMPLES,
+    PROGRESS_PROFILES,
+    PROGRESS_CPIS,
+    PROGRESS_DETECTIONS,
+    PROGRESS_STALLS,
+    PROGRESS_GATED,
+    NUM_PROGRESS
+};
+
+// Where each radio's chain or pipeline was the last time we fed the metrics,
+// reset whenever its processing starts over
+static uint64_t progress_last[MAX_RADIOS][NUM_PROGRESS];
+
+// Every radio's pipeline runs on this one pool, which is up for as long as
+// any of them is
+static struct task_pool shared_pool;
+static unsigned int pool_users;
+static uint64_t pool_stalls;
+
+// Feed whatever r's chain or pipeline has done since last time into the
+// metrics; their own statistics stay as they are for the final report
+static void update_metrics(struct radio * r)
+{
+    uint64_t now[NUM_PROGRESS];
+    uint64_t * last = progress_last[r->idx];
+    struct process_data_struct * pd = &r->process;
+    struct pipeline * pl = pd->pipeline;
+    if( pl ) {
+        now[PROGRESS_SAMPLES] = pl->samples;
+        now[PROGRESS_PROFILES] = pl->profiles;
+        now[PROGRESS_CPIS] = pl->cpis;
+        now[PROGRESS_DETECTIONS] = pl->map_detections;
+        now[PROGRESS_STALLS] = pl->stalls;
+    } else {
+        now[PROGRESS_SAMPLES] = pd->chain.samples;
+        now[PROGRESS_PROFILES] = pd->chain.profiles;
+        now[PROGRESS_CPIS] = pd->chain.cpis;
+        now[PROGRESS_DETECTIONS] = pd->chain.map_detections;
+        now[PROGRESS_STALLS] = 0;
+    }
+    now[PROGRESS_GATED] = pd->gate.dropped;
+    metric_add(M_PROC_SAMPLES, now[PROGRESS_SAMPLES] - last[PROGRESS_SAMPLES]);
+    metric_add(M_PROC_PROFILES, now[PROGRESS_PROFILES] - last[PROGRESS_PROFILES]);
+    metric_add(M_PROC_CPIS, now[PROGRESS_CPIS] - last[PROGRESS_CPIS]);
+    metric_add(M_PROC_DETECTIONS, now[PROGRESS_DETECTIONS] - last[PROGRESS_DETECTIONS]);
+    metric_add(M_PROC_STALLS, now[PROGRESS_STALLS] - last[PROGRESS_STALLS]);
+    metric_add(M_PROC_GATED, now[PROGRESS_GATED] - last[PROGRESS_GATED]);
+    memcpy(last, now, sizeof(now));
+}
+
+static void * process_thread(void * arg)
+{
+    struct radio * r = (struct radio *)arg;
+    struct process_data_struct * pd = &r->process;
+    struct sample_ring * ring = &r->rx.ring;
+    struct pipeline * pl = pd->pipeline;
+    unsigned int offset = 0;
+    unsigned int decim_count = 0;
+    bool decimated = false;
+
+    rt_thread_setup(RT_PROCESS, 0);
+    while( true ) {
+        struct rx_block * block = ring_peek(ring);
+        if( !block ) {
+            if( pl ) {
+                pipeline_retire(pl);
+                update_metrics(r);
+            }
+            // Drain everything that's left before we quit
+            if( !pd->running.load(std::memory_order_relaxed) )
+                break;
+            usleep(100);
+            continue;
+        }
+
+        double start = thread_cpu_secs();
+        const int16_t * iq = block->samples;
+        unsigned int count = block->count;
+        uint64_t ts = block->timestamp;
+        if( pd->decimating ) {
+            // Only once per block, however many tries the pipeline takes
+            if( offset == 0 && !decimated ) {
+                decim_count = decim_push_sc16(&pd->decim, iq, count, ts);
+                decimated = true;
+            }
+            iq = pd->decim.out_sc16;
+            count = decim_count;
+            ts = pd->decim.out_ts;
+        }
+        offset = push_gated(&pd->gate, &pd->chain, pl, iq, count, ts, offset);
+        if( pl ) {
+            double busy = thread_cpu_secs() - start;
+            pd->busy_secs += busy;
+            metric_observe(M_PROC_BLOCK_NS, (uint64_t)(busy*1e9));
+            update_metrics(r);
+
+            // If the workers are behind, hang on to the block until they
+            // catch up; the RX ring filling up behind it is our backpressure
+            if( offset < count ) {
+                usleep(100);
+                continue;
+            }
+        } else {
+            double busy = thread_cpu_secs() - start;
+            pd->busy_secs += busy;
+            metric_observe(M_PROC_BLOCK_NS, (uint64_t)(busy*1e9));
+            update_metrics(r);
+        }
+        offset = 0;
+        decimated = false;
+        ring_release(ring);
+    }
+    return NULL;
+}
+
+// What an echo of one period looks like once it's been decimated: the code
+// run through a decimator of its own, out to where the filters' tails have
+// died away.  Decimated samples come in DECIM_GAIN times bigger than Q11, so
+// this is that much smaller to keep range profiles the same size either way.
+static fftwf_complex * decimated_code(const struct waveform * wf, unsigned int * len)
+{
+    struct decimator d;
+    if( !decim_init(&d, opts.decimate) )
+        return NULL;
+
+    unsigned int total = wf->code_len + (DECIM_CIC_STAGES + DECIM_FIR_TAPS)*d.cic_ratio;
+    int16_t * in = (int16_t *)calloc(2*total, sizeof(int16_t));
+    if( !in ) {
+        decim_free(&d);
+        return NULL;
+    }
+    memcpy(in, wf->code, sizeof(int16_t)*2*wf->code_len);
+    unsigned int n = decim_push(&d, in, total, 0);
+    free(in);
+
+    float peak = 0;
+    for( unsigned int idx=0; idx<n; ++idx )
+        peak = MAX(peak, hypotf(d.out[2*idx + 0], d.out[2*idx + 1]));
+    while( n > 1 && hypotf(d.out[2*(n - 1) + 0], d.out[2*(n - 1) + 1]) < 1e-3f*peak )
+        n--;
+
+    fftwf_complex * code = fftwf_alloc_complex(n);
+    if( code ) {
+        for( unsigned int idx=0; idx<n; ++idx ) {
+            code[idx][0] = d.out[2*idx + 0]/(2048.0f*DECIM_GAIN);
+            code[idx][1] = d.out[2*idx + 1]/(2048.0f*DECIM_GAIN);
+        }
+        *len = n;
+    }
+    decim_free(&d);
+    return code;
+}
+
+// One period of exactly what we transmit (after decimation, if we're
+// decimating), to match against
+static fftwf_complex * reference_code(const struct waveform * wf, unsigned int * len)
+{
+    fftwf_complex * code;
+    if( opts.decimate > 1 ) {
+        code = decimated_code(wf, len);
+        if( !code )
+            return NULL;
+    } else {
+        code = fftwf_alloc_complex(wf->code_len);
+        if( !code )
+            return NULL;
+
+        // The chain correlates against the code itself, so undo the conjugate
+        // and reversal of the matched filter taps
+        *len = wf->code_len;
+        for( unsigned int idx=0; idx<wf->code_len; ++idx ) {
+            unsigned int rev = wf->code_len - 1 - idx;
+            code[idx][0] = wf->taps[2*rev + 0];
+            code[idx][1] = -wf->taps[2*rev + 1];
+        }
+    }
+
+    // Tapered with the range window, if there is one, to trade a little
+    // mainlobe width and SNR for lower range sidelobes
+    if( opts.range_window && strcasecmp(opts.range_window, "rect") != 0 ) {
+        const float * taper = window_get_f32(opts.range_window, *len);
+        if( !taper ) {
+            fftwf_free(code);
+            return NULL;
+        }
+        for( unsigned int idx=0; idx<*len; ++idx ) {
+            code[idx][0] *= taper[idx];
+            code[idx][1] *= taper[idx];
+        }
+    }
+    return code;
+}
+
+uint64_t process_range_offset(uint64_t epoch, double rx_delay)
+{
+    double lost = (double)(epoch % opts.decimate);
+    return opts.range_offset + (uint64_t)MAX(llround((lost + rx_delay)/opts.decimate), 0ll);
+}
+
+bool chain_init_waveform(struct process_chain * chain, const struct waveform * wf,
+                         uint64_t pri, uint64_t epoch, double rx_delay)
+{
+    unsigned int code_len;
+    fftwf_complex * code = reference_code(wf, &code_len);
+    if( !code )
+        return false;
+
+    // When the range gate will cut every PRI down to one window, one FFT
+    // that fits it all is plenty; otherwise the stream goes through whole
+    unsigned int fft_len = 0;
+    if( pri/opts.decimate >= opts.range_bins + code_len - 1 ) {
+        fft_len = 1;
+        while( fft_len < opts.range_bins + code_len - 1 )
+            fft_len *= 2;
+    }
+    bool ok = chain_init(chain, code, code_len, fft_len, opts.range_bins, pri/opts.decimate,
+                         epoch/opts.decimate + process_range_offset(epoch, rx_delay),
+                         opts.cpi_pulses, opts.doppler_window, (enum cfar_method)opts.cfar_method,
+                         opts.cfar_guard, opts.cfar_train, (float)opts.cfar_pfa);
+    fftwf_free(code);
+    return ok;
+}
+
+static bool pipeline_init_waveform(struct pipeline * pl, const struct waveform * wf)
+{
+    unsigned int code_len;
+    fftwf_complex * code = reference_code(wf, &code_len);
+    if( !code )
+        return false;
+    bool ok = pipeline_init(pl, &shared_pool, code, code_len, opts.range_bins,
+                            opts.range_bins, 0, opts.cpi_pulses, opts.doppler_window,
+                            (enum cfar_method)opts.cfar_method, opts.cfar_guard, opts.cfar_train,
+                            (float)opts.cfar_pfa);
+    fftwf_free(code);
+    return ok;
+}
+
+static profile_tap_fn profile_tap;
+
+void process_set_profile_tap(profile_tap_fn tap)
+{
+    profile_tap = tap;
+}
+
+// The first radio to start processing starts the pool, the last to stop
+// stops it
+static bool pool_get(void)
+{
+    if( pool_users == 0 ) {
+        // Every radio gets a pipeline on it
+        if( !pool_init(&shared_pool, opts.workers,
+                       MAX_RADIOS*pipeline_max_tasks(opts.workers, opts.cpi_pulses)) )
+            return false;
+        pool_stalls = 0;
+    }
+    pool_users++;
+    return true;
+}
+
+static void pool_put(void)
+{
+    if( --pool_users > 0 )
+        return;
+    pool_free(&shared_pool);
+    LOG("\nWorkers: %u, %llu tasks, %llu stolen, %llu stalls waiting on them",
+        shared_pool.num_workers, (unsigned long long)shared_pool.executed.load(),
+        (unsigned long long)shared_pool.stolen.load(), (unsigned long long)pool_stalls);
+}
+
+double process_bin_delay(const struct radio * r, double bin)
+{
+    uint64_t epoch = r->tx.epoch;
+    uint64_t start = epoch/opts.decimate + process_range_offset(epoch, r->rx_delay);
+    return ((double)start + bin)*opts.decimate - (double)epoch;
+}
+
+// How far away range bin `bin` of r's profiles is, in metres.  Without a
+// calibrated delay that includes the radio's own delay too.
+static double bin_range(const struct radio * r, unsigned int bin)
+{
+    return (process_bin_delay(r, bin) - r->rx_delay)*SPEED_OF_LIGHT/(2.0*opts.samplerate);
+}
+
+bool start_processing(struct radio * r, const struct waveform * wf)
+{
+    struct process_data_struct * pd = &r->process;
+
+    memset(progress_last[r->idx], 0, sizeof(progress_last[r->idx]));
+    pd->busy_secs = 0;
+    pd->pipeline = NULL;
+    pd->decimating = opts.decimate > 1;
+    if( pd->decimating && !decim_init(&pd->decim, opts.decimate) ) {
+        ERROR("%sFailed to set up decimation by %u\n", r->label, opts.decimate);
+        return false;
+    }
+    // Until there's a TX schedule to follow, as if there was a burst every
+    // range profile (which is as good as no gating at all)
+    gate_init(&pd->gate, NULL, opts.decimate, 0, opts.range_bins, opts.range_offset, opts.range_bins);
+    if( opts.workers > 1 ) {
+        if( !pool_get() ) {
+            ERROR("Failed to start processing workers\n");
+            goto fail_decim;
+        }
+        pd->pipeline = new struct pipeline;
+        if( !pipeline_init_waveform(pd->pipeline, wf) ) {
+            ERROR("%sFailed to set up processing pipeline\n", r->label);
+            delete pd->pipeline;
+            pd->pipeline = NULL;
+            pool_put();
+            goto fail_decim;
+        }
+    } else {
+        if( !chain_init_waveform(&pd->chain, wf, (uint64_t)(opts.pri_ms*opts.samplerate/1000), 0, 0) ) {
+            ERROR("%sFailed to set up processing chain\n", r->label);
+            goto fail_decim;
+        }
+        pd->chain.tap = profile_tap;
+        pd->chain.tap_data = r;
+    }
+
+    // Every radio's is set up just the same
+    if( r->idx == 0 ) {
+        if( pd->decimating ) {
+            char rate[9];
+            double2str_suffix(rate, (double)opts.samplerate/opts.decimate, freq_suffixes, NUM_FREQ_SUFFIXES);
+            INFO("  Decimation: %ux (%u-stage CIC %ux, %u-tap FIR 2x), processing at %ssps\n",
+                 opts.decimate, DECIM_CIC_STAGES, pd->decim.cic_ratio, DECIM_FIR_TAPS, rate);
+        }
+        const struct pulse_compressor * pc = pd->pipeline ? &pd->pipeline->workers[0].pc : &pd->chain.pc;
+        if( pc->direct ) {
+            INFO("  Pulse compression: %u-chip binary phase code, in the time domain\n", pc->code_len);
+        } else if( pd->pipeline ) {
+            INFO("  Pulse compression: %u workers, one %u-point FFT per pulse, %u CPIs in flight\n",
+                 opts.workers, pc->fft_len, pd->pipeline->num_slots);
+        } else {
+            INFO("  Pulse compression: %u-point FFT, %u samples per FFT\n", pc->fft_len, pc->step);
+        }
+        if( pc->direct && pd->pipeline )
+            INFO("  Workers: %u, %u CPIs in flight\n", opts.workers, pd->pipeline->num_slots);
+        INFO("  Range window: %s\n", opts.range_window);
+        INFO("  CPI: %u pulses, %s window\n", opts.cpi_pulses, opts.doppler_window);
+        INFO("  CFAR: %s, %u guard, %u training cells, Pfa %g\n", opts.cfar_method == CFAR_OS ? "OS" : "CA",
+             opts.cfar_guard, opts.cfar_train, opts.cfar_pfa);
+    }
+
+    pd->running = true;
+    if( pthread_create(&pd->thread, NULL, process_thread, r) != 0 ) {
+        ERROR("%sFailed to start processing thread\n", r->label);
+        pd->running = false;
+        if( pd->pipeline ) {
+            pipeline_free(pd->pipeline);
+            delete pd->pipeline;
+            pd->pipeline = NULL;
+            pool_put();
+        } else {
+            chain_free(&pd->chain);
+        }
+        goto fail_decim;
+    }
+    return true;
+
+fail_decim:
+    if( pd->decimating )
+        decim_free(&pd->decim);
+    return false;
+}
+
+void stop_processing(struct radio * r)
+{
+    struct process_data_struct * pd = &r->process;
+
+    pd->running = false;
+    pthread_join(pd->thread, NULL);
+
+    uint64_t samples, profiles, cpis, profile_detections, map_detections, dropped;
+    unsigned int last_cpi_detections;
+    struct detection det;
+    struct pipeline * pl = pd->pipeline;
+    if( pl ) {
+        pipeline_free(pl);
+        update_metrics(r);
+        pd->busy_secs += pl->busy_secs;
+        samples = pl->samples;
+        profiles = pl->profiles;
+        cpis = pl->cpis;
+        profile_detections = pl->profile_detections;
+        map_detections = pl->map_detections;
+        dropped = pl->dropped;
+        last_cpi_detections = pl->last_cpi_detections;
+        det = pl->last_cpi_strongest;
+        pool_stalls += pl->stalls;
+    } else {
+        struct process_chain * chain = &pd->chain;
+        samples = chain->samples;
+        profiles = chain->profiles;
+        cpis = chain->cpis;
+        profile_detections = chain->profile_detections;
+        map_detections = chain->map_detections;
+        dropped = chain->cfar.dropped;
+        last_cpi_detections = chain->last_cpi_detections;
+        det = chain->last_cpi_strongest;
+    }
+
+    // The gate saw everything, whether or not it went any further
+    uint64_t gated = pd->gate.kept + pd->gate.dropped;
+    double signal_secs = (double)gated*opts.decimate/opts.samplerate;
+    LOG("\n%sProcessing: %llu samples, %llu range profiles, %llu CPIs, %.3fs CPU for %.3fs of signal "
+        "(%.1fx real time)",
+        r->label, (unsigned long long)samples, (unsigned long long)profiles, (unsigned long long)cpis,
+        pd->busy_secs, signal_secs, pd->busy_secs > 0 ? signal_secs/pd->busy_secs : 0.0);
+    if( pd->gate.enabled && gated > 0 ) {
+        LOG("\n%sRange gate: %llu of %llu samples processed (%.1f%%), the rest thrown away", r->label,
+            (unsigned long long)pd->gate.kept, (unsigned long long)gated, 100.0*pd->gate.kept/gated);
+    }
+    if( pl )
+        pool_put();
+    LOG("\n%sDetections: %llu in range profiles, %llu in range-Doppler maps, %llu dropped",
+        r->label, (unsigned long long)profile_detections, (unsigned long long)map_detections,
+        (unsigned long long)dropped);
+    if( last_cpi_detections > 0 ) {
+        INFO("\n%sLast CPI: %u detections, strongest at range bin %u (%.0fm), Doppler bin %u, "
+             "%.1fdB over noise", r->label, last_cpi_detections, det.range_bin,
+             bin_range(r, det.range_bin), det.doppler_bin, 10*log10f(det.power/det.noise));
+    }
+
+    if( pl ) {
+        delete pl;
+        pd->pipeline = NULL;
+    } else {
+        chain_free(&pd->chain);
+    }
+    if( pd->decimating )
+        decim_free(&pd->decim);
+}
+
+void process_set_framing(struct radio * r, uint64_t epoch, uint64_t pri)
+{
+    struct process_data_struct * pd = &r->process;
+
+    // Processing counts in decimated samples, and range profiles start where
+    // the range gate does
+    uint64_t offset = process_range_offset(epoch, r->rx_delay);
+    epoch /= opts.decimate;
+    pri /= opts.decimate;
+    unsigned int code_len;
+    if( pd->pipeline ) {
+        pd->pipeline->epoch = epoch + offset;
+        pd->pipeline->pri = MAX(pri, (uint64_t)pd->pipeline->range_bins);
+        code_len = pd->pipeline->code_len;
+    } else {
+        pd->chain.epoch = epoch + offset;
+        pd->chain.pri = MAX(pri, (uint64_t)pd->chain.range_bins);
+        code_len = pd->chain.pc.code_len;
+    }
+    gate_init(&pd->gate, &r->tx, opts.decimate, epoch, pri, offset, opts.range_bins + code_len - 1);
+
+    if( r->idx == 0 ) {
+        if( pd->gate.enabled ) {
+            INFO("  Range gate: %u of every %llu samples, %.0fm to %.0fm\n", pd->gate.len,
+                 (unsigned long long)pd->gate.pri, bin_range(r, 0), bin_range(r, opts.range_bins));
+        } else {
+            INFO("  Range gate: none, range profiles take up the whole PRI\n");
+        }
+    }
+}
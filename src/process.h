@@ -0,0 +1,133 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "compress.h"
+#include "doppler.h"
+#include "cfar.h"
+#include "decimate.h"
+#include "gate.h"
+
+// Most detections we keep from a single range profile or range-Doppler map
+#define CHAIN_MAX_DETECTIONS 4096
+
+// Something to hand every range profile to as it's formed, e.g. --calibrate
+typedef void (*profile_tap_fn)(void * user_data, const fftwf_complex * profile,
+                               unsigned int range_bins, uint64_t ts);
+
+// Everything that happens to received samples, in order.  Kept separate from
+// the thread that drives it so the same chain can be run on live or recorded
+// data.
+struct process_chain {
+    struct pulse_compressor pc;
+
+    // Range profile framing: profile k covers compressed output timestamps
+    // [epoch + k*pri, epoch + k*pri + range_bins)
+    uint64_t epoch;
+    uint64_t pri;
+    unsigned int range_bins;
+
+    // The profile we're currently filling in
+    fftwf_complex * profile;
+    uint64_t profile_ts;
+    unsigned int profile_fill;
+
+    // Gets every profile as it's done, if set
+    profile_tap_fn tap;
+    void * tap_data;
+
+    // Profiles get stacked up into CPIs for range-Doppler processing
+    struct range_doppler rd;
+
+    // Run over every range profile and every range-Doppler map
+    struct cfar cfar;
+
+    // Statistics
+    uint64_t samples;
+    uint64_t profiles;
+    uint64_t cpis;
+    uint64_t profile_detections;
+    uint64_t map_detections;
+    unsigned int last_cpi_detections;
+    struct detection last_cpi_strongest;
+};
+
+// fft_len is the pulse compressor's (0 for its own pick)
+bool chain_init(struct process_chain * chain, const fftwf_complex * code, unsigned int code_len,
+                unsigned int fft_len, unsigned int range_bins, uint64_t pri, uint64_t epoch,
+                unsigned int cpi_pulses, const char * doppler_window,
+                enum cfar_method cfar_method, unsigned int cfar_guard, unsigned int cfar_train,
+                float cfar_pfa);
+
+struct waveform;
+
+// chain_init() matched to waveform wf, with everything else from opts.  pri
+// and epoch are at the RX sample rate, and get divided down if we're
+// decimating; feed it decimated samples in that case.  Range profiles start
+// process_range_offset(epoch, rx_delay) samples after each burst.
+bool chain_init_waveform(struct process_chain * chain, const struct waveform * wf,
+                         uint64_t pri, uint64_t epoch, double rx_delay);
+
+// How many processing samples after epoch/opts.decimate range bin 0 starts,
+// with bursts every PRI from epoch (at the RX sample rate): opts.range_offset,
+// plus however long the radio takes to get from a TX timestamp to the same
+// RX timestamp (rx_delay, also at the RX sample rate), plus whatever dividing
+// the epoch down left behind
+uint64_t process_range_offset(uint64_t epoch, double rx_delay);
+
+// Samples at the RX sample rate from one of r's bursts going out to range
+// bin `bin` of the profile after it coming in, r->rx_delay included
+double process_bin_delay(const struct radio * r, double bin);
+
+void chain_free(struct process_chain * chain);
+void chain_push_sc16(struct process_chain * chain, const int16_t * iq, unsigned int count, uint64_t ts);
+
+// Just the parts of count samples starting at ts that are inside one of
+// gate's windows, each one flushed through the chain once it's in
+void chain_push_gated(struct process_chain * chain, struct range_gate * gate, const int16_t * iq,
+                      unsigned int count, uint64_t ts);
+
+struct pipeline;
+
+struct process_data_struct {
+    pthread_t thread;
+    std::atomic<bool> running;
+
+    // With --decimate, RX samples go through here before anything else
+    bool decimating;
+    struct decimator decim;
+
+    // Then only the parts of them inside a range gate carry on
+    struct range_gate gate;
+
+    // With more than one worker everything runs through the pipeline (see
+    // pipeline.h), otherwise through the chain on the processing thread
+    struct process_chain chain;
+    struct pipeline * pipeline;
+
+    // CPU time spent in the chain (or the pipeline and its workers), to
+    // compare against how much signal that was
+    double busy_secs;
+};
+
+struct radio;
+
+// Starts a thread that pulls blocks off of r's RX ring and runs them through
+// the processing chain, matched to waveform wf.  With more than one worker,
+// every radio's pipeline runs on one pool of them that's started along with
+// the first and stopped along with the last.
+bool start_processing(struct radio * r, const struct waveform * wf);
+void stop_processing(struct radio * r);
+
+// Every chain started from now on hands its range profiles to tap, with its
+// radio as the user data.  The pipeline doesn't, so use one worker.
+void process_set_profile_tap(profile_tap_fn tap);
+
+// Line r's range profiles up with bursts that go out every pri samples
+// starting at epoch (at the RX sample rate, before any decimation), and gate
+// the samples after each burst r's TX schedule records, allowing for
+// r->rx_delay.  Only call this while RX isn't running.
+void process_set_framing(struct radio * r, uint64_t epoch, uint64_t pri);
+#endif
@@ -0,0 +1,178 @@
+#include <libbladeRF.h>
+#include "radio.h"
+#include "options.h"
+#include "util.h"
+#include "waveform.h"
+#include "metrics.h"
+#include "calibrate.h"
+#include <stdio.h>
+#include <string.h>
+
+// Tries at reading two clocks back to back, of which we keep the closest
+#define ALIGN_TRIES 20
+
+struct radio radios[MAX_RADIOS];
+unsigned int num_radios;
+
+// Radio r's clock relative to radio 0's.  Reading r's clock between two reads
+// of radio 0's pins it down to somewhere in between; with the tightest of a
+// few tries that's good to within however long a timestamp read takes
+// (usually tens of microseconds over USB).  A hardware trigger would do much
+// better, but this is plenty to get the boards' bursts into the same range
+// bin or two, and once measured boards on a shared clock stay put.
+static bool measure_clock_offset(struct radio * r)
+{
+    struct device_data_struct * ref = &radios[0].device;
+    uint64_t best_rtt = UINT64_MAX;
+
+    for( unsigned int idx=0; idx<ALIGN_TRIES; ++idx ) {
+        uint64_t before, ts, after;
+        int status = device_get_timestamp(ref, BLADERF_MODULE_TX, &before);
+        if( status == 0 )
+            status = device_get_timestamp(&r->device, BLADERF_MODULE_TX, &ts);
+        if( status == 0 )
+            status = device_get_timestamp(ref, BLADERF_MODULE_TX, &after);
+        if( status != 0 ) {
+            ERROR("%sFailed to get TX timestamp: %s\n", r->label, bladerf_strerror(status));
+            return false;
+        }
+        if( after - before < best_rtt ) {
+            best_rtt = after - before;
+            r->clock_offset = (int64_t)(before + (after - before)/2) - (int64_t)ts;
+        }
+    }
+    LOG("%sClock is %lld samples behind radio 0's, give or take %llu\n", r->label,
+        (long long)r->clock_offset, (unsigned long long)(best_rtt + 1)/2);
+    return true;
+}
+
+// Move every radio's epoch to the same instant, the earliest one that's no
+// earlier than any of them had already picked
+static void align_epochs(void)
+{
+    int64_t common = 0;
+    for( unsigned int idx=0; idx<num_radios; ++idx )
+        common = MAX(common, (int64_t)radios[idx].tx.epoch + radios[idx].clock_offset);
+
+    for( unsigned int idx=0; idx<num_radios; ++idx ) {
+        struct radio * r = &radios[idx];
+        r->tx.epoch = (uint64_t)(common - r->clock_offset);
+        r->device.next_tx_time = r->tx.epoch;
+    }
+    metric_set(M_TX_EPOCH, (int64_t)radios[0].tx.epoch);
+    INFO("  Aligned epoch: %lld on radio 0's clock\n", (long long)common);
+}
+
+bool start_radios(const struct waveform * wf)
+{
+    num_radios = opts.num_devices;
+    for( unsigned int idx=0; idx<num_radios; ++idx ) {
+        struct radio * r = &radios[idx];
+        r->idx = idx;
+        if( num_radios > 1 )
+            snprintf(r->label, sizeof(r->label), "radio %u: ", idx);
+        else
+            r->label[0] = '\0';
+        r->clock_offset = 0;
+        r->rx_delay = 0;
+        r->processing = r->opened = r->receiving = r->capturing = r->transmitting = false;
+    }
+
+    // Processing first, so it's ready and waiting by the time samples show up
+    for( unsigned int idx=0; idx<num_radios; ++idx ) {
+        if( !start_processing(&radios[idx], wf) )
+            goto fail;
+        radios[idx].processing = true;
+    }
+
+    for( unsigned int idx=0; idx<num_radios; ++idx ) {
+        if( !open_device(&radios[idx].device, opts.devstrs[idx]) )
+            goto fail;
+        radios[idx].opened = true;
+
+        // Unless that's what we're here to measure
+        if( !opts.calibrate )
+            calibration_load(&radios[idx]);
+    }
+    if( opts.align_timestamps ) {
+        for( unsigned int idx=1; idx<num_radios; ++idx ) {
+            if( !measure_clock_offset(&radios[idx]) )
+                goto fail;
+        }
+    }
+
+    // Figure out when our first burst goes out, and line range profiles up with it
+    for( unsigned int idx=0; idx<num_radios; ++idx ) {
+        if( !tx_init(&radios[idx], wf) )
+            goto fail;
+    }
+    if( opts.align_timestamps )
+        align_epochs();
+    for( unsigned int idx=0; idx<num_radios; ++idx )
+        process_set_framing(&radios[idx], radios[idx].tx.epoch, radios[idx].tx.pri);
+
+    // Start pulling samples off of them
+    for( unsigned int idx=0; idx<num_radios; ++idx ) {
+        struct radio * r = &radios[idx];
+        if( !start_rx(r) )
+            goto fail;
+        r->receiving = true;
+        if( opts.capture[0] != '\0' ) {
+            if( !start_capture(r) )
+                goto fail;
+            r->capturing = true;
+        }
+    }
+
+    for( unsigned int idx=0; idx<num_radios; ++idx ) {
+        if( !start_tx(&radios[idx]) )
+            goto fail;
+        radios[idx].transmitting = true;
+    }
+    return true;
+
+fail:
+    stop_radios();
+    return false;
+}
+
+bool radios_failed(void)
+{
+    for( unsigned int idx=0; idx<num_radios; ++idx ) {
+        if( radios[idx].receiving && radios[idx].rx.failed.load(std::memory_order_relaxed) )
+            return true;
+        if( radios[idx].transmitting && radios[idx].tx.failed.load(std::memory_order_relaxed) )
+            return true;
+    }
+    return false;
+}
+
+void stop_radios(void)
+{
+    for( unsigned int idx=0; idx<num_radios; ++idx ) {
+        if( radios[idx].transmitting )
+            stop_tx(&radios[idx]);
+    }
+    for( unsigned int idx=0; idx<num_radios; ++idx ) {
+        if( radios[idx].receiving )
+            stop_rx(&radios[idx]);
+        if( radios[idx].capturing )
+            stop_capture(&radios[idx]);
+    }
+    if( radios[0].receiving )
+        rx_report();
+    for( unsigned int idx=0; idx<num_radios; ++idx ) {
+        if( radios[idx].processing )
+            stop_processing(&radios[idx]);
+    }
+    if( radios[0].transmitting )
+        tx_report();
+    for( unsigned int idx=0; idx<num_radios; ++idx ) {
+        struct radio * r = &radios[idx];
+        if( r->receiving )
+            rx_cleanup(r);
+        if( r->opened )
+            close_device(&r->device);
+        r->processing = r->opened = r->receiving = r->capturing = r->transmitting = false;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef RADIO_H
+#define RADIO_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "device.h"
+#include "rx.h"
+#include "tx.h"
+#include "process.h"
+#include "capture.h"
+
+// Most --device's we'll run at once
+#define MAX_RADIOS 8
+
+/*
+ * Everything about one board: the device and its timestamps, the threads
+ * that move its samples in and out, the processing thread that runs its
+ * samples through the chain, and its capture.  With more than one worker
+ * every radio's processing shares the one pool of workers (see process.h).
+ *
+ * Each board keeps its own clock, so timestamps only mean anything next to
+ * others from the same radio.  Boards that share a reference clock and were
+ * started off the same trigger tick together though, and with
+ * --align-timestamps we measure how far apart their counters are and
+ * schedule every board's bursts for the same instant.
+ */
+struct radio {
+    unsigned int idx;
+
+    // What goes in front of anything we say about this radio: nothing when
+    // it's the only one, "radio N: " otherwise
+    char label[16];
+
+    struct device_data_struct device;
+    struct tx_data_struct tx;
+    struct rx_data_struct rx;
+    struct process_data_struct process;
+    struct capture_data_struct capture;
+
+    // Radio 0's clock minus ours, in samples, if --align-timestamps measured
+    // it (0 otherwise)
+    int64_t clock_offset;
+
+    // Samples from a TX timestamp to the RX timestamp an echo from zero range
+    // shows up at, as measured by --calibrate (0 if it hasn't been)
+    double rx_delay;
+
+    // What start_radios() got going, so stop_radios() knows what to stop
+    bool processing;
+    bool opened;
+    bool receiving;
+    bool capturing;
+    bool transmitting;
+};
+extern struct radio radios[MAX_RADIOS];
+extern unsigned int num_radios;
+
+struct waveform;
+
+// Bring up a radio for every --device, all transmitting wf: processing, the
+// device, the TX schedule (lined up across boards with --align-timestamps),
+// RX, capture, and then TX itself.  If any of it fails everything that did
+// start is stopped again.
+bool start_radios(const struct waveform * wf);
+
+// Stop everything start_radios() started, in order, report on how RX and TX
+// went over every radio, and close the devices
+void stop_radios(void);
+
+// Whether any radio has stopped receiving or transmitting for good, in which
+// case it's time to stop_radios()
+bool radios_failed(void);
+#endif
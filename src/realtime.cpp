@@ -0,0 +1,201 @@
+#include <libbladeRF.h>
+#include "realtime.h"
+#include "options.h"
+#include "util.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define DEFAULT_HUGE_PAGE_SIZE (2u << 20)
+
+struct rt_role_desc {
+    const char * name;
+    int priority;
+};
+
+// Samples coming in can't wait, bursts going out can wait even less, and
+// processing has a ring's worth of slack
+static const struct rt_role_desc role_descs[] = {
+    { "TX",         80 },
+    { "RX",         75 },
+    { "Processing", 60 },
+    { "Worker",     50 },
+};
+
+static struct {
+    // Where we were allowed to run at startup, for threads with no cores of
+    // their own to go back to (instead of inheriting whoever started them)
+    cpu_set_t all_cpus;
+    bool have_all_cpus;
+} rt_data;
+
+bool rt_parse_cpus(const char * str, cpu_set_t * set)
+{
+    CPU_ZERO(set);
+    const char * p = str;
+    while( *p != '\0' ) {
+        char * end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if( end == p || first < 0 )
+            return false;
+        p = end;
+        if( *p == '-' ) {
+            last = strtol(p + 1, &end, 10);
+            if( end == p + 1 || last < first )
+                return false;
+            p = end;
+        }
+        if( last >= CPU_SETSIZE )
+            return false;
+        for( long cpu=first; cpu<=last; ++cpu )
+            CPU_SET(cpu, set);
+        if( *p == ',' )
+            ++p;
+        else if( *p != '\0' )
+            return false;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+void rt_init(void)
+{
+    if( !opts.realtime )
+        return;
+
+    rt_data.have_all_cpus = sched_getaffinity(0, sizeof(rt_data.all_cpus), &rt_data.all_cpus) == 0;
+
+    // Everything from here on gets faulted in as it's mapped, and stays put
+    if( mlockall(MCL_CURRENT | MCL_FUTURE) != 0 ) {
+        ERROR("  Realtime: couldn't lock memory: %s\n", strerror(errno));
+    } else {
+        LOG("  Realtime: memory locked\n");
+    }
+}
+
+void rt_thread_setup(enum rt_role role, unsigned int idx)
+{
+    if( !opts.realtime )
+        return;
+
+    const struct rt_role_desc * desc = &role_descs[role];
+    const char * cpus = role == RT_TX ? opts.tx_cpus : role == RT_RX ? opts.rx_cpus : opts.worker_cpus;
+    char name[32], where[64];
+    if( role == RT_WORKER )
+        snprintf(name, sizeof(name), "%s %u", desc->name, idx);
+    else
+        snprintf(name, sizeof(name), "%s", desc->name);
+
+    cpu_set_t set;
+    bool pin = false;
+    if( cpus[0] != '\0' && rt_parse_cpus(cpus, &set) ) {
+        snprintf(where, sizeof(where), "CPUs %s", cpus);
+        if( role == RT_WORKER ) {
+            // Each worker gets one core, handed out in order
+            unsigned int nth = idx % (unsigned int)CPU_COUNT(&set);
+            for( int cpu=0; cpu<CPU_SETSIZE; ++cpu ) {
+                if( CPU_ISSET(cpu, &set) && nth-- == 0 ) {
+                    CPU_ZERO(&set);
+                    CPU_SET(cpu, &set);
+                    snprintf(where, sizeof(where), "CPU %d", cpu);
+                    break;
+                }
+            }
+        }
+        pin = true;
+    } else if( rt_data.have_all_cpus ) {
+        set = rt_data.all_cpus;
+        snprintf(where, sizeof(where), "any CPU");
+    } else {
+        snprintf(where, sizeof(where), "whichever CPUs it inherited");
+    }
+
+    bool ok = true;
+    if( pin || rt_data.have_all_cpus ) {
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if( err != 0 ) {
+            ERROR("  Realtime: couldn't put %s thread on %s: %s\n", name, where, strerror(err));
+            ok = false;
+        }
+    }
+
+    struct sched_param sp;
+    memset(&sp, 0, sizeof(sp));
+    sp.sched_priority = desc->priority;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+    if( err != 0 ) {
+        ERROR("  Realtime: couldn't make %s thread SCHED_FIFO: %s\n", name, strerror(err));
+        ok = false;
+    }
+
+    if( ok ) {
+        LOG("  Realtime: %s thread at SCHED_FIFO priority %d on %s\n", name, desc->priority, where);
+    }
+}
+
+// From /proc/meminfo, which is where the kernel tells us what MAP_HUGETLB gets
+static size_t huge_page_size(void)
+{
+    static size_t size = 0;
+    if( size != 0 )
+        return size;
+
+    size = DEFAULT_HUGE_PAGE_SIZE;
+    FILE * f = fopen("/proc/meminfo", "r");
+    if( !f )
+        return size;
+    char line[128];
+    unsigned long kb;
+    while( fgets(line, sizeof(line), f) ) {
+        if( sscanf(line, "Hugepagesize: %lu kB", &kb) == 1 && kb > 0 ) {
+            size = (size_t)kb*1024;
+            break;
+        }
+    }
+    fclose(f);
+    return size;
+}
+
+// Hugepage mappings have to be unmapped a whole hugepage at a time, so with
+// --realtime everything is that size, whichever kind of page it ended up on
+static size_t map_len(size_t len)
+{
+    size_t page = opts.realtime ? huge_page_size() : (size_t)sysconf(_SC_PAGESIZE);
+    return (len + page - 1)/page*page;
+}
+
+void * rt_alloc(const char * what, size_t len)
+{
+    len = map_len(len);
+    void * p = MAP_FAILED;
+    if( opts.realtime ) {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if( p != MAP_FAILED ) {
+            LOG("  Realtime: %s in %zu hugepages\n", what, len/huge_page_size());
+        } else {
+            ERROR("  Realtime: no hugepages for %s (%s), using ordinary pages\n", what, strerror(errno));
+        }
+    }
+    if( p == MAP_FAILED ) {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if( p == MAP_FAILED )
+            return NULL;
+        // Transparent hugepages are the next best thing, if they're enabled
+        if( opts.realtime )
+            madvise(p, len, MADV_HUGEPAGE);
+    }
+
+    // Touch everything now so we don't take page faults while streaming
+    memset(p, 0, len);
+    return p;
+}
+
+void rt_free(void * p, size_t len)
+{
+    if( p )
+        munmap(p, map_len(len));
+}
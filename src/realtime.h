@@ -0,0 +1,42 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <sched.h>
+
+/*
+ * The real-time host profile (--realtime).
+ *
+ * Late bursts and overruns on a loaded host mostly come down to a thread
+ * getting preempted or migrated, or taking a page fault, at the wrong time.
+ * With the profile on, every page we have or will have is locked in memory,
+ * the threads that move and process samples run SCHED_FIFO pinned to the
+ * cores they're given, and sample buffers come from hugepages.  Everything
+ * is best effort: whatever the host won't let us do gets reported and we run
+ * without it.  Without --realtime all of this does nothing.
+ */
+
+// Who's asking, which decides priority and cores
+enum rt_role {
+    RT_TX,
+    RT_RX,
+    RT_PROCESS,
+    RT_WORKER,
+};
+
+// Parse a CPU list like "2" or "0,4-7" into set, false if it isn't one
+bool rt_parse_cpus(const char * str, cpu_set_t * set);
+
+// Lock our memory, once at startup
+void rt_init(void);
+
+// Set up the calling thread for its role; workers get the idx'th of the
+// worker cores (wrapping around) to themselves
+void rt_thread_setup(enum rt_role role, unsigned int idx);
+
+// Zeroed, page aligned memory for sample buffers, already faulted in.  With
+// --realtime it's from hugepages when the system has any to spare.  what
+// names it when we report how that went.  Free with rt_free(), same len.
+void * rt_alloc(const char * what, size_t len);
+void rt_free(void * p, size_t len);
+#endif
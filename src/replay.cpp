@@ -0,0 +1,266 @@
+#include <libbladeRF.h>
+#include "options.h"
+#include "util.h"
+#include "process.h"
+#include "waveform.h"
+#include "replay.h"
+#include <atomic>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Samples per push into the chain for files without block metadata
+#define REPLAY_CHUNK 65536
+
+struct replay_block {
+    uint64_t offset;
+    uint64_t timestamp;
+    unsigned int count;
+};
+
+struct replay_file {
+    const char * path;
+
+    // From the capture metadata, if there is any
+    bool has_meta;
+    char waveform[WAVEFORM_NAME_LEN];
+    uint64_t epoch;
+    uint64_t pri;
+    double rx_delay;
+    std::vector<struct replay_block> blocks;
+
+    // How it went
+    bool ok;
+    uint64_t samples;
+    uint64_t profiles;
+    uint64_t cpis;
+    uint64_t detections;
+    double secs;
+};
+
+static struct {
+    const struct waveform * wf;
+    struct replay_file * files;
+    unsigned int num_files;
+    std::atomic<unsigned int> next;
+} replay;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Pick up foo.meta for foo.sc16, as written by --capture
+static void read_meta(struct replay_file * rf)
+{
+    size_t len = strlen(rf->path);
+    if( len < 5 || strcmp(rf->path + len - 5, ".sc16") != 0 )
+        return;
+
+    char * meta_path = strdup(rf->path);
+    strcpy(meta_path + len - 5, ".meta");
+    FILE * f = fopen(meta_path, "r");
+    free(meta_path);
+    if( !f )
+        return;
+
+    char line[256];
+    while( fgets(line, sizeof(line), f) ) {
+        unsigned long long a, b;
+        unsigned int count;
+        char name[WAVEFORM_NAME_LEN];
+        if( sscanf(line, "block %llu %llu %u", &a, &b, &count) == 3 ) {
+            struct replay_block block = { a, b, count };
+            rf->blocks.push_back(block);
+        } else if( sscanf(line, "tx_epoch %llu", &a) == 1 ) {
+            rf->epoch = a;
+        } else if( sscanf(line, "pri %llu", &a) == 1 ) {
+            rf->pri = a;
+        } else if( sscanf(line, "rx_delay %lf", &rf->rx_delay) == 1 ) {
+        } else if( sscanf(line, "waveform %63s", name) == 1 ) {
+            snprintf(rf->waveform, sizeof(rf->waveform), "%s", name);
+        }
+    }
+    fclose(f);
+    rf->has_meta = true;
+}
+
+// Through the decimator first, if we're decimating, then the range gate
+static void replay_push(struct process_chain * chain, struct decimator * d, struct range_gate * gate,
+                        const int16_t * iq, unsigned int count, uint64_t ts)
+{
+    if( d->factor != 0 ) {
+        unsigned int n = decim_push_sc16(d, iq, count, ts);
+        chain_push_gated(chain, gate, d->out_sc16, n, d->out_ts);
+    } else {
+        chain_push_gated(chain, gate, iq, count, ts);
+    }
+}
+
+static bool replay_file(struct replay_file * rf)
+{
+    struct process_chain chain;
+    struct decimator decim;
+    struct range_gate gate;
+    const int16_t * iq = NULL;
+    uint64_t num_samples = 0;
+    struct stat st;
+    bool ok = false;
+    double start = now_secs();
+
+    int fd = open(rf->path, O_RDONLY);
+    if( fd < 0 ) {
+        ERROR("Couldn't open %s: %s\n", rf->path, strerror(errno));
+        return false;
+    }
+    if( fstat(fd, &st) != 0 || st.st_size < (off_t)(2*sizeof(int16_t)) ) {
+        ERROR("Nothing to replay in %s\n", rf->path);
+        goto out_close;
+    }
+    num_samples = st.st_size/(2*sizeof(int16_t));
+    iq = (const int16_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if( iq == MAP_FAILED ) {
+        ERROR("Couldn't map %s: %s\n", rf->path, strerror(errno));
+        iq = NULL;
+        goto out_close;
+    }
+    madvise((void *)iq, st.st_size, MADV_SEQUENTIAL);
+
+    {
+        // Match against whatever the capture says was transmitted, if we have it
+        const struct waveform * wf = replay.wf;
+        uint64_t pri = (uint64_t)(opts.pri_ms*opts.samplerate/1000);
+        uint64_t epoch = 0;
+        read_meta(rf);
+        if( rf->has_meta ) {
+            if( rf->waveform[0] != '\0' && waveform_get(rf->waveform) )
+                wf = waveform_get(rf->waveform);
+            if( rf->pri != 0 )
+                pri = rf->pri;
+            epoch = rf->epoch;
+        }
+
+        if( !chain_init_waveform(&chain, wf, pri, epoch, rf->rx_delay) ) {
+            ERROR("Failed to set up processing chain for %s\n", rf->path);
+            goto out_unmap;
+        }
+        // Captures don't say which bursts actually went out, so gate after
+        // every one that should have
+        gate_init(&gate, NULL, opts.decimate, epoch/opts.decimate, pri/opts.decimate,
+                  process_range_offset(epoch, rf->rx_delay), opts.range_bins + chain.pc.code_len - 1);
+    }
+    memset(&decim, 0, sizeof(decim));
+    if( opts.decimate > 1 && !decim_init(&decim, opts.decimate) ) {
+        chain_free(&chain);
+        goto out_unmap;
+    }
+
+    if( rf->has_meta && !rf->blocks.empty() ) {
+        for( size_t idx=0; idx<rf->blocks.size(); ++idx ) {
+            const struct replay_block * block = &rf->blocks[idx];
+            if( block->offset >= num_samples )
+                break;
+            unsigned int count = (unsigned int)MIN((uint64_t)block->count, num_samples - block->offset);
+            replay_push(&chain, &decim, &gate, iq + 2*block->offset, count, block->timestamp);
+        }
+    } else {
+        for( uint64_t offset=0; offset<num_samples; offset += REPLAY_CHUNK ) {
+            unsigned int count = (unsigned int)MIN((uint64_t)REPLAY_CHUNK, num_samples - offset);
+            replay_push(&chain, &decim, &gate, iq + 2*offset, count, offset);
+        }
+    }
+
+    rf->samples = (gate.kept + gate.dropped)*opts.decimate;
+    rf->profiles = chain.profiles;
+    rf->cpis = chain.cpis;
+    rf->detections = chain.map_detections;
+    chain_free(&chain);
+    if( decim.factor != 0 )
+        decim_free(&decim);
+    ok = true;
+
+out_unmap:
+    munmap((void *)iq, st.st_size);
+out_close:
+    close(fd);
+    rf->secs = now_secs() - start;
+    return ok;
+}
+
+static void * replay_thread(void * arg)
+{
+    while( true ) {
+        unsigned int idx = replay.next.fetch_add(1);
+        if( idx >= replay.num_files )
+            break;
+        replay.files[idx].ok = replay_file(&replay.files[idx]);
+    }
+    return NULL;
+}
+
+bool run_replay(const struct waveform * wf)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int num_threads = (unsigned int)MIN((long)opts.num_replay, MAX(cores, 1L));
+    std::vector<pthread_t> threads(num_threads);
+    bool ok = true;
+
+    replay.wf = wf;
+    replay.num_files = opts.num_replay;
+    replay.files = new struct replay_file[opts.num_replay]();
+    replay.next = 0;
+    for( unsigned int idx=0; idx<opts.num_replay; ++idx )
+        replay.files[idx].path = opts.replay[idx];
+
+    LOG("Replaying %u files on %u threads\n", opts.num_replay, num_threads);
+    double start = now_secs();
+    unsigned int started = 0;
+    for( ; started<num_threads; ++started ) {
+        if( pthread_create(&threads[started], NULL, replay_thread, NULL) != 0 ) {
+            ERROR("Failed to start replay thread\n");
+            break;
+        }
+    }
+    // Whatever threads we did get will work through all the files
+    if( started == 0 )
+        replay_thread(NULL);
+    for( unsigned int idx=0; idx<started; ++idx )
+        pthread_join(threads[idx], NULL);
+    double secs = now_secs() - start;
+
+    uint64_t samples = 0, profiles = 0, cpis = 0, detections = 0;
+    for( unsigned int idx=0; idx<opts.num_replay; ++idx ) {
+        struct replay_file * rf = &replay.files[idx];
+        if( !rf->ok ) {
+            ok = false;
+            continue;
+        }
+        INFO("  %s: %llu samples, %llu range profiles, %llu CPIs, %llu detections in %.3fs%s\n",
+             rf->path, (unsigned long long)rf->samples, (unsigned long long)rf->profiles,
+             (unsigned long long)rf->cpis, (unsigned long long)rf->detections, rf->secs,
+             rf->has_meta ? "" : " (no metadata)");
+        samples += rf->samples;
+        profiles += rf->profiles;
+        cpis += rf->cpis;
+        detections += rf->detections;
+    }
+    delete[] replay.files;
+    replay.files = NULL;
+
+    double rate = secs > 0 ? samples/secs : 0;
+    printf("Replay: %llu samples, %llu range profiles, %llu CPIs, %llu detections in %.3fs\n",
+           (unsigned long long)samples, (unsigned long long)profiles, (unsigned long long)cpis,
+           (unsigned long long)detections, secs);
+    printf("        %.2f Msamples/s, %.1fx real time at %u samples/s\n",
+           rate/1e6, rate/opts.samplerate, opts.samplerate);
+    return ok;
+}
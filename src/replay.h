@@ -0,0 +1,14 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+#include <stdbool.h>
+#include <stdint.h>
+
+struct waveform;
+
+// Run every file in opts.replay through the processing chain as fast as we
+// can, one file per core at a time, and report how fast that was.  Files
+// with a capture .meta next to them get their hardware timestamps, waveform
+// and PRI framing from it; the rest are taken as one continuous stretch of
+// samples matched against wf, with bursts every opts.pri_ms from sample 0.
+bool run_replay(const struct waveform * wf);
+#endif
@@ -0,0 +1,64 @@
+#include "ring.h"
+#include "realtime.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Everything but the sample memory
+static bool ring_setup(struct sample_ring * ring, unsigned int num_blocks, unsigned int block_size)
+{
+    // We index with a mask, so we need a power of two
+    if( num_blocks == 0 || (num_blocks & (num_blocks - 1)) != 0 )
+        return false;
+
+    ring->head.store(0);
+    ring->tail.store(0);
+    ring->tap_tail.store(0);
+    ring->cached_tail = 0;
+    ring->cached_head = 0;
+    ring->tap_cached_head = 0;
+    ring->has_tap = false;
+    ring->num_blocks = num_blocks;
+    ring->block_size = block_size;
+    ring->arena = NULL;
+
+    ring->blocks = (struct rx_block *)calloc(num_blocks, sizeof(struct rx_block));
+    return ring->blocks != NULL;
+}
+
+bool ring_init(struct sample_ring * ring, unsigned int num_blocks, unsigned int block_size)
+{
+    if( !ring_setup(ring, num_blocks, block_size) )
+        return false;
+
+    // Already faulted in, so we don't take page faults while streaming
+    ring->arena = (int16_t *)rt_alloc("RX ring", (size_t)num_blocks*block_size*2*sizeof(int16_t));
+    if( !ring->arena ) {
+        free(ring->blocks);
+        ring->blocks = NULL;
+        return false;
+    }
+    for( unsigned int idx=0; idx<num_blocks; ++idx )
+        ring->blocks[idx].samples = ring->arena + (size_t)idx*block_size*2;
+    return true;
+}
+
+bool ring_init_external(struct sample_ring * ring, unsigned int num_blocks, unsigned int block_size)
+{
+    return ring_setup(ring, num_blocks, block_size);
+}
+
+void ring_free(struct sample_ring * ring)
+{
+    free(ring->blocks);
+    if( ring->arena )
+        rt_free(ring->arena, (size_t)ring->num_blocks*ring->block_size*2*sizeof(int16_t));
+    ring->blocks = NULL;
+    ring->arena = NULL;
+}
+
+void ring_add_tap(struct sample_ring * ring)
+{
+    ring->tap_tail.store(ring->head.load());
+    ring->tap_cached_head = ring->tap_tail.load();
+    ring->has_tap = true;
+}
@@ -0,0 +1,151 @@
+#ifndef RING_H
+#define RING_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#define CACHE_LINE_SIZE 64
+
+// Sample memory is page aligned so that runs of blocks can go straight to
+// O_DIRECT writes
+#define RING_ARENA_ALIGN 4096
+
+// One block of received samples, along with the metadata the radio gave us
+struct rx_block {
+    // Hardware timestamp of samples[0]
+    uint64_t timestamp;
+
+    // BLADERF_META_STATUS_* flags reported along with this block
+    uint32_t status;
+
+    // Number of valid samples (not int16_t's!) in this block
+    unsigned int count;
+
+    // Interleaved SC16 Q11 I/Q data
+    int16_t * samples;
+};
+
+// Lock-free single-producer/single-consumer ring of rx_blocks.  The sample
+// memory is preallocated, so pushing a block never allocates.  The producer
+// and consumer indices live on their own cache lines so the two threads don't
+// fight over them, and each side keeps a stale copy of the other's index so
+// it only has to touch the shared one when it looks like it's run out.
+//
+// There can also be a second consumer, the tap, that sees every block the
+// main consumer does.  The producer doesn't reuse a block until both of them
+// are done with it.
+struct sample_ring {
+    // Written by the producer only
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head;
+    uint64_t cached_tail;
+
+    // Written by the consumer only
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail;
+    uint64_t cached_head;
+
+    // Written by the tap only
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tap_tail;
+    uint64_t tap_cached_head;
+
+    // Read-only once initialized
+    alignas(CACHE_LINE_SIZE) struct rx_block * blocks;
+    int16_t * arena;
+    unsigned int num_blocks;
+    unsigned int block_size;
+    bool has_tap;
+};
+
+// num_blocks must be a power of two, block_size is in samples
+bool ring_init(struct sample_ring * ring, unsigned int num_blocks, unsigned int block_size);
+
+// Like ring_init(), but without any sample memory; the producer points each
+// block's samples at memory of its own before publishing it
+bool ring_init_external(struct sample_ring * ring, unsigned int num_blocks, unsigned int block_size);
+void ring_free(struct sample_ring * ring);
+
+// Add the tap; only before the producer gets going
+void ring_add_tap(struct sample_ring * ring);
+
+// Producer side: how many blocks (counting from the start) every consumer
+// is done with
+static inline uint64_t ring_released(struct sample_ring * ring)
+{
+    // Whichever consumer is further behind is the one holding us up
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->tail.load(std::memory_order_acquire);
+    if( ring->has_tap ) {
+        uint64_t tap_tail = ring->tap_tail.load(std::memory_order_acquire);
+        if( head - tap_tail > head - tail )
+            tail = tap_tail;
+    }
+    ring->cached_tail = tail;
+    return tail;
+}
+
+// Producer side: get the next free block (or NULL if the ring is full), fill
+// it in, then publish it to the consumer
+static inline struct rx_block * ring_claim(struct sample_ring * ring)
+{
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if( head - ring->cached_tail >= ring->num_blocks ) {
+        if( head - ring_released(ring) >= ring->num_blocks )
+            return NULL;
+    }
+    return &ring->blocks[head & (ring->num_blocks - 1)];
+}
+
+static inline void ring_publish(struct sample_ring * ring)
+{
+    ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Consumer side: look at the oldest published block (or NULL if there are
+// none), then release it back to the producer once we're done with it
+static inline struct rx_block * ring_peek(struct sample_ring * ring)
+{
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    if( tail == ring->cached_head ) {
+        ring->cached_head = ring->head.load(std::memory_order_acquire);
+        if( tail == ring->cached_head )
+            return NULL;
+    }
+    return &ring->blocks[tail & (ring->num_blocks - 1)];
+}
+
+static inline void ring_release(struct sample_ring * ring)
+{
+    ring->tail.store(ring->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Tap side: like ring_peek()/ring_release(), but for runs of blocks.  Returns
+// the oldest block the tap hasn't released yet (or NULL), and in *count how
+// many published blocks there are from it up to the end of the ring, whose
+// samples are all back to back in memory.
+static inline struct rx_block * ring_tap_peek(struct sample_ring * ring, unsigned int * count)
+{
+    uint64_t tail = ring->tap_tail.load(std::memory_order_relaxed);
+    if( tail == ring->tap_cached_head ) {
+        ring->tap_cached_head = ring->head.load(std::memory_order_acquire);
+        if( tail == ring->tap_cached_head )
+            return NULL;
+    }
+    unsigned int idx = (unsigned int)(tail & (ring->num_blocks - 1));
+    uint64_t avail = ring->tap_cached_head - tail;
+    *count = (unsigned int)(avail < ring->num_blocks - idx ? avail : ring->num_blocks - idx);
+    return &ring->blocks[idx];
+}
+
+static inline void ring_tap_release(struct sample_ring * ring, unsigned int count)
+{
+    ring->tap_tail.store(ring->tap_tail.load(std::memory_order_relaxed) + count,
+                         std::memory_order_release);
+}
+
+// Number of blocks waiting for the consumer; only approximate from either side
+static inline unsigned int ring_fill(struct sample_ring * ring)
+{
+    return (unsigned int)(ring->head.load(std::memory_order_acquire) -
+                          ring->tail.load(std::memory_order_acquire));
+}
+#endif
@@ -0,0 +1,139 @@
+#include <libbladeRF.h>
+#include "device.h"
+#include "options.h"
+#include "util.h"
+#include "rx.h"
+#include "metrics.h"
+#include "stream.h"
+#include "realtime.h"
+#include "radio.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void * rx_thread(void * arg)
+{
+    struct radio * r = (struct radio *)arg;
+    struct rx_data_struct * rx = &r->rx;
+    struct bladerf_metadata meta;
+    uint64_t expected_ts = 0;
+    bool first = true;
+    unsigned int errors = 0;
+    int status;
+
+    rt_thread_setup(RT_RX, 0);
+    while( rx->running.load(std::memory_order_relaxed) ) {
+        memset(&meta, 0, sizeof(meta));
+
+        // Start streaming from "now" on the first read, after that every
+        // read picks up where the last one left off
+        if( first )
+            meta.flags = BLADERF_META_FLAG_RX_NOW;
+
+        // Never wait on the consumer; if it's fallen behind we keep the
+        // device drained and drop the block on the floor instead
+        struct rx_block * block = ring_claim(&rx->ring);
+        int16_t * samples = block ? block->samples : rx->scratch;
+
+        status = device_sync_rx(&r->device, samples, opts.buffer_size, &meta, opts.timeout_ms);
+        if( status != 0 ) {
+            if( !rx->running.load(std::memory_order_relaxed) )
+                break;
+            metric_inc(M_RX_ERRORS);
+            ERROR("%sRX failed: %s\n", r->label, bladerf_strerror(status));
+            if( ++errors >= RX_MAX_ERRORS ) {
+                ERROR("%sRX failed %u times in a row, giving up on this radio\n", r->label, errors);
+                rx->failed = true;
+                break;
+            }
+            usleep(1000*MIN(1u << (errors - 1), (unsigned int)RX_RETRY_MAX_MS));
+            continue;
+        }
+        errors = 0;
+
+        if( meta.status & BLADERF_META_STATUS_OVERRUN )
+            metric_inc(M_RX_DEVICE_OVERRUNS);
+        if( !first && meta.timestamp != expected_ts )
+            metric_inc(M_RX_DISCONTINUITIES);
+        expected_ts = meta.timestamp + meta.actual_count;
+        first = false;
+
+        metric_inc(M_RX_BLOCKS);
+        metric_add(M_RX_SAMPLES, meta.actual_count);
+        if( !block ) {
+            metric_inc(M_RX_RING_OVERRUNS);
+            continue;
+        }
+
+        block->timestamp = meta.timestamp;
+        block->status = meta.status;
+        block->count = meta.actual_count;
+        ring_publish(&rx->ring);
+        metric_set(M_RX_RING_FILL, ring_fill(&rx->ring));
+    }
+    return NULL;
+}
+
+bool start_rx(struct radio * r)
+{
+    struct rx_data_struct * rx = &r->rx;
+
+    // The async engine fills the ring straight from its stream buffers
+    if( opts.async_stream )
+        return start_stream_rx(r);
+
+    if( !ring_init(&rx->ring, RX_RING_BLOCKS, opts.buffer_size) ) {
+        ERROR("%sFailed to allocate RX ring of %u blocks\n", r->label, RX_RING_BLOCKS);
+        return false;
+    }
+    if( opts.capture[0] != '\0' )
+        ring_add_tap(&rx->ring);
+    rx->scratch = (int16_t *)rt_alloc("RX scratch", sizeof(int16_t)*2*opts.buffer_size);
+    if( !rx->scratch ) {
+        ERROR("%sFailed to allocate RX scratch buffer\n", r->label);
+        ring_free(&rx->ring);
+        return false;
+    }
+
+    rx->running = true;
+    rx->failed = false;
+    if( pthread_create(&rx->thread, NULL, rx_thread, r) != 0 ) {
+        ERROR("%sFailed to start RX thread\n", r->label);
+        rx->running = false;
+        rt_free(rx->scratch, sizeof(int16_t)*2*opts.buffer_size);
+        rx->scratch = NULL;
+        ring_free(&rx->ring);
+        return false;
+    }
+    LOG("%sRX thread started with a %u x %u sample ring\n", r->label, RX_RING_BLOCKS, opts.buffer_size);
+    return true;
+}
+
+void stop_rx(struct radio * r)
+{
+    if( opts.async_stream ) {
+        stop_stream_rx(r);
+    } else {
+        r->rx.running = false;
+        pthread_join(r->rx.thread, NULL);
+    }
+}
+
+void rx_cleanup(struct radio * r)
+{
+    rt_free(r->rx.scratch, sizeof(int16_t)*2*opts.buffer_size);
+    r->rx.scratch = NULL;
+    ring_free(&r->rx.ring);
+    if( opts.async_stream )
+        stream_rx_cleanup(r);
+}
+
+void rx_report(void)
+{
+    LOG("\nRX: %llu blocks, %llu samples, %llu ring overruns, %llu device overruns, "
+        "%llu discontinuities, %llu errors",
+        (unsigned long long)metric_total(M_RX_BLOCKS), (unsigned long long)metric_total(M_RX_SAMPLES),
+        (unsigned long long)metric_total(M_RX_RING_OVERRUNS),
+        (unsigned long long)metric_total(M_RX_DEVICE_OVERRUNS),
+        (unsigned long long)metric_total(M_RX_DISCONTINUITIES), (unsigned long long)metric_total(M_RX_ERRORS));
+}
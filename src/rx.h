@@ -0,0 +1,50 @@
+#ifndef RX_H
+#define RX_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "ring.h"
+
+// Number of blocks (of opts.buffer_size samples each) the RX ring can hold.
+// 256 blocks of 8192 samples is ~50ms of headroom at 40 MS/s.
+#define RX_RING_BLOCKS 256
+
+// When reads keep failing (say the board's been unplugged) we wait twice as
+// long before each retry, up to RX_RETRY_MAX_MS, and give up on the radio
+// altogether after RX_MAX_ERRORS in a row
+#define RX_RETRY_MAX_MS 250
+#define RX_MAX_ERRORS 20
+
+struct rx_data_struct {
+    pthread_t thread;
+    std::atomic<bool> running;
+
+    // Set when the RX thread has given up, see RX_MAX_ERRORS
+    std::atomic<bool> failed;
+
+    // Received samples go here, in order, for the processing side to pick up
+    struct sample_ring ring;
+
+    // If the ring is full we still have to read from the device to keep it
+    // from overflowing, so we read into this instead and throw it away
+    int16_t * scratch;
+
+    // Statistics are kept in metrics.h, under M_RX_*
+};
+
+struct radio;
+
+bool start_rx(struct radio * r);
+
+// With --stream=async these run the async engine in stream.h instead.
+
+// Stops the RX thread; the ring stays around so consumers can drain it
+void stop_rx(struct radio * r);
+
+// Free the ring, once everything reading from it has stopped
+void rx_cleanup(struct radio * r);
+
+// Totals over every radio, once they've all stopped
+void rx_report(void);
+#endif
@@ -0,0 +1,324 @@
+#include "sc16.h"
+#include "util.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SC16_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Scalar reference.  The vector versions below do exactly the same float
+ * operations in exactly the same order, so they should match it bit for bit;
+ * sc16_check() makes sure of that, and radar_bench --check runs it on each.
+ */
+static void sc16_to_cf32_scalar(const int16_t * in, float * out, unsigned int count,
+                                float scale, const float * window)
+{
+    if( window ) {
+        for( unsigned int idx=0; idx<count; ++idx ) {
+            out[2*idx + 0] = ((float)in[2*idx + 0]*scale)*window[idx];
+            out[2*idx + 1] = ((float)in[2*idx + 1]*scale)*window[idx];
+        }
+    } else {
+        for( unsigned int idx=0; idx<2*count; ++idx )
+            out[idx] = (float)in[idx]*scale;
+    }
+}
+
+static inline int16_t cf32_to_sc16_one(float v, float scale)
+{
+    // Same semantics as maxps/minps, so NaN ends up at -2048 everywhere
+    v = v*scale;
+    v = v > -2048.0f ? v : -2048.0f;
+    v = v < 2047.0f ? v : 2047.0f;
+    return (int16_t)lrintf(v);
+}
+
+static void cf32_to_sc16_scalar(const float * in, int16_t * out, unsigned int count, float scale)
+{
+    for( unsigned int idx=0; idx<2*count; ++idx )
+        out[idx] = cf32_to_sc16_one(in[idx], scale);
+}
+
+static bool supported_always(void)
+{
+    return true;
+}
+
+#ifdef SC16_X86
+/*
+ * SSE2: 4 complex samples at a time
+ */
+__attribute__((target("sse2")))
+static bool supported_sse2(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("sse2")))
+static void sc16_to_cf32_sse2(const int16_t * in, float * out, unsigned int count,
+                              float scale, const float * window)
+{
+    const __m128 s = _mm_set1_ps(scale);
+    unsigned int idx = 0;
+    for( ; idx + 4 <= count; idx += 4 ) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + 2*idx));
+
+        // No pmovsx in SSE2; put each int16 in the top half and shift it down
+        __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+        __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+        lo = _mm_mul_ps(lo, s);
+        hi = _mm_mul_ps(hi, s);
+        if( window ) {
+            __m128 w = _mm_loadu_ps(window + idx);
+            lo = _mm_mul_ps(lo, _mm_unpacklo_ps(w, w));
+            hi = _mm_mul_ps(hi, _mm_unpackhi_ps(w, w));
+        }
+        _mm_storeu_ps(out + 2*idx + 0, lo);
+        _mm_storeu_ps(out + 2*idx + 4, hi);
+    }
+    sc16_to_cf32_scalar(in + 2*idx, out + 2*idx, count - idx, scale, window ? window + idx : NULL);
+}
+
+__attribute__((target("sse2")))
+static void cf32_to_sc16_sse2(const float * in, int16_t * out, unsigned int count, float scale)
+{
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 lo_lim = _mm_set1_ps(-2048.0f);
+    const __m128 hi_lim = _mm_set1_ps(2047.0f);
+    unsigned int idx = 0;
+    for( ; idx + 4 <= count; idx += 4 ) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(in + 2*idx + 0), s);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(in + 2*idx + 4), s);
+        a = _mm_min_ps(_mm_max_ps(a, lo_lim), hi_lim);
+        b = _mm_min_ps(_mm_max_ps(b, lo_lim), hi_lim);
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        _mm_storeu_si128((__m128i *)(out + 2*idx), packed);
+    }
+    cf32_to_sc16_scalar(in + 2*idx, out + 2*idx, count - idx, scale);
+}
+
+/*
+ * AVX2: 8 complex samples at a time
+ */
+__attribute__((target("avx2")))
+static bool supported_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void sc16_to_cf32_avx2(const int16_t * in, float * out, unsigned int count,
+                              float scale, const float * window)
+{
+    const __m256 s = _mm256_set1_ps(scale);
+    const __m256i dup_lo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i dup_hi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+    unsigned int idx = 0;
+    for( ; idx + 8 <= count; idx += 8 ) {
+        __m128i x0 = _mm_loadu_si128((const __m128i *)(in + 2*idx + 0));
+        __m128i x1 = _mm_loadu_si128((const __m128i *)(in + 2*idx + 8));
+        __m256 lo = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x0)), s);
+        __m256 hi = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x1)), s);
+        if( window ) {
+            __m256 w = _mm256_loadu_ps(window + idx);
+            lo = _mm256_mul_ps(lo, _mm256_permutevar8x32_ps(w, dup_lo));
+            hi = _mm256_mul_ps(hi, _mm256_permutevar8x32_ps(w, dup_hi));
+        }
+        _mm256_storeu_ps(out + 2*idx + 0, lo);
+        _mm256_storeu_ps(out + 2*idx + 8, hi);
+    }
+    sc16_to_cf32_sse2(in + 2*idx, out + 2*idx, count - idx, scale, window ? window + idx : NULL);
+}
+
+__attribute__((target("avx2")))
+static void cf32_to_sc16_avx2(const float * in, int16_t * out, unsigned int count, float scale)
+{
+    const __m256 s = _mm256_set1_ps(scale);
+    const __m256 lo_lim = _mm256_set1_ps(-2048.0f);
+    const __m256 hi_lim = _mm256_set1_ps(2047.0f);
+    unsigned int idx = 0;
+    for( ; idx + 8 <= count; idx += 8 ) {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(in + 2*idx + 0), s);
+        __m256 b = _mm256_mul_ps(_mm256_loadu_ps(in + 2*idx + 8), s);
+        a = _mm256_min_ps(_mm256_max_ps(a, lo_lim), hi_lim);
+        b = _mm256_min_ps(_mm256_max_ps(b, lo_lim), hi_lim);
+
+        // packs works within 128-bit lanes, so put the quadwords back in order
+        __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+        packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(out + 2*idx), packed);
+    }
+    cf32_to_sc16_sse2(in + 2*idx, out + 2*idx, count - idx, scale);
+}
+
+/*
+ * AVX-512: 16 complex samples at a time.  GCC 12 warns that the undefined
+ * passthrough vectors in its own avx512fintrin.h (__Y = __Y) may be used
+ * uninitialized once they're inlined in here (GCC bug 105593); they aren't.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f,avx512bw")))
+static bool supported_avx512(void)
+{
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void sc16_to_cf32_avx512(const int16_t * in, float * out, unsigned int count,
+                                float scale, const float * window)
+{
+    const __m512 s = _mm512_set1_ps(scale);
+    const __m512i dup_lo = _mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7);
+    const __m512i dup_hi = _mm512_setr_epi32(8, 8, 9, 9, 10, 10, 11, 11,
+                                             12, 12, 13, 13, 14, 14, 15, 15);
+    unsigned int idx = 0;
+    for( ; idx + 16 <= count; idx += 16 ) {
+        __m256i x0 = _mm256_loadu_si256((const __m256i *)(in + 2*idx + 0));
+        __m256i x1 = _mm256_loadu_si256((const __m256i *)(in + 2*idx + 16));
+        __m512 lo = _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(x0)), s);
+        __m512 hi = _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(x1)), s);
+        if( window ) {
+            __m512 w = _mm512_loadu_ps(window + idx);
+            lo = _mm512_mul_ps(lo, _mm512_permutexvar_ps(dup_lo, w));
+            hi = _mm512_mul_ps(hi, _mm512_permutexvar_ps(dup_hi, w));
+        }
+        _mm512_storeu_ps(out + 2*idx + 0, lo);
+        _mm512_storeu_ps(out + 2*idx + 16, hi);
+    }
+    sc16_to_cf32_avx2(in + 2*idx, out + 2*idx, count - idx, scale, window ? window + idx : NULL);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void cf32_to_sc16_avx512(const float * in, int16_t * out, unsigned int count, float scale)
+{
+    const __m512 s = _mm512_set1_ps(scale);
+    const __m512 lo_lim = _mm512_set1_ps(-2048.0f);
+    const __m512 hi_lim = _mm512_set1_ps(2047.0f);
+    unsigned int idx = 0;
+    for( ; idx + 8 <= count; idx += 8 ) {
+        __m512 a = _mm512_mul_ps(_mm512_loadu_ps(in + 2*idx), s);
+        a = _mm512_min_ps(_mm512_max_ps(a, lo_lim), hi_lim);
+        _mm256_storeu_si256((__m256i *)(out + 2*idx), _mm512_cvtsepi32_epi16(_mm512_cvtps_epi32(a)));
+    }
+    cf32_to_sc16_avx2(in + 2*idx, out + 2*idx, count - idx, scale);
+}
+#pragma GCC diagnostic pop
+#endif
+
+const struct sc16_impl sc16_impls[] = {
+    { "scalar", supported_always, sc16_to_cf32_scalar, cf32_to_sc16_scalar },
+#ifdef SC16_X86
+    { "sse2", supported_sse2, sc16_to_cf32_sse2, cf32_to_sc16_sse2 },
+    { "avx2", supported_avx2, sc16_to_cf32_avx2, cf32_to_sc16_avx2 },
+    { "avx512", supported_avx512, sc16_to_cf32_avx512, cf32_to_sc16_avx512 },
+#endif
+};
+const unsigned int num_sc16_impls = sizeof(sc16_impls)/sizeof(sc16_impls[0]);
+
+sc16_to_cf32_fn sc16_to_cf32 = sc16_to_cf32_scalar;
+cf32_to_sc16_fn cf32_to_sc16 = cf32_to_sc16_scalar;
+
+// Where out first differs from ref, bit for bit, or -1 if it doesn't
+template<typename T>
+static long first_mismatch(const std::vector<T> & ref, const std::vector<T> & out, unsigned int n)
+{
+    for( unsigned int idx=0; idx<n; ++idx ) {
+        if( memcmp(&ref[idx], &out[idx], sizeof(T)) != 0 )
+            return idx;
+    }
+    return -1;
+}
+
+bool sc16_check(const struct sc16_impl * impl)
+{
+    // Every int16 there is going one way.  Going the other: rounding ties
+    // either side of zero and the floats just either side of those, the
+    // rails and past them, infinities, NaN and denormals, then random values.
+    const unsigned int max_count = 32768;
+    std::vector<int16_t> sc16(2*max_count), sc16_ref(2*max_count), sc16_out(2*max_count);
+    std::vector<float> cf32(2*max_count), cf32_ref(2*max_count), cf32_out(2*max_count);
+    std::vector<float> window(max_count);
+
+    for( unsigned int idx=0; idx<2*max_count; ++idx )
+        sc16[idx] = (int16_t)(uint16_t)(idx*40503);
+
+    const float specials[] = { 0.0f, -0.0f, 2047.0f, 2047.5f, 2048.0f, -2048.0f, -2048.5f, -2049.0f,
+                               32767.0f, -32768.0f, 1e20f, -1e20f, INFINITY, -INFINITY, NAN, -NAN,
+                               1e-40f, -1e-40f };
+    unsigned int n = 0;
+    for( unsigned int idx=0; idx<sizeof(specials)/sizeof(specials[0]); ++idx )
+        cf32[n++] = specials[idx];
+    for( int k=-2060; k<2060; ++k ) {
+        cf32[n++] = k + 0.5f;
+        cf32[n++] = nextafterf(k + 0.5f, -INFINITY);
+        cf32[n++] = nextafterf(k + 0.5f, INFINITY);
+    }
+    uint32_t rng = 0xdeadbeef;
+    for( ; n<2*max_count; ++n ) {
+        rng = rng*1664525 + 1013904223;
+        cf32[n] = ((int32_t)rng)/524288.0f;
+    }
+    for( unsigned int idx=0; idx<max_count; ++idx )
+        window[idx] = 0.5f - 0.5f*cosf(2*(float)M_PI*idx/(max_count - 1));
+
+    // Every length up to a few of the widest vectors, so every tail gets a
+    // go, then everything at once
+    std::vector<unsigned int> counts;
+    for( unsigned int count=0; count<=70; ++count )
+        counts.push_back(count);
+    counts.push_back(max_count - 1);
+    counts.push_back(max_count);
+
+    const float scales[] = { 1.0f/2048.0f, 1.0f, 2048.0f, 3.3f, -1.0f, 1e-3f };
+    for( size_t c=0; c<counts.size(); ++c ) {
+        unsigned int count = counts[c];
+        for( unsigned int s=0; s<sizeof(scales)/sizeof(scales[0]); ++s ) {
+            for( int w=0; w<2; ++w ) {
+                const float * win = w ? &window[0] : NULL;
+                sc16_to_cf32_scalar(&sc16[0], &cf32_ref[0], count, scales[s], win);
+                impl->to_cf32(&sc16[0], &cf32_out[0], count, scales[s], win);
+                long bad = first_mismatch(cf32_ref, cf32_out, 2*count);
+                if( bad >= 0 ) {
+                    ERROR("SC16 %s sc16_to_cf32 of %u samples at scale %g%s: %d gave %a, not %a\n",
+                          impl->name, count, scales[s], win ? " with a window" : "", sc16[bad],
+                          cf32_out[bad], cf32_ref[bad]);
+                    return false;
+                }
+            }
+            cf32_to_sc16_scalar(&cf32[0], &sc16_ref[0], count, scales[s]);
+            impl->to_sc16(&cf32[0], &sc16_out[0], count, scales[s]);
+            long bad = first_mismatch(sc16_ref, sc16_out, 2*count);
+            if( bad >= 0 ) {
+                ERROR("SC16 %s cf32_to_sc16 of %u samples at scale %g: %a gave %d, not %d\n",
+                      impl->name, count, scales[s], cf32[bad], sc16_out[bad], sc16_ref[bad]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+const char * sc16_init(void)
+{
+    // A vector version that doesn't match is a bug, not something to quietly
+    // fall back from
+    const struct sc16_impl * best = &sc16_impls[0];
+    for( unsigned int idx=1; idx<num_sc16_impls; ++idx ) {
+        if( !sc16_impls[idx].supported() )
+            continue;
+        if( !sc16_check(&sc16_impls[idx]) ) {
+            ERROR("SC16 %s conversions don't match the scalar reference\n", sc16_impls[idx].name);
+            return NULL;
+        }
+        best = &sc16_impls[idx];
+    }
+    sc16_to_cf32 = best->to_cf32;
+    cf32_to_sc16 = best->to_sc16;
+    return best->name;
+}
@@ -0,0 +1,41 @@
+#ifndef SC16_H
+#define SC16_H
+#include <stdbool.h>
+#include <stdint.h>
+
+// Conversions between interleaved SC16 Q11 I/Q (what the bladeRF speaks) and
+// interleaved complex float (what everything else speaks).  `count` is always
+// in complex samples.
+
+// out = in*scale, and then *window[n] for sample n if window isn't NULL
+typedef void (*sc16_to_cf32_fn)(const int16_t * in, float * out, unsigned int count,
+                                float scale, const float * window);
+
+// out = round(in*scale), saturated to the [-2048, 2047] the DAC can take
+typedef void (*cf32_to_sc16_fn)(const float * in, int16_t * out, unsigned int count,
+                                float scale);
+
+struct sc16_impl {
+    const char * name;
+    bool (*supported)(void);
+    sc16_to_cf32_fn to_cf32;
+    cf32_to_sc16_fn to_sc16;
+};
+
+// Every implementation we have, scalar reference first and best last
+extern const struct sc16_impl sc16_impls[];
+extern const unsigned int num_sc16_impls;
+
+// The best implementation this CPU runs.  These point at the scalar versions
+// until sc16_init().
+extern sc16_to_cf32_fn sc16_to_cf32;
+extern cf32_to_sc16_fn cf32_to_sc16;
+
+// Pick implementations for the functions above, returns the name of the
+// winner, or NULL if any this CPU runs disagrees with the scalar reference
+const char * sc16_init(void);
+
+// Check an implementation bit for bit against the scalar reference, and say
+// where it went wrong if it doesn't match
+bool sc16_check(const struct sc16_impl * impl);
+#endif
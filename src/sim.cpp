@@ -0,0 +1,538 @@
+#include <libbladeRF.h>
+#include "device.h"
+#include "options.h"
+#include "util.h"
+#include "conversions.h"
+#include "sim.h"
+#include "stream.h"
+#include <deque>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+// Length of the echo line, in samples.  Must be a power of two; 4M samples is
+// a tenth of a second at 40 MS/s which is a very long way away for a radar.
+#define SIM_ECHO_LEN (1 << 22)
+#define SIM_ECHO_MASK (SIM_ECHO_LEN - 1)
+
+// Number of precomputed gaussian noise values we cycle through pseudorandomly
+#define SIM_NOISE_LEN (1 << 16)
+
+struct sim_state {
+    pthread_mutex_t lock;
+
+    // Signalled whenever the free running clock moves
+    pthread_cond_t clock_cond;
+
+    // Echo line indexed by timestamp; TX adds into it, RX reads and clears it.
+    // Interleaved I/Q in Q11 units.
+    float * echo;
+
+    // Timestamp of the next sample RX will hand out, and whether RX has started
+    uint64_t rx_ts;
+    bool rx_started;
+
+    // Timestamp right after the last transmitted sample
+    uint64_t tx_ts;
+
+    // Wall clock time of timestamp zero when pacing against real time
+    struct timespec t0;
+
+    // Free running clock before RX starts; moves forward by a buffer every
+    // time somebody looks at it so that polling loops still make progress
+    uint64_t virt_ts;
+
+    // Once the TX side shows up, a free running RX doesn't get to run any
+    // further ahead than the timestamp TX is waiting for, otherwise it would
+    // leave the transmit schedule behind
+    bool tx_started;
+    uint64_t horizon;
+
+    // Channel parameters
+    unsigned int delay;
+    float gain;
+    float *noise;
+    uint32_t rng;
+    bool freerun;
+
+    // Samples the device can have queued up before sync calls start blocking
+    uint64_t queue_depth;
+
+    // Totals, reported at close
+    uint64_t tx_samples, rx_samples, rx_overruns;
+};
+
+bool is_sim_devstr(const char * devstr)
+{
+    return strncmp(devstr, "sim", 3) == 0 && (devstr[3] == '\0' || devstr[3] == ':');
+}
+
+static inline uint32_t xorshift32(uint32_t * state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// Parse "sim:delay=100,atten=20,..." into the channel parameters
+static bool sim_parse(const char * devstr, struct sim_state * sim, double * atten_db, double * noise_db)
+{
+    bool ok = true;
+    if( devstr[3] == '\0' )
+        return true;
+
+    char * params = strdup(devstr + 4);
+    char * saveptr = NULL;
+    for( char * tok = strtok_r(params, ",", &saveptr); tok && ok; tok = strtok_r(NULL, ",", &saveptr) ) {
+        char * val = strchr(tok, '=');
+        if( val )
+            *(val++) = '\0';
+
+        if( strcasecmp(tok, "freerun") == 0 && !val ) {
+            sim->freerun = true;
+        } else if( strcasecmp(tok, "delay") == 0 && val ) {
+            sim->delay = str2uint(val, 0, SIM_ECHO_LEN/2, &ok);
+        } else if( strcasecmp(tok, "atten") == 0 && val ) {
+            *atten_db = str2double(val, 0, 200, &ok);
+        } else if( strcasecmp(tok, "noise") == 0 && val ) {
+            *noise_db = str2double(val, -200, 0, &ok);
+        } else {
+            ok = false;
+        }
+
+        if( !ok )
+            ERROR("Invalid simulated device parameter \"%s%s%s\"\n", tok, val ? "=" : "", val ? val : "");
+    }
+    free(params);
+    return ok;
+}
+
+// Current device time in samples.  Called with the lock held.
+static uint64_t sim_now(struct sim_state * sim)
+{
+    // Free running, RX reading samples is what makes time pass.  Until it
+    // starts, time moves whenever somebody looks at the clock or transmits.
+    if( sim->freerun )
+        return sim->rx_started ? sim->rx_ts : MAX(sim->virt_ts, sim->tx_ts);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - sim->t0.tv_sec) + (now.tv_nsec - sim->t0.tv_nsec)*1e-9;
+    return (uint64_t)(elapsed*opts.samplerate);
+}
+
+static void add_secs(struct timespec * t, double secs)
+{
+    t->tv_sec += (time_t)secs;
+    t->tv_nsec += (long)((secs - floor(secs))*1e9);
+    if( t->tv_nsec >= 1000000000L ) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000L;
+    }
+}
+
+// Block until the device clock reaches timestamp ts, or timeout_ms passes.
+// Called with the lock held, which is dropped while we wait.
+static int sim_wait_until(struct sim_state * sim, uint64_t ts, unsigned int timeout_ms)
+{
+    struct timespec deadline;
+
+    if( sim->freerun ) {
+        if( !sim->rx_started ) {
+            sim->virt_ts = MAX(sim->virt_ts, ts);
+            return 0;
+        }
+
+        sim->horizon = MAX(sim->horizon, ts);
+        pthread_cond_broadcast(&sim->clock_cond);
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        add_secs(&deadline, timeout_ms/1000.0);
+        while( sim->rx_ts < ts ) {
+            if( pthread_cond_timedwait(&sim->clock_cond, &sim->lock, &deadline) == ETIMEDOUT )
+                return BLADERF_ERR_TIMEOUT;
+        }
+        return 0;
+    }
+
+    double secs = (double)ts/opts.samplerate;
+    deadline = sim->t0;
+    add_secs(&deadline, secs);
+
+    struct timespec limit;
+    clock_gettime(CLOCK_MONOTONIC, &limit);
+    add_secs(&limit, timeout_ms/1000.0);
+    bool timed_out = limit.tv_sec < deadline.tv_sec ||
+                     (limit.tv_sec == deadline.tv_sec && limit.tv_nsec < deadline.tv_nsec);
+    if( timed_out )
+        deadline = limit;
+
+    pthread_mutex_unlock(&sim->lock);
+    while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR )
+        ;
+    pthread_mutex_lock(&sim->lock);
+    return timed_out ? BLADERF_ERR_TIMEOUT : 0;
+}
+
+static int sim_open(struct device_data_struct * dd)
+{
+    struct sim_state * sim = (struct sim_state *)calloc(1, sizeof(struct sim_state));
+    double atten_db = 20, noise_db = -60;
+
+    sim->delay = 100;
+    sim->rng = 0x1234567;
+    if( !sim_parse(dd->devstr, sim, &atten_db, &noise_db) ) {
+        free(sim);
+        return BLADERF_ERR_INVAL;
+    }
+
+    sim->echo = (float *)calloc(2*SIM_ECHO_LEN, sizeof(float));
+    sim->noise = (float *)malloc(SIM_NOISE_LEN*sizeof(float));
+    if( !sim->echo || !sim->noise ) {
+        free(sim->echo);
+        free(sim->noise);
+        free(sim);
+        return BLADERF_ERR_MEM;
+    }
+
+    // Full scale is 2048 in Q11, the noise floor is relative to that
+    sim->gain = powf(10.0f, -atten_db/20.0);
+    float sigma = 2048.0f*pow(10.0, noise_db/20.0);
+    for( int idx=0; idx<SIM_NOISE_LEN; idx += 2 ) {
+        // Box-Muller, done once up front so RX doesn't pay for log()/cos()
+        float u1 = (xorshift32(&sim->rng) + 1.0f)/4294967296.0f;
+        float u2 = xorshift32(&sim->rng)/4294967296.0f;
+        float r = sigma*sqrtf(-2*logf(u1));
+        sim->noise[idx + 0] = r*cosf(2*M_PI*u2);
+        sim->noise[idx + 1] = r*sinf(2*M_PI*u2);
+    }
+
+    sim->queue_depth = (uint64_t)opts.num_buffers*opts.buffer_size;
+    dd->msg_size = 2048;
+    snprintf(dd->serial, sizeof(dd->serial), "sim");
+    pthread_mutex_init(&sim->lock, NULL);
+    pthread_cond_init(&sim->clock_cond, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &sim->t0);
+    dd->backend_data = sim;
+
+    INFO("  Echo delay: %u samples\n", sim->delay);
+    INFO("  Echo attenuation: %.1fdB\n", atten_db);
+    INFO("  Noise floor: %.1fdBFS\n", noise_db);
+    INFO("  Clock: %s\n", sim->freerun ? "free running" : "real time");
+    return 0;
+}
+
+static void sim_close(struct device_data_struct * dd)
+{
+    struct sim_state * sim = (struct sim_state *)dd->backend_data;
+
+    LOG("\n  Simulated %llu TX samples, %llu RX samples, %llu RX overruns",
+        (unsigned long long)sim->tx_samples, (unsigned long long)sim->rx_samples,
+        (unsigned long long)sim->rx_overruns);
+    pthread_cond_destroy(&sim->clock_cond);
+    pthread_mutex_destroy(&sim->lock);
+    free(sim->echo);
+    free(sim->noise);
+    free(sim);
+    dd->backend_data = NULL;
+}
+
+static int sim_sync_tx(struct device_data_struct * dd, void * samples, unsigned int num_samples,
+                       struct bladerf_metadata * meta, unsigned int timeout_ms)
+{
+    struct sim_state * sim = (struct sim_state *)dd->backend_data;
+    int16_t * iq = (int16_t *)samples;
+    int status = 0;
+
+    pthread_mutex_lock(&sim->lock);
+    sim->tx_started = true;
+    uint64_t now = sim_now(sim);
+    uint64_t ts = sim->tx_ts;
+    if( meta->flags & BLADERF_META_FLAG_TX_BURST_START ) {
+        if( meta->flags & BLADERF_META_FLAG_TX_NOW ) {
+            ts = MAX(now, sim->tx_ts);
+        } else {
+            ts = meta->timestamp;
+            if( ts < now ) {
+                pthread_mutex_unlock(&sim->lock);
+                return BLADERF_ERR_TIME_PAST;
+            }
+        }
+    }
+
+    // Like the real thing, block once the device has a full queue of samples
+    if( ts > now + sim->queue_depth ) {
+        status = sim_wait_until(sim, ts - sim->queue_depth, timeout_ms);
+        if( status != 0 ) {
+            pthread_mutex_unlock(&sim->lock);
+            return status;
+        }
+    }
+
+    // Nobody is listening for echoes until RX starts, and anything further out
+    // than the echo line would wrap onto samples RX hasn't read yet
+    if( sim->rx_started ) {
+        for( unsigned int idx=0; idx<num_samples; ++idx ) {
+            uint64_t echo_ts = ts + sim->delay + idx;
+            if( echo_ts < sim->rx_ts || echo_ts >= sim->rx_ts + SIM_ECHO_LEN )
+                continue;
+            float * e = sim->echo + 2*(echo_ts & SIM_ECHO_MASK);
+            e[0] += sim->gain*iq[2*idx + 0];
+            e[1] += sim->gain*iq[2*idx + 1];
+        }
+    }
+    sim->tx_ts = ts + num_samples;
+    sim->tx_samples += num_samples;
+    pthread_mutex_unlock(&sim->lock);
+    return 0;
+}
+
+static int sim_sync_rx(struct device_data_struct * dd, void * samples, unsigned int num_samples,
+                       struct bladerf_metadata * meta, unsigned int timeout_ms)
+{
+    struct sim_state * sim = (struct sim_state *)dd->backend_data;
+    int16_t * iq = (int16_t *)samples;
+
+    pthread_mutex_lock(&sim->lock);
+    uint64_t now = sim_now(sim);
+    uint64_t ts = sim->rx_ts;
+    meta->status = 0;
+    if( !sim->rx_started || (meta->flags & BLADERF_META_FLAG_RX_NOW) ) {
+        ts = MAX(now, sim->rx_ts);
+    } else if( !sim->freerun && now > ts + sim->queue_depth ) {
+        // We weren't read fast enough and the device's buffers overflowed
+        meta->status |= BLADERF_META_STATUS_OVERRUN;
+        sim->rx_overruns++;
+        ts = now - num_samples;
+    }
+
+    // Forget about any echoes in the stretch of time we just skipped over
+    uint64_t skipped = MIN(ts - sim->rx_ts, (uint64_t)SIM_ECHO_LEN);
+    for( uint64_t idx=0; idx<skipped; ++idx ) {
+        float * e = sim->echo + 2*((sim->rx_ts + idx) & SIM_ECHO_MASK);
+        e[0] = e[1] = 0.0f;
+    }
+    sim->rx_ts = ts;
+    sim->rx_started = true;
+
+    // Samples aren't available until the device clock has passed them.  When
+    // free running we *are* the device clock, and only have to wait for TX.
+    if( !sim->freerun ) {
+        int status = sim_wait_until(sim, ts + num_samples, timeout_ms);
+        if( status != 0 ) {
+            pthread_mutex_unlock(&sim->lock);
+            return status;
+        }
+    } else if( sim->tx_started ) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        add_secs(&deadline, timeout_ms/1000.0);
+        while( ts >= sim->horizon ) {
+            if( pthread_cond_timedwait(&sim->clock_cond, &sim->lock, &deadline) == ETIMEDOUT ) {
+                pthread_mutex_unlock(&sim->lock);
+                return BLADERF_ERR_TIMEOUT;
+            }
+        }
+    }
+
+    for( unsigned int idx=0; idx<num_samples; ++idx ) {
+        float * e = sim->echo + 2*((ts + idx) & SIM_ECHO_MASK);
+        const float * n = sim->noise + (xorshift32(&sim->rng) & (SIM_NOISE_LEN - 2));
+        float i = e[0] + n[0], q = e[1] + n[1];
+        e[0] = e[1] = 0.0f;
+
+        // The LMS6002D's ADC gives us 12 bits, saturate like it does
+        iq[2*idx + 0] = (int16_t)lrintf(MAX(MIN(i, 2047.0f), -2048.0f));
+        iq[2*idx + 1] = (int16_t)lrintf(MAX(MIN(q, 2047.0f), -2048.0f));
+    }
+    sim->rx_ts = ts + num_samples;
+    sim->rx_samples += num_samples;
+    pthread_cond_broadcast(&sim->clock_cond);
+    pthread_mutex_unlock(&sim->lock);
+
+    meta->timestamp = ts;
+    meta->actual_count = num_samples;
+    return 0;
+}
+
+static int sim_get_timestamp(struct device_data_struct * dd, bladerf_module module, uint64_t * value)
+{
+    struct sim_state * sim = (struct sim_state *)dd->backend_data;
+    pthread_mutex_lock(&sim->lock);
+    *value = sim_now(sim);
+    if( sim->freerun )
+        sim->virt_ts = *value + opts.buffer_size;
+    if( module == BLADERF_MODULE_TX )
+        sim->tx_started = true;
+    pthread_mutex_unlock(&sim->lock);
+    return 0;
+}
+
+static int sim_wait_timestamp(struct device_data_struct * dd, bladerf_module module, uint64_t ts,
+                              unsigned int timeout_ms)
+{
+    struct sim_state * sim = (struct sim_state *)dd->backend_data;
+    pthread_mutex_lock(&sim->lock);
+    int status = sim_now(sim) >= ts ? 0 : sim_wait_until(sim, ts, timeout_ms);
+    pthread_mutex_unlock(&sim->lock);
+    return status;
+}
+
+// The async API, done with the sync calls underneath: one message at a time,
+// with the metadata moved between the headers and bladerf_metadata
+struct sim_stream {
+    bladerf_stream_cb callback;
+    void * user_data;
+    void ** buffers;
+    size_t num_buffers;
+    size_t samples_per_buffer;
+    size_t num_transfers;
+};
+
+static void sim_deinit_stream(struct device_data_struct * dd, struct bladerf_stream * stream)
+{
+    struct sim_stream * ss = (struct sim_stream *)stream;
+    for( size_t idx=0; idx<ss->num_buffers; ++idx )
+        free(ss->buffers[idx]);
+    free(ss->buffers);
+    free(ss);
+}
+
+static int sim_init_stream(struct device_data_struct * dd, struct bladerf_stream ** stream,
+                           bladerf_stream_cb callback, void *** buffers, size_t num_buffers,
+                           size_t samples_per_buffer, size_t num_transfers, void * user_data)
+{
+    struct sim_stream * ss = (struct sim_stream *)calloc(1, sizeof(struct sim_stream));
+    if( !ss )
+        return BLADERF_ERR_MEM;
+    ss->callback = callback;
+    ss->user_data = user_data;
+    ss->num_buffers = num_buffers;
+    ss->samples_per_buffer = samples_per_buffer;
+    ss->num_transfers = num_transfers;
+    ss->buffers = (void **)calloc(num_buffers, sizeof(void *));
+    if( !ss->buffers ) {
+        free(ss);
+        return BLADERF_ERR_MEM;
+    }
+    for( size_t idx=0; idx<num_buffers; ++idx ) {
+        ss->buffers[idx] = calloc(samples_per_buffer, 2*sizeof(int16_t));
+        if( !ss->buffers[idx] ) {
+            sim_deinit_stream(dd, (struct bladerf_stream *)ss);
+            return BLADERF_ERR_MEM;
+        }
+    }
+    *stream = (struct bladerf_stream *)ss;
+    *buffers = ss->buffers;
+    return 0;
+}
+
+// A whole buffer's worth at once (waiting on the clock for each message adds
+// up), then dealt out into messages
+static int sim_stream_rx_buffer(struct device_data_struct * dd, uint8_t * buf, unsigned int msgs,
+                                int16_t * scratch, bool * first)
+{
+    const unsigned int msg_samples = stream_msg_samples(dd->msg_size);
+    struct bladerf_metadata meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.flags = *first ? BLADERF_META_FLAG_RX_NOW : 0;
+    int status = sim_sync_rx(dd, scratch, msgs*msg_samples, &meta, opts.timeout_ms);
+    if( status != 0 )
+        return status;
+    *first = false;
+
+    for( unsigned int idx=0; idx<msgs; ++idx ) {
+        uint8_t * msg = buf + (size_t)idx*dd->msg_size;
+        stream_msg_set_header(msg, meta.timestamp + (uint64_t)idx*msg_samples, 0);
+        memcpy(msg + STREAM_HEADER_SIZE, scratch + 2*(size_t)idx*msg_samples,
+               2*sizeof(int16_t)*msg_samples);
+    }
+    return 0;
+}
+
+static int sim_stream_tx_buffer(struct device_data_struct * dd, uint8_t * buf, unsigned int msgs)
+{
+    const unsigned int msg_samples = stream_msg_samples(dd->msg_size);
+    for( unsigned int idx=0; idx<msgs; ++idx ) {
+        uint8_t * msg = buf + (size_t)idx*dd->msg_size;
+        uint32_t flags = stream_msg_flags(msg);
+        struct bladerf_metadata meta;
+        memset(&meta, 0, sizeof(meta));
+        meta.timestamp = stream_msg_timestamp(msg);
+        if( flags & STREAM_FLAG_TX_BURST_START )
+            meta.flags |= BLADERF_META_FLAG_TX_BURST_START;
+        if( flags & STREAM_FLAG_TX_BURST_END )
+            meta.flags |= BLADERF_META_FLAG_TX_BURST_END;
+
+        // A burst that's already late gets dropped, like the FPGA would
+        int status = sim_sync_tx(dd, msg + STREAM_HEADER_SIZE, msg_samples, &meta, opts.timeout_ms);
+        if( status != 0 && status != BLADERF_ERR_TIME_PAST )
+            return status;
+    }
+    return 0;
+}
+
+static int sim_stream(struct device_data_struct * dd, struct bladerf_stream * stream, bladerf_module module)
+{
+    struct sim_stream * ss = (struct sim_stream *)stream;
+    unsigned int msgs = (unsigned int)(ss->samples_per_buffer*2*sizeof(int16_t)/dd->msg_size);
+    std::deque<void *> in_flight;
+    struct bladerf_metadata meta;
+    bool first = true;
+    int status = 0;
+
+    int16_t * scratch = (int16_t *)malloc(ss->samples_per_buffer*2*sizeof(int16_t));
+    if( !scratch )
+        return BLADERF_ERR_MEM;
+
+    // Like libbladeRF, RX starts out with the first num_transfers buffers and
+    // TX asks for them
+    memset(&meta, 0, sizeof(meta));
+    for( size_t idx=0; idx<ss->num_transfers && idx<ss->num_buffers; ++idx ) {
+        if( module == BLADERF_MODULE_RX ) {
+            in_flight.push_back(ss->buffers[idx]);
+        } else {
+            void * buf = ss->callback(NULL, stream, &meta, NULL, ss->samples_per_buffer, ss->user_data);
+            if( buf == BLADERF_STREAM_SHUTDOWN )
+                goto out;
+            if( buf != BLADERF_STREAM_NO_DATA )
+                in_flight.push_back(buf);
+        }
+    }
+
+    while( !in_flight.empty() ) {
+        uint8_t * buf = (uint8_t *)in_flight.front();
+        in_flight.pop_front();
+        status = module == BLADERF_MODULE_RX ? sim_stream_rx_buffer(dd, buf, msgs, scratch, &first)
+                                             : sim_stream_tx_buffer(dd, buf, msgs);
+        if( status != 0 )
+            break;
+
+        void * next = ss->callback(NULL, stream, &meta, buf, ss->samples_per_buffer, ss->user_data);
+        if( next == BLADERF_STREAM_SHUTDOWN )
+            break;
+        if( next != BLADERF_STREAM_NO_DATA )
+            in_flight.push_back(next);
+    }
+
+out:
+    free(scratch);
+    return status;
+}
+
+const struct device_ops sim_ops = {
+    "simulated",
+    sim_open,
+    sim_close,
+    sim_sync_tx,
+    sim_sync_rx,
+    sim_get_timestamp,
+    sim_wait_timestamp,
+    sim_init_stream,
+    sim_stream,
+    sim_deinit_stream,
+};
@@ -0,0 +1,14 @@
+#include <stdbool.h>
+
+// A software stand-in for the bladeRF.  Selected with --device=sim or
+// --device=sim:<key>=<val>,... where the keys are:
+//   delay=<n>      Echo delay in samples [default: 100]
+//   atten=<dB>     Echo attenuation relative to the transmitted burst [default: 20]
+//   noise=<dBFS>   Receiver noise floor, -200 for a noiseless channel [default: -60]
+//   freerun        Don't pace timestamps against the wall clock; the clock moves
+//                  as fast as RX reads samples, held back only by the TX
+//                  schedule (for benchmarking)
+struct device_ops;
+extern const struct device_ops sim_ops;
+
+bool is_sim_devstr(const char * devstr);
@@ -0,0 +1,396 @@
+#include <libbladeRF.h>
+#include "device.h"
+#include "options.h"
+#include "util.h"
+#include "rx.h"
+#include "tx.h"
+#include "waveform.h"
+#include "metrics.h"
+#include "stream.h"
+#include "realtime.h"
+#include "radio.h"
+#include <stdlib.h>
+#include <string.h>
+
+// What RX and TX streams have in common
+struct stream_state {
+    struct bladerf_stream * stream;
+    void ** buffers;
+    unsigned int num_buffers;
+    unsigned int msgs_per_buffer;
+    unsigned int msg_samples;
+    bladerf_module module;
+    struct radio * r;
+
+    pthread_t thread;
+    std::atomic<bool> running;
+};
+
+struct stream_rx_state {
+    struct stream_state s;
+
+    // Buffers with blocks in the ring, oldest first, each with the ring
+    // position just past its last block.  Only touched by the callback.
+    void ** held;
+    uint64_t * held_end;
+    unsigned int held_first;
+    unsigned int held_count;
+
+    // Buffers past this one have never been handed to the device
+    unsigned int next_fresh;
+
+    uint64_t expected_ts;
+    bool first;
+
+    // expected_ts as of the last callback, for TX to tell the time by (0
+    // until something's come in)
+    std::atomic<uint64_t> now;
+};
+
+struct stream_tx_state {
+    struct stream_state s;
+
+    // Every burst takes this many buffers, and there are a few copies of it
+    unsigned int buffers_per_burst;
+
+    // Next buffer to hand out, and when the burst it's part of goes out
+    unsigned int next;
+    uint64_t next_ts;
+};
+
+// One of each per radio
+static struct stream_rx_state stream_rx[MAX_RADIOS];
+static struct stream_tx_state stream_tx[MAX_RADIOS];
+
+static void * stream_thread(void * arg)
+{
+    struct stream_state * st = (struct stream_state *)arg;
+    rt_thread_setup(st->module == BLADERF_MODULE_RX ? RT_RX : RT_TX, 0);
+
+    // Returns once the callback says to shut down, or the device gives up
+    int status = device_stream(&st->r->device, st->stream, st->module);
+    if( status != 0 ) {
+        ERROR("%s%s stream failed: %s\n", st->r->label, st->module == BLADERF_MODULE_RX ? "RX" : "TX",
+              bladerf_strerror(status));
+        metric_inc(st->module == BLADERF_MODULE_RX ? M_RX_ERRORS : M_TX_ERRORS);
+    }
+    return NULL;
+}
+
+static bool stream_setup(struct stream_state * st, struct radio * r, bladerf_module module,
+                         bladerf_stream_cb callback, unsigned int num_buffers)
+{
+    unsigned int msg_size = r->device.msg_size;
+    size_t buffer_bytes = (size_t)opts.buffer_size*2*sizeof(int16_t);
+    if( buffer_bytes % msg_size != 0 ) {
+        ERROR("Buffer size of %u samples isn't a whole number of %u byte messages\n",
+              opts.buffer_size, msg_size);
+        return false;
+    }
+    st->module = module;
+    st->r = r;
+    st->num_buffers = num_buffers;
+    st->msgs_per_buffer = (unsigned int)(buffer_bytes/msg_size);
+    st->msg_samples = stream_msg_samples(msg_size);
+
+    // The callbacks get st back as their user_data
+    int status = device_init_stream(&r->device, &st->stream, callback, &st->buffers, num_buffers,
+                                    opts.buffer_size, opts.num_transfers, st);
+    if( status != 0 ) {
+        ERROR("%sFailed to set up %s stream: %s\n", r->label, module == BLADERF_MODULE_RX ? "RX" : "TX",
+              bladerf_strerror(status));
+        st->stream = NULL;
+        return false;
+    }
+    return true;
+}
+
+static bool stream_start(struct stream_state * st)
+{
+    st->running = true;
+    if( pthread_create(&st->thread, NULL, stream_thread, st) != 0 ) {
+        ERROR("%sFailed to start %s stream thread\n", st->r->label,
+              st->module == BLADERF_MODULE_RX ? "RX" : "TX");
+        st->running = false;
+        return false;
+    }
+    return true;
+}
+
+static void stream_stop(struct stream_state * st)
+{
+    // The callback notices the next time a buffer comes back
+    st->running = false;
+    pthread_join(st->thread, NULL);
+}
+
+/*
+ * RX
+ */
+
+// A buffer the device can fill next, or NULL if the ring's consumers are
+// still holding on to every one we've got
+static void * rx_free_buffer(struct stream_rx_state * srx)
+{
+    if( srx->next_fresh < srx->s.num_buffers )
+        return srx->s.buffers[srx->next_fresh++];
+    if( srx->held_count == 0 ||
+        ring_released(&srx->s.r->rx.ring) < srx->held_end[srx->held_first] )
+        return NULL;
+
+    void * buf = srx->held[srx->held_first];
+    srx->held_first = (srx->held_first + 1) % srx->s.num_buffers;
+    srx->held_count--;
+    return buf;
+}
+
+static void * rx_stream_callback(struct bladerf * dev, struct bladerf_stream * stream,
+                                 struct bladerf_metadata * meta, void * samples, size_t num_samples,
+                                 void * user_data)
+{
+    struct stream_rx_state * srx = (struct stream_rx_state *)user_data;
+    struct sample_ring * ring = &srx->s.r->rx.ring;
+    const unsigned int msg_size = srx->s.r->device.msg_size;
+    const unsigned int msg_samples = srx->s.msg_samples;
+
+    if( !srx->s.running.load(std::memory_order_relaxed) )
+        return BLADERF_STREAM_SHUTDOWN;
+
+    unsigned int msgs = (unsigned int)(num_samples*2*sizeof(int16_t)/msg_size);
+    metric_add(M_RX_BLOCKS, msgs);
+    metric_add(M_RX_SAMPLES, (uint64_t)msgs*msg_samples);
+
+    void * next = rx_free_buffer(srx);
+    if( !next ) {
+        // Keep the device fed with this one, and lose what's in it
+        metric_add(M_RX_RING_OVERRUNS, msgs);
+        uint8_t * last = (uint8_t *)samples + (size_t)(msgs - 1)*msg_size;
+        srx->expected_ts = stream_msg_timestamp(last) + msg_samples;
+        srx->now.store(srx->expected_ts, std::memory_order_relaxed);
+        return samples;
+    }
+
+    // Every message becomes a block, samples and all, right where it is.  The
+    // ring has room for every buffer's worth, so claiming never fails.
+    for( unsigned int idx=0; idx<msgs; ++idx ) {
+        uint8_t * msg = (uint8_t *)samples + (size_t)idx*msg_size;
+        uint64_t ts = stream_msg_timestamp(msg);
+        struct rx_block * block = ring_claim(ring);
+
+        // Overruns aren't flagged in-band, but they leave a gap
+        block->status = 0;
+        if( !srx->first && ts != srx->expected_ts ) {
+            block->status = BLADERF_META_STATUS_OVERRUN;
+            metric_inc(M_RX_DEVICE_OVERRUNS);
+            metric_inc(M_RX_DISCONTINUITIES);
+        }
+        srx->expected_ts = ts + msg_samples;
+        srx->first = false;
+
+        block->timestamp = ts;
+        block->count = msg_samples;
+        block->samples = (int16_t *)(msg + STREAM_HEADER_SIZE);
+        ring_publish(ring);
+    }
+
+    unsigned int slot = (srx->held_first + srx->held_count) % srx->s.num_buffers;
+    srx->held[slot] = samples;
+    srx->held_end[slot] = ring->head.load(std::memory_order_relaxed);
+    srx->held_count++;
+    srx->now.store(srx->expected_ts, std::memory_order_relaxed);
+    metric_set(M_RX_RING_FILL, ring_fill(ring));
+    return next;
+}
+
+bool start_stream_rx(struct radio * r)
+{
+    struct stream_rx_state * srx = &stream_rx[r->idx];
+
+    // Enough buffers to give processing as much headroom as the sync ring does
+    if( !stream_setup(&srx->s, r, BLADERF_MODULE_RX, rx_stream_callback,
+                      RX_RING_BLOCKS + opts.num_transfers) )
+        return false;
+
+    unsigned int num_blocks = 1;
+    while( num_blocks < srx->s.num_buffers*srx->s.msgs_per_buffer )
+        num_blocks <<= 1;
+    srx->held = (void **)calloc(srx->s.num_buffers, sizeof(void *));
+    srx->held_end = (uint64_t *)calloc(srx->s.num_buffers, sizeof(uint64_t));
+    if( !srx->held || !srx->held_end ||
+        !ring_init_external(&r->rx.ring, num_blocks, srx->s.msg_samples) ) {
+        ERROR("%sFailed to allocate RX ring of %u blocks\n", r->label, num_blocks);
+        goto fail;
+    }
+    if( opts.capture[0] != '\0' )
+        ring_add_tap(&r->rx.ring);
+
+    // libbladeRF starts out with the first num_transfers buffers
+    srx->held_first = 0;
+    srx->held_count = 0;
+    srx->next_fresh = MIN(opts.num_transfers, srx->s.num_buffers);
+    srx->first = true;
+    srx->now = 0;
+
+    if( !stream_start(&srx->s) ) {
+        ring_free(&r->rx.ring);
+        goto fail;
+    }
+    LOG("%sRX stream started with %u x %u sample buffers (%u samples per block)\n",
+        r->label, srx->s.num_buffers, opts.buffer_size, srx->s.msg_samples);
+    return true;
+
+fail:
+    free(srx->held);
+    free(srx->held_end);
+    srx->held = NULL;
+    srx->held_end = NULL;
+    device_deinit_stream(&r->device, srx->s.stream);
+    srx->s.stream = NULL;
+    return false;
+}
+
+void stop_stream_rx(struct radio * r)
+{
+    stream_stop(&stream_rx[r->idx].s);
+}
+
+void stream_rx_cleanup(struct radio * r)
+{
+    struct stream_rx_state * srx = &stream_rx[r->idx];
+
+    if( srx->s.stream )
+        device_deinit_stream(&r->device, srx->s.stream);
+    srx->s.stream = NULL;
+    free(srx->held);
+    free(srx->held_end);
+    srx->held = NULL;
+    srx->held_end = NULL;
+}
+
+/*
+ * TX
+ */
+
+// Asking the device what time it is would hold up the stream, so go by the
+// last RX timestamp instead, which can only be behind it.  If the burst about
+// to go out isn't at least min_lead past that it's late: skip ahead by whole
+// PRIs, like tx_schedule_burst() does, and make some noise about it.
+static void tx_stream_catch_up(struct stream_tx_state * stx)
+{
+    struct radio * r = stx->s.r;
+    struct tx_data_struct * tx = &r->tx;
+    uint64_t now = stream_rx[r->idx].now.load(std::memory_order_relaxed);
+    if( now == 0 )
+        return;
+
+    if( stx->next_ts < now + tx->min_lead ) {
+        uint64_t behind = now + tx->min_lead - stx->next_ts;
+        uint64_t skip = (behind + tx->pri - 1)/tx->pri;
+        ERROR("%sLate burst: %llu samples behind, skipping %llu PRIs\n",
+              r->label, (unsigned long long)behind, (unsigned long long)skip);
+        stx->next_ts += skip*tx->pri;
+        metric_inc(M_TX_LATE_BURSTS);
+        metric_add(M_TX_SKIPPED_PRIS, skip);
+        metric_observe(M_TX_SLIP_SAMPLES, behind);
+    }
+    metric_observe(M_TX_LEAD_SAMPLES, stx->next_ts - now);
+}
+
+static void * tx_stream_callback(struct bladerf * dev, struct bladerf_stream * stream,
+                                 struct bladerf_metadata * meta, void * samples, size_t num_samples,
+                                 void * user_data)
+{
+    struct stream_tx_state * stx = (struct stream_tx_state *)user_data;
+    const unsigned int msg_size = stx->s.r->device.msg_size;
+    const unsigned int msgs = stx->s.msgs_per_buffer;
+
+    if( !stx->s.running.load(std::memory_order_relaxed) )
+        return BLADERF_STREAM_SHUTDOWN;
+
+    // Buffers go round in order, and there are more of them than the device
+    // can have in flight, so this one's long since been sent.  Its samples
+    // are already right; only when they go out changes.
+    unsigned int part = stx->next % stx->buffers_per_burst;
+    if( part == 0 )
+        tx_stream_catch_up(stx);
+    uint8_t * buf = (uint8_t *)stx->s.buffers[stx->next];
+    uint64_t ts = stx->next_ts + (uint64_t)part*msgs*stx->s.msg_samples;
+    for( unsigned int idx=0; idx<msgs; ++idx )
+        stream_msg_set_timestamp(buf + (size_t)idx*msg_size, ts + (uint64_t)idx*stx->s.msg_samples);
+
+    if( part == 0 )
+        tx_record_burst(&stx->s.r->tx, stx->next_ts);
+    if( part == stx->buffers_per_burst - 1 ) {
+        stx->next_ts += stx->s.r->tx.pri;
+        metric_inc(M_TX_BURSTS);
+    }
+    stx->next = (stx->next + 1) % stx->s.num_buffers;
+    return buf;
+}
+
+bool start_stream_tx(struct radio * r)
+{
+    struct stream_tx_state * stx = &stream_tx[r->idx];
+    const struct waveform * wf = r->tx.wf;
+    const unsigned int msg_size = r->device.msg_size;
+    const unsigned int msg_samples = stream_msg_samples(msg_size);
+    const unsigned int msgs_per_buffer = opts.buffer_size*2*sizeof(int16_t)/msg_size;
+
+    // Bursts go out in whole buffers, and end on at least one zero sample so
+    // the DAC doesn't sit on whatever the last one was
+    unsigned int msgs = (wf->burst_len + 1 + msg_samples - 1)/msg_samples;
+    unsigned int buffers_per_burst = (msgs + msgs_per_buffer - 1)/msgs_per_buffer;
+    msgs = buffers_per_burst*msgs_per_buffer;
+    uint64_t padded = (uint64_t)msgs*msg_samples;
+    if( padded > r->tx.pri ) {
+        ERROR("Burst of %u samples takes %llu once padded out to whole stream buffers, which "
+              "doesn't fit in a PRI of %llu samples\n", wf->burst_len, (unsigned long long)padded,
+              (unsigned long long)r->tx.pri);
+        ERROR("Use a longer --pri or shorter --burst, or --stream=sync\n");
+        return false;
+    }
+
+    // At least two copies of the burst, and more buffers than can be in flight
+    unsigned int copies = MAX(2u, opts.num_transfers/buffers_per_burst + 2);
+    if( !stream_setup(&stx->s, r, BLADERF_MODULE_TX, tx_stream_callback, copies*buffers_per_burst) )
+        return false;
+    stx->buffers_per_burst = buffers_per_burst;
+
+    // The only time we ever touch samples: lay the burst out in every copy
+    for( unsigned int b=0; b<stx->s.num_buffers; ++b ) {
+        uint8_t * buf = (uint8_t *)stx->s.buffers[b];
+        for( unsigned int idx=0; idx<msgs_per_buffer; ++idx ) {
+            unsigned int m = (b % buffers_per_burst)*msgs_per_buffer + idx;
+            uint8_t * msg = buf + (size_t)idx*msg_size;
+            uint32_t flags = (m == 0 ? STREAM_FLAG_TX_BURST_START : 0) |
+                             (m == msgs - 1 ? STREAM_FLAG_TX_BURST_END : 0);
+            stream_msg_set_header(msg, 0, flags);
+
+            int16_t * out = (int16_t *)(msg + STREAM_HEADER_SIZE);
+            unsigned int start = m*msg_samples;
+            unsigned int n = start < wf->burst_len ? MIN(msg_samples, wf->burst_len - start) : 0;
+            memcpy(out, wf->burst + 2*(size_t)start, 2*sizeof(int16_t)*n);
+            memset(out + 2*n, 0, 2*sizeof(int16_t)*(msg_samples - n));
+        }
+    }
+    stx->next = 0;
+    stx->next_ts = r->tx.epoch;
+
+    if( !stream_start(&stx->s) ) {
+        device_deinit_stream(&r->device, stx->s.stream);
+        stx->s.stream = NULL;
+        return false;
+    }
+    LOG("%sTX stream started with %u x %u sample buffers, %u per burst\n",
+        r->label, stx->s.num_buffers, opts.buffer_size, buffers_per_burst);
+    return true;
+}
+
+void stop_stream_tx(struct radio * r)
+{
+    struct stream_tx_state * stx = &stream_tx[r->idx];
+
+    stream_stop(&stx->s);
+    device_deinit_stream(&r->device, stx->s.stream);
+    stx->s.stream = NULL;
+}
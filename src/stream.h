@@ -0,0 +1,78 @@
+#ifndef STREAM_H
+#define STREAM_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+/*
+ * The zero-copy streaming engine (--stream=async).
+ *
+ * Instead of bladerf_sync_rx()/bladerf_sync_tx() copying every sample through
+ * libbladeRF's own buffers, both modules run on the async stream API and we
+ * work directly in the buffers it hands us.  In SC16_Q11_META format each of
+ * those buffers is a run of messages, a header (timestamp and flags) followed
+ * by samples:
+ *
+ *  - RX: every message becomes an rx_block whose samples point straight into
+ *    the stream buffer.  A buffer goes back to the device once every block in
+ *    it has been released by the ring's consumers.
+ *  - TX: the burst is laid out in messages once, in a few copies.  All the
+ *    callback does is patch the timestamps in a copy's headers and hand it
+ *    back; the device holds it until its time comes.
+ */
+
+// In-band metadata at the start of every message
+#define STREAM_HEADER_SIZE 16
+#define STREAM_TIMESTAMP_OFFSET 4
+#define STREAM_FLAGS_OFFSET 12
+#define STREAM_FLAG_TX_BURST_START (1 << 0)
+#define STREAM_FLAG_TX_BURST_END (1 << 1)
+
+// Samples (not int16_t's) after the header of a message of msg_size bytes
+static inline unsigned int stream_msg_samples(unsigned int msg_size)
+{
+    return (msg_size - STREAM_HEADER_SIZE)/(2*sizeof(int16_t));
+}
+
+static inline uint64_t stream_msg_timestamp(const void * msg)
+{
+    uint64_t ts;
+    memcpy(&ts, (const uint8_t *)msg + STREAM_TIMESTAMP_OFFSET, sizeof(ts));
+    return le64toh(ts);
+}
+
+static inline uint32_t stream_msg_flags(const void * msg)
+{
+    uint32_t flags;
+    memcpy(&flags, (const uint8_t *)msg + STREAM_FLAGS_OFFSET, sizeof(flags));
+    return le32toh(flags);
+}
+
+static inline void stream_msg_set_timestamp(void * msg, uint64_t ts)
+{
+    ts = htole64(ts);
+    memcpy((uint8_t *)msg + STREAM_TIMESTAMP_OFFSET, &ts, sizeof(ts));
+}
+
+static inline void stream_msg_set_header(void * msg, uint64_t ts, uint32_t flags)
+{
+    memset(msg, 0, STREAM_HEADER_SIZE);
+    stream_msg_set_timestamp(msg, ts);
+    flags = htole32(flags);
+    memcpy((uint8_t *)msg + STREAM_FLAGS_OFFSET, &flags, sizeof(flags));
+}
+
+struct radio;
+
+// RX: set up r's ring and an RX stream feeding it, and start streaming.
+// stop_stream_rx() stops it, but the stream buffers (which the ring's blocks
+// point into) stick around until stream_rx_cleanup().
+bool start_stream_rx(struct radio * r);
+void stop_stream_rx(struct radio * r);
+void stream_rx_cleanup(struct radio * r);
+
+// TX: transmit r->tx.wf every r->tx.pri samples from r->tx.epoch until stopped
+bool start_stream_tx(struct radio * r);
+void stop_stream_tx(struct radio * r);
+#endif
@@ -0,0 +1,191 @@
+#include <libbladeRF.h>
+#include "device.h"
+#include "options.h"
+#include "util.h"
+#include "waveform.h"
+#include "tx.h"
+#include "metrics.h"
+#include "stream.h"
+#include "realtime.h"
+#include "radio.h"
+#include <string.h>
+#include <unistd.h>
+
+bool tx_init(struct radio * r, const struct waveform * wf)
+{
+    struct tx_data_struct * tx = &r->tx;
+    struct device_data_struct * dd = &r->device;
+    tx->wf = wf;
+    tx->pri = (uint64_t)(opts.pri_ms*opts.samplerate/1000);
+    tx->lead = (uint64_t)(opts.tx_lead_ms*opts.samplerate/1000);
+
+    // libbladeRF needs at least a transfer's worth of time to get samples out
+    // the door before their timestamp comes up
+    tx->min_lead = opts.buffer_size;
+
+    if( wf->burst_len > tx->pri ) {
+        ERROR("Burst of %u samples doesn't fit in a PRI of %llu samples\n",
+              wf->burst_len, (unsigned long long)tx->pri);
+        return false;
+    }
+    if( tx->lead < 2*tx->min_lead ) {
+        LOG("TX lead time too short at this sample rate, using %u samples\n", 2*opts.buffer_size);
+        tx->lead = 2*tx->min_lead;
+    }
+
+    uint64_t now;
+    int status = device_get_timestamp(dd, BLADERF_MODULE_TX, &now);
+    if( status != 0 ) {
+        ERROR("%sFailed to get TX timestamp: %s\n", r->label, bladerf_strerror(status));
+        return false;
+    }
+    // Leave time for the rest of startup (RX ring, threads) so that the very
+    // first burst isn't already late
+    tx->epoch = now + MAX(tx->lead, (uint64_t)opts.samplerate/10);
+    dd->next_tx_time = tx->epoch;
+    tx->history_count = 0;
+    metric_set(M_TX_EPOCH, (int64_t)tx->epoch);
+
+    INFO("  PRI: %llu samples\n", (unsigned long long)tx->pri);
+    INFO("  Burst: %u samples\n", wf->burst_len);
+    INFO("  TX lead: %llu samples\n", (unsigned long long)tx->lead);
+    return true;
+}
+
+// False if the device let us down, rather than just being late
+static bool tx_schedule_burst(struct radio * r)
+{
+    struct tx_data_struct * tx = &r->tx;
+    struct device_data_struct * dd = &r->device;
+    struct bladerf_metadata meta;
+    uint64_t now;
+    int status;
+
+    status = device_get_timestamp(dd, BLADERF_MODULE_TX, &now);
+    if( status != 0 ) {
+        ERROR("%sFailed to get TX timestamp: %s\n", r->label, bladerf_strerror(status));
+        metric_inc(M_TX_ERRORS);
+        return false;
+    }
+
+    // If we've fallen behind, skip ahead by whole PRIs so every burst stays on
+    // the same grid, and make some noise about it
+    if( dd->next_tx_time < now + tx->min_lead ) {
+        uint64_t behind = now + tx->min_lead - dd->next_tx_time;
+        uint64_t skip = (behind + tx->pri - 1)/tx->pri;
+        ERROR("%sLate burst: %llu samples behind, skipping %llu PRIs\n",
+              r->label, (unsigned long long)behind, (unsigned long long)skip);
+        dd->next_tx_time += skip*tx->pri;
+        metric_inc(M_TX_LATE_BURSTS);
+        metric_add(M_TX_SKIPPED_PRIS, skip);
+        metric_observe(M_TX_SLIP_SAMPLES, behind);
+    }
+
+    // Don't queue up more than our lead time; sleep until it's time instead
+    if( dd->next_tx_time > now + tx->lead ) {
+        uint64_t wake = dd->next_tx_time - tx->lead;
+        unsigned int timeout_ms = (unsigned int)((wake - now)*1000/opts.samplerate) + opts.timeout_ms;
+        status = device_wait_timestamp(dd, BLADERF_MODULE_TX, wake, timeout_ms);
+        if( status != 0 ) {
+            ERROR("%sFailed waiting for TX timestamp: %s\n", r->label, bladerf_strerror(status));
+            metric_inc(M_TX_ERRORS);
+            return false;
+        }
+        now = wake;
+    }
+    metric_observe(M_TX_LEAD_SAMPLES, dd->next_tx_time - now);
+
+    memset(&meta, 0, sizeof(meta));
+    meta.flags = BLADERF_META_FLAG_TX_BURST_START | BLADERF_META_FLAG_TX_BURST_END;
+    meta.timestamp = dd->next_tx_time;
+
+    uint64_t start = metrics_now_ns();
+    status = device_sync_tx(dd, (void *)tx->wf->burst, tx->wf->burst_len,
+                            &meta, opts.timeout_ms);
+    metric_observe(M_TX_QUEUE_NS, metrics_now_ns() - start);
+    if( status == BLADERF_ERR_TIME_PAST ) {
+        ERROR("%sLate burst: missed timestamp %llu\n", r->label, (unsigned long long)meta.timestamp);
+        metric_inc(M_TX_LATE_BURSTS);
+    } else if( status != 0 ) {
+        ERROR("%sTX failed for %u samples: %s\n", r->label, tx->wf->burst_len, bladerf_strerror(status));
+        metric_inc(M_TX_ERRORS);
+    } else {
+        tx_record_burst(tx, meta.timestamp);
+        metric_inc(M_TX_BURSTS);
+    }
+    dd->next_tx_time += tx->pri;
+    return status == 0 || status == BLADERF_ERR_TIME_PAST;
+}
+
+static void * tx_thread(void * arg)
+{
+    struct radio * r = (struct radio *)arg;
+
+    unsigned int errors = 0;
+
+    rt_thread_setup(RT_TX, 0);
+    while( r->tx.running.load(std::memory_order_relaxed) ) {
+        if( tx_schedule_burst(r) ) {
+            errors = 0;
+            continue;
+        }
+        if( ++errors >= TX_MAX_ERRORS ) {
+            ERROR("%sTX failed %u times in a row, giving up on this radio\n", r->label, errors);
+            r->tx.failed = true;
+            break;
+        }
+        usleep(1000*MIN(1u << (errors - 1), (unsigned int)TX_RETRY_MAX_MS));
+    }
+    return NULL;
+}
+
+bool start_tx(struct radio * r)
+{
+    // The async engine transmits from its stream callback
+    if( opts.async_stream )
+        return start_stream_tx(r);
+
+    r->tx.running = true;
+    r->tx.failed = false;
+    if( pthread_create(&r->tx.thread, NULL, tx_thread, r) != 0 ) {
+        ERROR("%sFailed to start TX thread\n", r->label);
+        r->tx.running = false;
+        return false;
+    }
+    return true;
+}
+
+void stop_tx(struct radio * r)
+{
+    if( opts.async_stream ) {
+        stop_stream_tx(r);
+    } else {
+        // It notices once it's done waiting on the burst it's queueing up
+        r->tx.running = false;
+        pthread_join(r->tx.thread, NULL);
+    }
+}
+
+void tx_record_burst(struct tx_data_struct * tx, uint64_t ts)
+{
+    uint64_t n = tx->history_count.load(std::memory_order_relaxed);
+    tx->history[n % TX_HISTORY].store(ts, std::memory_order_release);
+    tx->history_count.store(n + 1, std::memory_order_release);
+}
+
+bool tx_burst_time(const struct tx_data_struct * tx, uint64_t n, uint64_t * ts)
+{
+    if( n >= tx->history_count.load(std::memory_order_acquire) )
+        return false;
+    *ts = tx->history[n % TX_HISTORY].load(std::memory_order_acquire);
+
+    // If the writer's lapped us since we checked, that was some later burst
+    return n + TX_HISTORY > tx->history_count.load(std::memory_order_relaxed);
+}
+
+void tx_report(void)
+{
+    LOG("\nTX: %llu bursts, %llu late, %llu PRIs skipped, %llu errors",
+        (unsigned long long)metric_total(M_TX_BURSTS), (unsigned long long)metric_total(M_TX_LATE_BURSTS),
+        (unsigned long long)metric_total(M_TX_SKIPPED_PRIS), (unsigned long long)metric_total(M_TX_ERRORS));
+}
@@ -0,0 +1,71 @@
+#ifndef TX_H
+#define TX_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+
+struct waveform;
+struct radio;
+
+// Bursts whose timestamps we remember, a power of two
+#define TX_HISTORY 1024
+
+// Like RX (see rx.h): back off twice as long after each failure in a row, up
+// to TX_RETRY_MAX_MS, and give up on the radio after TX_MAX_ERRORS of them
+#define TX_RETRY_MAX_MS 250
+#define TX_MAX_ERRORS 20
+
+struct tx_data_struct {
+    // What we're sending
+    const struct waveform * wf;
+
+    // Samples between the starts of consecutive bursts
+    uint64_t pri;
+
+    // How far ahead of the device clock we keep bursts queued up
+    uint64_t lead;
+
+    // A burst that we can't get queued at least this far ahead is late
+    uint64_t min_lead;
+
+    // Timestamp of the very first burst; every burst goes out at a whole
+    // number of PRIs after this
+    uint64_t epoch;
+
+    // Timestamps of the last TX_HISTORY bursts we handed to the radio: burst
+    // n (counting from 0) is in history[n % TX_HISTORY], and history_count
+    // bursts have gone in so far.  Only whatever queues up bursts writes it.
+    std::atomic<uint64_t> history[TX_HISTORY];
+    std::atomic<uint64_t> history_count;
+
+    // With sync calls, the thread queueing up bursts
+    pthread_t thread;
+    std::atomic<bool> running;
+
+    // Set when the TX thread has given up, see TX_MAX_ERRORS
+    std::atomic<bool> failed;
+
+    // Statistics are kept in metrics.h, under M_TX_*
+};
+
+// Set up r's schedule for transmitting wf every opts.pri_ms, starting as soon
+// as we can get opts.tx_lead_ms ahead of the device.  The epoch can still be
+// moved (later, and by whole samples) until TX starts.
+bool tx_init(struct radio * r, const struct waveform * wf);
+
+// Start transmitting on schedule: with sync calls on a thread that queues up
+// each burst at its exact timestamp, sleeping whenever it's more than our
+// lead time ahead of the device, or with --stream=async on the async engine
+bool start_tx(struct radio * r);
+void stop_tx(struct radio * r);
+
+// Remember that a burst goes out at timestamp ts
+void tx_record_burst(struct tx_data_struct * tx, uint64_t ts);
+
+// The timestamp of burst n in *ts.  False if it hasn't been queued yet, or
+// has been forgotten.
+bool tx_burst_time(const struct tx_data_struct * tx, uint64_t n, uint64_t * ts);
+
+void tx_report(void);
+#endif
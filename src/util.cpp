@@ -22,6 +22,11 @@ const struct numeric_suffix time_suffixes[NUM_TIME_SUFFIXES] = {
     {"ms", 1}
 };
 
+const struct numeric_suffix distance_suffixes[NUM_DISTANCE_SUFFIXES] = {
+    {"km", 1000},
+    {"m",  1}
+};
+
 
 void time2str(struct timeval &tv, char * out)
 {
@@ -113,36 +118,3 @@ bladerf_lna_gain bladerf_db_to_lna_gain(unsigned char db, bool * ok)
             return BLADERF_LNA_GAIN_UNKNOWN;
     }
 }
-
-void hann(double * rainbow, unsigned int len) {
-    for( int idx=0; idx<len; ++idx )
-        rainbow[idx] = 0.5 * (1 - cos(2*M_PI*idx/(len - 1)));
-}
-
-void hamming(double * window, unsigned int len) {
-    for( int idx=0; idx<len; ++idx )
-        window[idx] = 0.53836 - 0.46164*cos(2*M_PI*idx/(len - 1));
-}
-
-void rect(double * window, unsigned int len) {
-    for( int idx=0; idx<len; ++idx)
-        window[idx] = 1.0;
-}
-
-// If length is zero, we're just checking to see if window_name is valid
-bool gen_window(const char * name, double * window, unsigned int len) {
-    if( strcasecmp(name, "hann") == 0 ) {
-        hann(window, len);
-        return true;
-    }
-    if( strcasecmp(name, "hamming") == 0 ) {
-        hamming(window, len);
-        return true;
-    }
-    if( strcasecmp(name, "boxcar") == 0 || strcasecmp(name, "rect") == 0 ||
-        strcasecmp(name, "rectangular") == 0) {
-        rect(window, len);
-        return true;
-    }
-    return false;
-}
@@ -2,10 +2,11 @@
 #include <libbladeRF.h>
 #include <time.h>
 
-// Some useful define's
-#define ERROR(x...) fprintf(stderr, x)
-#define LOG(x...)  if( opts.verbosity > 0 ) { fprintf(stderr, x); }
-#define INFO(x...) if( opts.verbosity > 1 ) { fprintf(stderr, x); }
+// Some useful define's.  These hand messages off to the logging thread (see
+// logger.h) rather than writing to stderr themselves.
+#define ERROR(x...) ((void)sizeof(log_check_format(x)), log_write(LOG_LEVEL_ERROR, x))
+#define LOG(x...)  if( opts.verbosity > 0 ) { (void)sizeof(log_check_format(x)); log_write(LOG_LEVEL_LOG, x); }
+#define INFO(x...) if( opts.verbosity > 1 ) { (void)sizeof(log_check_format(x)); log_write(LOG_LEVEL_INFO, x); }
 
 #ifndef MAX
 #define MAX(x, y) ((x)  > (y) ? (x) : (y))
@@ -13,11 +14,10 @@
 #ifndef MIN
 #define MIN(x, y) ((x) <= (y) ? (x) : (y))
 #endif
+#include "logger.h"
 #define msdiff(a, b) ((a.tv_sec - b.tv_sec)*1000 + (a.tv_usec - b.tv_usec)/1000)
 
 
-bool gen_window(const char * window_name, double * window, unsigned int len);
-
 // Time.... time makes fools of us all
 void time2str(struct timeval &tv, char * out);
 
@@ -27,6 +27,11 @@ void time2str(struct timeval &tv, char * out);
 extern const struct numeric_suffix freq_suffixes[NUM_FREQ_SUFFIXES];
 #define NUM_TIME_SUFFIXES 5
 extern const struct numeric_suffix time_suffixes[NUM_TIME_SUFFIXES];
+#define NUM_DISTANCE_SUFFIXES 2
+extern const struct numeric_suffix distance_suffixes[NUM_DISTANCE_SUFFIXES];
+
+// Metres per second, for turning echo delays into ranges
+#define SPEED_OF_LIGHT 299792458.0
 
 // Here are some things that should go back into conversions.{c,h} I think...
 int double2str_suffix(char * out, double val, const struct numeric_suffix suffixes[],
@@ -0,0 +1,326 @@
+#include <libbladeRF.h>
+#include "options.h"
+#include "util.h"
+#include "waveform.h"
+#include "codes.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+
+static std::vector<struct waveform> bank;
+
+// Codes we always have, built at compile time, unless there's a file of the
+// same name
+struct builtin_code {
+    const char * name;
+    const int16_t * iq;
+    const float * taps;
+    unsigned int len;
+};
+
+#define BUILTIN_CODE(name, type, len) \
+    { name, code_table<type, len>::value.iq, code_table<type, len>::value.taps, len }
+
+static const struct builtin_code builtin_codes[] = {
+    BUILTIN_CODE("barker2", CODE_BARKER, 2),
+    BUILTIN_CODE("barker3", CODE_BARKER, 3),
+    BUILTIN_CODE("barker4", CODE_BARKER, 4),
+    BUILTIN_CODE("barker5", CODE_BARKER, 5),
+    BUILTIN_CODE("barker7", CODE_BARKER, 7),
+    BUILTIN_CODE("barker11", CODE_BARKER, 11),
+    BUILTIN_CODE("barker13", CODE_BARKER, 13),
+    BUILTIN_CODE("frank16", CODE_FRANK, 16),
+    BUILTIN_CODE("frank64", CODE_FRANK, 64),
+    BUILTIN_CODE("p3_64", CODE_P3, 64),
+    BUILTIN_CODE("p4_64", CODE_P4, 64),
+    BUILTIN_CODE("lfm64", CODE_LFM, 64),
+    BUILTIN_CODE("lfm256", CODE_LFM, 256),
+};
+#define NUM_BUILTIN_CODES (sizeof(builtin_codes)/sizeof(builtin_codes[0]))
+
+// A code we can generate, as named by the user
+struct code_spec {
+    enum code_type type;
+    unsigned int len;
+    double bt;
+    unsigned int spc;
+};
+
+static const struct {
+    const char * prefix;
+    enum code_type type;
+} code_prefixes[] = {
+    { "barker", CODE_BARKER },
+    { "frank", CODE_FRANK },
+    { "p3_", CODE_P3 },
+    { "p4_", CODE_P4 },
+    { "lfm", CODE_LFM },
+};
+#define NUM_CODE_PREFIXES (sizeof(code_prefixes)/sizeof(code_prefixes[0]))
+
+// barker<n>, frank<n>, p3_<n>, p4_<n> or lfm<n>[_bt<bt>], then maybe x<spc>
+static bool parse_code_name(const char * name, struct code_spec * cs)
+{
+    const char * p = NULL;
+    for( unsigned int idx=0; idx<NUM_CODE_PREFIXES; ++idx ) {
+        size_t len = strlen(code_prefixes[idx].prefix);
+        if( strncmp(name, code_prefixes[idx].prefix, len) == 0 ) {
+            cs->type = code_prefixes[idx].type;
+            p = name + len;
+            break;
+        }
+    }
+    if( !p || !isdigit(*p) )
+        return false;
+
+    char * end;
+    cs->len = strtoul(p, &end, 10);
+    cs->bt = CODE_LFM_DEFAULT_BT(cs->len);
+    cs->spc = 1;
+    if( cs->type == CODE_LFM && strncmp(end, "_bt", 3) == 0 ) {
+        if( !isdigit(end[3]) )
+            return false;
+        cs->bt = strtod(end + 3, &end);
+    }
+    if( *end == 'x' ) {
+        if( !isdigit(end[1]) )
+            return false;
+        cs->spc = strtoul(end + 1, &end, 10);
+    }
+    return *end == '\0';
+}
+
+static void * map_anon(size_t len)
+{
+    void * p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+void waveform_tile(const int16_t * code, unsigned int code_len, int16_t * burst, unsigned int burst_len)
+{
+    // Copy the code in once, then keep doubling what we've got
+    size_t total = sizeof(int16_t)*2*burst_len;
+    size_t filled = MIN(sizeof(int16_t)*2*code_len, total);
+    memcpy(burst, code, filled);
+    while( filled < total ) {
+        size_t n = MIN(filled, total - filled);
+        memcpy((char *)burst + filled, burst, n);
+        filled += n;
+    }
+}
+
+// Repeat the code out to (at most) burst_len samples, then lock it read-only
+static bool tile_burst(struct waveform * wf, unsigned int burst_len)
+{
+    unsigned int periods = burst_len/wf->code_len;
+    if( periods == 0 ) {
+        ERROR("Waveform %s (%u samples) is longer than a burst (%u samples)\n",
+              wf->name, wf->code_len, burst_len);
+        return false;
+    }
+
+    wf->burst_len = periods*wf->code_len;
+    wf->burst_map_len = sizeof(int16_t)*2*wf->burst_len;
+    int16_t * burst = (int16_t *)map_anon(wf->burst_map_len);
+    if( !burst ) {
+        ERROR("Failed to allocate %u sample burst for waveform %s\n", wf->burst_len, wf->name);
+        return false;
+    }
+
+    waveform_tile(wf->code, wf->code_len, burst, wf->burst_len);
+    mprotect(burst, wf->burst_map_len, PROT_READ);
+    wf->burst = burst;
+    return true;
+}
+
+static bool load_sc16(const char * path, const char * name, struct waveform * wf)
+{
+    int fd = open(path, O_RDONLY);
+    if( fd < 0 )
+        return false;
+
+    struct stat st;
+    if( fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size % (2*sizeof(int16_t)) != 0 ) {
+        ERROR("Ignoring %s, not a whole number of SC16 samples\n", path);
+        close(fd);
+        return false;
+    }
+
+    void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if( map == MAP_FAILED ) {
+        ERROR("Failed to map %s\n", path);
+        return false;
+    }
+
+    memset(wf, 0, sizeof(struct waveform));
+    snprintf(wf->name, WAVEFORM_NAME_LEN, "%s", name);
+    wf->code = (const int16_t *)map;
+    wf->code_len = st.st_size/(2*sizeof(int16_t));
+    wf->code_map = map;
+    wf->code_map_len = st.st_size;
+    return true;
+}
+
+// Taps for a code that came from a file
+static bool taps_from_code(struct waveform * wf)
+{
+    float * taps = (float *)malloc(sizeof(float)*2*wf->code_len);
+    if( !taps )
+        return false;
+    for( unsigned int idx=0; idx<wf->code_len; ++idx ) {
+        unsigned int rev = wf->code_len - 1 - idx;
+        taps[2*rev + 0] = wf->code[2*idx + 0]/2048.0f;
+        taps[2*rev + 1] = -wf->code[2*idx + 1]/2048.0f;
+    }
+    wf->taps = taps;
+    wf->taps_alloc = taps;
+    return true;
+}
+
+static void builtin_sc16(const struct builtin_code * bc, struct waveform * wf)
+{
+    memset(wf, 0, sizeof(struct waveform));
+    snprintf(wf->name, WAVEFORM_NAME_LEN, "%s", bc->name);
+    wf->code = bc->iq;
+    wf->code_len = bc->len;
+    wf->taps = bc->taps;
+}
+
+static bool synth_sc16(const char * name, const struct code_spec * cs, unsigned int burst_len,
+                       struct waveform * wf)
+{
+    if( !code_valid(cs->type, cs->len) || cs->spc == 0 ) {
+        ERROR("There's no such code as %s\n", name);
+        return false;
+    }
+    if( (uint64_t)cs->len*cs->spc > burst_len ) {
+        ERROR("Waveform %s (%llu samples) is longer than a burst (%u samples)\n", name,
+              (unsigned long long)cs->len*cs->spc, burst_len);
+        return false;
+    }
+
+    memset(wf, 0, sizeof(struct waveform));
+    snprintf(wf->name, WAVEFORM_NAME_LEN, "%s", name);
+    wf->code_len = cs->len*cs->spc;
+    wf->code_map_len = sizeof(int16_t)*2*wf->code_len;
+    int16_t * code = (int16_t *)map_anon(wf->code_map_len);
+    float * taps = (float *)malloc(sizeof(float)*2*wf->code_len);
+    if( !code || !taps ) {
+        ERROR("Failed to allocate %u sample waveform %s\n", wf->code_len, name);
+        if( code )
+            munmap(code, wf->code_map_len);
+        free(taps);
+        return false;
+    }
+
+    code_generate(cs->type, cs->len, cs->bt, cs->spc, code, taps);
+    wf->code = code;
+    wf->code_map = code;
+    wf->taps = taps;
+    wf->taps_alloc = taps;
+    return true;
+}
+
+static void free_waveform(struct waveform * wf)
+{
+    if( wf->code_map )
+        munmap(wf->code_map, wf->code_map_len);
+    if( wf->burst )
+        munmap((void *)wf->burst, wf->burst_map_len);
+    free(wf->taps_alloc);
+    memset(wf, 0, sizeof(struct waveform));
+}
+
+bool waveform_bank_init(const char * signal_dir, const char * wanted, unsigned int burst_len)
+{
+    struct waveform wf;
+
+    DIR * dir = opendir(signal_dir);
+    if( dir ) {
+        struct dirent * ent;
+        while( (ent = readdir(dir)) != NULL ) {
+            size_t len = strlen(ent->d_name);
+            if( len <= 5 || len - 5 >= WAVEFORM_NAME_LEN || strcmp(ent->d_name + len - 5, ".sc16") != 0 )
+                continue;
+
+            char name[WAVEFORM_NAME_LEN];
+            memcpy(name, ent->d_name, len - 5);
+            name[len - 5] = '\0';
+
+            std::vector<char> path(strlen(signal_dir) + len + 2);
+            sprintf(&path[0], "%s/%s", signal_dir, ent->d_name);
+            if( !load_sc16(&path[0], name, &wf) )
+                continue;
+            if( !taps_from_code(&wf) ) {
+                free_waveform(&wf);
+                continue;
+            }
+            bank.push_back(wf);
+        }
+        closedir(dir);
+    } else {
+        LOG("Can't open signal directory %s, only built-in waveforms are available\n", signal_dir);
+    }
+
+    for( unsigned int idx=0; idx<NUM_BUILTIN_CODES; ++idx ) {
+        if( !waveform_get(builtin_codes[idx].name) ) {
+            builtin_sc16(&builtin_codes[idx], &wf);
+            bank.push_back(wf);
+        }
+    }
+
+    // Anything else has to be added now, the bank can't move once we've
+    // handed out pointers into it
+    struct code_spec cs;
+    if( wanted && !waveform_get(wanted) && parse_code_name(wanted, &cs) ) {
+        if( strlen(wanted) >= WAVEFORM_NAME_LEN ) {
+            ERROR("Waveform name %s is too long\n", wanted);
+            waveform_bank_free();
+            return false;
+        }
+        if( !synth_sc16(wanted, &cs, burst_len, &wf) ) {
+            waveform_bank_free();
+            return false;
+        }
+        bank.push_back(wf);
+    }
+
+    // Only what we're going to transmit needs a burst, the rest are just
+    // there to match against (a replay's waveform, say)
+    for( size_t idx=0; idx<bank.size(); ++idx ) {
+        if( wanted && strcmp(bank[idx].name, wanted) == 0 ) {
+            if( !tile_burst(&bank[idx], burst_len) ) {
+                waveform_bank_free();
+                return false;
+            }
+            INFO("  Waveform %s: %u samples, %u per burst\n", bank[idx].name,
+                 bank[idx].code_len, bank[idx].burst_len);
+        } else {
+            INFO("  Waveform %s: %u samples\n", bank[idx].name, bank[idx].code_len);
+        }
+    }
+    return true;
+}
+
+void waveform_bank_free(void)
+{
+    for( size_t idx=0; idx<bank.size(); ++idx )
+        free_waveform(&bank[idx]);
+    bank.clear();
+}
+
+const struct waveform * waveform_get(const char * name)
+{
+    for( size_t idx=0; idx<bank.size(); ++idx ) {
+        if( strcmp(bank[idx].name, name) == 0 )
+            return &bank[idx];
+    }
+    return NULL;
+}
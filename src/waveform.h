@@ -0,0 +1,48 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define WAVEFORM_NAME_LEN 64
+
+struct waveform {
+    // File name without the .sc16 extension, e.g. "barker11"
+    char name[WAVEFORM_NAME_LEN];
+
+    // One period of the code in SC16 Q11
+    const int16_t * code;
+    unsigned int code_len;
+
+    // Matched filter for one period: code_len interleaved complex floats,
+    // the code conjugated and time reversed at unit amplitude
+    const float * taps;
+
+    // The code repeated to fill a whole burst, in page aligned memory that is
+    // read-only once built.  Hand this straight to sync_tx every burst.  Only
+    // the waveform we were asked for has one, it's NULL for the rest.
+    const int16_t * burst;
+    unsigned int burst_len;
+
+    // Where the above came from, so we can give it back
+    void * code_map;
+    size_t code_map_len;
+    size_t burst_map_len;
+    void * taps_alloc;
+};
+
+// Load every .sc16 file in signal_dir, add the built-in codes that aren't
+// there, and make up wanted if it's a code we can generate that we don't have
+// yet: barker<n>, frank<n>, p3_<n>, p4_<n> or lfm<n>[_bt<bt>], with x<spc> on
+// the end to hold each chip for spc samples (so p4_128x2 is 256 samples).
+// Only wanted is tiled out to burst_len samples, rounded down to a whole
+// number of code periods, and it's an error if it doesn't fit.
+bool waveform_bank_init(const char * signal_dir, const char * wanted, unsigned int burst_len);
+void waveform_bank_free(void);
+
+// Fill burst_len samples of burst with code repeated over and over
+void waveform_tile(const int16_t * code, unsigned int code_len, int16_t * burst, unsigned int burst_len);
+
+// Look up a waveform by name, NULL if we don't have it
+const struct waveform * waveform_get(const char * name);
+#endif
@@ -0,0 +1,284 @@
+#include <libbladeRF.h>
+#include "options.h"
+#include "util.h"
+#include "window.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <map>
+
+/*
+ * Same deal as the CFAR kernels: plain loops the compiler vectorizes, built
+ * for AVX-512 and AVX2 as well as the baseline on x86.
+ */
+#if defined(__x86_64__) && defined(__linux__)
+#define WINDOW_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define WINDOW_CLONES
+#endif
+
+#define WINDOW_ALIGN 64
+
+enum window_type {
+    WINDOW_RECT,
+    WINDOW_HANN,
+    WINDOW_HAMMING,
+    WINDOW_BLACKMAN_HARRIS,
+    WINDOW_KAISER,
+    WINDOW_TAYLOR,
+};
+
+struct window_key {
+    enum window_type type;
+    double p0, p1;
+    unsigned int len;
+
+    bool operator<(const window_key &o) const {
+        if( type != o.type ) return type < o.type;
+        if( len != o.len ) return len < o.len;
+        if( p0 != o.p0 ) return p0 < o.p0;
+        return p1 < o.p1;
+    }
+};
+
+struct window_entry {
+    double * f64;
+    float * f32;
+};
+
+static pthread_mutex_t window_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<window_key, window_entry> windows;
+
+// Pull the type and any parameters out of a name, len is left alone
+static bool parse_window(const char * name, struct window_key * key)
+{
+    const char * colon = strchr(name, ':');
+    size_t base_len = colon ? (size_t)(colon - name) : strlen(name);
+    const char * params = colon ? colon + 1 : NULL;
+
+#define IS(s) (base_len == strlen(s) && strncasecmp(name, s, base_len) == 0)
+    key->p0 = 0;
+    key->p1 = 0;
+    if( IS("hann") ) {
+        key->type = WINDOW_HANN;
+    } else if( IS("hamming") ) {
+        key->type = WINDOW_HAMMING;
+    } else if( IS("boxcar") || IS("rect") || IS("rectangular") ) {
+        key->type = WINDOW_RECT;
+    } else if( IS("blackman-harris") || IS("blackmanharris") ) {
+        key->type = WINDOW_BLACKMAN_HARRIS;
+    } else if( IS("kaiser") ) {
+        key->type = WINDOW_KAISER;
+        key->p0 = 8.6;
+        if( params ) {
+            char * end;
+            key->p0 = strtod(params, &end);
+            if( end == params || *end != '\0' || !(key->p0 >= 0 && key->p0 <= 100) )
+                return false;
+        }
+        return true;
+    } else if( IS("taylor") ) {
+        key->type = WINDOW_TAYLOR;
+        key->p0 = 30;
+        key->p1 = 4;
+        if( params ) {
+            char * end;
+            key->p0 = strtod(params, &end);
+            if( end == params || !(key->p0 > 0 && key->p0 <= 200) )
+                return false;
+            if( *end == ':' ) {
+                const char * nbar = end + 1;
+                key->p1 = (double)strtoul(nbar, &end, 10);
+                if( end == nbar || key->p1 < 1 || key->p1 > 64 )
+                    return false;
+            }
+            if( *end != '\0' )
+                return false;
+        }
+        return true;
+    } else {
+        return false;
+    }
+#undef IS
+    // Only kaiser and taylor take parameters
+    return params == NULL;
+}
+
+// Modified Bessel function of the first kind, order zero
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0, half = x/2;
+    for( int k=1; k<500; ++k ) {
+        term *= (half/k)*(half/k);
+        sum += term;
+        if( term < sum*1e-17 )
+            break;
+    }
+    return sum;
+}
+
+// Taylor's coefficients for nbar - 1 cosine terms, as in Carrara's SAR book
+static void taylor(double * window, unsigned int len, double sll, int nbar)
+{
+    double A = acosh(pow(10, sll/20))/M_PI;
+    double s2 = nbar*nbar/(A*A + (nbar - 0.5)*(nbar - 0.5));
+    double * Fm = (double *)malloc(sizeof(double)*nbar);
+
+    for( int m=1; m<nbar; ++m ) {
+        double numer = (m & 1) ? 1.0 : -1.0;
+        double denom = 2.0;
+        for( int i=1; i<nbar; ++i ) {
+            numer *= 1 - (double)m*m/s2/(A*A + (i - 0.5)*(i - 0.5));
+            if( i != m )
+                denom *= 1 - (double)m*m/((double)i*i);
+        }
+        Fm[m] = numer/denom;
+    }
+
+    // Normalized so the middle of the window (n = (len - 1)/2, where the
+    // cosines all peak) comes out to 1
+    double peak = 1.0;
+    for( int m=1; m<nbar; ++m )
+        peak += 2*Fm[m];
+    for( unsigned int n=0; n<len; ++n ) {
+        double w = 1.0;
+        for( int m=1; m<nbar; ++m )
+            w += 2*Fm[m]*cos(2*M_PI*m*(n - len/2.0 + 0.5)/len);
+        window[n] = w/peak;
+    }
+    free(Fm);
+}
+
+static void compute_window(const struct window_key * key, double * window)
+{
+    unsigned int len = key->len;
+    if( len == 1 ) {
+        window[0] = 1.0;
+        return;
+    }
+
+    double step = 2*M_PI/(len - 1);
+    switch( key->type ) {
+        case WINDOW_RECT:
+            for( unsigned int n=0; n<len; ++n )
+                window[n] = 1.0;
+            break;
+        case WINDOW_HANN:
+            for( unsigned int n=0; n<len; ++n )
+                window[n] = 0.5*(1 - cos(step*n));
+            break;
+        case WINDOW_HAMMING:
+            for( unsigned int n=0; n<len; ++n )
+                window[n] = 0.53836 - 0.46164*cos(step*n);
+            break;
+        case WINDOW_BLACKMAN_HARRIS:
+            for( unsigned int n=0; n<len; ++n )
+                window[n] = 0.35875 - 0.48829*cos(step*n) + 0.14128*cos(2*step*n)
+                            - 0.01168*cos(3*step*n);
+            break;
+        case WINDOW_KAISER: {
+            double norm = bessel_i0(key->p0);
+            for( unsigned int n=0; n<len; ++n ) {
+                double x = 2.0*n/(len - 1) - 1;
+                window[n] = bessel_i0(key->p0*sqrt(MAX(0.0, 1 - x*x)))/norm;
+            }
+            break;
+        }
+        case WINDOW_TAYLOR:
+            taylor(window, len, key->p0, (int)key->p1);
+            break;
+    }
+}
+
+static const struct window_entry * window_get(const char * name, unsigned int len)
+{
+    struct window_key key;
+    if( len == 0 || !parse_window(name, &key) )
+        return NULL;
+    key.len = len;
+
+    pthread_mutex_lock(&window_lock);
+    std::map<window_key, window_entry>::iterator it = windows.find(key);
+    if( it == windows.end() ) {
+        struct window_entry entry = { NULL, NULL };
+        if( posix_memalign((void **)&entry.f64, WINDOW_ALIGN, sizeof(double)*len) != 0 ||
+            posix_memalign((void **)&entry.f32, WINDOW_ALIGN, sizeof(float)*len) != 0 ) {
+            ERROR("Failed to allocate %u point %s window\n", len, name);
+            free(entry.f64);
+            pthread_mutex_unlock(&window_lock);
+            return NULL;
+        }
+        compute_window(&key, entry.f64);
+        for( unsigned int n=0; n<len; ++n )
+            entry.f32[n] = (float)entry.f64[n];
+        it = windows.insert(std::make_pair(key, entry)).first;
+    }
+    // Entries never move or go away until cleanup, so this is safe to hand out
+    const struct window_entry * entry = &it->second;
+    pthread_mutex_unlock(&window_lock);
+    return entry;
+}
+
+bool window_valid(const char * name)
+{
+    struct window_key key;
+    return parse_window(name, &key);
+}
+
+const double * window_get_f64(const char * name, unsigned int len)
+{
+    const struct window_entry * entry = window_get(name, len);
+    return entry ? entry->f64 : NULL;
+}
+
+const float * window_get_f32(const char * name, unsigned int len)
+{
+    const struct window_entry * entry = window_get(name, len);
+    return entry ? entry->f32 : NULL;
+}
+
+void window_cache_cleanup(void)
+{
+    pthread_mutex_lock(&window_lock);
+    for( std::map<window_key, window_entry>::iterator it = windows.begin(); it != windows.end(); ++it ) {
+        free(it->second.f64);
+        free(it->second.f32);
+    }
+    windows.clear();
+    pthread_mutex_unlock(&window_lock);
+}
+
+bool gen_window(const char * name, double * window, unsigned int len)
+{
+    if( len == 0 )
+        return window_valid(name);
+    const double * table = window_get_f64(name, len);
+    if( !table )
+        return false;
+    memcpy(window, table, sizeof(double)*len);
+    return true;
+}
+
+WINDOW_CLONES
+void window_apply(const fftwf_complex * in, fftwf_complex * out, const float * window,
+                  unsigned int count)
+{
+    const float * x = (const float *)in;
+    float * y = (float *)out;
+    // size_t so 2*n can't wrap, which would stop the compiler vectorizing it
+    for( size_t n=0; n<count; ++n ) {
+        y[2*n + 0] = x[2*n + 0]*window[n];
+        y[2*n + 1] = x[2*n + 1]*window[n];
+    }
+}
+
+WINDOW_CLONES
+void window_scale(const fftwf_complex * in, fftwf_complex * out, float w, unsigned int count)
+{
+    const float * x = (const float *)in;
+    float * y = (float *)out;
+    for( unsigned int n=0; n<2*count; ++n )
+        y[n] = x[n]*w;
+}
@@ -0,0 +1,37 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+#include <stdbool.h>
+#include <fftw3.h>
+
+/*
+ * Window names are one of:
+ *   rect (or boxcar, rectangular), hann, hamming, blackman-harris,
+ *   kaiser[:beta]        beta defaults to 8.6
+ *   taylor[:sll[:nbar]]  sidelobe level in dB below the peak, default 30:4
+ * and are case insensitive.
+ */
+
+// Whether name is a window we know how to make
+bool window_valid(const char * name);
+
+// Symmetric window of len points.  Each distinct window is computed once, in
+// double, and kept along with a float copy; the tables are 64 byte aligned,
+// must not be written to and stay valid until window_cache_cleanup().  NULL
+// if name isn't a window.  Safe to call from any thread.
+const double * window_get_f64(const char * name, unsigned int len);
+const float * window_get_f32(const char * name, unsigned int len);
+
+// Free every cached table
+void window_cache_cleanup(void);
+
+// Fill window with len points of a window, for callers that want their own
+// copy.  If len is zero, we're just checking to see if name is valid.
+bool gen_window(const char * name, double * window, unsigned int len);
+
+// out[n] = in[n]*window[n] for count complex samples (in place is fine)
+void window_apply(const fftwf_complex * in, fftwf_complex * out, const float * window,
+                  unsigned int count);
+
+// out[n] = in[n]*w for count complex samples, for windowing across rows
+void window_scale(const fftwf_complex * in, fftwf_complex * out, float w, unsigned int count);
+#endif